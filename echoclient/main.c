@@ -46,8 +46,7 @@ int main(int argc, char ** argv) {
 
     run_echo_client(c_sock);
 
-    if ( close(c_sock) == -1 ) {
-        set_errmsg("error closing socket");
+    if ( socket_close(c_sock) == -1 ) {
         fprintf(stderr, "echoclient: %s\n", get_errmsg());
         return EXIT_FAILURE;
     }
@@ -81,7 +80,7 @@ void run_echo_client(const int c_sock) {
             fprintf(stderr, "echoclient: no bytes could be written.\n");
             break;
         } else if ( num_bytes < 0 ) {
-            fprintf(stderr, "echoclient: %s\n", get_errmsg());
+            fprintf(stderr, "echoclient: %s\n", socket_error_text());
             break;
         }
 
@@ -90,7 +89,7 @@ void run_echo_client(const int c_sock) {
             fprintf(stderr, "echoclient: no bytes could be read.\n");
             break;
         } else if ( num_bytes < 0 ) {
-            fprintf(stderr, "echoclient: %s\n", get_errmsg());
+            fprintf(stderr, "echoclient: %s\n", socket_error_text());
             break;
         }
 
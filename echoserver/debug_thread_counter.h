@@ -2,7 +2,8 @@
  * \file            debug_thread_counter.h
  * \brief           Interface to debug thread counter.
  * \details         A utility for counting active threads for debugging
- * purposes.
+ * purposes. The count is kept with the socket helpers' server metrics,
+ * so is available in all builds, and costs no lock.
  * \author          Paul Griffiths
  * \copyright       Copyright 2013 Paul Griffiths. Distributed under the terms
  * of the GNU General Public License. <http://www.gnu.org/licenses/>
@@ -13,9 +14,7 @@
 #define PG_DEBUG_THREAD_COUNTER_H
 
 
-/*  Debugging function prototypes and macros  */
-
-#ifdef DEBUG
+/*  Function prototypes and macros  */
 
 void increment_thread_count(void);
 void decrement_thread_count(void);
@@ -23,23 +22,16 @@ int get_thread_count(void);
 
 
 /*!
- * \brief           Calls increment_thread_count() only if DEBUG is defined.
+ * \brief           Calls increment_thread_count().
  */
 
-# define DINCREMENT_THREAD_COUNT(arg) increment_thread_count()
+#define DINCREMENT_THREAD_COUNT(arg) increment_thread_count()
 
 
 /*!
- * \brief           Calls decrement_thread_count() only if DEBUG is defined.
+ * \brief           Calls decrement_thread_count().
  */
 
-# define DDECREMENT_THREAD_COUNT(arg) decrement_thread_count()
-
-#else
-
-# define DINCREMENT_THREAD_COUNT(arg)
-# define DDECREMENT_THREAD_COUNT(arg)
-
-#endif          /*  DEBUG  */
+#define DDECREMENT_THREAD_COUNT(arg) decrement_thread_count()
 
 #endif          /*  PG_DEBUG_THREAD_COUNTER_H  */
@@ -10,8 +10,10 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <errno.h>
 #include <unistd.h>
 #include <pthread.h>
+#include <sys/uio.h>
 #include <paulgrif/chelpers.h>
 #include <paulgrif/socket_helpers.h>
 #include "socket_helpers.h"
@@ -20,17 +22,18 @@
 
 
 /*!
- * \brief           Maximum character buffer size.
+ * \brief           Size of the buffer for echoing a message.
+ * \details         Longer messages are echoed in parts.
  */
 
-#define MAX_BUFFER_LEN 1024
+#define MAX_MSG_BUFFER_LEN 65536
 
 
 /*!
  * \brief           File scope variable for default time out seconds.
  */
 
-static const long time_out_secs = 60;
+static const long time_out_secs = ECHO_IDLE_TIMEOUT_MS / 1000;
 
 
 /*!
@@ -47,26 +50,140 @@ static const char time_out_msg[] = "Timeout - closing connection.\n";
 
 
 /*!
- * \brief           Main echo server handler thread function.
+ * \brief           File scope variable for the longest line echoed.
+ * \details         Set before any connections are served, and only read
+ * afterwards.
+ */
+
+static size_t max_line_len = ECHO_MAX_LINE_LEN;
+
+
+/*!
+ * \brief           File scope variable for the message format.
+ * \details         `ECHO_LINES` to echo lines, or a message format for
+ * socket_readmsg(). Set before any connections are served, and only
+ * read afterwards.
+ */
+
+static int msg_format = ECHO_LINES;
+
+
+/*  Function prototypes  */
+
+static int echo_line(void * arg, const char * line, const size_t len,
+                     const int complete, LineReply * reply);
+static void echo_error(const char * msg);
+static void echo_messages(const int c_socket, uint64_t accepted_ns);
+
+
+/*!
+ * \brief           File scope variable for the echo line service.
+ * \details         The longest line is filled in by
+ * echo_set_max_line_len(), the output limits by
+ * echo_set_output_policy(), and the round budget by
+ * echo_set_round_bytes().
+ */
+
+static LineService echo_service = {
+    echo_line,
+    NULL,
+    time_out_msg,
+    ECHO_IDLE_TIMEOUT_MS,
+    ECHO_MAX_LINE_LEN,
+    {0, 0, SOCKET_OVERFLOW_BLOCK},
+    0
+};
+
+
+/*!
+ * \brief           Sets the longest line, or message, to echo.
+ * \details         Longer lines close the connection. Lines are echoed in
+ * parts as they arrive, so the limit does not affect the memory used.
+ * Must be called before any connections are served.
+ * \param max_len   The longest line, excluding the line ending, or message,
+ * in bytes.
+ */
+
+void echo_set_max_line_len(const size_t max_len) {
+    max_line_len = max_len;
+    echo_service.max_line_len = max_len;
+}
+
+
+/*!
+ * \brief           Sets what happens to a client which stops reading.
+ * \details         Applies in the epoll and io_uring modes, where echoes
+ * a client has not read are queued. Must be called before any
+ * connections are served.
+ * \param overflow  `SOCKET_OVERFLOW_BLOCK` to stop reading from the
+ * client until its echoes drain, which is the default,
+ * `SOCKET_OVERFLOW_DROP` to discard further echoes, or
+ * `SOCKET_OVERFLOW_DISCONNECT` to close the connection.
+ * \param high_watermark The number of bytes of echoes queued at which
+ * the policy applies, or 0 for the default.
+ */
+
+void echo_set_output_policy(const int overflow, const size_t high_watermark) {
+    echo_service.output.overflow = overflow;
+    echo_service.output.high_watermark = high_watermark;
+}
+
+
+/*!
+ * \brief           Sets how much input to echo for a client per turn.
+ * \details         Applies in the epoll and pool modes, where a client
+ * which has had this many bytes echoed waits for the other clients
+ * served by the same thread to have their turn. Must be called before
+ * any connections are served.
+ * \param round_bytes The number of bytes, or 0 for the default.
+ */
+
+void echo_set_round_bytes(const size_t round_bytes) {
+    echo_service.round_bytes = round_bytes;
+}
+
+
+/*!
+ * \brief           Returns the echo line service.
+ * \details         Each line is echoed with a single slice, so all the
+ * lines received by one read are echoed with a single write, without
+ * copying.
+ * \returns         A pointer to the service.
+ */
+
+const LineService * echo_line_service(void) {
+    return &echo_service;
+}
+
+
+/*!
+ * \brief           Sets the framing of the threaded echo server.
+ * \details         Must be called before any connections are served.
+ * \param format    `ECHO_LINES` to echo lines, which is the default, or
+ * `SOCKET_MSG_VARINT` or `SOCKET_MSG_FIXED32` to echo length-prefixed
+ * messages.
+ */
+
+void echo_set_msg_format(const int format) {
+    msg_format = format;
+}
+
+
+/*!
+ * \brief           Message echo server handler thread function.
  * \details         Provides echo server service to a provided connected
- * socket. The server loops and echoes any whole lines provided. The
- * server will time-out after a pre-defined period, if no input, or if
- * no more input, is received.
+ * socket. The server loops and echoes any whole messages provided, in
+ * the format set by echo_set_msg_format(). Lines are echoed by the echo
+ * line service instead. The server will time-out after a pre-defined period, if no
+ * input, or if no more input, is received.
  * \param arg Pointer to a ServerTag struct
  * \returns         NULL
  */
 
 void * echo_server(void * arg) {
-    int status;
-    char buffer[MAX_BUFFER_LEN];
     ServerTag * server_tag = arg;
     int c_socket = server_tag->c_socket;
-    ssize_t num_read;
-    struct timeval time_out;
-    char * error_msg;
-
-    /*  Free struct allocated by calling function before we do
-        anything that might cause us to exit()                   */
+    const uint64_t accepted_ns = server_tag->accepted_ns;
 
     free(server_tag);
 
@@ -74,68 +191,202 @@ void * echo_server(void * arg) {
     DFPRINTF ((stderr, "Entering thread - number of active threads is %d.\n",
             get_thread_count()));
 
-    /*  Detach thread, the main server doesn't wait for it */
+    /*  The main server doesn't wait for the thread. Should
+        detaching fail, the thread still serves the connection.  */
+
+    pthread_detach(pthread_self());
 
-    status = pthread_detach(pthread_self());
-    if ( status != 0 ) {
-        mk_errmsg("Error detaching thread", &error_msg);
-        fprintf(stderr, "%s\n", error_msg);
-        free(error_msg);
-        exit(EXIT_FAILURE);
+    echo_messages(c_socket, accepted_ns);
+
+    socket_reader_release(c_socket);
+    if ( close(c_socket) == - 1 ) {
+        echo_error("Error closing socket");
     }
 
-    /*  Loop over input lines  */
+    DFPRINTF ((stderr, "Exiting from thread.\n"));
+    DDECREMENT_THREAD_COUNT();
 
-    while ( 1 ) {
+    return NULL;
+}
+
+
+/*!
+ * \brief           Records and counts an error on a connection.
+ * \details         The error text is kept per thread, so no memory is
+ * allocated, and is written to `stderr` only in debug builds. The
+ * caller closes the connection, and only the connection.
+ * \param msg       A message describing what failed, with `errno` set.
+ */
 
-        /*  Note: Linux modifies the struct timeval on a call to
-            select(), so we need to reset it before each call.    */
+static void echo_error(const char * msg) {
+    socket_count_error(socket_set_error(msg));
+    DFPRINTF ((stderr, "%s\n", socket_error_text()));
+}
+
+
+/*!
+ * \brief           Echoes length-prefixed messages on a connected socket.
+ * \details         Each message is read with exact-size reads, and a
+ * message which fits the buffer is echoed with a single gathered write
+ * of its prefix and payload. Longer messages are echoed in parts as
+ * they arrive. The timeout message is sent as a message. Messages are
+ * counted as lines in the server metrics, and the time from the last of
+ * a message arriving to its echo being written is recorded as a line's.
+ * \param c_socket  File descriptor for the connected socket.
+ * \param accepted_ns When the connection was accepted, to record the
+ * time to its first message.
+ */
+
+static void echo_messages(const int c_socket, uint64_t accepted_ns) {
+    char buffer[MAX_MSG_BUFFER_LEN];
+    unsigned char header[SOCKET_MSG_MAX_HEADER];
+    struct iovec iov;
+    struct timeval time_out;
+    struct timespec deadline;
+    uint64_t received_ns = 0;
+    size_t len, count;
+    ssize_t num_read, num_written;
+    int status;
+
+    time_out.tv_sec = time_out_secs;
+    time_out.tv_usec = time_out_usecs;
+
+    /*  Loop over input messages  */
+
+    while ( 1 ) {
 
-        time_out.tv_sec = time_out_secs;
-        time_out.tv_usec = time_out_usecs;
+        /*  Each message must arrive in full within the timeout
+            period of the previous message being echoed.         */
 
-        num_read = socket_readline_timeout_r(c_socket, buffer,
-                MAX_BUFFER_LEN, &time_out, &error_msg);
-        if ( num_read < 0 ) {
-            fprintf(stderr, "%s\n", error_msg);
-            free(error_msg);
-            exit(EXIT_FAILURE);
+        if ( socket_deadline_after(&deadline, &time_out) == -1 ) {
+            echo_error("Error getting time");
+            return;
         }
-            
-        if ( num_read == 0 ) {
 
-            /*  We've timed out getting a line of input  */
+        status = socket_readmsg_header(c_socket, msg_format, &len, &deadline);
+        if ( status == -1 && errno == ETIMEDOUT ) {
+
+            /*  We've timed out getting a message  */
 
             DFPRINTF ((stderr, "No input available.\n"));
-            if ( socket_writeline_r(c_socket, time_out_msg,
-                    strlen(time_out_msg), &error_msg) < 0 ) {
-                fprintf(stderr, "%s\n", error_msg);
-                free(error_msg);
-                exit(EXIT_FAILURE);
+            socket_count_error(SOCKET_ERROR_TIMEOUT);
+            socket_writemsg(c_socket, time_out_msg,
+                            sizeof(time_out_msg) - 1, msg_format);
+            return;
+        } else if ( status == -1 ) {
+            echo_error("Error reading message length");
+            return;
+        } else if ( status == 0 ) {
+            DFPRINTF ((stderr, "Connection closed by peer.\n"));
+            return;
+        } else if ( accepted_ns != 0 ) {
+            socket_metrics_record(SOCKET_LATENCY_FIRST_BYTE,
+                                  socket_clock_ns() - accepted_ns, 1);
+            accepted_ns = 0;
+        }
+
+        if ( len > max_line_len ) {
+            errno = EMSGSIZE;
+            echo_error("Error reading message");
+            return;
+        }
+
+        iov.iov_base = header;
+        iov.iov_len = socket_msg_header(header, len, msg_format);
+        socket_metrics_add(SOCKET_METRIC_BYTES_IN, iov.iov_len);
+
+        if ( len <= sizeof(buffer) ) {
+            num_read = socket_recv_exact(c_socket, buffer, len, &deadline);
+            if ( num_read == -1 ) {
+                echo_error("Error reading message");
+                return;
+            } else if ( num_read < (ssize_t) len ) {
+                DFPRINTF ((stderr, "Message truncated.\n"));
+                return;
+            }
+            socket_metrics_add(SOCKET_METRIC_BYTES_IN, len);
+            socket_metrics_add(SOCKET_METRIC_LINES_IN, 1);
+            received_ns = socket_clock_ns();
+
+            DFPRINTF ((stderr, "Echoing input.\n"));
+            if ( (num_written = socket_writemsg(c_socket, buffer, len,
+                                                msg_format)) < 0 ) {
+                echo_error("Error writing to socket");
+                return;
             }
-            break;
+            socket_metrics_add(SOCKET_METRIC_BYTES_OUT,
+                               (unsigned long) num_written);
+            socket_metrics_add(SOCKET_METRIC_LINES_OUT, 1);
+            socket_metrics_record(SOCKET_LATENCY_SERVICE,
+                                  socket_clock_ns() - received_ns, 1);
+            continue;
         }
 
-        /*  Echo the line of input  */
+        /*  Echo a long message in parts as it arrives, starting
+            with its prefix.                                      */
 
         DFPRINTF ((stderr, "Echoing input.\n"));
-        if ( socket_writeline_r(c_socket, buffer,
-                    strlen(buffer), &error_msg) < 0 ) {
-            fprintf(stderr, "%s\n", error_msg);
-            free(error_msg);
-            exit(EXIT_FAILURE);
+
+        while ( 1 ) {
+            if ( (num_written = socket_writev_all(c_socket, &iov, 1)) < 0 ) {
+                echo_error("Error writing to socket");
+                return;
+            }
+            socket_metrics_add(SOCKET_METRIC_BYTES_OUT,
+                               (unsigned long) num_written);
+            if ( len == 0 ) {
+                socket_metrics_add(SOCKET_METRIC_LINES_IN, 1);
+                socket_metrics_add(SOCKET_METRIC_LINES_OUT, 1);
+                socket_metrics_record(SOCKET_LATENCY_SERVICE,
+                                      socket_clock_ns() - received_ns, 1);
+                break;
+            }
+
+            count = len > sizeof(buffer) ? sizeof(buffer) : len;
+            num_read = socket_recv_exact(c_socket, buffer, count, &deadline);
+            if ( num_read == -1 ) {
+                echo_error("Error reading message");
+                return;
+            } else if ( num_read < (ssize_t) count ) {
+                DFPRINTF ((stderr, "Message truncated.\n"));
+                return;
+            }
+            socket_metrics_add(SOCKET_METRIC_BYTES_IN, count);
+            received_ns = socket_clock_ns();
+
+            iov.iov_base = buffer;
+            iov.iov_len = count;
+            len -= count;
         }
     }
+}
 
-    if ( close(c_socket) == - 1 ) {
-        mk_errmsg("Error closing socket", &error_msg);
-        fprintf(stderr, "%s\n", error_msg);
-        free(error_msg);
-        exit(EXIT_FAILURE);
-    }
 
-    DFPRINTF ((stderr, "Exiting from thread.\n"));
-    DDECREMENT_THREAD_COUNT();
+/*!
+ * \brief           Echo line service handler.
+ * \details         Any trailing CR or LF characters are stripped from a
+ * complete line, and the service ends the echo with a CRLF. Part of a
+ * line is echoed as it is.
+ * \param arg       Unused.
+ * \param line      The line, or part of a line.
+ * \param len       The length of the line.
+ * \param complete  False if `line` is part of a line, other than the
+ * final part.
+ * \param reply     The reply to which to add the echo.
+ * \returns         0 to continue, or non-zero to close the connection.
+ */
 
-    return NULL;
+static int echo_line(void * arg, const char * line, const size_t len,
+                     const int complete, LineReply * reply) {
+    size_t echo_len = len;
+
+    (void) arg;
+
+    while ( complete && echo_len > 0 &&
+            (line[echo_len - 1] == '\r' || line[echo_len - 1] == '\n') ) {
+        --echo_len;
+    }
+
+    DFPRINTF ((stderr, "Echoing input.\n"));
+    return line_reply_add(reply, line, echo_len);
 }
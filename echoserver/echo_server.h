@@ -10,9 +10,38 @@
 #ifndef PG_ECHOSERVER_H
 #define PG_ECHOSERVER_H
 
+#include <stddef.h>
+#include <paulgrif/socket_helpers.h>
+
+
+/*!
+ * \brief           Idle timeout for connections, in milliseconds.
+ */
+
+#define ECHO_IDLE_TIMEOUT_MS 60000
+
+
+/*!
+ * \brief           Default longest line echoed, in bytes.
+ */
+
+#define ECHO_MAX_LINE_LEN (16UL * 1024 * 1024)
+
+
+/*!
+ * \brief           Framing for echo_set_msg_format() to echo lines.
+ */
+
+#define ECHO_LINES -1
+
 
 /*  Function prototypes  */
 
+void echo_set_max_line_len(const size_t max_len);
+void echo_set_output_policy(const int overflow, const size_t high_watermark);
+void echo_set_round_bytes(const size_t round_bytes);
+const LineService * echo_line_service(void);
+void echo_set_msg_format(const int format);
 void * echo_server(void * arg);
 
 
@@ -9,14 +9,86 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <inttypes.h>
+#include <unistd.h>
+#include <signal.h>
+#include <pthread.h>
 #include <paulgrif/socket_helpers.h>
 #include "echo_server.h"
+#include "stats_server.h"
+
+
+/*!
+ * \brief           Enumeration of server modes.
+ */
+
+enum server_mode {
+    SERVER_MODE_THREADED,       /*!< One thread per connection */
+    SERVER_MODE_EPOLL,          /*!< epoll event-loop threads */
+    SERVER_MODE_POOL,           /*!< Fixed pool of worker threads */
+    SERVER_MODE_URING           /*!< io_uring event-loop threads */
+};
+
+
+/*!
+ * \brief           Struct for command line options.
+ */
+
+typedef struct EchoOptions {
+    uint16_t port;              /*!< TCP port on which to listen */
+    enum server_mode mode;      /*!< Server mode */
+    int num_threads;            /*!< Number of event-loop or worker threads */
+    int num_shards;             /*!< Number of listening shards, or 0 */
+    int shard_flags;            /*!< Flags for create_tcp_server_shards() */
+    size_t max_line_len;        /*!< Longest line to echo */
+    int msg_format;             /*!< Message format, or ECHO_LINES */
+    int slab_flags;             /*!< Flags for the library's slabs */
+    int overflow;               /*!< Policy for clients which stop reading */
+    size_t high_watermark;      /*!< Queued output at which it applies */
+    size_t round_bytes;         /*!< Input echoed per client per turn */
+    size_t max_conns;           /*!< Most connections in threaded mode */
+    int reject;                 /*!< True to reject connections over it */
+    int report_secs;            /*!< Latency report interval, or 0 */
+    uint16_t stats_port;        /*!< Statistics port, or 0 */
+} EchoOptions;
+
+
+/*!
+ * \brief           File scope variable for the message sent to a
+ * connection rejected at the connection limit.
+ */
+
+static const char busy_msg[] = "Server busy - closing connection.\n";
+
+
+/*!
+ * \brief           Struct for passing to the shard report thread.
+ */
+
+typedef struct ShardReport {
+    TcpShard * shards;          /*!< The shards */
+    int num_shards;             /*!< The number of shards */
+    sigset_t signals;           /*!< Signals to wait for */
+} ShardReport;
 
 
 /*  Function prototypes  */
 
-uint16_t get_port_from_commandline(const int argc, char ** argv);
+int get_options_from_commandline(const int argc, char ** argv,
+                                 EchoOptions * options);
+void set_threaded_limits(const EchoOptions * options);
+uint16_t get_port_from_commandline(const char * progname,
+                                   const char * port_str);
+void print_usage(const char * progname);
+int line_service_mode(const enum server_mode mode);
+int run_sharded_server(const EchoOptions * options);
+void * report_shards_thread(void * arg);
+void print_shard_counts(const TcpShard * shards, const int num_shards);
+int start_latency_report(const int interval_secs);
+void * report_latency_thread(void * arg);
+void print_latency(const char * name, const char * units,
+                   const SocketLatency * latency);
 
 
 /*!
@@ -26,58 +98,572 @@ uint16_t get_port_from_commandline(const int argc, char ** argv);
  */
 
 int main(int argc, char ** argv) {
-    uint16_t l_port;
+    EchoOptions options;
     int l_socket;
     int exit_status;
 
-    if ( (l_port = get_port_from_commandline(argc, argv)) == 0 ) {
+    if ( get_options_from_commandline(argc, argv, &options) == -1 ) {
+        return EXIT_FAILURE;
+    }
+
+    echo_set_max_line_len(options.max_line_len);
+    echo_set_msg_format(options.msg_format);
+    echo_set_output_policy(options.overflow, options.high_watermark);
+    echo_set_round_bytes(options.round_bytes);
+    socket_slab_set_default_flags(options.slab_flags);
+    set_threaded_limits(&options);
+
+    if ( options.report_secs > 0 &&
+         start_latency_report(options.report_secs) == -1 ) {
         return EXIT_FAILURE;
     }
 
-    if ( (l_socket = create_tcp_server_socket(l_port)) == -1 ) {
+    if ( options.stats_port != 0 &&
+         start_stats_server(options.stats_port) == -1 ) {
         return EXIT_FAILURE;
     }
 
-    exit_status = start_threaded_tcp_server(l_socket, echo_server);
+    if ( options.num_shards > 0 ) {
+        return run_sharded_server(&options);
+    }
+
+    if ( (l_socket = create_tcp_server_socket(options.port)) == -1 ) {
+        return EXIT_FAILURE;
+    }
+
+    if ( options.msg_format != ECHO_LINES ) {
+        exit_status = start_threaded_tcp_server(l_socket, echo_server);
+    } else if ( options.mode == SERVER_MODE_EPOLL ||
+                options.mode == SERVER_MODE_URING ) {
+        exit_status = start_line_service(l_socket,
+                line_service_mode(options.mode),
+                options.num_threads > 0 ? options.num_threads : 1,
+                echo_line_service());
+    } else {
+        exit_status = start_line_service(l_socket,
+                line_service_mode(options.mode), options.num_threads,
+                echo_line_service());
+    }
 
     return exit_status;
 }
 
 
 /*!
- * \brief       Parses the command line for a specified TCP port.
- * \details     Checks for the existence of a single command line
- * argument, and if one and only one is present, attempts to interpret
- * it as a TCP listening port, between 1 and 49151 (ports above
- * 49151 are ephemeral ports).
+ * \brief       Parses the command line options.
+ * \details     Accepts an optional `-m` option specifying the server
+ * mode, either `threaded` (the default), `epoll`, `uring` or `pool`, an
+ * optional `-t` option specifying the number of event-loop threads for
+ * `epoll` or `uring` mode (default 1) or worker threads for `pool` mode
+ * (default one per CPU), an optional `-s` option specifying a number of `SO_REUSEPORT`
+ * listening shards for `threaded` or `epoll` mode (`0` for one per CPU),
+ * an optional `-c` flag to steer connections to a shard per CPU, an
+ * optional `-l` option specifying the longest line to echo, an optional
+ * `-f` option specifying the framing for `threaded` mode, either `lines`
+ * (the default), `varint` or `fixed32`, an optional `-H` flag to back
+ * connection memory with huge pages, an optional `-o` option specifying
+ * what to do with a client which stops reading in `epoll` or `uring`
+ * mode, either `block` (the default), `drop` or `disconnect`, an
+ * optional `-w` option specifying the bytes of queued output at which
+ * that applies, an optional `-b` option specifying the bytes of input
+ * echoed for a client per turn in `epoll` or `pool` mode, an optional
+ * `-n` option specifying the most connections to serve at once in
+ * `threaded` mode, where `-t` sets the most server threads, an optional
+ * `-r` flag to reject connections over that limit rather than leave
+ * them in the listening backlog, an optional `-i` option specifying the
+ * interval in seconds at which to report latency percentiles, an
+ * optional `-a` option specifying a TCP port on which to serve the
+ * server statistics, and a single non-option argument
+ * specifying the TCP listening port.
  * \param argc The number of command line arguments, passed from main()
  * \param argv The command line arguments, passed from main()
- * \returns The specified TCP port if successful, or 0 on error.
+ * \param options Pointer to a struct to receive the options.
+ * \returns 0 on success, or -1 on error.
  */
 
-uint16_t get_port_from_commandline(const int argc, char ** argv) {
-    long port_value;
+int get_options_from_commandline(const int argc, char ** argv,
+                                 EchoOptions * options) {
     char * endptr;
+    unsigned long max_line_len, high_watermark, round_bytes, max_conns;
+    int opt;
+
+    options->mode = SERVER_MODE_THREADED;
+    options->num_threads = 0;
+    options->num_shards = 0;
+    options->shard_flags = 0;
+    options->max_line_len = ECHO_MAX_LINE_LEN;
+    options->msg_format = ECHO_LINES;
+    options->slab_flags = 0;
+    options->overflow = SOCKET_OVERFLOW_BLOCK;
+    options->high_watermark = 0;
+    options->round_bytes = 0;
+    options->max_conns = 0;
+    options->reject = 0;
+    options->report_secs = 0;
+    options->stats_port = 0;
+
+    while ( (opt = getopt(argc, argv, "m:t:s:cl:f:Ho:w:b:n:ri:a:")) != -1 ) {
+        switch ( opt ) {
+            case 'm':
+                if ( strcmp(optarg, "threaded") == 0 ) {
+                    options->mode = SERVER_MODE_THREADED;
+                } else if ( strcmp(optarg, "epoll") == 0 ) {
+                    options->mode = SERVER_MODE_EPOLL;
+                } else if ( strcmp(optarg, "uring") == 0 ) {
+                    options->mode = SERVER_MODE_URING;
+                } else if ( strcmp(optarg, "pool") == 0 ) {
+                    options->mode = SERVER_MODE_POOL;
+                } else {
+                    fprintf(stderr, "%s: unknown server mode '%s'.\n",
+                            argv[0], optarg);
+                    return -1;
+                }
+                break;
+
+            case 't':
+                options->num_threads = (int) strtol(optarg, &endptr, 10);
+                if ( *endptr != '\0' || options->num_threads < 1 ) {
+                    fprintf(stderr, "%s: number of threads should be "
+                            "at least 1.\n", argv[0]);
+                    return -1;
+                }
+                break;
+
+            case 's':
+                options->num_shards = (int) strtol(optarg, &endptr, 10);
+                if ( *endptr != '\0' || options->num_shards < 0 ) {
+                    fprintf(stderr, "%s: number of shards should be "
+                            "at least 0.\n", argv[0]);
+                    return -1;
+                }
+                if ( options->num_shards == 0 ) {
+                    options->num_shards = (int) sysconf(_SC_NPROCESSORS_ONLN);
+                }
+                break;
+
+            case 'c':
+                options->shard_flags |= SHARD_STEER_CPU;
+                break;
+
+            case 'l':
+                max_line_len = strtoul(optarg, &endptr, 10);
+                if ( *endptr != '\0' || *optarg == '-' || max_line_len < 1 ) {
+                    fprintf(stderr, "%s: maximum line length should be "
+                            "at least 1.\n", argv[0]);
+                    return -1;
+                }
+                options->max_line_len = (size_t) max_line_len;
+                break;
+
+            case 'f':
+                if ( strcmp(optarg, "lines") == 0 ) {
+                    options->msg_format = ECHO_LINES;
+                } else if ( strcmp(optarg, "varint") == 0 ) {
+                    options->msg_format = SOCKET_MSG_VARINT;
+                } else if ( strcmp(optarg, "fixed32") == 0 ) {
+                    options->msg_format = SOCKET_MSG_FIXED32;
+                } else {
+                    fprintf(stderr, "%s: unknown framing '%s'.\n",
+                            argv[0], optarg);
+                    return -1;
+                }
+                break;
+
+            case 'H':
+                options->slab_flags |= SOCKET_SLAB_HUGE;
+                break;
+
+            case 'o':
+                if ( strcmp(optarg, "block") == 0 ) {
+                    options->overflow = SOCKET_OVERFLOW_BLOCK;
+                } else if ( strcmp(optarg, "drop") == 0 ) {
+                    options->overflow = SOCKET_OVERFLOW_DROP;
+                } else if ( strcmp(optarg, "disconnect") == 0 ) {
+                    options->overflow = SOCKET_OVERFLOW_DISCONNECT;
+                } else {
+                    fprintf(stderr, "%s: unknown overflow policy '%s'.\n",
+                            argv[0], optarg);
+                    return -1;
+                }
+                break;
+
+            case 'w':
+                high_watermark = strtoul(optarg, &endptr, 10);
+                if ( *endptr != '\0' || *optarg == '-' ||
+                     high_watermark < 1 ) {
+                    fprintf(stderr, "%s: high watermark should be "
+                            "at least 1.\n", argv[0]);
+                    return -1;
+                }
+                options->high_watermark = (size_t) high_watermark;
+                break;
 
-    if ( argc < 2 ) {
+            case 'b':
+                round_bytes = strtoul(optarg, &endptr, 10);
+                if ( *endptr != '\0' || *optarg == '-' || round_bytes < 1 ) {
+                    fprintf(stderr, "%s: round budget should be "
+                            "at least 1.\n", argv[0]);
+                    return -1;
+                }
+                options->round_bytes = (size_t) round_bytes;
+                break;
+
+            case 'n':
+                max_conns = strtoul(optarg, &endptr, 10);
+                if ( *endptr != '\0' || *optarg == '-' || max_conns < 1 ) {
+                    fprintf(stderr, "%s: maximum connections should be "
+                            "at least 1.\n", argv[0]);
+                    return -1;
+                }
+                options->max_conns = (size_t) max_conns;
+                break;
+
+            case 'r':
+                options->reject = 1;
+                break;
+
+            case 'i':
+                options->report_secs = (int) strtol(optarg, &endptr, 10);
+                if ( *endptr != '\0' || options->report_secs < 1 ) {
+                    fprintf(stderr, "%s: report interval should be "
+                            "at least 1.\n", argv[0]);
+                    return -1;
+                }
+                break;
+
+            case 'a':
+                options->stats_port = get_port_from_commandline(argv[0],
+                                                                optarg);
+                if ( options->stats_port == 0 ) {
+                    return -1;
+                }
+                break;
+
+            default:
+                print_usage(argv[0]);
+                return -1;
+        }
+    }
+
+    if ( options->num_shards > 0 && (options->mode == SERVER_MODE_POOL ||
+                                     options->mode == SERVER_MODE_URING) ) {
+        fprintf(stderr, "%s: shards are supported only in threaded and "
+                "epoll modes.\n", argv[0]);
+        return -1;
+    }
+
+    if ( options->msg_format != ECHO_LINES &&
+         options->mode != SERVER_MODE_THREADED ) {
+        fprintf(stderr, "%s: message framing is supported only in "
+                "threaded mode.\n", argv[0]);
+        return -1;
+    }
+
+    if ( (options->max_conns > 0 || options->reject) &&
+         options->mode != SERVER_MODE_THREADED ) {
+        fprintf(stderr, "%s: connection limits are supported only in "
+                "threaded mode.\n", argv[0]);
+        return -1;
+    }
+
+    if ( optind > argc - 1 ) {
         fprintf(stderr, "%s: not enough command line arguments.\n", argv[0]);
-        return 0;
-    } else if ( argc > 2 ) {
+        return -1;
+    } else if ( optind < argc - 1 ) {
         fprintf(stderr, "%s: too many command line arguments.\n", argv[0]);
-        return 0;
+        return -1;
+    }
+
+    options->port = get_port_from_commandline(argv[0], argv[optind]);
+    if ( options->port == 0 ) {
+        return -1;
+    } else if ( options->port == options->stats_port ) {
+        fprintf(stderr, "%s: statistics port should differ from the "
+                "listening port.\n", argv[0]);
+        return -1;
     }
 
-    port_value = strtol(argv[1], &endptr, 10);
+    return 0;
+}
+
+
+/*!
+ * \brief       Parses a command line argument for a specified TCP port.
+ * \details     Attempts to interpret the argument as a TCP listening
+ * port, between 1 and 49151 (ports above 49151 are ephemeral ports).
+ * \param progname The program name, for error messages.
+ * \param port_str The command line argument.
+ * \returns The specified TCP port if successful, or 0 on error.
+ */
+
+uint16_t get_port_from_commandline(const char * progname,
+                                   const char * port_str) {
+    long port_value;
+    char * endptr;
+
+    port_value = strtol(port_str, &endptr, 10);
     if ( *endptr != '\0' ) {
-        fprintf(stderr, "Usage: %s [listening port number]\n", argv[0]);
+        print_usage(progname);
         return 0;
     }
 
     if ( port_value < 1 || port_value > 49151 ) {
         fprintf(stderr, "%s: port number should be in the range [1 - 49151]\n",
-                argv[0]);
+                progname);
         return 0;
     }
 
     return (uint16_t) port_value;
 }
+
+
+/*!
+ * \brief       Prints a usage message.
+ * \param progname The program name.
+ */
+
+void print_usage(const char * progname) {
+    fprintf(stderr, "Usage: %s [-m threaded|epoll|uring|pool] "
+            "[-t threads] [-s shards [-c]] [-l max line length] "
+            "[-f lines|varint|fixed32] [-H] [-o block|drop|disconnect] "
+            "[-w high watermark] [-b round bytes] "
+            "[-n max connections [-r]] [-i report seconds] "
+            "[-a statistics port] "
+            "[listening port number]\n",
+            progname);
+}
+
+
+/*!
+ * \brief       Sets the connection and thread limits for threaded mode.
+ * \details     Threaded mode serves each connection on its own thread,
+ * so the `-t` option limits those threads.
+ * \param options The command line options.
+ */
+
+void set_threaded_limits(const EchoOptions * options) {
+    ServerLimits limits;
+
+    if ( options->mode != SERVER_MODE_THREADED ) {
+        return;
+    }
+
+    limits.max_conns = options->max_conns;
+    limits.max_threads = (size_t) options->num_threads;
+    limits.policy = options->reject ? SERVER_LIMIT_REJECT : SERVER_LIMIT_WAIT;
+    limits.reject_msg = busy_msg;
+    set_server_limits(&limits);
+}
+
+
+/*!
+ * \brief       Returns the line service mode for a server mode.
+ * \param mode  The server mode.
+ * \returns     The line service mode.
+ */
+
+int line_service_mode(const enum server_mode mode) {
+    switch ( mode ) {
+        case SERVER_MODE_EPOLL:
+            return LINE_SERVICE_EPOLL;
+
+        case SERVER_MODE_URING:
+            return LINE_SERVICE_URING;
+
+        case SERVER_MODE_POOL:
+            return LINE_SERVICE_POOL;
+
+        default:
+            return LINE_SERVICE_THREADED;
+    }
+}
+
+
+/*!
+ * \brief       Runs the server on a set of listening shards.
+ * \details     The shard accept counts are written to standard error
+ * on receipt of `SIGUSR1`, and before exiting on receipt of `SIGINT`
+ * or `SIGTERM`.
+ * \param options The command line options.
+ * \returns     Exit status.
+ */
+
+int run_sharded_server(const EchoOptions * options) {
+    static ShardReport report;
+    pthread_t thread_id;
+
+    report.num_shards = options->num_shards;
+    if ( (report.shards = malloc(report.num_shards *
+                                 sizeof(*report.shards))) == NULL ) {
+        perror("echoserver: couldn't allocate shards");
+        return EXIT_FAILURE;
+    }
+
+    if ( create_tcp_server_shards(options->port, report.shards,
+                                  report.num_shards,
+                                  options->shard_flags) == -1 ) {
+        return EXIT_FAILURE;
+    }
+    stats_server_set_shards(report.shards, report.num_shards);
+
+    /*  Block the report signals in every thread, so that only the
+        report thread receives them, through sigwait().             */
+
+    sigemptyset(&report.signals);
+    sigaddset(&report.signals, SIGUSR1);
+    sigaddset(&report.signals, SIGINT);
+    sigaddset(&report.signals, SIGTERM);
+
+    if ( pthread_sigmask(SIG_BLOCK, &report.signals, NULL) != 0 ||
+         pthread_create(&thread_id, NULL, report_shards_thread,
+                        &report) != 0 ) {
+        fprintf(stderr, "echoserver: couldn't start report thread.\n");
+        return EXIT_FAILURE;
+    }
+
+    if ( options->msg_format != ECHO_LINES ) {
+        return start_sharded_tcp_server(report.shards, report.num_shards,
+                                        echo_server);
+    }
+
+    return start_sharded_line_service(report.shards, report.num_shards,
+                                      line_service_mode(options->mode),
+                                      echo_line_service());
+}
+
+
+/*!
+ * \brief       Thread function to report shard accept counts.
+ * \param arg   Pointer to a ShardReport struct.
+ * \returns     NULL
+ */
+
+void * report_shards_thread(void * arg) {
+    ShardReport * report = arg;
+    int signum;
+
+    while ( sigwait(&report->signals, &signum) == 0 ) {
+        print_shard_counts(report->shards, report->num_shards);
+        if ( signum != SIGUSR1 ) {
+            exit(EXIT_SUCCESS);
+        }
+    }
+
+    return NULL;
+}
+
+
+/*!
+ * \brief       Writes shard accept counts to standard error.
+ * \param shards The shards.
+ * \param num_shards The number of shards.
+ */
+
+void print_shard_counts(const TcpShard * shards, const int num_shards) {
+    int index;
+
+    for ( index = 0; index < num_shards; ++index ) {
+        fprintf(stderr, "shard %d (cpu %d): %lu connections accepted\n",
+                index, shards[index].cpu,
+                get_shard_accept_count(&shards[index]));
+    }
+}
+
+
+/*!
+ * \brief       Starts the latency report thread.
+ * \details     The thread blocks every signal, so that signals are
+ * left to the threads which wait for them.
+ * \param interval_secs The report interval, in seconds.
+ * \returns     0 on success, or -1 on error.
+ */
+
+int start_latency_report(const int interval_secs) {
+    static int interval;
+    sigset_t all_signals, old_signals;
+    pthread_t thread_id;
+    int status;
+
+    interval = interval_secs;
+
+    sigfillset(&all_signals);
+    pthread_sigmask(SIG_BLOCK, &all_signals, &old_signals);
+    status = pthread_create(&thread_id, NULL, report_latency_thread,
+                            &interval);
+    pthread_sigmask(SIG_SETMASK, &old_signals, NULL);
+
+    if ( status != 0 ) {
+        fprintf(stderr, "echoserver: couldn't start latency report "
+                "thread.\n");
+        return -1;
+    }
+
+    pthread_detach(thread_id);
+    return 0;
+}
+
+
+/*!
+ * \brief       Thread function to report latency percentiles.
+ * \details     Every interval, writes to standard error the percentiles
+ * of the service and first input latencies recorded during it, taken
+ * from the difference of the histograms read at its start and end.
+ * Intervals with nothing recorded are not reported.
+ * \param arg   Pointer to the report interval, in seconds.
+ * \returns     NULL
+ */
+
+void * report_latency_thread(void * arg) {
+    static SocketHistogram previous[SOCKET_LATENCIES];
+    static SocketHistogram current[SOCKET_LATENCIES];
+    const int interval_secs = *((int *) arg);
+    SocketLatency latency;
+    int index;
+
+    for ( index = 0; index < SOCKET_LATENCIES; ++index ) {
+        socket_metrics_read_latency(index, &previous[index]);
+    }
+
+    while ( 1 ) {
+        sleep(interval_secs);
+
+        for ( index = 0; index < SOCKET_LATENCIES; ++index ) {
+            socket_metrics_read_latency(index, &current[index]);
+        }
+
+        socket_histogram_latency(&current[SOCKET_LATENCY_SERVICE],
+                                 &previous[SOCKET_LATENCY_SERVICE],
+                                 &latency);
+        print_latency("service", "lines", &latency);
+
+        socket_histogram_latency(&current[SOCKET_LATENCY_FIRST_BYTE],
+                                 &previous[SOCKET_LATENCY_FIRST_BYTE],
+                                 &latency);
+        print_latency("first input", "connections", &latency);
+
+        memcpy(previous, current, sizeof(previous));
+    }
+
+    return NULL;
+}
+
+
+/*!
+ * \brief       Writes latency percentiles to standard error.
+ * \param name  The name of the latency.
+ * \param units What was counted, such as "lines".
+ * \param latency The percentiles, in nanoseconds.
+ */
+
+void print_latency(const char * name, const char * units,
+                   const SocketLatency * latency) {
+    if ( latency->count == 0 ) {
+        return;
+    }
+
+    fprintf(stderr, "echoserver: %s latency: %lu %s, p50 %.1f us, "
+            "p99 %.1f us, p99.9 %.1f us, max %.1f us\n",
+            name, latency->count, units, latency->p50 / 1000.0,
+            latency->p99 / 1000.0, latency->p999 / 1000.0,
+            latency->max / 1000.0);
+}
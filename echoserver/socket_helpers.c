@@ -17,11 +17,12 @@
 #include <sys/socket.h>
 #include <netdb.h>
 #include <sys/time.h>
-#include <sys/select.h>
+#include <sys/uio.h>
 #include <errno.h>
 #include <inttypes.h>
 #include <signal.h>
 #include <paulgrif/chelpers.h>
+#include <paulgrif/socket_helpers.h>
 #include "socket_helpers.h"
 
 
@@ -32,12 +33,23 @@
 #define MAX_BUFFER_SIZE 1024
 
 
+/*!
+ * \brief           File scope variable for the network-standard line ending.
+ */
+
+static const char crlf[] = "\r\n";
+
+
 /*!
  * \brief           Reads a \\n terminated line from a socket.
  * \details         The function will not overwrite the buffer, so
  * `max_len` should be the size of the whole buffer, and function will
  * at most write `max_len - 1` characters plus the terminating \\0.
- * Any terminating CR or LF characters will be stripped.
+ * Any terminating CR or LF characters will be stripped. Input is read
+ * through the socket's sockethelpers registry reader, which should be
+ * released with socket_reader_release() before the socket is closed to
+ * free its memory; a later socket with the same descriptor is never
+ * given the old socket's bytes.
  * \param socket File description of the socket
  * \param buffer The buffer into which to read
  * \param max_len The maximum number of characters to read, including
@@ -51,147 +63,164 @@
 
 ssize_t socket_readline_r(const int socket, char * buffer,
         const size_t max_len, char ** error_msg) {
-    size_t index;
+    SocketReader * reader;
     ssize_t num_read;
 
-    for ( index = 0; index < (max_len - 1); ++index ) {
-
-        /*  Attempt to read one character  */
-
-        num_read = read(socket, &buffer[index], 1);
-
-        if ( num_read == 1 ) {
-
-            /*  Successfully read a character  */
-
-            if ( index > 0 &&
-                 buffer[index] == '\n' &&
-                 buffer[index - 1] == '\r' ) {
-
-                /*  End of line, so add terminating NUL and break  */
-
-                buffer[++index] = '\0';
-                break;
-            }
-        } else if ( num_read == 0 ) {
-
-            /*  No characters read, but we haven't reached end
-                of line so add terminating NUL and return error  */
-
-            buffer[index] = '\0';
-            mk_errmsg("No bytes to read", error_msg);
-            return ERROR_RETURN;
-        } else if ( errno == EINTR ) {
-
-            /*  read() got interrupted by a signal, so try again  */
+    if ( (reader = socket_reader_for_socket(socket)) == NULL ) {
+        mk_errno_errmsg("Error getting socket reader", error_msg);
+        return ERROR_RETURN;
+    }
 
-            continue;
-        } else {
+    num_read = socket_reader_readline(reader, buffer, max_len, NULL);
+    if ( num_read == ERROR_RETURN ) {
+        mk_errno_errmsg("Error reading from socket", error_msg);
+        socket_reader_release(socket);
+    } else if ( socket_reader_eof(reader) ) {
 
-            /*  Some other error, so set error message and return  */
+        /*  Reached end-of-file before end of line  */
 
-            mk_errno_errmsg("Error reading from socket", error_msg);
-            return ERROR_RETURN;
-        }
+        mk_errmsg("No bytes to read", error_msg);
+        socket_reader_release(socket);
+        num_read = ERROR_RETURN;
     }
 
-    trim_line_ending(buffer);
-
-    return (ssize_t) index;
+    return num_read;
 }
 
 
 /*!
  * \brief           Reads a \\n terminated line from a socket with timeout.
  * \details         Behaves the same as socket_readline(), except it
- * will time out if no input is available on the socket after the
- * specified time. Any terminating CR or LF characters will be stripped.
+ * will time out if the whole line has not arrived within the specified
+ * period. Any terminating CR or LF characters will be stripped.
  * \param socket File description of the socket
  * \param buffer The buffer into which to read
  * \param max_len The maximum number of characters to read, including
  * the terminating \\0.
  * \param time_out A pointer to a `timeval` struct containing the timeout
- * period. Note that some implementations of `select()` may alter this
- * variable, so the calling function should consider it unusable after
- * return. In addition, on such an implementation, the value will
- * specify the cumulative timeout period over the entire read line
- * operation, rather than resetting after reading each character.
+ * period, which covers the whole line.
  * \param error_msg A pointer to a char pointer which may point to an
  * error message on failure. Set this to NULL to avoid setting an error
  * message.
- * \returns         The number of characters read, or -1 on encountering
- * an error.
+ * \returns         The number of characters read, 0 on timing out, or
+ * -1 on encountering an error.
  */
 
 ssize_t socket_readline_timeout_r(const int socket, char * buffer,
-        const size_t max_len, struct timeval * time_out,
+        const size_t max_len, const struct timeval * time_out,
         char ** error_msg) {
-    ssize_t num_read;
-    size_t index;
-    int status;
-    fd_set socket_set;
+    struct timespec deadline;
 
-    /*  Zero and set fd_set  */
-
-    FD_ZERO(&socket_set);
-    FD_SET(socket, &socket_set);
-
-    for ( index = 0; index < (max_len - 1); ++index ) {
-
-        /*  Wait for input for timeout period  */
-
-        status = select(socket + 1, &socket_set, NULL, NULL, time_out);
-        if ( status == -1 ) {
-            mk_errno_errmsg("Error calling select()", error_msg);
-            return ERROR_RETURN;
-        } else if ( status == 0 ) {
-
-            /*  No data ready after timeout period  */
+    if ( socket_deadline_after(&deadline, time_out) == -1 ) {
+        mk_errno_errmsg("Error getting time", error_msg);
+        return ERROR_RETURN;
+    }
 
-            buffer[index] = '\0';
-            break;
-        }
+    return socket_readline_deadline_r(socket, buffer, max_len,
+                                      &deadline, error_msg);
+}
 
-        /*  Try to read a single character  */
 
-        num_read = read(socket, &buffer[index], 1);
-        if ( num_read == 1 ) {
+/*!
+ * \brief           Reads a \\n terminated line from a socket by a deadline.
+ * \details         Behaves the same as socket_readline(), except it
+ * will time out if the whole line has not arrived by the deadline. The
+ * socket is only waited on when no buffered input remains. Any
+ * terminating CR or LF characters will be stripped.
+ * \param socket File description of the socket
+ * \param buffer The buffer into which to read
+ * \param max_len The maximum number of characters to read, including
+ * the terminating \\0.
+ * \param deadline The absolute deadline, from socket_deadline_after().
+ * \param error_msg A pointer to a char pointer which may point to an
+ * error message on failure. Set this to NULL to avoid setting an error
+ * message.
+ * \returns         The number of characters read, 0 on timing out, or
+ * -1 on encountering an error.
+ */
 
-            /*  Successfully read a character  */
+ssize_t socket_readline_deadline_r(const int socket, char * buffer,
+        const size_t max_len, const struct timespec * deadline,
+        char ** error_msg) {
+    SocketReader * reader;
+    ssize_t num_read;
 
-            if ( index > 0 &&
-                 buffer[index] == '\n' &&
-                 buffer[index - 1] == '\r' ) {
+    if ( (reader = socket_reader_for_socket(socket)) == NULL ) {
+        mk_errno_errmsg("Error getting socket reader", error_msg);
+        return ERROR_RETURN;
+    }
 
-                /*  End of line, so add terminating NUL and break  */
+    num_read = socket_reader_readline_until(reader, buffer, max_len, deadline);
+    if ( num_read == ERROR_RETURN ) {
+        mk_errno_errmsg("Error reading from socket", error_msg);
+        socket_reader_release(socket);
+    } else if ( socket_reader_eof(reader) ) {
+        socket_reader_release(socket);
+    }
 
-                buffer[++index] = '\0';
-                break;
-            }
-        } else if ( num_read == 0 ) {
+    return num_read;
+}
 
-            /*  No characters read, but we haven't reached end
-                of line so add terminating NUL and return error  */
 
-            buffer[index] = '\0';
-            break;
-        } else if ( errno == EINTR ) {
+/*!
+ * \brief           Reads all the available \\r\\n terminated lines.
+ * \details         Behaves the same as socket_readlines(). The lines
+ * point into the socket's reader buffer, and are valid only until the
+ * next read from the socket. A line longer than the buffer is returned
+ * in parts, as it arrives.
+ * \param socket File description of the socket
+ * \param lines Array to receive the lines.
+ * \param max_lines The number of elements in `lines`.
+ * \param deadline The absolute deadline, from socket_deadline_after(),
+ * or NULL to wait indefinitely.
+ * \param error_msg A pointer to a char pointer which may point to an
+ * error message on failure. Set this to NULL to avoid setting an error
+ * message.
+ * \returns         The number of lines read, 0 on end-of-file, or -1 on
+ * encountering an error, with `errno` set to `ETIMEDOUT` if the
+ * deadline passed before a line was complete, or to `EMSGSIZE` if a
+ * line is longer than the limit set with socket_reader_set_max_line().
+ */
 
-            /*  read() got interrupted by a signal, so try again  */
+ssize_t socket_readlines_r(const int socket, SocketLine * lines,
+        const size_t max_lines, const struct timespec * deadline,
+        char ** error_msg) {
+    SocketReader * reader;
+    ssize_t num_lines, num_read;
 
-            continue;
-        } else {
-            
-            /*  Some other error, so set error message and return  */
+    if ( max_lines == 0 ) {
+        errno = EINVAL;
+        mk_errno_errmsg("Error reading from socket", error_msg);
+        return ERROR_RETURN;
+    } else if ( (reader = socket_reader_for_socket(socket)) == NULL ) {
+        mk_errno_errmsg("Error getting socket reader", error_msg);
+        return ERROR_RETURN;
+    }
 
+    while ( (num_lines = socket_reader_getlines(reader, lines,
+                                                max_lines)) == 0 ) {
+        num_read = socket_reader_fill_until(reader, deadline);
+        if ( num_read == ERROR_RETURN ) {
             mk_errno_errmsg("Error reading from socket", error_msg);
+            socket_reader_release(socket);
             return ERROR_RETURN;
+        } else if ( num_read == 0 && !socket_reader_eof(reader) ) {
+            errno = ETIMEDOUT;
+            mk_errno_errmsg("Error reading from socket", error_msg);
+            errno = ETIMEDOUT;
+            return ERROR_RETURN;
+        } else if ( num_read == 0 && socket_reader_pending(reader) == 0 ) {
+            socket_reader_release(socket);
+            return 0;
         }
     }
 
-    trim_line_ending(buffer);
+    if ( num_lines == ERROR_RETURN ) {
+        mk_errno_errmsg("Error reading from socket", error_msg);
+        errno = EMSGSIZE;
+    }
 
-    return (ssize_t) index;
+    return num_lines;
 }
 
 
@@ -199,7 +228,7 @@ ssize_t socket_readline_timeout_r(const int socket, char * buffer,
  * \brief           Writes a line to a socket.
  * \details         The function adds a network-standard terminating
  * CRLF, so the provided string should not normally end in any newline
- * characters.
+ * characters. Equivalent to socket_writelinev_r().
  * \param socket File description of the socket
  * \param buffer The buffer from which to write.
  * \param max_len The maximum number of characters to write to the buffer.
@@ -214,41 +243,40 @@ ssize_t socket_readline_timeout_r(const int socket, char * buffer,
 
 ssize_t socket_writeline_r(const int socket, const char * buffer,
         const size_t max_len, char ** error_msg) {
-    size_t num_left = max_len + 2;
-    ssize_t num_written, total_written = 0;
-    const char * buf_ptr;
-
-    /*  Allocate new buffer with enough room to add \r\n  */
-
-    char * eol_buf = malloc(strlen(buffer) + 3);
-    if ( eol_buf == NULL ) {
-        mk_errno_errmsg("Couldn't allocate memory", error_msg);
-        return ERROR_RETURN;
-    }
+    return socket_writelinev_r(socket, buffer, max_len, error_msg);
+}
 
-    sprintf(eol_buf, "%s\r\n", buffer);
-    buf_ptr = eol_buf;
 
-    /*  Write characters  */
+/*!
+ * \brief           Writes a line to a socket without copying it.
+ * \details         The line and a terminating CRLF are written from
+ * their own buffers with `writev()`, so no memory is allocated unless
+ * an error message is needed.
+ * \param socket File description of the socket
+ * \param buffer The buffer from which to write. It need not be
+ * NUL-terminated.
+ * \param len The number of characters to write from the buffer.
+ * `len + 2` characters will actually be written.
+ * \param error_msg A pointer to a char pointer which may point to an
+ * error message on failure. Set this to NULL to avoid setting an error
+ * message.
+ * \returns         The number of characters written, or -1 on encountering
+ * an error.
+ */
 
-    while ( num_left > 0 ) {
-        num_written = write(socket, buf_ptr, num_left);
+ssize_t socket_writelinev_r(const int socket, const char * buffer,
+        const size_t len, char ** error_msg) {
+    struct iovec iov[2];
+    ssize_t num_written;
 
-        if ( num_written <= 0 ) {
-            if ( errno == EINTR ) {
-                num_written = 0;
-            } else {
-                mk_errno_errmsg("Error writing to socket", error_msg);
-                free(eol_buf);
-                return ERROR_RETURN;
-            }
-        }
+    iov[0].iov_base = (char *) buffer;
+    iov[0].iov_len = len;
+    iov[1].iov_base = (char *) crlf;
+    iov[1].iov_len = 2;
 
-        num_left -= num_written;
-        buf_ptr += num_written;
-        total_written += num_written;
+    if ( (num_written = socket_writev_all(socket, iov, 2)) == ERROR_RETURN ) {
+        mk_errno_errmsg("Error writing to socket", error_msg);
     }
 
-    free(eol_buf);
-    return total_written;
+    return num_written;
 }
@@ -11,7 +11,9 @@
 #define PG_ECHOSERVER_SOCKET_HELPERS_H
 
 #include <sys/time.h>
+#include <time.h>
 #include <inttypes.h>
+#include <paulgrif/socket_helpers_reader.h>
 
 
 /*  Function prototypes  */
@@ -19,10 +21,18 @@
 ssize_t socket_readline_r(const int l_socket, char * buffer,
         const size_t max_len, char ** error_msg);
 ssize_t socket_readline_timeout_r(const int l_socket, char * buffer,
-        const size_t max_len, struct timeval * time_out,
+        const size_t max_len, const struct timeval * time_out,
+        char ** error_msg);
+ssize_t socket_readline_deadline_r(const int l_socket, char * buffer,
+        const size_t max_len, const struct timespec * deadline,
+        char ** error_msg);
+ssize_t socket_readlines_r(const int l_socket, SocketLine * lines,
+        const size_t max_lines, const struct timespec * deadline,
         char ** error_msg);
 ssize_t socket_writeline_r(const int l_socket, const char * buffer,
         const size_t max_len, char ** error_msg);
+ssize_t socket_writelinev_r(const int l_socket, const char * buffer,
+        const size_t len, char ** error_msg);
 
 
 #endif          /*  PG_ECHOSERVER_SOCKET_HELPERS_H  */
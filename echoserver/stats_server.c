@@ -0,0 +1,516 @@
+/*!
+ * \file            stats_server.c
+ * \brief           Implementation of the statistics server.
+ * \details         Connections to the statistics port are served one at
+ * a time by a single thread. An HTTP request is read, up to its blank
+ * line, and answered with an HTTP/1.0 response, so the port can be
+ * scraped by Prometheus; a client which sends anything else, or nothing
+ * for a second, is sent the snapshot alone. Every value is a total
+ * since the server started, latencies included, so a scrape changes
+ * nothing and any number of scrapers see consistent series.
+ * \author          Paul Griffiths
+ * \copyright       Copyright 2013 Paul Griffiths. Distributed under the terms
+ * of the GNU General Public License. <http://www.gnu.org/licenses/>
+ */
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <errno.h>
+#include <signal.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include "stats_server.h"
+
+
+/*!
+ * \brief           Longest request read from a statistics client.
+ */
+
+#define STATS_MAX_REQUEST 4096
+
+
+/*!
+ * \brief           Seconds to wait for a statistics client's request.
+ */
+
+#define STATS_REQUEST_TIMEOUT 1
+
+
+/*!
+ * \brief           Smallest latency bucket bound, as a power of two
+ * nanoseconds.
+ * \details         The bounds are one less than each power of two from
+ * this to `STATS_LATENCY_MAX_BITS`, as those are the tops of buckets of
+ * the socket helpers' histograms, so the counts are exact.
+ */
+
+#define STATS_LATENCY_MIN_BITS 12
+
+
+/*!
+ * \brief           Largest latency bucket bound, as a power of two
+ * nanoseconds.
+ */
+
+#define STATS_LATENCY_MAX_BITS 34
+
+
+/*!
+ * \brief           Struct for a snapshot being written.
+ */
+
+typedef struct StatsBuffer {
+    char * data;                /*!< The snapshot */
+    size_t len;                 /*!< Bytes written */
+    size_t capacity;            /*!< Bytes allocated */
+    int failed;                 /*!< True if memory ran out */
+} StatsBuffer;
+
+
+/*!
+ * \brief           File scope variable for the statistics listening
+ * socket.
+ */
+
+static int stats_socket = -1;
+
+
+/*!
+ * \brief           File scope variable for the listening shards, or
+ * NULL if the server is not sharded.
+ */
+
+static const TcpShard * stats_shards = NULL;
+
+
+/*!
+ * \brief           File scope variable for the number of shards.
+ */
+
+static int stats_num_shards = 0;
+
+
+/*  Function prototypes  */
+
+static void * stats_thread(void * arg);
+static void serve_stats(const int c_socket);
+static int read_request(const int c_socket);
+static void write_snapshot(StatsBuffer * buffer);
+static void write_latency(StatsBuffer * buffer, const char * name,
+                          const char * help, const int latency);
+static void write_header(StatsBuffer * buffer, const char * name,
+                         const char * type, const char * help);
+static void write_value(StatsBuffer * buffer, const char * name,
+                        const char * type, const char * help,
+                        const unsigned long value);
+static void stats_printf(StatsBuffer * buffer, const char * format, ...);
+
+
+/*!
+ * \brief           Starts the statistics server.
+ * \details         The server's thread blocks every signal, so that
+ * signals are left to the threads which wait for them.
+ * \param port      The TCP port on which to listen.
+ * \returns         0 on success, or -1 on error.
+ */
+
+int start_stats_server(const uint16_t port) {
+    sigset_t all_signals, old_signals;
+    pthread_t thread_id;
+    int status;
+
+    if ( (stats_socket = create_tcp_server_socket(port)) == -1 ) {
+        return -1;
+    }
+
+    sigfillset(&all_signals);
+    pthread_sigmask(SIG_BLOCK, &all_signals, &old_signals);
+    status = pthread_create(&thread_id, NULL, stats_thread, NULL);
+    pthread_sigmask(SIG_SETMASK, &old_signals, NULL);
+
+    if ( status != 0 ) {
+        fprintf(stderr, "echoserver: couldn't start statistics thread.\n");
+        close(stats_socket);
+        return -1;
+    }
+
+    pthread_detach(thread_id);
+    return 0;
+}
+
+
+/*!
+ * \brief           Sets the listening shards to report.
+ * \details         May be called after the statistics server is started.
+ * \param shards    The shards, which must last for the life of the
+ * server.
+ * \param num_shards The number of shards.
+ */
+
+void stats_server_set_shards(const TcpShard * shards, const int num_shards) {
+    __atomic_store_n(&stats_num_shards, num_shards, __ATOMIC_RELAXED);
+    __atomic_store_n(&stats_shards, shards, __ATOMIC_RELEASE);
+}
+
+
+/*!
+ * \brief           Thread function to serve statistics clients.
+ * \param arg       Unused.
+ * \returns         NULL
+ */
+
+static void * stats_thread(void * arg) {
+    int c_socket;
+
+    (void) arg;
+
+    while ( 1 ) {
+        if ( (c_socket = accept(stats_socket, NULL, NULL)) == -1 ) {
+            if ( errno == EINTR || errno == ECONNABORTED ||
+                 errno == EMFILE || errno == ENFILE ) {
+                continue;
+            }
+            perror("echoserver: couldn't accept statistics client");
+            return NULL;
+        }
+
+        serve_stats(c_socket);
+        close(c_socket);
+    }
+
+    return NULL;
+}
+
+
+/*!
+ * \brief           Serves a statistics client.
+ * \param c_socket  File descriptor for the connected socket.
+ */
+
+static void serve_stats(const int c_socket) {
+    static const char http_header[] = "HTTP/1.0 200 OK\r\n"
+        "Content-Type: text/plain; version=0.0.4\r\n"
+        "Connection: close\r\n\r\n";
+    StatsBuffer buffer;
+    size_t sent = 0;
+    ssize_t num_sent;
+
+    buffer.data = NULL;
+    buffer.len = 0;
+    buffer.capacity = 0;
+    buffer.failed = 0;
+
+    if ( read_request(c_socket) ) {
+        stats_printf(&buffer, "%s", http_header);
+    }
+    write_snapshot(&buffer);
+
+    while ( !buffer.failed && sent < buffer.len ) {
+        num_sent = send(c_socket, buffer.data + sent, buffer.len - sent,
+                        MSG_NOSIGNAL);
+        if ( num_sent == -1 && errno != EINTR ) {
+            break;
+        } else if ( num_sent > 0 ) {
+            sent += (size_t) num_sent;
+        }
+    }
+
+    free(buffer.data);
+}
+
+
+/*!
+ * \brief           Reads a statistics client's request.
+ * \details         Reads until the blank line ending an HTTP request's
+ * header, the client closes or shuts down its side, or no input arrives
+ * for `STATS_REQUEST_TIMEOUT` seconds.
+ * \param c_socket  File descriptor for the connected socket.
+ * \returns         1 if the request is an HTTP request, otherwise 0.
+ */
+
+static int read_request(const int c_socket) {
+    char request[STATS_MAX_REQUEST + 1];
+    struct timeval time_out;
+    size_t len = 0;
+    ssize_t num_read;
+
+    time_out.tv_sec = STATS_REQUEST_TIMEOUT;
+    time_out.tv_usec = 0;
+    setsockopt(c_socket, SOL_SOCKET, SO_RCVTIMEO,
+               &time_out, sizeof(time_out));
+
+    while ( len < STATS_MAX_REQUEST ) {
+        num_read = recv(c_socket, request + len, STATS_MAX_REQUEST - len, 0);
+        if ( num_read == -1 && errno == EINTR ) {
+            continue;
+        } else if ( num_read <= 0 ) {
+            break;
+        }
+
+        len += (size_t) num_read;
+        request[len] = '\0';
+        if ( strstr(request, "\r\n\r\n") != NULL ||
+             strstr(request, "\n\n") != NULL ) {
+            break;
+        }
+    }
+
+    return len > 4 && strncmp(request, "GET ", 4) == 0;
+}
+
+
+/*!
+ * \brief           Writes a snapshot of the server metrics.
+ * \param buffer    The buffer to write to.
+ */
+
+static void write_snapshot(StatsBuffer * buffer) {
+    unsigned long error_counts[SOCKET_ERROR_KINDS];
+    ServerAdmissionStats admission;
+    ServerRoundStats rounds;
+    SocketBufferStats buffers;
+    SocketSlabStats slab_stats;
+    SocketMetrics metrics;
+    const TcpShard * shards;
+    SocketSlab * slab;
+    int index, num_slabs, num_shards;
+
+    socket_metrics_get(&metrics);
+
+    write_value(buffer, "echoserver_connections_accepted_total", "counter",
+                "Connections accepted.", metrics.accepts);
+    write_value(buffer, "echoserver_connections_active", "gauge",
+                "Connections now being served.", metrics.active_conns);
+    write_value(buffer, "echoserver_lines_received_total", "counter",
+                "Lines, or messages, received.", metrics.lines_in);
+    write_value(buffer, "echoserver_lines_sent_total", "counter",
+                "Lines, or messages, written.", metrics.lines_out);
+    write_value(buffer, "echoserver_bytes_received_total", "counter",
+                "Bytes received.", metrics.bytes_in);
+    write_value(buffer, "echoserver_bytes_sent_total", "counter",
+                "Bytes written or queued.", metrics.bytes_out);
+    write_value(buffer, "echoserver_threads", "gauge",
+                "Server threads now running.", metrics.threads);
+
+    socket_get_error_counts(error_counts);
+    write_header(buffer, "echoserver_connection_errors_total", "counter",
+                 "Connections closed for errors, by kind.");
+    for ( index = SOCKET_ERROR_NONE + 1; index < SOCKET_ERROR_KINDS;
+          ++index ) {
+        stats_printf(buffer, "echoserver_connection_errors_total"
+                     "{kind=\"%s\"} %lu\n", socket_error_name(index),
+                     error_counts[index]);
+    }
+
+    write_latency(buffer, "echoserver_service_latency_seconds",
+                  "Time from a line, or message, arriving to its echo "
+                  "being written.", SOCKET_LATENCY_SERVICE);
+    write_latency(buffer, "echoserver_first_input_latency_seconds",
+                  "Time from a connection being accepted to its first "
+                  "input arriving.", SOCKET_LATENCY_FIRST_BYTE);
+
+    get_server_admission_stats(&admission);
+    write_value(buffer, "echoserver_admission_queued", "gauge",
+                "Connections now waiting for a thread.", admission.queued);
+    write_value(buffer, "echoserver_admission_max_queued", "gauge",
+                "Most connections waiting for a thread at once.",
+                admission.max_queued);
+    write_value(buffer, "echoserver_admission_rejected_total", "counter",
+                "Connections rejected at the connection limit.",
+                admission.rejected);
+    write_value(buffer, "echoserver_admission_pauses_total", "counter",
+                "Times accepting stopped at a limit.", admission.pauses);
+    write_value(buffer, "echoserver_admission_thread_failures_total",
+                "counter", "Server threads not created.",
+                admission.thread_failures);
+
+    get_server_round_stats(&rounds);
+    write_value(buffer, "echoserver_round_deferrals_total", "counter",
+                "Turns ended with input left.", rounds.deferrals);
+    write_value(buffer, "echoserver_round_waiting", "gauge",
+                "Connections now waiting a turn.", rounds.waiting);
+    write_header(buffer, "echoserver_round_wait_seconds_total", "counter",
+                 "Time connections waited for a turn.");
+    stats_printf(buffer, "echoserver_round_wait_seconds_total %.6f\n",
+                 rounds.total_wait_us / 1e6);
+    write_header(buffer, "echoserver_round_max_wait_seconds", "gauge",
+                 "Longest wait for a turn.");
+    stats_printf(buffer, "echoserver_round_max_wait_seconds %.6f\n",
+                 rounds.max_wait_us / 1e6);
+
+    socket_conn_buffer_stats(&buffers);
+    write_header(buffer, "echoserver_buffers", "gauge",
+                 "Connection buffers, by state.");
+    stats_printf(buffer, "echoserver_buffers{state=\"attached\"} %lu\n",
+                 buffers.attached);
+    stats_printf(buffer, "echoserver_buffers{state=\"pooled\"} %lu\n",
+                 buffers.pooled);
+    write_header(buffer, "echoserver_buffer_bytes", "gauge",
+                 "Bytes in connection buffers, by state.");
+    stats_printf(buffer, "echoserver_buffer_bytes{state=\"attached\"} %lu\n",
+                 (unsigned long) buffers.attached_bytes);
+    stats_printf(buffer, "echoserver_buffer_bytes{state=\"pooled\"} %lu\n",
+                 (unsigned long) buffers.pooled_bytes);
+
+    num_slabs = socket_slab_count();
+    write_header(buffer, "echoserver_slab_objects", "gauge",
+                 "Objects carved from each slab.");
+    for ( index = 0; index < num_slabs; ++index ) {
+        slab = socket_slab_get(index);
+        socket_slab_get_stats(slab, &slab_stats);
+        stats_printf(buffer, "echoserver_slab_objects{slab=\"%s\"} %lu\n",
+                     socket_slab_name(slab), slab_stats.objects);
+    }
+    write_header(buffer, "echoserver_slab_objects_in_use", "gauge",
+                 "Objects allocated from each slab.");
+    for ( index = 0; index < num_slabs; ++index ) {
+        slab = socket_slab_get(index);
+        socket_slab_get_stats(slab, &slab_stats);
+        stats_printf(buffer, "echoserver_slab_objects_in_use"
+                     "{slab=\"%s\"} %lu\n",
+                     socket_slab_name(slab), slab_stats.in_use);
+    }
+    write_header(buffer, "echoserver_slab_bytes", "gauge",
+                 "Bytes mapped for each slab.");
+    for ( index = 0; index < num_slabs; ++index ) {
+        slab = socket_slab_get(index);
+        socket_slab_get_stats(slab, &slab_stats);
+        stats_printf(buffer, "echoserver_slab_bytes{slab=\"%s\"} %lu\n",
+                     socket_slab_name(slab),
+                     (unsigned long) (slab_stats.objects *
+                                      slab_stats.object_size));
+    }
+
+    if ( (shards = __atomic_load_n(&stats_shards,
+                                   __ATOMIC_ACQUIRE)) != NULL ) {
+        num_shards = __atomic_load_n(&stats_num_shards, __ATOMIC_RELAXED);
+        write_header(buffer, "echoserver_shard_connections_accepted_total",
+                     "counter", "Connections accepted by each shard.");
+        for ( index = 0; index < num_shards; ++index ) {
+            stats_printf(buffer, "echoserver_shard_connections_accepted_total"
+                         "{shard=\"%d\",cpu=\"%d\"} %lu\n", index,
+                         shards[index].cpu,
+                         get_shard_accept_count(&shards[index]));
+        }
+    }
+}
+
+
+/*!
+ * \brief           Writes a latency as a histogram.
+ * \details         The buckets, sum and count are of all the values
+ * recorded since the server started, so quantiles over any interval may
+ * be had from the difference of two scrapes, as with Prometheus's
+ * `histogram_quantile()` and `rate()`.
+ * \param buffer    The buffer to write to.
+ * \param name      The metric name.
+ * \param help      The metric's help text.
+ * \param latency   The histogram, such as `SOCKET_LATENCY_SERVICE`.
+ */
+
+static void write_latency(StatsBuffer * buffer, const char * name,
+                          const char * help, const int latency) {
+    static SocketHistogram current;
+    unsigned long count = 0;
+    uint64_t bound;
+    int bucket = 0, last, bits;
+
+    socket_metrics_read_latency(latency, &current);
+
+    write_header(buffer, name, "histogram", help);
+    for ( bits = STATS_LATENCY_MIN_BITS; bits <= STATS_LATENCY_MAX_BITS;
+          ++bits ) {
+        bound = ((uint64_t) 1 << bits) - 1;
+        last = socket_histogram_bucket(bound);
+        while ( bucket <= last ) {
+            count += current.counts[bucket++];
+        }
+        stats_printf(buffer, "%s_bucket{le=\"%.9f\"} %lu\n",
+                     name, bound / 1e9, count);
+    }
+    while ( bucket < SOCKET_HISTOGRAM_BUCKETS ) {
+        count += current.counts[bucket++];
+    }
+    stats_printf(buffer, "%s_bucket{le=\"+Inf\"} %lu\n", name, count);
+    stats_printf(buffer, "%s_sum %.9f\n", name, current.sum / 1e9);
+    stats_printf(buffer, "%s_count %lu\n", name, count);
+}
+
+
+/*!
+ * \brief           Writes the help and type lines for a metric.
+ * \param buffer    The buffer to write to.
+ * \param name      The metric name.
+ * \param type      The metric type, such as "counter".
+ * \param help      The metric's help text.
+ */
+
+static void write_header(StatsBuffer * buffer, const char * name,
+                         const char * type, const char * help) {
+    stats_printf(buffer, "# HELP %s %s\n# TYPE %s %s\n",
+                 name, help, name, type);
+}
+
+
+/*!
+ * \brief           Writes a metric without labels.
+ * \param buffer    The buffer to write to.
+ * \param name      The metric name.
+ * \param type      The metric type, such as "counter".
+ * \param help      The metric's help text.
+ * \param value     The value.
+ */
+
+static void write_value(StatsBuffer * buffer, const char * name,
+                        const char * type, const char * help,
+                        const unsigned long value) {
+    write_header(buffer, name, type, help);
+    stats_printf(buffer, "%s %lu\n", name, value);
+}
+
+
+/*!
+ * \brief           Writes formatted text to a snapshot.
+ * \details         The buffer grows as needed. If memory runs out, the
+ * buffer is marked as failed and nothing more is written.
+ * \param buffer    The buffer to write to.
+ * \param format    The format string, as for printf().
+ */
+
+static void stats_printf(StatsBuffer * buffer, const char * format, ...) {
+    va_list args;
+    size_t capacity;
+    char * data;
+    int len;
+
+    while ( !buffer->failed ) {
+        va_start(args, format);
+        len = vsnprintf(buffer->data + buffer->len,
+                        buffer->capacity - buffer->len, format, args);
+        va_end(args);
+
+        if ( len < 0 ) {
+            buffer->failed = 1;
+        } else if ( buffer->len + (size_t) len < buffer->capacity ) {
+            buffer->len += (size_t) len;
+            return;
+        } else {
+            capacity = buffer->capacity > 0 ? buffer->capacity * 2 : 4096;
+            while ( capacity <= buffer->len + (size_t) len ) {
+                capacity *= 2;
+            }
+            if ( (data = realloc(buffer->data, capacity)) == NULL ) {
+                buffer->failed = 1;
+            } else {
+                buffer->data = data;
+                buffer->capacity = capacity;
+            }
+        }
+    }
+}
@@ -0,0 +1,26 @@
+/*!
+ * \file            stats_server.h
+ * \brief           Interface to the statistics server.
+ * \details         The statistics server answers each connection to its
+ * port with a snapshot of the server metrics, in the Prometheus text
+ * exposition format. It reads only the socket helpers' lock-free
+ * getters, so never holds up the threads serving clients.
+ * \author          Paul Griffiths
+ * \copyright       Copyright 2013 Paul Griffiths. Distributed under the terms
+ * of the GNU General Public License. <http://www.gnu.org/licenses/>
+ */
+
+
+#ifndef PG_STATS_SERVER_H
+#define PG_STATS_SERVER_H
+
+#include <inttypes.h>
+#include <paulgrif/socket_helpers.h>
+
+
+/*  Function prototypes  */
+
+int start_stats_server(const uint16_t port);
+void stats_server_set_shards(const TcpShard * shards, const int num_shards);
+
+#endif          /*  PG_STATS_SERVER_H  */
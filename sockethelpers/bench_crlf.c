@@ -0,0 +1,193 @@
+/*!
+ * \file            bench_crlf.c
+ * \brief           Microbenchmark for the CRLF scanners.
+ * \details         Splits a buffer of `\r\n` terminated lines into lines
+ * with each available scanner, and with the byte-by-byte loop previously
+ * used by the readline functions, and reports the throughput of each
+ * for a range of line lengths.
+ * \author          Paul Griffiths
+ * \copyright       Copyright 2013 Paul Griffiths. Distributed under the terms
+ * of the GNU General Public License. <http://www.gnu.org/licenses/>
+ */
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "socket_helpers_scan.h"
+
+
+/*!
+ * \brief           Size of the buffer of lines to split.
+ */
+
+#define BENCH_BUFFER_SIZE (4 * 1024 * 1024)
+
+
+/*!
+ * \brief           Minimum time to run each measurement, in seconds.
+ */
+
+#define BENCH_MIN_SECONDS 0.25
+
+
+/*!
+ * \brief           Struct describing a scanner to benchmark.
+ */
+
+typedef struct BenchScanner {
+    const char * name;          /*!< Name to report */
+    const char * (*scan)(const char *, const size_t);   /*!< Scanner */
+} BenchScanner;
+
+
+/*!
+ * \brief           File scope variable to stop splits being optimized away.
+ */
+
+static volatile size_t bench_sink;
+
+
+/*!
+ * \brief           Finds a `\r\n` pair one byte at a time.
+ * \details         The loop previously used by socket_readline().
+ * \param data      The data to search.
+ * \param len       The number of bytes of data to search.
+ * \returns         A pointer to the `\r` of the first `\r\n` pair, or NULL.
+ */
+
+static const char * find_crlf_bytewise(const char * data, const size_t len) {
+    size_t index;
+
+    for ( index = 1; index < len; ++index ) {
+        if ( data[index] == '\n' && data[index - 1] == '\r' ) {
+            return data + index - 1;
+        }
+    }
+
+    return NULL;
+}
+
+
+/*!
+ * \brief           Gets the current monotonic time in seconds.
+ * \returns         The current time.
+ */
+
+static double now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+
+/*!
+ * \brief           Splits a buffer into lines.
+ * \param scan      The scanner to use.
+ * \param data      The buffer.
+ * \param len       The length of the buffer.
+ * \returns         The number of lines found.
+ */
+
+static size_t split_lines(const char * (*scan)(const char *, const size_t),
+                          const char * data, const size_t len) {
+    const char * end = data + len;
+    const char * cr;
+    size_t num_lines = 0;
+
+    while ( (cr = scan(data, end - data)) != NULL ) {
+        data = cr + 2;
+        ++num_lines;
+    }
+
+    return num_lines;
+}
+
+
+/*!
+ * \brief           Fills a buffer with lines of a given length.
+ * \param data      The buffer.
+ * \param len       The length of the buffer.
+ * \param line_len  The length of each line, including the `\r\n`.
+ * \returns         The number of bytes of the buffer used.
+ */
+
+static size_t fill_lines(char * data, const size_t len,
+                         const size_t line_len) {
+    size_t used = 0;
+    size_t index;
+
+    while ( used + line_len <= len ) {
+        for ( index = 0; index < line_len - 2; ++index ) {
+            data[used + index] = (char) ('a' + (used + index) % 26);
+        }
+        data[used + line_len - 2] = '\r';
+        data[used + line_len - 1] = '\n';
+        used += line_len;
+    }
+
+    return used;
+}
+
+
+/*!
+ * \brief       Main function.
+ * \details     Runs the benchmark and prints the results to standard output.
+ * \returns     Exit status.
+ */
+
+int main(void) {
+    static const size_t line_lens[] = {16, 100, 1024, 4096, 65536};
+    BenchScanner scanners[4];
+    size_t num_scanners = 0;
+    size_t i, j, len, num_lines, iterations;
+    double start, elapsed;
+    char * data;
+
+    scanners[num_scanners].name = "bytewise";
+    scanners[num_scanners++].scan = find_crlf_bytewise;
+    scanners[num_scanners].name = "scalar";
+    scanners[num_scanners++].scan = socket_find_crlf_scalar;
+#ifdef SOCKET_HELPERS_X86_SIMD
+    scanners[num_scanners].name = "sse2";
+    scanners[num_scanners++].scan = socket_find_crlf_sse2;
+    if ( strcmp(socket_crlf_scanner_name(), "avx2") == 0 ) {
+        scanners[num_scanners].name = "avx2";
+        scanners[num_scanners++].scan = socket_find_crlf_avx2;
+    }
+#endif
+
+    if ( (data = malloc(BENCH_BUFFER_SIZE)) == NULL ) {
+        perror("bench_crlf: couldn't allocate memory");
+        return EXIT_FAILURE;
+    }
+
+    printf("socket_find_crlf() uses the %s scanner.\n\n",
+           socket_crlf_scanner_name());
+    printf("%10s %10s %12s %12s\n", "line len", "scanner", "MB/s",
+           "ns/line");
+
+    for ( i = 0; i < sizeof(line_lens) / sizeof(line_lens[0]); ++i ) {
+        len = fill_lines(data, BENCH_BUFFER_SIZE, line_lens[i]);
+
+        for ( j = 0; j < num_scanners; ++j ) {
+            num_lines = 0;
+            iterations = 0;
+            start = now();
+
+            do {
+                num_lines += split_lines(scanners[j].scan, data, len);
+                ++iterations;
+            } while ( (elapsed = now() - start) < BENCH_MIN_SECONDS );
+
+            bench_sink = num_lines;
+            printf("%10lu %10s %12.1f %12.1f\n", (unsigned long) line_lens[i],
+                   scanners[j].name, len * iterations / elapsed / 1e6,
+                   elapsed * 1e9 / num_lines);
+        }
+    }
+
+    free(data);
+    return EXIT_SUCCESS;
+}
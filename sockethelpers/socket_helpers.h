@@ -13,5 +13,20 @@
 
 #include "socket_helpers_main.h"
 #include "socket_helpers_server.h"
+#include "socket_helpers_reader.h"
+#include "socket_helpers_scan.h"
+#include "socket_helpers_epoll.h"
+#include "socket_helpers_pool.h"
+#include "socket_helpers_uring.h"
+#include "socket_helpers_timer.h"
+#include "socket_helpers_framer.h"
+#include "socket_helpers_message.h"
+#include "socket_helpers_service.h"
+#include "socket_helpers_conn.h"
+#include "socket_helpers_slab.h"
+#include "socket_helpers_queue.h"
+#include "socket_helpers_error.h"
+#include "socket_helpers_histogram.h"
+#include "socket_helpers_metrics.h"
 
 #endif          /*  PG_SOCKET_HELPERS_H  */
@@ -0,0 +1,685 @@
+/*!
+ * \file            socket_helpers_conn.c
+ * \brief           Implementation of connection context functions.
+ * \details         A context keeps a connection's state in one place, so
+ * each read or write picks up where the last left off instead of
+ * looking its state up or allocating it again: lines are read through
+ * the context's own reader, against a deadline which is armed once per
+ * batch of lines, and small writes are gathered in its output buffer
+ * until flushed, or written together with the next gathered write.
+ * Output is written with socket_writev_all(), which waits for the peer,
+ * unless the context is given an event loop's SocketOutput, which never
+ * does. The memory a context holds is reported by socket_conn_memory(), and a
+ * context may be reset and reused for another connection.
+ *
+ * Buffers are attached to a context only while they hold data. Input
+ * which has already arrived is read without waiting; the receive buffer
+ * goes back to its pool only when a connection must wait for input with
+ * no partial line buffered, and is taken again once input arrives, and the output buffer goes back whenever its
+ * contents have been written. An idle connection therefore holds only
+ * its context.
+ * \author          Paul Griffiths
+ * \copyright       Copyright 2013 Paul Griffiths. Distributed under the terms
+ * of the GNU General Public License. <http://www.gnu.org/licenses/>
+ */
+
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/time.h>
+#include <paulgrif/chelpers.h>
+#include "socket_helpers_conn.h"
+#include "socket_helpers_main.h"
+#include "socket_helpers_slab.h"
+#include "socket_helpers_metrics.h"
+
+
+/*!
+ * \brief           Size of a pooled output buffer.
+ * \details         Larger output is gathered in a buffer from `malloc()`.
+ */
+
+#define CONN_OUTPUT_SIZE 4096
+
+
+/*!
+ * \brief           Struct for a connection context.
+ */
+
+struct SocketConn {
+    int socket;                 /*!< File descriptor of the socket */
+    SocketReader * reader;      /*!< Receive buffer, or NULL until needed */
+    size_t max_line;            /*!< Longest line, or 0 for no limit */
+    char * output;              /*!< Pending output, or NULL */
+    size_t output_len;          /*!< Number of bytes in `output` */
+    size_t output_capacity;     /*!< Size of `output` */
+    int output_pooled;          /*!< True if `output` is from the pool */
+    const SocketOutput * sink;  /*!< Event-loop output, or NULL to write
+                                     to the socket directly */
+    struct timeval time_out;    /*!< Idle timeout */
+    int has_time_out;           /*!< True if `time_out` applies */
+    struct timespec deadline;   /*!< Deadline for the current batch */
+    int deadline_set;           /*!< True if `deadline` is armed */
+    SocketConnStats stats;      /*!< Counters */
+    uint64_t accepted_ns;       /*!< When the connection was accepted, or
+                                     0 once its first input is timed */
+    struct sockaddr_storage peer;   /*!< Peer address */
+    socklen_t peer_len;         /*!< Length of `peer`, or 0 if not known */
+};
+
+
+/*!
+ * \brief           File scope variable for line ending.
+ */
+
+static const char crlf[] = "\r\n";
+
+
+/*!
+ * \brief           File scope variable for the context slab.
+ */
+
+static SocketSlab * conn_slab = NULL;
+
+
+/*!
+ * \brief           File scope variable for the output buffer slab.
+ */
+
+static SocketSlab * output_slab = NULL;
+
+
+/*  Function prototypes  */
+
+static void release_output(SocketConn * conn);
+static int acquire_reader(SocketConn * conn);
+static void release_reader(SocketConn * conn);
+static ssize_t fill_reader(SocketConn * conn);
+static void first_input(SocketConn * conn);
+
+
+/*!
+ * \brief           Creates a connection context.
+ * \details         The context comes from a slab, and no buffers are
+ * allocated until they are needed.
+ * \param socket    File descriptor of the connected socket.
+ * \returns         A pointer to the context, or NULL with `errno` set on
+ * encountering an error.
+ */
+
+SocketConn * socket_conn_create(const int socket) {
+    SocketConn * conn;
+
+    if ( socket_slab_shared(&conn_slab, "socket_conn",
+                            sizeof(*conn)) == NULL ||
+         (conn = socket_slab_alloc(conn_slab)) == NULL ) {
+        return NULL;
+    }
+
+    conn->reader = NULL;
+    conn->output = NULL;
+    conn->output_capacity = 0;
+    conn->output_pooled = FALSE;
+    conn->max_line = 0;
+    conn->has_time_out = FALSE;
+    socket_conn_reset(conn, socket);
+    return conn;
+}
+
+
+/*!
+ * \brief           Destroys a connection context.
+ * \details         The socket itself is not closed.
+ * \param conn      The context to destroy. May be NULL.
+ */
+
+void socket_conn_destroy(SocketConn * conn) {
+    if ( conn != NULL ) {
+        release_reader(conn);
+        release_output(conn);
+        socket_slab_free(conn_slab, conn);
+    }
+}
+
+
+/*!
+ * \brief           Rebinds a connection context to another socket.
+ * \details         Discards any buffered input and pending output, returning
+ * the buffers to their pools, zeroes the counters and clears any
+ * SocketOutput, but keeps the line limit and the idle timeout.
+ * \param conn      The context.
+ * \param socket    File descriptor of the connected socket.
+ */
+
+void socket_conn_reset(SocketConn * conn, const int socket) {
+    conn->socket = socket;
+    conn->sink = NULL;
+    release_reader(conn);
+    release_output(conn);
+    conn->deadline_set = FALSE;
+    memset(&conn->stats, 0, sizeof(conn->stats));
+    conn->accepted_ns = 0;
+    conn->peer_len = 0;
+}
+
+
+/*!
+ * \brief           Closes a connection and destroys its context.
+ * \details         Any pending output is discarded.
+ * \param conn      The context.
+ * \returns         0 on success, or -1 with `errno` set if the socket
+ * could not be closed. The context is destroyed in either case.
+ */
+
+int socket_conn_close(SocketConn * conn) {
+    const int socket = conn->socket;
+
+    socket_conn_destroy(conn);
+    if ( close(socket) == -1 ) {
+        set_errno_errmsg("couldn't close socket");
+        return ERROR_RETURN;
+    }
+
+    return 0;
+}
+
+
+/*!
+ * \brief           Returns a connection's socket.
+ * \param conn      The context.
+ * \returns         File descriptor of the socket.
+ */
+
+int socket_conn_socket(const SocketConn * conn) {
+    return conn->socket;
+}
+
+
+/*!
+ * \brief           Sets the longest line socket_conn_readlines() accepts.
+ * \param conn      The context.
+ * \param max_line  The longest line, excluding the line ending, or 0 for
+ * no limit.
+ */
+
+void socket_conn_set_max_line(SocketConn * conn, const size_t max_line) {
+    conn->max_line = max_line;
+    if ( conn->reader != NULL ) {
+        socket_reader_set_max_line(conn->reader, max_line);
+    }
+}
+
+
+/*!
+ * \brief           Sets a connection's idle timeout.
+ * \details         Each batch of lines from socket_conn_readlines() must
+ * arrive in full within the timeout of the previous batch being
+ * returned.
+ * \param conn      The context.
+ * \param time_out_ms The timeout in milliseconds, or 0 for none.
+ */
+
+void socket_conn_set_idle_timeout(SocketConn * conn, const long time_out_ms) {
+    conn->time_out.tv_sec = time_out_ms / 1000;
+    conn->time_out.tv_usec = (time_out_ms % 1000) * 1000;
+    conn->has_time_out = time_out_ms > 0;
+    conn->deadline_set = FALSE;
+}
+
+
+/*!
+ * \brief           Sets when a connection was accepted.
+ * \details         The time to the connection's first input is recorded
+ * in the `SOCKET_LATENCY_FIRST_BYTE` histogram when it arrives.
+ * \param conn      The context.
+ * \param accepted_ns The time, from socket_clock_ns().
+ */
+
+void socket_conn_set_accepted(SocketConn * conn, const uint64_t accepted_ns) {
+    conn->accepted_ns = accepted_ns;
+}
+
+
+/*!
+ * \brief           Sets how a connection's output is written.
+ * \details         For connections served by an event loop, whose
+ * output must never wait for the peer.
+ * \param conn      The context.
+ * \param output    The SocketOutput passed to the handler's `on_open`
+ * callback, or NULL to write to the socket directly.
+ */
+
+void socket_conn_set_output(SocketConn * conn, const SocketOutput * output) {
+    conn->sink = output;
+}
+
+
+/*!
+ * \brief           Reads as many lines as are available from a connection.
+ * \details         Waits only if no whole line is buffered. The lines
+ * point into the context's receive buffer, which is allocated on the
+ * first call, and lines longer than the buffer are returned in parts.
+ * \param conn      The context.
+ * \param lines     Array to receive the lines.
+ * \param max_lines The size of the array, which must not be 0.
+ * \returns         The number of lines returned, 0 on end-of-file, or -1
+ * with `errno` set on encountering an error, including `ETIMEDOUT` if the
+ * idle timeout passed first and `EMSGSIZE` for a line longer than the
+ * limit.
+ */
+
+ssize_t socket_conn_readlines(SocketConn * conn, SocketLine * lines,
+                              const size_t max_lines) {
+    ssize_t num_lines = 0, num_read, index;
+    unsigned long complete = 0;
+
+    if ( max_lines == 0 ) {
+        errno = EINVAL;
+        return ERROR_RETURN;
+    }
+
+    while ( conn->reader == NULL ||
+            (num_lines = socket_reader_getlines(conn->reader, lines,
+                                                max_lines)) == 0 ) {
+        if ( conn->has_time_out && !conn->deadline_set ) {
+            if ( socket_deadline_after(&conn->deadline,
+                                       &conn->time_out) == -1 ) {
+                return ERROR_RETURN;
+            }
+            conn->deadline_set = TRUE;
+        }
+
+        if ( (num_read = fill_reader(conn)) == -1 ) {
+            if ( errno == ETIMEDOUT ) {
+                conn->deadline_set = FALSE;
+            }
+            return ERROR_RETURN;
+        } else if ( num_read == 0 &&
+                    socket_reader_pending(conn->reader) == 0 ) {
+            return 0;
+        }
+
+        conn->stats.bytes_in += (unsigned long) num_read;
+        socket_metrics_add(SOCKET_METRIC_BYTES_IN, (unsigned long) num_read);
+        if ( conn->accepted_ns != 0 && num_read > 0 ) {
+            first_input(conn);
+        }
+    }
+
+    if ( num_lines > 0 ) {
+        conn->deadline_set = FALSE;
+        for ( index = 0; index < num_lines; ++index ) {
+            complete += lines[index].complete ? 1 : 0;
+        }
+        conn->stats.lines_in += complete;
+        socket_metrics_add(SOCKET_METRIC_LINES_IN, complete);
+    }
+
+    return num_lines;
+}
+
+
+/*!
+ * \brief           Counts input read other than by socket_conn_readlines().
+ * \details         For connections whose input is read by an event loop.
+ * \param conn      The context.
+ * \param bytes     The number of bytes read.
+ * \param lines     The number of complete lines they held.
+ */
+
+void socket_conn_add_input(SocketConn * conn, const size_t bytes,
+                           const size_t lines) {
+    conn->stats.bytes_in += (unsigned long) bytes;
+    conn->stats.lines_in += (unsigned long) lines;
+    socket_metrics_add(SOCKET_METRIC_BYTES_IN, (unsigned long) bytes);
+    socket_metrics_add(SOCKET_METRIC_LINES_IN, (unsigned long) lines);
+    if ( conn->accepted_ns != 0 && bytes > 0 ) {
+        first_input(conn);
+    }
+}
+
+
+/*!
+ * \brief           Queues data for writing to a connection.
+ * \details         The data is copied into the context's output buffer,
+ * and written by the next call to socket_conn_flush() or
+ * socket_conn_writev().
+ * \param conn      The context.
+ * \param data      The data.
+ * \param len       The length of the data.
+ * \returns         `len`, or -1 with `errno` set if memory could not be
+ * allocated.
+ */
+
+ssize_t socket_conn_write(SocketConn * conn, const char * data,
+                          const size_t len) {
+    size_t capacity = conn->output_capacity;
+    char * output;
+
+    if ( conn->output == NULL && len <= CONN_OUTPUT_SIZE ) {
+        if ( socket_slab_shared(&output_slab, "socket_output",
+                                CONN_OUTPUT_SIZE) == NULL ||
+             (conn->output = socket_slab_alloc(output_slab)) == NULL ) {
+            return ERROR_RETURN;
+        }
+        conn->output_capacity = CONN_OUTPUT_SIZE;
+        conn->output_pooled = TRUE;
+    } else if ( conn->output_len + len > capacity ) {
+        if ( capacity < CONN_OUTPUT_SIZE ) {
+            capacity = CONN_OUTPUT_SIZE;
+        }
+        while ( capacity < conn->output_len + len ) {
+            capacity *= 2;
+        }
+
+        /*  Outgrown the pooled buffer, so move to a larger one  */
+
+        if ( conn->output_pooled ) {
+            if ( (output = malloc(capacity)) == NULL ) {
+                return ERROR_RETURN;
+            }
+            memcpy(output, conn->output, conn->output_len);
+            socket_slab_free(output_slab, conn->output);
+            conn->output_pooled = FALSE;
+        } else if ( (output = realloc(conn->output, capacity)) == NULL ) {
+            return ERROR_RETURN;
+        }
+        conn->output = output;
+        conn->output_capacity = capacity;
+    }
+
+    memcpy(conn->output + conn->output_len, data, len);
+    conn->output_len += len;
+    return (ssize_t) len;
+}
+
+
+/*!
+ * \brief           Queues a line for writing to a connection.
+ * \details         As socket_conn_write(), followed by a `\r\n`.
+ * \param conn      The context.
+ * \param data      The line, which should not end in a line ending.
+ * \param len       The length of the line.
+ * \returns         `len + 2`, or -1 with `errno` set if memory could not
+ * be allocated.
+ */
+
+ssize_t socket_conn_writeline(SocketConn * conn, const char * data,
+                              const size_t len) {
+    if ( socket_conn_write(conn, data, len) == -1 ||
+         socket_conn_write(conn, crlf, 2) == -1 ) {
+        return ERROR_RETURN;
+    }
+
+    ++conn->stats.lines_out;
+    socket_metrics_add(SOCKET_METRIC_LINES_OUT, 1);
+    return (ssize_t) len + 2;
+}
+
+
+/*!
+ * \brief           Writes pending output and several buffers to a
+ * connection.
+ * \details         The pending output and the buffers are written with
+ * a single gathered write, through the context's SocketOutput if it has
+ * one, and otherwise with socket_writev_all().
+ * \param conn      The context.
+ * \param iov       The buffers, which are not modified.
+ * \param iovcnt    The number of buffers, which must not exceed
+ * `SOCKET_CONN_MAX_IOV`.
+ * \param num_lines The number of lines the buffers complete, for the
+ * connection's counters.
+ * \returns         The number of bytes written, or -1 with `errno` set
+ * on encountering an error.
+ */
+
+ssize_t socket_conn_writev(SocketConn * conn, const struct iovec * iov,
+                           const int iovcnt, const size_t num_lines) {
+    struct iovec out_iov[SOCKET_CONN_MAX_IOV + 1];
+    ssize_t num_written;
+    int out_cnt = 0;
+
+    if ( iovcnt < 0 || iovcnt > SOCKET_CONN_MAX_IOV ) {
+        errno = EINVAL;
+        return ERROR_RETURN;
+    }
+
+    if ( conn->output_len > 0 ) {
+        out_iov[0].iov_base = conn->output;
+        out_iov[0].iov_len = conn->output_len;
+        out_cnt = 1;
+    }
+    if ( iovcnt > 0 ) {
+        memcpy(out_iov + out_cnt, iov, iovcnt * sizeof(*iov));
+        out_cnt += iovcnt;
+    }
+
+    if ( out_cnt == 0 ) {
+        return 0;
+    } else if ( conn->sink != NULL ) {
+        num_written = conn->sink->writev(conn->sink->conn, out_iov, out_cnt);
+    } else {
+        num_written = socket_writev_all(conn->socket, out_iov, out_cnt);
+    }
+
+    if ( num_written == -1 ) {
+        return ERROR_RETURN;
+    }
+
+    release_output(conn);
+    conn->stats.bytes_out += (unsigned long) num_written;
+    conn->stats.lines_out += (unsigned long) num_lines;
+    socket_metrics_add(SOCKET_METRIC_BYTES_OUT, (unsigned long) num_written);
+    socket_metrics_add(SOCKET_METRIC_LINES_OUT, (unsigned long) num_lines);
+    return num_written;
+}
+
+
+/*!
+ * \brief           Writes a connection's pending output.
+ * \param conn      The context.
+ * \returns         0 on success, or -1 with `errno` set on encountering
+ * an error.
+ */
+
+int socket_conn_flush(SocketConn * conn) {
+    return socket_conn_writev(conn, NULL, 0, 0) == -1 ? ERROR_RETURN : 0;
+}
+
+
+/*!
+ * \brief           Returns the number of bytes of pending output.
+ * \param conn      The context.
+ * \returns         The number of bytes queued and not yet written.
+ */
+
+size_t socket_conn_pending_output(const SocketConn * conn) {
+    return conn->output_len;
+}
+
+
+/*!
+ * \brief           Returns a connection's peer address.
+ * \details         The address is looked up on the first call, and
+ * kept for later calls.
+ * \param conn      The context.
+ * \param len       Pointer to receive the length of the address.
+ * \returns         A pointer to the address, which is valid for the life
+ * of the connection, or NULL with `errno` set on encountering an error.
+ */
+
+const struct sockaddr * socket_conn_peer(SocketConn * conn, socklen_t * len) {
+    socklen_t peer_len = sizeof(conn->peer);
+
+    if ( conn->peer_len == 0 ) {
+        if ( getpeername(conn->socket, (struct sockaddr *) &conn->peer,
+                         &peer_len) == -1 ) {
+            return NULL;
+        }
+        conn->peer_len = peer_len;
+    }
+
+    *len = conn->peer_len;
+    return (const struct sockaddr *) &conn->peer;
+}
+
+
+/*!
+ * \brief           Gets a connection's counters.
+ * \param conn      The context.
+ * \param stats     Pointer to a struct to receive the counters.
+ */
+
+void socket_conn_get_stats(const SocketConn * conn, SocketConnStats * stats) {
+    *stats = conn->stats;
+}
+
+
+/*!
+ * \brief           Returns the memory held by a connection context.
+ * \param conn      The context.
+ * \returns         The number of bytes allocated for the context and
+ * its buffers.
+ */
+
+size_t socket_conn_memory(const SocketConn * conn) {
+    return sizeof(*conn) + conn->output_capacity +
+           (conn->reader != NULL ? socket_reader_size() : 0);
+}
+
+
+/*!
+ * \brief           Gets the counts of pooled and attached buffers.
+ * \details         Covers the receive and output buffers of every
+ * connection context, and of the reader registry.
+ * \param stats     Pointer to a struct to receive the counts.
+ */
+
+void socket_conn_buffer_stats(SocketBufferStats * stats) {
+    SocketSlabStats slab_stats;
+    SocketSlab * slab;
+
+    socket_reader_pool_stats(&slab_stats);
+    stats->attached = slab_stats.in_use;
+    stats->pooled = slab_stats.objects - slab_stats.in_use;
+    stats->attached_bytes = slab_stats.in_use * slab_stats.object_size;
+    stats->pooled_bytes = stats->pooled * slab_stats.object_size;
+
+    if ( (slab = __atomic_load_n(&output_slab, __ATOMIC_ACQUIRE)) != NULL ) {
+        socket_slab_get_stats(slab, &slab_stats);
+        stats->attached += slab_stats.in_use;
+        stats->pooled += slab_stats.objects - slab_stats.in_use;
+        stats->attached_bytes += slab_stats.in_use * slab_stats.object_size;
+        stats->pooled_bytes += (slab_stats.objects - slab_stats.in_use) *
+                               slab_stats.object_size;
+    }
+}
+
+
+/*!
+ * \brief           Returns a context's output buffer to its pool.
+ * \details         Any pending output is discarded.
+ * \param conn      The context.
+ */
+
+static void release_output(SocketConn * conn) {
+    if ( conn->output_pooled ) {
+        socket_slab_free(output_slab, conn->output);
+    } else {
+        free(conn->output);
+    }
+
+    conn->output = NULL;
+    conn->output_len = 0;
+    conn->output_capacity = 0;
+    conn->output_pooled = FALSE;
+}
+
+
+/*!
+ * \brief           Attaches a receive buffer to a context.
+ * \param conn      The context, which has no receive buffer.
+ * \returns         0 on success, or -1 with `errno` set if memory could
+ * not be allocated.
+ */
+
+static int acquire_reader(SocketConn * conn) {
+    if ( (conn->reader = socket_reader_create(conn->socket)) == NULL ) {
+        return ERROR_RETURN;
+    }
+
+    socket_reader_set_max_line(conn->reader, conn->max_line);
+    return 0;
+}
+
+
+/*!
+ * \brief           Returns a context's receive buffer to its pool.
+ * \details         Any buffered input is discarded.
+ * \param conn      The context.
+ */
+
+static void release_reader(SocketConn * conn) {
+    socket_reader_destroy(conn->reader);
+    conn->reader = NULL;
+}
+
+
+/*!
+ * \brief           Reads input into a context's buffer, waiting if need be.
+ * \details         Whatever input has already arrived is read without
+ * waiting. Only if there is none does the connection wait, and if no
+ * partial line is buffered, the receive buffer is returned to its pool
+ * while it does so, and taken again once input arrives.
+ * \param conn      The context.
+ * \returns         The number of bytes read, 0 on end-of-file, or -1
+ * with `errno` set on encountering an error, including `ETIMEDOUT` if
+ * the deadline passed first.
+ */
+
+static ssize_t fill_reader(SocketConn * conn) {
+    const struct timespec * deadline =
+            conn->has_time_out ? &conn->deadline : NULL;
+    ssize_t num_read;
+    int status;
+
+    if ( conn->reader == NULL && acquire_reader(conn) == -1 ) {
+        return ERROR_RETURN;
+    }
+
+    if ( (num_read = socket_reader_fill_nowait(conn->reader)) != -1 ||
+         (errno != EAGAIN && errno != EWOULDBLOCK) ) {
+        return num_read;
+    }
+
+    if ( socket_reader_pending(conn->reader) == 0 ) {
+        release_reader(conn);
+    }
+
+    if ( (status = socket_wait_readable_until(conn->socket,
+                                              deadline)) < 1 ) {
+        if ( status == 0 ) {
+            errno = ETIMEDOUT;
+        }
+        return ERROR_RETURN;
+    } else if ( conn->reader == NULL && acquire_reader(conn) == -1 ) {
+        return ERROR_RETURN;
+    }
+
+    return socket_reader_fill_until(conn->reader, NULL);
+}
+
+
+/*!
+ * \brief           Records the time from a connection being accepted to
+ * its first input arriving.
+ * \param conn      The context.
+ */
+
+static void first_input(SocketConn * conn) {
+    socket_metrics_record(SOCKET_LATENCY_FIRST_BYTE,
+                          socket_clock_ns() - conn->accepted_ns, 1);
+    conn->accepted_ns = 0;
+}
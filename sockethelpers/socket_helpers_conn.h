@@ -0,0 +1,102 @@
+/*!
+ * \file            socket_helpers_conn.h
+ * \brief           Interface to connection context functions.
+ * \details         Interface to connection context functions.
+ * \author          Paul Griffiths
+ * \copyright       Copyright 2013 Paul Griffiths. Distributed under the terms
+ * of the GNU General Public License. <http://www.gnu.org/licenses/>
+ */
+
+
+#ifndef PG_SOCKET_HELPERS_CONN_H
+#define PG_SOCKET_HELPERS_CONN_H
+
+#include <stddef.h>
+#include <inttypes.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include "socket_helpers_reader.h"
+#include "socket_helpers_queue.h"
+
+
+/*!
+ * \brief           Maximum number of buffers for socket_conn_writev().
+ */
+
+#define SOCKET_CONN_MAX_IOV 1024
+
+
+/*!
+ * \brief           Opaque connection context type.
+ * \details         A connection context owns everything kept for one
+ * connected socket between calls: its receive buffer, pending output,
+ * idle deadline, counters and peer address. The receive buffer and
+ * output buffer come from shared pools, and are attached only while
+ * they hold data.
+ */
+
+typedef struct SocketConn SocketConn;
+
+
+/*!
+ * \brief           Struct for a connection's counters.
+ */
+
+typedef struct SocketConnStats {
+    unsigned long bytes_in;     /*!< Bytes received */
+    unsigned long bytes_out;    /*!< Bytes written */
+    unsigned long lines_in;     /*!< Complete lines received */
+    unsigned long lines_out;    /*!< Complete lines written */
+} SocketConnStats;
+
+
+/*!
+ * \brief           Struct for the counts of pooled and attached buffers.
+ */
+
+typedef struct SocketBufferStats {
+    unsigned long attached;     /*!< Buffers held by connections */
+    unsigned long pooled;       /*!< Buffers free for reuse */
+    size_t attached_bytes;      /*!< Bytes in attached buffers */
+    size_t pooled_bytes;        /*!< Bytes in pooled buffers */
+} SocketBufferStats;
+
+
+/*  Function prototypes  */
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+SocketConn * socket_conn_create(const int socket);
+void socket_conn_destroy(SocketConn * conn);
+void socket_conn_reset(SocketConn * conn, const int socket);
+int socket_conn_close(SocketConn * conn);
+int socket_conn_socket(const SocketConn * conn);
+void socket_conn_set_max_line(SocketConn * conn, const size_t max_line);
+void socket_conn_set_idle_timeout(SocketConn * conn, const long time_out_ms);
+void socket_conn_set_accepted(SocketConn * conn, const uint64_t accepted_ns);
+void socket_conn_set_output(SocketConn * conn, const SocketOutput * output);
+ssize_t socket_conn_readlines(SocketConn * conn, SocketLine * lines,
+                              const size_t max_lines);
+void socket_conn_add_input(SocketConn * conn, const size_t bytes,
+                           const size_t lines);
+ssize_t socket_conn_write(SocketConn * conn, const char * data,
+                          const size_t len);
+ssize_t socket_conn_writeline(SocketConn * conn, const char * data,
+                              const size_t len);
+ssize_t socket_conn_writev(SocketConn * conn, const struct iovec * iov,
+                           const int iovcnt, const size_t num_lines);
+int socket_conn_flush(SocketConn * conn);
+size_t socket_conn_pending_output(const SocketConn * conn);
+const struct sockaddr * socket_conn_peer(SocketConn * conn, socklen_t * len);
+void socket_conn_get_stats(const SocketConn * conn, SocketConnStats * stats);
+size_t socket_conn_memory(const SocketConn * conn);
+void socket_conn_buffer_stats(SocketBufferStats * stats);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif          /*  PG_SOCKET_HELPERS_CONN_H  */
@@ -0,0 +1,801 @@
+/*!
+ * \file            socket_helpers_epoll.c
+ * \brief           Implementation of epoll event-loop server functions.
+ * \details         Each event-loop thread has its own epoll instance,
+ * which watches the shared listening socket, or when sharded its own
+ * shard's listening socket, and the connections that thread has
+ * accepted. Connections are non-blocking and registered
+ * edge-triggered, so each readable event is drained until `recv()`
+ * would block. Idle timeouts are kept in a timer wheel per thread,
+ * which sets the `epoll_wait()` timeout, so they cost no system calls.
+ *
+ * Connections are also registered for writability, and output written
+ * by a handler callback, through the SocketOutput it is given when the
+ * connection is opened, goes through the connection's SocketQueue, so a
+ * peer which stops reading never blocks the thread. The queue is sent as
+ * the socket becomes writable, and while it is over its high watermark
+ * the connection is not read, so the peer's own sends back up instead.
+ * A connection closed with output queued is closed once the output has
+ * been sent, or its idle timeout passes again.
+ *
+ * So that one busy connection cannot hold up the others sharing its
+ * thread, a connection is read for at most the handler's round budget
+ * per turn. A connection with input left over goes on the thread's ready
+ * list, which is served after each round of events, in order, so each
+ * connection with input gets one turn per round.
+ *
+ * When `accept()` fails for want of file descriptors or memory, the
+ * thread stops watching the listening socket, and watches it again once
+ * it closes a connection, or after `SERVER_RETRY_MS` milliseconds, so
+ * it neither spins on connections it cannot accept nor stops.
+ * \author          Paul Griffiths
+ * \copyright       Copyright 2013 Paul Griffiths. Distributed under the terms
+ * of the GNU General Public License. <http://www.gnu.org/licenses/>
+ */
+
+
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/epoll.h>
+#include <paulgrif/chelpers.h>
+#include "socket_helpers_epoll.h"
+#include "socket_helpers_server.h"
+#include "socket_helpers_timer.h"
+#include "socket_helpers_slab.h"
+#include "socket_helpers_queue.h"
+#include "socket_helpers_error.h"
+#include "socket_helpers_metrics.h"
+
+
+/*!
+ * \brief           Maximum number of events to handle per `epoll_wait()`.
+ */
+
+#define EPOLL_MAX_EVENTS 256
+
+
+/*!
+ * \brief           Size of each event-loop thread's receive buffer.
+ */
+
+#define EPOLL_RECV_BUFFER_SIZE 65536
+
+
+/*!
+ * \brief           Struct for an event-loop connection.
+ */
+
+typedef struct EpollConn {
+    int socket;         /*!< File descriptor for the connected socket */
+    void * conn_data;   /*!< Handler data for the connection */
+    TimerEntry timer;   /*!< Idle timer */
+    SocketQueue output; /*!< Output waiting for the socket */
+    SocketOutput sink;  /*!< Writes to `output`, for the handler */
+    const SocketQueuePolicy * policy;   /*!< The handler's output limits */
+    int blocked;        /*!< True while not read, for output to drain */
+    int closing;        /*!< True once closed, while output drains */
+    int failed;         /*!< True if a write has failed */
+    int ready;          /*!< True while on the ready list */
+    uint64_t deferred_us;       /*!< When the connection joined the list */
+    struct EpollConn * ready_prev;  /*!< Previous connection on the list */
+    struct EpollConn * ready_next;  /*!< Next connection on the list */
+} EpollConn;
+
+
+/*!
+ * \brief           File scope variable for the connection slab.
+ * \details         Created when the first connection is accepted.
+ */
+
+static SocketSlab * conn_slab = NULL;
+
+
+/*!
+ * \brief           Struct for an event-loop thread.
+ */
+
+typedef struct EpollLoop {
+    int listening_socket;           /*!< Shared listening socket */
+    int epoll_fd;                   /*!< This thread's epoll instance */
+    const EpollHandler * handler;   /*!< Connection callbacks */
+    TcpShard * shard;               /*!< Shard served, or NULL */
+    TimerWheel * timers;            /*!< Idle timers */
+    uint64_t now_ms;                /*!< Time of the last wakeup */
+    EpollConn * ready_head;         /*!< Connections with input left */
+    EpollConn * ready_tail;         /*!< Last connection on the list */
+    size_t num_ready;               /*!< Connections on the list */
+    TimerEntry accept_timer;        /*!< Timer to resume accepting */
+    int accept_paused;              /*!< True while not accepting */
+    pthread_t thread_id;            /*!< Thread running the loop */
+} EpollLoop;
+
+
+/*!
+ * \brief           Sets a socket to non-blocking mode.
+ * \param socket    File descriptor of the socket.
+ * \returns         0 on success, or -1 with `errno` set on encountering
+ * an error.
+ */
+
+int set_socket_nonblocking(const int socket) {
+    int flags = fcntl(socket, F_GETFL);
+    if ( flags == -1 || fcntl(socket, F_SETFL, flags | O_NONBLOCK) == -1 ) {
+        return ERROR_RETURN;
+    }
+    return 0;
+}
+
+
+/*!
+ * \brief           Adds a connection to the end of the ready list.
+ * \param loop      The event loop.
+ * \param conn      The connection, which has input left to read.
+ */
+
+static void ready_push(EpollLoop * loop, EpollConn * conn) {
+    conn->ready = TRUE;
+    conn->deferred_us = server_round_deferred();
+    conn->ready_next = NULL;
+    conn->ready_prev = loop->ready_tail;
+
+    if ( loop->ready_tail != NULL ) {
+        loop->ready_tail->ready_next = conn;
+    } else {
+        loop->ready_head = conn;
+    }
+    loop->ready_tail = conn;
+    ++loop->num_ready;
+}
+
+
+/*!
+ * \brief           Removes a connection from the ready list.
+ * \param loop      The event loop.
+ * \param conn      The connection, which must be on the list.
+ */
+
+static void ready_remove(EpollLoop * loop, EpollConn * conn) {
+    if ( conn->ready_prev != NULL ) {
+        conn->ready_prev->ready_next = conn->ready_next;
+    } else {
+        loop->ready_head = conn->ready_next;
+    }
+
+    if ( conn->ready_next != NULL ) {
+        conn->ready_next->ready_prev = conn->ready_prev;
+    } else {
+        loop->ready_tail = conn->ready_prev;
+    }
+
+    conn->ready = FALSE;
+    --loop->num_ready;
+    server_round_resumed(conn->deferred_us);
+}
+
+
+/*!
+ * \brief           Watches the listening socket for connections.
+ * \details         Connections which arrived while accepting was paused
+ * are reported by the next `epoll_wait()`, as the listening socket is
+ * level-triggered.
+ * \param loop      The event loop.
+ * \returns         0 on success, or -1 on encountering an error.
+ */
+
+static int watch_listener(EpollLoop * loop) {
+    struct epoll_event event;
+
+    /*  A NULL data pointer marks the listening socket. Where it is
+        available, EPOLLEXCLUSIVE wakes only one of the threads
+        waiting on the listening socket for each new connection.    */
+
+    event.events = EPOLLIN;
+#ifdef EPOLLEXCLUSIVE
+    event.events |= EPOLLEXCLUSIVE;
+#endif
+    event.data.ptr = NULL;
+
+    return epoll_ctl(loop->epoll_fd, EPOLL_CTL_ADD,
+                     loop->listening_socket, &event);
+}
+
+
+/*!
+ * \brief           Stops accepting for a while.
+ * \details         Called when `accept()` fails for want of resources.
+ * The listening socket is removed from the thread's epoll instance, as
+ * it would otherwise be reported readable on every pass.
+ * \param loop      The event loop.
+ */
+
+static void pause_accepting(EpollLoop * loop) {
+    socket_count_error(SOCKET_ERROR_RESOURCE);
+    if ( epoll_ctl(loop->epoll_fd, EPOLL_CTL_DEL,
+                   loop->listening_socket, NULL) == -1 ) {
+        return;
+    }
+
+    loop->accept_paused = TRUE;
+    timer_wheel_arm(loop->timers, &loop->accept_timer,
+                    loop->now_ms + SERVER_RETRY_MS);
+}
+
+
+/*!
+ * \brief           Starts accepting again.
+ * \details         Should the listening socket not be watched again,
+ * the timer is rearmed to try later.
+ * \param loop      The event loop.
+ */
+
+static void resume_accepting(EpollLoop * loop) {
+    if ( watch_listener(loop) == -1 ) {
+        timer_wheel_arm(loop->timers, &loop->accept_timer,
+                        loop->now_ms + SERVER_RETRY_MS);
+        return;
+    }
+
+    loop->accept_paused = FALSE;
+    timer_wheel_cancel(loop->timers, &loop->accept_timer);
+}
+
+
+/*!
+ * \brief           Closes an event-loop connection.
+ * \param loop      The event loop.
+ * \param conn      The connection.
+ */
+
+static void close_conn(EpollLoop * loop, EpollConn * conn) {
+    if ( conn->ready ) {
+        ready_remove(loop, conn);
+    }
+
+    timer_wheel_cancel(loop->timers, &conn->timer);
+    socket_queue_clear(&conn->output);
+    socket_queue_update_blocked(&loop->handler->output, &conn->blocked, 0);
+
+    if ( loop->handler->on_close != NULL ) {
+        loop->handler->on_close(conn->socket, conn->conn_data);
+    }
+
+    close(conn->socket);
+    socket_slab_free(conn_slab, conn);
+    socket_metrics_add(SOCKET_METRIC_CLOSED, 1);
+
+    if ( loop->accept_paused ) {
+        resume_accepting(loop);
+    }
+}
+
+
+/*!
+ * \brief           Writes output for an event-loop connection.
+ * \details         The connection's SocketOutput function. What the
+ * socket will not take at once is copied to the connection's queue,
+ * subject to the handler's output limits, so the buffers may be reused
+ * as soon as the function returns.
+ * \param arg       The connection.
+ * \param iov       The buffers to write.
+ * \param iovcnt    The number of buffers in `iov`.
+ * \returns         The number of characters written or queued, or -1
+ * with `errno` set on encountering an error, including `ENOBUFS` if the
+ * connection's output limit was exceeded. The connection is closed after
+ * the callback returns if the function fails.
+ */
+
+static ssize_t write_conn(void * arg, const struct iovec * iov,
+                          const int iovcnt) {
+    EpollConn * conn = arg;
+    ssize_t num_written;
+
+    if ( conn->failed ) {
+        errno = EPIPE;
+        return ERROR_RETURN;
+    }
+
+    if ( (num_written = socket_queue_writev(&conn->output, conn->socket,
+                                            iov, iovcnt,
+                                            conn->policy)) == -1 ) {
+        socket_count_error(socket_error_kind(errno));
+        conn->failed = TRUE;
+        return ERROR_RETURN;
+    }
+
+    socket_queue_update_blocked(conn->policy, &conn->blocked,
+                                conn->output.len);
+    return num_written;
+}
+
+
+/*!
+ * \brief           Accepts all pending connections.
+ * \details         Pauses accepting if the process runs out of file
+ * descriptors or memory.
+ * \param loop      The event loop.
+ * \returns         0 on success, or -1 on encountering an error.
+ */
+
+static int accept_conns(EpollLoop * loop) {
+    struct epoll_event event;
+    EpollConn * conn;
+    int conn_socket;
+
+    while ( 1 ) {
+        conn_socket = accept(loop->listening_socket, NULL, NULL);
+        if ( conn_socket == -1 ) {
+            if ( errno == EAGAIN || errno == EWOULDBLOCK ) {
+                break;
+            } else if ( errno == EINTR || errno == ECONNABORTED ||
+                        errno == EPROTO ) {
+                continue;
+            } else if ( server_accept_exhausted(errno) ) {
+                pause_accepting(loop);
+                break;
+            }
+            set_errno_errmsg("Error accepting connection");
+            return ERROR_RETURN;
+        }
+
+        if ( loop->shard != NULL ) {
+            __atomic_add_fetch(&loop->shard->accepts, 1, __ATOMIC_RELAXED);
+        }
+        socket_metrics_add(SOCKET_METRIC_ACCEPTS, 1);
+
+        if ( set_socket_nonblocking(conn_socket) == -1 ||
+             socket_slab_shared(&conn_slab, "epoll_conn",
+                                sizeof(*conn)) == NULL ||
+             (conn = socket_slab_alloc(conn_slab)) == NULL ) {
+            socket_count_error(socket_error_kind(errno));
+            close(conn_socket);
+            continue;
+        }
+
+        conn->socket = conn_socket;
+        conn->conn_data = NULL;
+        timer_entry_init(&conn->timer, conn);
+        socket_queue_init(&conn->output);
+        conn->sink.writev = write_conn;
+        conn->sink.conn = conn;
+        conn->policy = &loop->handler->output;
+        conn->blocked = FALSE;
+        conn->closing = FALSE;
+        conn->failed = FALSE;
+        conn->ready = FALSE;
+
+        if ( loop->handler->on_open != NULL &&
+             loop->handler->on_open(conn_socket, &conn->sink,
+                                    &conn->conn_data) != 0 ) {
+            close(conn_socket);
+            socket_slab_free(conn_slab, conn);
+            continue;
+        }
+        socket_metrics_add(SOCKET_METRIC_OPENED, 1);
+
+        event.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET;
+        event.data.ptr = conn;
+        if ( epoll_ctl(loop->epoll_fd, EPOLL_CTL_ADD,
+                       conn_socket, &event) == -1 ) {
+            close_conn(loop, conn);
+        } else if ( loop->handler->idle_timeout_ms > 0 ) {
+            timer_wheel_arm(loop->timers, &conn->timer,
+                    loop->now_ms + loop->handler->idle_timeout_ms);
+        }
+    }
+
+    return 0;
+}
+
+
+/*!
+ * \brief           Closes a connection once its queued output is sent.
+ * \details         A connection whose writes have failed is closed at
+ * once. Otherwise the idle timeout bounds the wait for the output to
+ * be sent.
+ * \param loop      The event loop.
+ * \param conn      The connection.
+ */
+
+static void finish_conn(EpollLoop * loop, EpollConn * conn) {
+    if ( conn->output.len == 0 || conn->failed ) {
+        close_conn(loop, conn);
+    } else {
+        conn->closing = TRUE;
+        if ( loop->handler->idle_timeout_ms > 0 ) {
+            timer_wheel_arm(loop->timers, &conn->timer,
+                    loop->now_ms + loop->handler->idle_timeout_ms);
+        }
+    }
+}
+
+
+/*!
+ * \brief           Reads from a connection until it would block.
+ * \details         Each chunk read is passed to the handler. Reading
+ * stops early if the connection becomes blocked by its queued output,
+ * or once it has used up its round budget, in which case it is put on
+ * the ready list to be read again after the other connections. The
+ * connection is finished with on end-of-file, on error, or when the
+ * handler asks for it to be.
+ * \param loop      The event loop.
+ * \param conn      The connection.
+ * \param buffer    The thread's receive buffer.
+ */
+
+static void read_conn(EpollLoop * loop, EpollConn * conn, char * buffer) {
+    size_t budget = loop->handler->round_bytes > 0 ?
+                    loop->handler->round_bytes : SERVER_ROUND_BYTES;
+    ssize_t num_read;
+    int status;
+
+    while ( !conn->blocked ) {
+        if ( budget == 0 ) {
+            ready_push(loop, conn);
+            return;
+        }
+
+        num_read = recv(conn->socket, buffer,
+                        budget < EPOLL_RECV_BUFFER_SIZE ?
+                        budget : EPOLL_RECV_BUFFER_SIZE, 0);
+
+        if ( num_read > 0 ) {
+            budget -= (size_t) num_read;
+
+            status = loop->handler->on_data(conn->socket, conn->conn_data,
+                                            buffer, (size_t) num_read);
+
+            if ( status != 0 || conn->failed ) {
+                finish_conn(loop, conn);
+                return;
+            }
+
+            if ( loop->handler->idle_timeout_ms > 0 ) {
+                timer_wheel_arm(loop->timers, &conn->timer,
+                        loop->now_ms + loop->handler->idle_timeout_ms);
+            }
+        } else if ( num_read == -1 && errno == EINTR ) {
+            continue;
+        } else if ( num_read == -1 &&
+                    (errno == EAGAIN || errno == EWOULDBLOCK) ) {
+            return;
+        } else {
+
+            /*  End-of-file or error  */
+
+            if ( num_read == -1 ) {
+                socket_count_error(socket_error_kind(errno));
+            } else {
+                loop->handler->on_data(conn->socket, conn->conn_data,
+                                       buffer, 0);
+            }
+            finish_conn(loop, conn);
+            return;
+        }
+    }
+}
+
+
+/*!
+ * \brief           Serves an event on a connection.
+ * \details         Sends any queued output the socket will now take,
+ * then reads input if there is any, or if the connection has just been
+ * unblocked, since edge-triggered events for input which arrived while
+ * it was blocked have already been delivered. A connection on the ready
+ * list is not read until its turn comes round.
+ * \param loop      The event loop.
+ * \param conn      The connection.
+ * \param events    The events reported for the connection.
+ * \param buffer    The thread's receive buffer.
+ */
+
+static void serve_conn(EpollLoop * loop, EpollConn * conn,
+                       const uint32_t events, char * buffer) {
+    const int was_blocked = conn->blocked;
+    ssize_t num_sent;
+
+    if ( conn->output.len > 0 &&
+         (events & (EPOLLOUT | EPOLLERR | EPOLLHUP)) ) {
+        if ( (num_sent = socket_queue_send(&conn->output,
+                                           conn->socket)) == -1 ) {
+            socket_count_error(socket_error_kind(errno));
+            close_conn(loop, conn);
+            return;
+        } else if ( conn->closing && conn->output.len == 0 ) {
+            close_conn(loop, conn);
+            return;
+        }
+
+        if ( num_sent > 0 && loop->handler->idle_timeout_ms > 0 ) {
+            timer_wheel_arm(loop->timers, &conn->timer,
+                    loop->now_ms + loop->handler->idle_timeout_ms);
+        }
+        socket_queue_update_blocked(&loop->handler->output, &conn->blocked,
+                                    conn->output.len);
+    }
+
+    if ( !conn->closing && !conn->blocked && !conn->ready &&
+         (was_blocked ||
+          (events & (EPOLLIN | EPOLLRDHUP | EPOLLERR | EPOLLHUP))) ) {
+        read_conn(loop, conn, buffer);
+    }
+}
+
+
+/*!
+ * \brief           Gives each connection on the ready list its turn.
+ * \details         Serves only the connections on the list when called,
+ * so a connection which uses up its budget again waits for the next
+ * round. A connection blocked by its queued output is dropped from the
+ * list, and is read again when it is unblocked.
+ * \param loop      The event loop.
+ * \param buffer    The thread's receive buffer.
+ */
+
+static void serve_ready(EpollLoop * loop, char * buffer) {
+    size_t num_ready = loop->num_ready;
+    EpollConn * conn;
+
+    while ( num_ready-- > 0 && (conn = loop->ready_head) != NULL ) {
+        ready_remove(loop, conn);
+        if ( !conn->closing && !conn->blocked ) {
+            read_conn(loop, conn, buffer);
+        }
+    }
+}
+
+
+/*!
+ * \brief           Closes a connection whose idle timer has expired.
+ * \details         Anything the handler's `on_timeout` callback writes
+ * is sent before the connection is closed, unless the idle timeout
+ * passes again first. A connection already closing is closed at once.
+ * The loop's accept timer resumes accepting instead.
+ * \param timer     The connection's timer, or the loop's accept timer.
+ * \param arg       The event loop.
+ */
+
+static void expire_conn(TimerEntry * timer, void * arg) {
+    EpollLoop * loop = arg;
+    EpollConn * conn = timer->data;
+
+    if ( timer == &loop->accept_timer ) {
+        resume_accepting(loop);
+        return;
+    }
+
+    if ( conn->closing ) {
+        close_conn(loop, conn);
+        return;
+    }
+
+    socket_count_error(SOCKET_ERROR_TIMEOUT);
+    if ( loop->handler->on_timeout != NULL ) {
+        loop->handler->on_timeout(conn->socket, conn->conn_data);
+    }
+
+    finish_conn(loop, conn);
+}
+
+
+/*!
+ * \brief           Runs an event loop.
+ * \param loop      The event loop.
+ * \returns         Returns -1 on encountering an error. The loop runs
+ * indefinitely, and this function will not return unless an error is
+ * encountered.
+ */
+
+static int run_epoll_loop(EpollLoop * loop) {
+    struct epoll_event events[EPOLL_MAX_EVENTS];
+    int num_events, index;
+    long time_out;
+    char * buffer;
+
+    if ( (buffer = malloc(EPOLL_RECV_BUFFER_SIZE)) == NULL ) {
+        set_errno_errmsg("Error allocating receive buffer");
+        return ERROR_RETURN;
+    }
+    socket_metrics_add(SOCKET_METRIC_THREADS_STARTED, 1);
+
+    while ( 1 ) {
+        time_out = loop->ready_head != NULL ? 0 :
+                   timer_wheel_next_timeout(loop->timers, loop->now_ms);
+        num_events = epoll_wait(loop->epoll_fd, events, EPOLL_MAX_EVENTS,
+                                time_out > INT_MAX ? INT_MAX : (int) time_out);
+        loop->now_ms = timer_now_ms();
+
+        if ( num_events == -1 ) {
+            if ( errno == EINTR ) {
+                continue;
+            }
+            set_errno_errmsg("Error calling epoll_wait()");
+            break;
+        }
+
+        for ( index = 0; index < num_events; ++index ) {
+            if ( events[index].data.ptr == NULL ) {
+                if ( accept_conns(loop) == -1 ) {
+                    free(buffer);
+                    socket_metrics_add(SOCKET_METRIC_THREADS_EXITED, 1);
+                    return ERROR_RETURN;
+                }
+            } else {
+                serve_conn(loop, events[index].data.ptr,
+                           events[index].events, buffer);
+            }
+        }
+
+        serve_ready(loop, buffer);
+        timer_wheel_advance(loop->timers, loop->now_ms, expire_conn, loop);
+    }
+
+    free(buffer);
+    socket_metrics_add(SOCKET_METRIC_THREADS_EXITED, 1);
+    return ERROR_RETURN;
+}
+
+
+/*!
+ * \brief           Thread function for additional event-loop threads.
+ * \param arg       Pointer to the thread's EpollLoop struct.
+ * \returns         NULL
+ */
+
+static void * epoll_loop_thread(void * arg) {
+    EpollLoop * loop = arg;
+
+    if ( loop->shard != NULL ) {
+        pin_thread_to_cpu(loop->shard->cpu);
+    }
+
+    run_epoll_loop(loop);
+    return NULL;
+}
+
+
+/*!
+ * \brief           Initializes an event loop.
+ * \param loop      The event loop to initialize.
+ * \param listening_socket A file descriptor for a listening socket.
+ * \param handler   The connection callbacks.
+ * \returns         0 on success, or -1 on encountering an error.
+ */
+
+static int init_epoll_loop(EpollLoop * loop, const int listening_socket,
+                           const EpollHandler * handler) {
+    loop->listening_socket = listening_socket;
+    loop->handler = handler;
+    loop->shard = NULL;
+    loop->now_ms = timer_now_ms();
+    loop->ready_head = NULL;
+    loop->ready_tail = NULL;
+    loop->num_ready = 0;
+    timer_entry_init(&loop->accept_timer, NULL);
+    loop->accept_paused = FALSE;
+
+    if ( (loop->timers = timer_wheel_create(loop->now_ms)) == NULL ) {
+        set_errno_errmsg("Error creating timer wheel");
+        return ERROR_RETURN;
+    }
+
+    if ( (loop->epoll_fd = epoll_create1(0)) == -1 ) {
+        set_errno_errmsg("Error creating epoll instance");
+        timer_wheel_destroy(loop->timers);
+        return ERROR_RETURN;
+    }
+
+    if ( watch_listener(loop) == -1 ) {
+        set_errno_errmsg("Error adding listening socket to epoll");
+        close(loop->epoll_fd);
+        timer_wheel_destroy(loop->timers);
+        return ERROR_RETURN;
+    }
+
+    return 0;
+}
+
+
+/*!
+ * \brief           Starts an event-loop server.
+ * \details         Connections are served by `num_threads` event-loop
+ * threads, one of which is the calling thread. Each connection is
+ * served by the thread which accepted it, and readable data is passed
+ * to the handler's `on_data` callback.
+ * \param listening_socket A file descriptor for a listening socket.
+ * \param num_threads The number of event-loop threads to run.
+ * \param handler   The connection callbacks.
+ * \returns         Returns non-zero on encountering an error. The
+ * server runs in an infinite loop, and this function will not return
+ * unless an error is encountered.
+ */
+
+int start_epoll_tcp_server(const int listening_socket, const int num_threads,
+                           const EpollHandler * handler) {
+    EpollLoop * loops;
+    int index;
+
+    if ( num_threads < 1 ) {
+        set_errmsg("Invalid number of event-loop threads");
+        return ERROR_RETURN;
+    }
+
+    if ( set_socket_nonblocking(listening_socket) == -1 ) {
+        set_errno_errmsg("Error setting listening socket non-blocking");
+        return ERROR_RETURN;
+    }
+
+    if ( (loops = malloc(num_threads * sizeof(*loops))) == NULL ) {
+        set_errno_errmsg("Error allocating event loops");
+        return ERROR_RETURN;
+    }
+
+    for ( index = 0; index < num_threads; ++index ) {
+        if ( init_epoll_loop(&loops[index], listening_socket,
+                             handler) == -1 ) {
+            return ERROR_RETURN;
+        }
+
+        if ( index > 0 && pthread_create(&loops[index].thread_id, NULL,
+                                epoll_loop_thread, &loops[index]) != 0 ) {
+            set_errmsg("Error creating thread");
+            return ERROR_RETURN;
+        }
+    }
+
+    return run_epoll_loop(&loops[0]);
+}
+
+
+/*!
+ * \brief           Starts an event-loop server on a set of shards.
+ * \details         Each shard is served by its own event-loop thread,
+ * one of which is the calling thread, which accepts connections on the
+ * shard's listening socket only. When a shard is assigned to a CPU, its
+ * thread is pinned to that CPU.
+ * \param shards    The shards, created with create_tcp_server_shards().
+ * \param num_shards The number of shards.
+ * \param handler   The connection callbacks.
+ * \returns         Returns non-zero on encountering an error. The
+ * server runs in an infinite loop, and this function will not return
+ * unless an error is encountered.
+ */
+
+int start_sharded_epoll_tcp_server(TcpShard * shards, const int num_shards,
+                                   const EpollHandler * handler) {
+    EpollLoop * loops;
+    int index;
+
+    if ( (loops = malloc(num_shards * sizeof(*loops))) == NULL ) {
+        set_errno_errmsg("Error allocating event loops");
+        return ERROR_RETURN;
+    }
+
+    for ( index = 0; index < num_shards; ++index ) {
+        if ( set_socket_nonblocking(shards[index].l_socket) == -1 ) {
+            set_errno_errmsg("Error setting listening socket non-blocking");
+            return ERROR_RETURN;
+        }
+
+        if ( init_epoll_loop(&loops[index], shards[index].l_socket,
+                             handler) == -1 ) {
+            return ERROR_RETURN;
+        }
+        loops[index].shard = &shards[index];
+
+        if ( index > 0 && pthread_create(&loops[index].thread_id, NULL,
+                                epoll_loop_thread, &loops[index]) != 0 ) {
+            set_errmsg("Error creating thread");
+            return ERROR_RETURN;
+        }
+    }
+
+    pin_thread_to_cpu(shards[0].cpu);
+    return run_epoll_loop(&loops[0]);
+}
@@ -0,0 +1,108 @@
+/*!
+ * \file            socket_helpers_epoll.h
+ * \brief           Interface to epoll event-loop server functions.
+ * \details         Interface to epoll event-loop server functions.
+ * \author          Paul Griffiths
+ * \copyright       Copyright 2013 Paul Griffiths. Distributed under the terms
+ * of the GNU General Public License. <http://www.gnu.org/licenses/>
+ */
+
+
+#ifndef PG_SOCKET_HELPERS_EPOLL_H
+#define PG_SOCKET_HELPERS_EPOLL_H
+
+#include <stddef.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+#include "socket_helpers_server.h"
+#include "socket_helpers_queue.h"
+
+
+/*!
+ * \brief           Struct of callbacks for an event-loop server.
+ * \details         All callbacks for a connection are made from the same
+ * event-loop thread, so need no locking for per-connection data. A
+ * callback should not block for long, as it holds up every other
+ * connection served by that thread. Output written to a connection
+ * through the SocketOutput passed to `on_open` never blocks, but is
+ * queued when the peer is not keeping up, subject to `output`.
+ */
+
+typedef struct EpollHandler {
+
+    /*!
+     * \brief       Called when a connection is accepted. May be NULL.
+     * \details     Should return zero to serve the connection, or
+     * non-zero to close it immediately. Any pointer stored through
+     * `conn_data` is passed to the other callbacks. `output` is valid
+     * until `on_close` is called, and is how the callbacks write to the
+     * connection.
+     */
+
+    int (*on_open)(const int c_socket, const SocketOutput * output,
+                   void ** conn_data);
+
+    /*!
+     * \brief       Called with each chunk of data read from a connection.
+     * \details     Should return zero to keep the connection open, or
+     * non-zero to close it. Called once more with `len` zero at
+     * end-of-file, before the connection is closed, so that input left
+     * unterminated may be handled and answered.
+     */
+
+    int (*on_data)(const int c_socket, void * conn_data,
+                   const char * data, const size_t len);
+
+    /*!
+     * \brief       Called before a connection is closed. May be NULL.
+     */
+
+    void (*on_close)(const int c_socket, void * conn_data);
+
+    /*!
+     * \brief       Called when a connection has been idle for
+     * `idle_timeout_ms`, before it is closed. May be NULL.
+     */
+
+    void (*on_timeout)(const int c_socket, void * conn_data);
+
+    /*!
+     * \brief       Milliseconds without input after which a connection
+     * is closed, or 0 for no idle timeout.
+     */
+
+    long idle_timeout_ms;
+
+    /*!
+     * \brief       Limits on each connection's queued output.
+     */
+
+    SocketQueuePolicy output;
+
+    /*!
+     * \brief       Bytes read from a connection in one turn before the
+     * thread's other connections are served, or 0 for
+     * `SERVER_ROUND_BYTES`.
+     */
+
+    size_t round_bytes;
+} EpollHandler;
+
+
+/*  Function prototypes  */
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+int start_epoll_tcp_server(const int listening_socket, const int num_threads,
+                           const EpollHandler * handler);
+int start_sharded_epoll_tcp_server(TcpShard * shards, const int num_shards,
+                                   const EpollHandler * handler);
+int set_socket_nonblocking(const int socket);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif          /*  PG_SOCKET_HELPERS_EPOLL_H  */
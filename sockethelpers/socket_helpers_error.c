@@ -0,0 +1,188 @@
+/*!
+ * \file            socket_helpers_error.c
+ * \brief           Implementation of connection error functions.
+ * \details         Errors on a connection are recorded per thread, as
+ * their kind and a fixed-size text, so recording one takes no lock and
+ * allocates no memory, and an error on one connection is never seen by
+ * the threads serving the others. The servers count the errors they
+ * close connections for by kind, with the server metrics, so counting
+ * one takes no lock either.
+ * \author          Paul Griffiths
+ * \copyright       Copyright 2013 Paul Griffiths. Distributed under the terms
+ * of the GNU General Public License. <http://www.gnu.org/licenses/>
+ */
+
+
+#include <string.h>
+#include <errno.h>
+#include "socket_helpers_error.h"
+#include "socket_helpers_metrics.h"
+
+
+/*!
+ * \brief           Struct for a thread's last error.
+ */
+
+typedef struct SocketError {
+    int kind;                           /*!< The error kind */
+    char text[SOCKET_ERROR_TEXT_LEN];   /*!< Message and system error */
+} SocketError;
+
+
+/*!
+ * \brief           The last error recorded by this thread.
+ */
+
+static __thread SocketError last_error = {SOCKET_ERROR_NONE, ""};
+
+
+/*!
+ * \brief           File scope variable for the error kind names.
+ */
+
+static const char * const error_names[SOCKET_ERROR_KINDS] = {
+    "none",
+    "timeout",
+    "reset",
+    "protocol",
+    "overflow",
+    "resource",
+    "system"
+};
+
+
+/*!
+ * \brief           Gets the kind of a system error.
+ * \param errnum    The `errno` value.
+ * \returns         The error kind.
+ */
+
+int socket_error_kind(const int errnum) {
+    switch ( errnum ) {
+        case 0:
+            return SOCKET_ERROR_NONE;
+
+        case ETIMEDOUT:
+            return SOCKET_ERROR_TIMEOUT;
+
+        case ECONNRESET:
+        case ECONNABORTED:
+        case EPIPE:
+        case ENOTCONN:
+        case EHOSTUNREACH:
+        case ENETUNREACH:
+            return SOCKET_ERROR_RESET;
+
+        case EPROTO:
+        case EMSGSIZE:
+        case EILSEQ:
+            return SOCKET_ERROR_PROTOCOL;
+
+        case ENOBUFS:
+            return SOCKET_ERROR_OVERFLOW;
+
+        case ENOMEM:
+        case EMFILE:
+        case ENFILE:
+            return SOCKET_ERROR_RESOURCE;
+
+        default:
+            return SOCKET_ERROR_SYSTEM;
+    }
+}
+
+
+/*!
+ * \brief           Records an error for the calling thread.
+ * \details         The error's kind and text are taken from `errno`,
+ * which is left unchanged. Takes no lock and allocates no memory.
+ * \param msg       A message describing what failed, which is
+ * truncated if it does not fit the text with the system error.
+ * \returns         The error kind.
+ */
+
+int socket_set_error(const char * msg) {
+    const int errnum = errno;
+    size_t len = strlen(msg);
+
+    if ( len > SOCKET_ERROR_TEXT_LEN / 2 ) {
+        len = SOCKET_ERROR_TEXT_LEN / 2;
+    }
+
+    memcpy(last_error.text, msg, len);
+    memcpy(last_error.text + len, ": ", 3);
+    len += 2;
+
+    if ( strerror_r(errnum, last_error.text + len,
+                    SOCKET_ERROR_TEXT_LEN - len) != 0 ) {
+        last_error.text[len] = '\0';
+    }
+
+    last_error.kind = socket_error_kind(errnum);
+    errno = errnum;
+    return last_error.kind;
+}
+
+
+/*!
+ * \brief           Gets the kind of the calling thread's last error.
+ * \returns         The error kind, or `SOCKET_ERROR_NONE` if the thread
+ * has recorded no error.
+ */
+
+int socket_last_error(void) {
+    return last_error.kind;
+}
+
+
+/*!
+ * \brief           Gets the text of the calling thread's last error.
+ * \returns         The text, which belongs to the thread and is valid
+ * until it records another error, or an empty string if it has
+ * recorded none.
+ */
+
+const char * socket_error_text(void) {
+    return last_error.text;
+}
+
+
+/*!
+ * \brief           Gets the name of an error kind.
+ * \param kind      The error kind.
+ * \returns         A short lower-case name, such as `"reset"`.
+ */
+
+const char * socket_error_name(const int kind) {
+    if ( kind < 0 || kind >= SOCKET_ERROR_KINDS ) {
+        return error_names[SOCKET_ERROR_SYSTEM];
+    }
+    return error_names[kind];
+}
+
+
+/*!
+ * \brief           Counts a connection closed for an error.
+ * \param kind      The error kind.
+ */
+
+void socket_count_error(const int kind) {
+    if ( kind > SOCKET_ERROR_NONE && kind < SOCKET_ERROR_KINDS ) {
+        socket_metrics_add(SOCKET_METRIC_ERRORS + kind, 1);
+    }
+}
+
+
+/*!
+ * \brief           Gets the counts of connections closed for errors.
+ * \param counts    An array of `SOCKET_ERROR_KINDS` elements to receive
+ * the counts, indexed by error kind.
+ */
+
+void socket_get_error_counts(unsigned long * counts) {
+    unsigned long metrics[SOCKET_METRICS];
+
+    socket_metrics_read(metrics);
+    memcpy(counts, metrics + SOCKET_METRIC_ERRORS,
+           SOCKET_ERROR_KINDS * sizeof(*counts));
+}
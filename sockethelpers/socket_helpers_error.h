@@ -0,0 +1,99 @@
+/*!
+ * \file            socket_helpers_error.h
+ * \brief           Interface to connection error functions.
+ * \details         Interface to connection error functions.
+ * \author          Paul Griffiths
+ * \copyright       Copyright 2013 Paul Griffiths. Distributed under the terms
+ * of the GNU General Public License. <http://www.gnu.org/licenses/>
+ */
+
+
+#ifndef PG_SOCKET_HELPERS_ERROR_H
+#define PG_SOCKET_HELPERS_ERROR_H
+
+
+/*!
+ * \brief           Error kind for no error.
+ */
+
+#define SOCKET_ERROR_NONE 0
+
+
+/*!
+ * \brief           Error kind for a deadline or idle timeout passing.
+ */
+
+#define SOCKET_ERROR_TIMEOUT 1
+
+
+/*!
+ * \brief           Error kind for a connection reset or closed by the
+ * peer while in use.
+ */
+
+#define SOCKET_ERROR_RESET 2
+
+
+/*!
+ * \brief           Error kind for input which breaks the protocol, such
+ * as a malformed message length, or a line or message over the limit.
+ */
+
+#define SOCKET_ERROR_PROTOCOL 3
+
+
+/*!
+ * \brief           Error kind for output over a connection's limit.
+ */
+
+#define SOCKET_ERROR_OVERFLOW 4
+
+
+/*!
+ * \brief           Error kind for running out of memory, file
+ * descriptors or threads.
+ */
+
+#define SOCKET_ERROR_RESOURCE 5
+
+
+/*!
+ * \brief           Error kind for any other system error.
+ */
+
+#define SOCKET_ERROR_SYSTEM 6
+
+
+/*!
+ * \brief           The number of error kinds.
+ */
+
+#define SOCKET_ERROR_KINDS 7
+
+
+/*!
+ * \brief           Size of the buffer for a thread's error text.
+ */
+
+#define SOCKET_ERROR_TEXT_LEN 128
+
+
+/*  Function prototypes  */
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+int socket_error_kind(const int errnum);
+int socket_set_error(const char * msg);
+int socket_last_error(void);
+const char * socket_error_text(void);
+const char * socket_error_name(const int kind);
+void socket_count_error(const int kind);
+void socket_get_error_counts(unsigned long * counts);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif          /*  PG_SOCKET_HELPERS_ERROR_H  */
@@ -0,0 +1,454 @@
+/*!
+ * \file            socket_helpers_framer.c
+ * \brief           Implementation of incremental line framing functions.
+ * \details         The framer never reads from a socket, so suits
+ * non-blocking sockets and event loops: the caller feeds it whatever
+ * each read returned, and it returns each complete line as soon as its
+ * `\r\n` arrives, even when the `\r` and `\n` arrive in separate chunks.
+ * A streaming framer passes on each part of a line as it arrives, and
+ * holds back only a trailing `\r` until the next byte shows whether it
+ * begins the line ending.
+ * \author          Paul Griffiths
+ * \copyright       Copyright 2013 Paul Griffiths. Distributed under the terms
+ * of the GNU General Public License. <http://www.gnu.org/licenses/>
+ */
+
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <paulgrif/chelpers.h>
+#include "socket_helpers_framer.h"
+#include "socket_helpers_scan.h"
+
+
+/*!
+ * \brief           Initial size of a framer's partial line buffer.
+ */
+
+#define FRAMER_MIN_CAPACITY 128
+
+
+/*!
+ * \brief           File scope variable for a held back `\r`.
+ */
+
+static const char held_cr[] = "\r";
+
+
+/*!
+ * \brief           Initializes a line framer.
+ * \param framer    The framer.
+ * \param max_len   The longest line to accept, excluding the `\r\n`.
+ */
+
+void line_framer_init(LineFramer * framer, const size_t max_len) {
+    framer->buffer = NULL;
+    framer->capacity = 0;
+    framer->max_len = max_len;
+    framer->streaming = FALSE;
+    line_framer_reset(framer);
+}
+
+
+/*!
+ * \brief           Initializes a streaming line framer.
+ * \details         A streaming framer returns the parts of a line as
+ * they arrive, rather than keeping a partial line until it is complete,
+ * so lines of any length up to `max_len` use no memory.
+ * \param framer    The framer.
+ * \param max_len   The longest line to accept, excluding the `\r\n`.
+ */
+
+void line_framer_init_stream(LineFramer * framer, const size_t max_len) {
+    line_framer_init(framer, max_len);
+    framer->streaming = TRUE;
+}
+
+
+/*!
+ * \brief           Frees the resources held by a line framer.
+ * \param framer    The framer.
+ */
+
+void line_framer_free(LineFramer * framer) {
+    free(framer->buffer);
+    framer->buffer = NULL;
+    framer->capacity = 0;
+    line_framer_reset(framer);
+}
+
+
+/*!
+ * \brief           Discards any partial line held by a line framer.
+ * \param framer    The framer.
+ */
+
+void line_framer_reset(LineFramer * framer) {
+    framer->len = 0;
+    framer->streamed = 0;
+    framer->pending_cr = FALSE;
+    framer->discarding = FALSE;
+    framer->discard_cr = FALSE;
+}
+
+
+/*!
+ * \brief           Returns the number of bytes of partial line held.
+ * \param framer    The framer.
+ * \returns         The number of bytes held.
+ */
+
+size_t line_framer_pending(const LineFramer * framer) {
+    return framer->len;
+}
+
+
+/*!
+ * \brief           Appends bytes to a framer's partial line.
+ * \param framer    The framer.
+ * \param data      The bytes to append.
+ * \param len       The number of bytes to append, which must not take
+ * the partial line past `max_len + 1` bytes.
+ * \returns         0 on success, or -1 with `errno` set on encountering
+ * an error.
+ */
+
+static int append_partial(LineFramer * framer, const char * data,
+                          const size_t len) {
+    size_t capacity = framer->capacity;
+    char * buffer;
+
+    if ( framer->len + len > capacity ) {
+        if ( capacity == 0 ) {
+            capacity = FRAMER_MIN_CAPACITY;
+        }
+        while ( capacity < framer->len + len ) {
+            capacity *= 2;
+        }
+
+        /*  A partial line may hold a trailing `\r` beyond the limit,
+            as it may yet turn out to be the start of the `\r\n`.    */
+
+        if ( capacity - 1 > framer->max_len ) {
+            capacity = framer->max_len + 1;
+        }
+
+        if ( (buffer = realloc(framer->buffer, capacity)) == NULL ) {
+            return ERROR_RETURN;
+        }
+        framer->buffer = buffer;
+        framer->capacity = capacity;
+    }
+
+    memcpy(framer->buffer + framer->len, data, len);
+    framer->len += len;
+    return 0;
+}
+
+
+/*!
+ * \brief           Rejects an overlong line.
+ * \details         Drops any partial line, and skips the rest of the
+ * line, in this chunk and, if its end is not in this chunk, in later
+ * ones.
+ * \param framer    The framer.
+ * \param data      The chunk.
+ * \param len       The length of the chunk.
+ * \param cr        Pointer to the `\r\n` ending the line, or NULL if the
+ * line does not end in this chunk.
+ * \param consumed  Pointer to receive the number of bytes consumed.
+ * \returns         -1, with `errno` set to `EMSGSIZE`.
+ */
+
+static int reject_line(LineFramer * framer, const char * data,
+                       const size_t len, const char * cr,
+                       size_t * consumed) {
+    framer->len = 0;
+    framer->streamed = 0;
+    framer->pending_cr = FALSE;
+
+    if ( cr != NULL ) {
+        *consumed = (size_t) (cr - data) + 2;
+    } else {
+        *consumed = len;
+        framer->discarding = TRUE;
+        framer->discard_cr = data[len - 1] == '\r';
+    }
+
+    errno = EMSGSIZE;
+    return ERROR_RETURN;
+}
+
+
+/*!
+ * \brief           Frames the next piece of a line from a chunk.
+ * \details         Behaves the same as line_framer_next(), for a
+ * streaming framer.
+ * \param framer    The framer.
+ * \param data      The chunk, which is not empty.
+ * \param len       The length of the chunk.
+ * \param consumed  Pointer to receive the number of bytes consumed.
+ * \param line      Pointer to receive a pointer to the piece.
+ * \param line_len  Pointer to receive the length of the piece.
+ * \returns         `LINE_FRAMER_LINE`, `LINE_FRAMER_PARTIAL`,
+ * `LINE_FRAMER_NONE`, or -1 with `errno` set to `EMSGSIZE`.
+ */
+
+static int stream_next(LineFramer * framer, const char * data,
+                       const size_t len, size_t * consumed,
+                       const char ** line, size_t * line_len) {
+    const char * cr;
+    size_t count;
+
+    if ( framer->pending_cr ) {
+        framer->pending_cr = FALSE;
+
+        if ( data[0] == '\n' ) {
+            *consumed = 1;
+            *line = data;
+            *line_len = 0;
+            framer->streamed = 0;
+            return LINE_FRAMER_LINE;
+        }
+
+        /*  The held back `\r` was part of the line  */
+
+        if ( framer->streamed + 1 > framer->max_len ) {
+            return reject_line(framer, data, len,
+                               socket_find_crlf(data, len), consumed);
+        }
+
+        ++framer->streamed;
+        *line = held_cr;
+        *line_len = 1;
+        return LINE_FRAMER_PARTIAL;
+    }
+
+    if ( (cr = socket_find_crlf(data, len)) != NULL ) {
+        count = (size_t) (cr - data);
+        if ( framer->streamed + count > framer->max_len ) {
+            return reject_line(framer, data, len, cr, consumed);
+        }
+
+        *consumed = count + 2;
+        *line = data;
+        *line_len = count;
+        framer->streamed = 0;
+        return LINE_FRAMER_LINE;
+    }
+
+    count = len;
+    if ( data[len - 1] == '\r' ) {
+        --count;
+    }
+
+    if ( framer->streamed + count > framer->max_len ) {
+        return reject_line(framer, data, len, NULL, consumed);
+    }
+
+    *consumed = len;
+    framer->pending_cr = count < len;
+    framer->streamed += count;
+    *line = data;
+    *line_len = count;
+    return count > 0 ? LINE_FRAMER_PARTIAL : LINE_FRAMER_NONE;
+}
+
+
+/*!
+ * \brief           Frames the next line from a chunk.
+ * \details         Consumes bytes from the start of the chunk up to and
+ * including the end of the first complete line, or the whole chunk if
+ * it completes no line, in which case any partial line is kept for the
+ * next call. A streaming framer instead returns the partial line as
+ * part of a line, and keeps nothing. Call repeatedly, advancing past
+ * the consumed bytes, until the chunk is used up.
+ * \param framer    The framer.
+ * \param data      The chunk.
+ * \param len       The length of the chunk.
+ * \param consumed  Pointer to receive the number of bytes consumed.
+ * \param line      Pointer to receive a pointer to the line, which
+ * points into the chunk unless the line began in an earlier chunk, and
+ * is valid only until the next call to a framer function or until the
+ * chunk is released. The line is not NUL-terminated.
+ * \param line_len  Pointer to receive the length of the line, excluding
+ * the `\r\n`.
+ * \returns         `LINE_FRAMER_LINE` if a line, or the final part of a
+ * line, was returned, `LINE_FRAMER_PARTIAL` if any other part of a line
+ * was returned, `LINE_FRAMER_NONE` if nothing was returned, or -1 with
+ * `errno` set on encountering an error. On a line longer than the
+ * framer's limit, `errno` is `EMSGSIZE`, and the framer skips to the
+ * start of the next line, so may continue to be fed.
+ */
+
+int line_framer_next(LineFramer * framer, const char * data,
+                     const size_t len, size_t * consumed,
+                     const char ** line, size_t * line_len) {
+    const char * cr;
+    size_t count;
+
+    *consumed = 0;
+    if ( len == 0 ) {
+        return LINE_FRAMER_NONE;
+    }
+
+    /*  Skip the remainder of an overlong line  */
+
+    if ( framer->discarding ) {
+        if ( framer->discard_cr && data[0] == '\n' ) {
+            *consumed = 1;
+            line_framer_reset(framer);
+        } else if ( (cr = socket_find_crlf(data, len)) != NULL ) {
+            *consumed = (size_t) (cr - data) + 2;
+            line_framer_reset(framer);
+        } else {
+            *consumed = len;
+            framer->discard_cr = data[len - 1] == '\r';
+        }
+        return LINE_FRAMER_NONE;
+    } else if ( framer->streaming ) {
+        return stream_next(framer, data, len, consumed, line, line_len);
+    }
+
+    /*  The `\r` ending the partial line may have been the first half
+        of the line ending, with the `\n` starting this chunk.         */
+
+    if ( framer->len > 0 && framer->buffer[framer->len - 1] == '\r' &&
+         data[0] == '\n' ) {
+        *consumed = 1;
+        *line = framer->buffer;
+        *line_len = framer->len - 1;
+        framer->len = 0;
+        return LINE_FRAMER_LINE;
+    }
+
+    cr = socket_find_crlf(data, len);
+
+    if ( cr != NULL ) {
+        count = (size_t) (cr - data);
+        if ( framer->len + count > framer->max_len ) {
+            return reject_line(framer, data, len, cr, consumed);
+        }
+
+        *consumed = count + 2;
+        *line_len = framer->len + count;
+
+        if ( framer->len == 0 ) {
+
+            /*  The whole line is in this chunk, so is not copied  */
+
+            *line = data;
+            return LINE_FRAMER_LINE;
+        }
+
+        if ( append_partial(framer, data, count) == -1 ) {
+            return ERROR_RETURN;
+        }
+        *line = framer->buffer;
+        framer->len = 0;
+        return LINE_FRAMER_LINE;
+    }
+
+    /*  No line ends in this chunk, so keep it as a partial line. A
+        trailing `\r` does not count towards the limit until it is
+        known not to start the line ending.                          */
+
+    if ( framer->len + len - (data[len - 1] == '\r') > framer->max_len ) {
+        return reject_line(framer, data, len, NULL, consumed);
+    }
+
+    if ( append_partial(framer, data, len) == -1 ) {
+        return ERROR_RETURN;
+    }
+    *consumed = len;
+    return LINE_FRAMER_NONE;
+}
+
+
+/*!
+ * \brief           Frames the line left at end-of-file.
+ * \details         A final line without a `\r\n` is returned as a
+ * complete line, as socket_reader_getline() returns it, and a held back
+ * `\r` is returned as part of it. The framer is left empty, so may be
+ * fed a new stream.
+ * \param framer    The framer.
+ * \param line      Pointer to receive a pointer to the line, or to its
+ * final part for a streaming framer, which is valid only until the next
+ * call to a framer function. The line is not NUL-terminated.
+ * \param line_len  Pointer to receive the length of the line.
+ * \returns         `LINE_FRAMER_LINE` if a line was returned,
+ * `LINE_FRAMER_NONE` if no line was left, or -1 with `errno` set to
+ * `EMSGSIZE` if the line is longer than the framer's limit.
+ */
+
+int line_framer_finish(LineFramer * framer, const char ** line,
+                       size_t * line_len) {
+    int status = LINE_FRAMER_NONE;
+
+    if ( framer->discarding ) {
+
+        /*  The rest of an overlong line, already rejected  */
+
+    } else if ( framer->streaming ) {
+        if ( framer->pending_cr && framer->streamed + 1 > framer->max_len ) {
+            errno = EMSGSIZE;
+            status = ERROR_RETURN;
+        } else if ( framer->pending_cr || framer->streamed > 0 ) {
+            *line = held_cr;
+            *line_len = framer->pending_cr ? 1 : 0;
+            status = LINE_FRAMER_LINE;
+        }
+    } else if ( framer->len > framer->max_len ) {
+        errno = EMSGSIZE;
+        status = ERROR_RETURN;
+    } else if ( framer->len > 0 ) {
+        *line = framer->buffer;
+        *line_len = framer->len;
+        status = LINE_FRAMER_LINE;
+    }
+
+    line_framer_reset(framer);
+    return status;
+}
+
+
+/*!
+ * \brief           Frames all the lines in a chunk.
+ * \details         Calls line_framer_next() until the chunk is used up,
+ * passing each complete line, or each part of a line from a streaming
+ * framer, to a callback.
+ * \param framer    The framer.
+ * \param data      The chunk.
+ * \param len       The length of the chunk.
+ * \param on_line   Function to call with each line. The line is valid
+ * only until the callback returns.
+ * \param arg       Argument to pass to `on_line`.
+ * \returns         The number of bytes consumed, which is less than
+ * `len` only if the callback asked to stop, or -1 with `errno` set on
+ * encountering an error, including `EMSGSIZE` for a line longer than
+ * the framer's limit.
+ */
+
+ssize_t line_framer_feed(LineFramer * framer, const char * data,
+                         const size_t len, LineCallback on_line, void * arg) {
+    size_t offset = 0, consumed, line_len;
+    const char * line;
+    int status;
+
+    while ( offset < len ) {
+        status = line_framer_next(framer, data + offset, len - offset,
+                                  &consumed, &line, &line_len);
+        offset += consumed;
+
+        if ( status == -1 ) {
+            return ERROR_RETURN;
+        } else if ( status != LINE_FRAMER_NONE &&
+                    on_line(arg, line, line_len,
+                            status == LINE_FRAMER_LINE) != 0 ) {
+            break;
+        }
+    }
+
+    return (ssize_t) offset;
+}
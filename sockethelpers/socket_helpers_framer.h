@@ -0,0 +1,99 @@
+/*!
+ * \file            socket_helpers_framer.h
+ * \brief           Interface to incremental line framing functions.
+ * \details         Interface to incremental line framing functions.
+ * \author          Paul Griffiths
+ * \copyright       Copyright 2013 Paul Griffiths. Distributed under the terms
+ * of the GNU General Public License. <http://www.gnu.org/licenses/>
+ */
+
+
+#ifndef PG_SOCKET_HELPERS_FRAMER_H
+#define PG_SOCKET_HELPERS_FRAMER_H
+
+#include <stddef.h>
+#include <sys/types.h>
+
+
+/*!
+ * \brief           Struct for an incremental line framer.
+ * \details         A framer splits a stream of arbitrary chunks into
+ * `\r\n` terminated lines, and can be embedded in a per-connection
+ * structure. Only a line split across chunks is copied, into a buffer
+ * which is allocated when first needed and grows as far as the line
+ * length limit. A streaming framer instead returns each line in pieces
+ * as its bytes arrive, so never copies, and holds no buffer however
+ * long the line. The fields are private to the framer functions.
+ */
+
+typedef struct LineFramer {
+    char * buffer;              /*!< Partial line carried between chunks */
+    size_t len;                 /*!< Number of bytes in `buffer` */
+    size_t capacity;            /*!< Size of `buffer` */
+    size_t max_len;             /*!< Longest line, excluding the `\r\n` */
+    size_t streamed;            /*!< Bytes of the line already returned */
+    int streaming;              /*!< True if lines are returned in pieces */
+    int pending_cr;             /*!< True if a `\r` is being held back */
+    int discarding;             /*!< True while skipping an overlong line */
+    int discard_cr;             /*!< True if the last byte skipped was `\r` */
+} LineFramer;
+
+
+/*!
+ * \brief           Return value of line_framer_next() if no line was framed.
+ */
+
+#define LINE_FRAMER_NONE 0
+
+
+/*!
+ * \brief           Return value of line_framer_next() for a complete line.
+ * \details         For a streaming framer, the final piece of the line.
+ */
+
+#define LINE_FRAMER_LINE 1
+
+
+/*!
+ * \brief           Return value of line_framer_next() for part of a line.
+ * \details         Only a streaming framer returns part of a line.
+ */
+
+#define LINE_FRAMER_PARTIAL 2
+
+
+/*!
+ * \brief           Line callback type for line_framer_feed().
+ * \details         `complete` is false for a piece of a line from a
+ * streaming framer, other than the final piece. Should return zero to
+ * continue, or non-zero to stop framing the current chunk.
+ */
+
+typedef int (*LineCallback)(void * arg, const char * line, const size_t len,
+                            const int complete);
+
+
+/*  Function prototypes  */
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+void line_framer_init(LineFramer * framer, const size_t max_len);
+void line_framer_init_stream(LineFramer * framer, const size_t max_len);
+void line_framer_free(LineFramer * framer);
+void line_framer_reset(LineFramer * framer);
+size_t line_framer_pending(const LineFramer * framer);
+int line_framer_next(LineFramer * framer, const char * data,
+                     const size_t len, size_t * consumed,
+                     const char ** line, size_t * line_len);
+int line_framer_finish(LineFramer * framer, const char ** line,
+                       size_t * line_len);
+ssize_t line_framer_feed(LineFramer * framer, const char * data,
+                         const size_t len, LineCallback on_line, void * arg);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif          /*  PG_SOCKET_HELPERS_FRAMER_H  */
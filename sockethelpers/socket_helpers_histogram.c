@@ -0,0 +1,175 @@
+/*!
+ * \file            socket_helpers_histogram.c
+ * \brief           Implementation of latency histogram functions.
+ * \details         Values are bucketed by their leading bit and the
+ * `SOCKET_HISTOGRAM_SUB_BITS` bits below it, as in an HDR histogram, so
+ * recording one is a few shifts and an add, and the relative error is
+ * the same from nanoseconds to seconds. Histograms of counts only ever
+ * grow, so the values recorded over an interval are the difference of
+ * the histograms taken at its ends.
+ * \author          Paul Griffiths
+ * \copyright       Copyright 2013 Paul Griffiths. Distributed under the terms
+ * of the GNU General Public License. <http://www.gnu.org/licenses/>
+ */
+
+
+#include <string.h>
+#include <time.h>
+#include "socket_helpers_histogram.h"
+
+
+/*!
+ * \brief           Number of sub-buckets for each power of two.
+ */
+
+#define HISTOGRAM_SUB_COUNT ((uint64_t) 1 << SOCKET_HISTOGRAM_SUB_BITS)
+
+
+/*!
+ * \brief           Gets the time from the monotonic clock.
+ * \returns         The time, in nanoseconds.
+ */
+
+uint64_t socket_clock_ns(void) {
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t) now.tv_sec * 1000000000U + (uint64_t) now.tv_nsec;
+}
+
+
+/*!
+ * \brief           Gets the bucket for a value.
+ * \param value     The value.
+ * \returns         The index of the bucket.
+ */
+
+int socket_histogram_bucket(const uint64_t value) {
+    uint64_t high = value;
+    int bits = 0, shift;
+
+    if ( value < HISTOGRAM_SUB_COUNT ) {
+        return (int) value;
+    } else if ( value >> SOCKET_HISTOGRAM_MAX_BITS ) {
+        return SOCKET_HISTOGRAM_BUCKETS - 1;
+    }
+
+    /*  Find the leading bit  */
+
+    if ( high >> 32 ) {
+        high >>= 32;
+        bits += 32;
+    }
+    if ( high >> 16 ) {
+        high >>= 16;
+        bits += 16;
+    }
+    if ( high >> 8 ) {
+        high >>= 8;
+        bits += 8;
+    }
+    if ( high >> 4 ) {
+        high >>= 4;
+        bits += 4;
+    }
+    if ( high >> 2 ) {
+        high >>= 2;
+        bits += 2;
+    }
+    if ( high >> 1 ) {
+        bits += 1;
+    }
+
+    shift = bits - SOCKET_HISTOGRAM_SUB_BITS;
+    return ((shift + 1) << SOCKET_HISTOGRAM_SUB_BITS) +
+           (int) ((value >> shift) - HISTOGRAM_SUB_COUNT);
+}
+
+
+/*!
+ * \brief           Gets the highest value recorded in a bucket.
+ * \param bucket    The index of the bucket.
+ * \returns         The value.
+ */
+
+uint64_t socket_histogram_value(const int bucket) {
+    const int shift = (bucket >> SOCKET_HISTOGRAM_SUB_BITS) - 1;
+    uint64_t sub;
+
+    if ( shift < 0 ) {
+        return (uint64_t) bucket;
+    }
+
+    sub = (uint64_t) bucket & (HISTOGRAM_SUB_COUNT - 1);
+    return ((sub + HISTOGRAM_SUB_COUNT + 1) << shift) - 1;
+}
+
+
+/*!
+ * \brief           Clears a histogram.
+ * \param histogram The histogram.
+ */
+
+void socket_histogram_clear(SocketHistogram * histogram) {
+    memset(histogram, 0, sizeof(*histogram));
+}
+
+
+/*!
+ * \brief           Gets the percentiles of the values in a histogram.
+ * \param histogram The histogram.
+ * \param since     An earlier copy of the histogram, whose values are
+ * left out, to get the percentiles of the values recorded since it was
+ * taken, or NULL for all the values.
+ * \param latency   Pointer to a struct to receive the percentiles, which
+ * are all 0 if there are no values.
+ */
+
+void socket_histogram_latency(const SocketHistogram * histogram,
+                              const SocketHistogram * since,
+                              SocketLatency * latency) {
+    unsigned long counts[SOCKET_HISTOGRAM_BUCKETS];
+    unsigned long total = 0, before, seen = 0;
+    unsigned long p50_rank, p99_rank, p999_rank;
+    int bucket;
+
+    for ( bucket = 0; bucket < SOCKET_HISTOGRAM_BUCKETS; ++bucket ) {
+        counts[bucket] = histogram->counts[bucket];
+        if ( since != NULL ) {
+            counts[bucket] -= since->counts[bucket];
+        }
+        total += counts[bucket];
+    }
+
+    memset(latency, 0, sizeof(*latency));
+    latency->count = total;
+    if ( total == 0 ) {
+        return;
+    }
+
+    /*  The rank of each percentile is rounded up, so that at least
+        that fraction of the values are at or below it.              */
+
+    p50_rank = (total * 500 + 999) / 1000;
+    p99_rank = (total * 990 + 999) / 1000;
+    p999_rank = (total * 999 + 999) / 1000;
+
+    for ( bucket = 0; bucket < SOCKET_HISTOGRAM_BUCKETS; ++bucket ) {
+        if ( counts[bucket] == 0 ) {
+            continue;
+        }
+
+        before = seen;
+        seen += counts[bucket];
+        if ( before < p50_rank && seen >= p50_rank ) {
+            latency->p50 = socket_histogram_value(bucket);
+        }
+        if ( before < p99_rank && seen >= p99_rank ) {
+            latency->p99 = socket_histogram_value(bucket);
+        }
+        if ( before < p999_rank && seen >= p999_rank ) {
+            latency->p999 = socket_histogram_value(bucket);
+        }
+        latency->max = socket_histogram_value(bucket);
+    }
+}
@@ -0,0 +1,90 @@
+/*!
+ * \file            socket_helpers_histogram.h
+ * \brief           Interface to latency histogram functions.
+ * \details         Interface to latency histogram functions.
+ * \author          Paul Griffiths
+ * \copyright       Copyright 2013 Paul Griffiths. Distributed under the terms
+ * of the GNU General Public License. <http://www.gnu.org/licenses/>
+ */
+
+
+#ifndef PG_SOCKET_HELPERS_HISTOGRAM_H
+#define PG_SOCKET_HELPERS_HISTOGRAM_H
+
+#include <inttypes.h>
+
+
+/*!
+ * \brief           Number of bits of a value kept below its leading bit.
+ * \details         Each power of two is split into 2 to the power of this
+ * many buckets, so a value is recorded to within about 3%.
+ */
+
+#define SOCKET_HISTOGRAM_SUB_BITS 5
+
+
+/*!
+ * \brief           Number of bits of the largest value recorded exactly.
+ * \details         Larger values, from about 68 seconds in nanoseconds,
+ * are recorded in the last bucket.
+ */
+
+#define SOCKET_HISTOGRAM_MAX_BITS 36
+
+
+/*!
+ * \brief           Number of buckets in a histogram.
+ */
+
+#define SOCKET_HISTOGRAM_BUCKETS ((SOCKET_HISTOGRAM_MAX_BITS - \
+                                   SOCKET_HISTOGRAM_SUB_BITS + 1) << \
+                                  SOCKET_HISTOGRAM_SUB_BITS)
+
+
+/*!
+ * \brief           Struct for a histogram of values.
+ * \details         Buckets are linear below `2^SOCKET_HISTOGRAM_SUB_BITS`,
+ * and logarithmic with linear sub-buckets above, as for HDR histograms.
+ * The sum is exact, so the mean is not subject to the buckets' error.
+ */
+
+typedef struct SocketHistogram {
+    unsigned long counts[SOCKET_HISTOGRAM_BUCKETS];     /*!< The counts */
+    uint64_t sum;                   /*!< Sum of the values recorded */
+} SocketHistogram;
+
+
+/*!
+ * \brief           Struct for the percentiles of a histogram.
+ * \details         Each percentile is the highest value recorded in the
+ * same bucket as it, so is never under-reported.
+ */
+
+typedef struct SocketLatency {
+    unsigned long count;        /*!< Number of values */
+    uint64_t p50;               /*!< Median */
+    uint64_t p99;               /*!< 99th percentile */
+    uint64_t p999;              /*!< 99.9th percentile */
+    uint64_t max;               /*!< Largest value */
+} SocketLatency;
+
+
+/*  Function prototypes  */
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+uint64_t socket_clock_ns(void);
+int socket_histogram_bucket(const uint64_t value);
+uint64_t socket_histogram_value(const int bucket);
+void socket_histogram_clear(SocketHistogram * histogram);
+void socket_histogram_latency(const SocketHistogram * histogram,
+                              const SocketHistogram * since,
+                              SocketLatency * latency);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif          /*  PG_SOCKET_HELPERS_HISTOGRAM_H  */
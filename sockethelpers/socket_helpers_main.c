@@ -8,6 +8,7 @@
 
 
 #include <stdlib.h>
+#include <limits.h>
 #include <string.h>
 #include <stdio.h>
 #include <errno.h>
@@ -15,12 +16,13 @@
 #include <unistd.h>
 #include <signal.h>
 #include <netdb.h>
+#include <poll.h>
 #include <arpa/inet.h>
 #include <netinet/in.h>
 #include <sys/types.h>
 #include <sys/socket.h>
 #include <sys/time.h>
-#include <sys/select.h>
+#include <sys/uio.h>
 #include <paulgrif/chelpers.h>
 #include "socket_helpers.h"
 
@@ -32,12 +34,50 @@
 #define MAX_BUFFER_SIZE 1024
 
 
+/*!
+ * \brief           Maximum number of buffers to pass to one `writev()` call.
+ */
+
+#ifndef IOV_MAX
+# define IOV_MAX 1024
+#endif
+
+
+/*!
+ * \brief           File scope variable for the network-standard line ending.
+ */
+
+static const char crlf[] = "\r\n";
+
+
+/*!
+ * \brief           Records an error from a socket function.
+ * \details         Records it with socket_set_error(), for the calling
+ * thread, and with set_errno_errmsg(), where callers of these functions
+ * have always found it. `errno` is left unchanged.
+ * \param msg       The error message.
+ */
+
+static void record_error(const char * msg) {
+    const int errnum = errno;
+
+    socket_set_error(msg);
+    set_errno_errmsg(msg);
+    errno = errnum;
+}
+
+
 /*!
  * \brief           Reads an `\r\n` terminated line from a socket.
  * \details         The function will not overwrite the buffer, so
  * `max_len` should be the size of the whole buffer, and function will
  * at most write `max_len - 1` characters plus the terminating `\0`.
- * Any terminating CR or LF characters will be stripped.
+ * Any terminating CR or LF characters will be stripped. Input is read
+ * through the socket's registry reader, so bytes received after the
+ * end of the line are kept for the next call. Closing the socket with
+ * socket_close() also frees the reader, but a socket closed with plain
+ * `close()` is safe, as a later socket with the same descriptor is
+ * detected and given an empty reader.
  * \param socket File description of the socket
  * \param buffer The buffer into which to read
  * \param max_len The maximum number of characters to read, including
@@ -47,143 +87,147 @@
  */
 
 ssize_t socket_readline(const int socket, char * buffer, const size_t max_len) {
-    size_t index;
-    ssize_t num_read;
-
-    /*  Fill buffer with 0, to avoid having to add terminating NUL  */
-
-    memset(buffer, 0, max_len);
-
-    for ( index = 0; index < (max_len - 1); ++index ) {
-
-        /*  Attempt to read one character  */
-
-        num_read = read(socket, &buffer[index], 1);
-
-        if ( num_read == 1 ) {
-
-            /*  Successfully read a character  */
-
-            if ( index > 0 &&
-                 buffer[index] == '\n' &&
-                 buffer[index - 1] == '\r' ) {
-
-                /*  End of line, so break  */
-
-                break;
-            }
-        } else if ( num_read == 0 ) {
-
-            /*  No characters read, but we haven't reached end
-                of line so break                                */
-
-            break;
-        } else if ( errno == EINTR ) {
-
-            /*  read() got interrupted by a signal, so try again  */
-
-            continue;
-        } else {
-
-            /*  Some other error, so set error message and return  */
-
-            set_errno_errmsg("error reading from socket");
-            return ERROR_RETURN;
-        }
-    }
-
-    trim_line_ending(buffer);
-    return (ssize_t) index;
+    return socket_readline_deadline(socket, buffer, max_len, NULL);
 }
 
 
 /*!
  * \brief           Reads an `\r\n` terminated line from a socket with timeout.
  * \details         Behaves the same as socket_readline(), except it
- * will time out if no input is available on the socket after the
- * specified time. Any terminating CR or LF characters will be stripped.
+ * will time out if the whole line has not arrived within the specified
+ * period. Any terminating CR or LF characters will be stripped.
  * \param socket File description of the socket
  * \param buffer The buffer into which to read
  * \param max_len The maximum number of characters to read, including
  * the terminating `\0`.
  * \param time_out A pointer to a `timeval` struct containing the timeout
- * period. Note that some implementations of `select()` may alter this
- * variable, so the calling function should consider it unusable after
- * return. In addition, on such an implementation, the value will
- * specify the cumulative timeout period over the entire read line
- * operation, rather than resetting after reading each character.
- * \returns         The number of characters read, or -1 on encountering
- * an error.
+ * period, or NULL to wait indefinitely. The period runs from the call,
+ * and covers the whole line rather than each wait for input.
+ * \returns         The number of characters read, 0 on timing out, or
+ * -1 on encountering an error.
  */
 
 ssize_t socket_readline_timeout(const int socket, char * buffer,
-        const size_t max_len, struct timeval * time_out) {
-    ssize_t num_read;
-    size_t index;
-    int status;
-    fd_set socket_set;
+        const size_t max_len, const struct timeval * time_out) {
+    struct timespec deadline;
 
-    /*  Zero and set fd_set  */
+    if ( time_out == NULL ) {
+        return socket_readline_deadline(socket, buffer, max_len, NULL);
+    } else if ( socket_deadline_after(&deadline, time_out) == -1 ) {
+        record_error("error getting time");
+        return ERROR_RETURN;
+    }
 
-    FD_ZERO(&socket_set);
-    FD_SET(socket, &socket_set);
+    return socket_readline_deadline(socket, buffer, max_len, &deadline);
+}
 
-    /*  Fill buffer with 0, to avoid having to add terminating NUL  */
 
-    memset(buffer, 0, max_len);
+/*!
+ * \brief           Reads an `\r\n` terminated line by a deadline.
+ * \details         Behaves the same as socket_readline(), except it
+ * will time out if the whole line has not arrived by the deadline. The
+ * socket is only waited on, with `poll()`, when no buffered input
+ * remains. Any terminating CR or LF characters will be stripped.
+ * \param socket File description of the socket
+ * \param buffer The buffer into which to read
+ * \param max_len The maximum number of characters to read, including
+ * the terminating `\0`.
+ * \param deadline The absolute deadline, from socket_deadline_after(),
+ * or NULL to wait indefinitely.
+ * \returns         The number of characters read, 0 on timing out, or
+ * -1 on encountering an error.
+ */
 
-    for ( index = 0; index < (max_len - 1); ++index ) {
+ssize_t socket_readline_deadline(const int socket, char * buffer,
+        const size_t max_len, const struct timespec * deadline) {
+    SocketReader * reader;
+    ssize_t num_read;
 
-        /*  Wait for input for timeout period  */
+    if ( (reader = socket_reader_for_socket(socket)) == NULL ) {
+        record_error("error getting socket reader");
+        return ERROR_RETURN;
+    }
 
-        status = select(socket + 1, &socket_set, NULL, NULL, time_out);
-        if ( status == -1 ) {
-            set_errno_errmsg("error calling select()");
-            return ERROR_RETURN;
-        } else if ( status == 0 ) {
+    num_read = socket_reader_readline_until(reader, buffer, max_len, deadline);
+    if ( num_read == ERROR_RETURN ) {
+        record_error("error reading from socket");
+        socket_reader_release(socket);
+    } else if ( socket_reader_eof(reader) &&
+                socket_reader_pending(reader) == 0 ) {
 
-            /*  No data ready after timeout period  */
+        /*  Peer has closed and everything has been read,
+            so the reader is no longer needed              */
 
-            break;
-        }
+        socket_reader_release(socket);
+    }
 
-        /*  Try to read a single character  */
+    return num_read;
+}
 
-        num_read = read(socket, &buffer[index], 1);
-        if ( num_read == 1 ) {
 
-            /*  Successfully read a character  */
+/*!
+ * \brief           Reads all the available `\r\n` terminated lines.
+ * \details         Returns the complete lines already buffered for the
+ * socket, or, if there are none, receives until at least one line is
+ * complete and returns all the lines that receive completed. The lines
+ * are not copied, but point into the socket's reader buffer, and are
+ * valid only until the next read from the socket. A line longer than
+ * the buffer is returned in parts, as it arrives, with `complete` set
+ * only for the final part. The socket is only waited on, with `poll()`,
+ * when no complete line is buffered.
+ * \param socket File description of the socket
+ * \param lines Array to receive the lines.
+ * \param max_lines The number of elements in `lines`.
+ * \param deadline The absolute deadline, from socket_deadline_after(),
+ * or NULL to wait indefinitely.
+ * \returns         The number of lines read, 0 on end-of-file, or -1 on
+ * encountering an error, with `errno` set to `ETIMEDOUT` if the
+ * deadline passed before a line was complete, or to `EMSGSIZE` if a
+ * line is longer than the limit set with socket_reader_set_max_line().
+ */
 
-            if ( index > 0 &&
-                 buffer[index] == '\n' &&
-                 buffer[index - 1] == '\r' ) {
+ssize_t socket_readlines(const int socket, SocketLine * lines,
+        const size_t max_lines, const struct timespec * deadline) {
+    SocketReader * reader;
+    ssize_t num_lines, num_read;
 
-                /*  End of line, so add break  */
+    if ( max_lines == 0 ) {
+        errno = EINVAL;
+        record_error("error reading from socket");
+        return ERROR_RETURN;
+    } else if ( (reader = socket_reader_for_socket(socket)) == NULL ) {
+        record_error("error getting socket reader");
+        return ERROR_RETURN;
+    }
 
-                break;
+    while ( (num_lines = socket_reader_getlines(reader, lines,
+                                                max_lines)) == 0 ) {
+        num_read = socket_reader_fill_until(reader, deadline);
+        if ( num_read == ERROR_RETURN ) {
+            record_error("error reading from socket");
+            if ( errno != EAGAIN && errno != EWOULDBLOCK ) {
+                socket_reader_release(socket);
             }
-        } else if ( num_read == 0 ) {
-
-            /*  No characters read, but we haven't reached end
-                of line so break                                */
-
-            break;
-        } else if ( errno == EINTR ) {
-
-            /*  read() got interrupted by a signal, so try again  */
+            return ERROR_RETURN;
+        } else if ( num_read == 0 && !socket_reader_eof(reader) ) {
+            errno = ETIMEDOUT;
+            record_error("error reading from socket");
+            return ERROR_RETURN;
+        } else if ( num_read == 0 && socket_reader_pending(reader) == 0 ) {
 
-            continue;
-        } else {
-            
-            /*  Some other error, so set error message and return  */
+            /*  Peer has closed and everything has been read,
+                so the reader is no longer needed              */
 
-            set_errno_errmsg("error reading from socket");
-            return ERROR_RETURN;
+            socket_reader_release(socket);
+            return 0;
         }
     }
 
-    trim_line_ending(buffer);
-    return (ssize_t) index;
+    if ( num_lines == ERROR_RETURN ) {
+        record_error("error reading from socket");
+    }
+
+    return num_lines;
 }
 
 
@@ -191,7 +235,7 @@ ssize_t socket_readline_timeout(const int socket, char * buffer,
  * \brief           Writes a line to a socket.
  * \details         The function adds a network-standard terminating
  * CRLF, so the provided string should not normally end in any newline
- * characters.
+ * characters. Equivalent to socket_writelinev().
  * \param socket File description of the socket
  * \param buffer The buffer from which to write.
  * \param max_len The maximum number of characters to write to the buffer.
@@ -203,42 +247,117 @@ ssize_t socket_readline_timeout(const int socket, char * buffer,
 
 ssize_t socket_writeline(const int socket, const char * buffer,
         const size_t max_len) {
-    size_t num_left = max_len + 2;
-    ssize_t num_written, total_written = 0;
-    const char * buf_ptr;
+    return socket_writelinev(socket, buffer, max_len);
+}
 
-    /*  Allocate new buffer with enough room to add \r\n  */
 
-    char * eol_buf = malloc(strlen(buffer) + 3);
-    if ( eol_buf == NULL ) {
-        set_errno_errmsg("couldn't allocate memory");
-        return ERROR_RETURN;
+/*!
+ * \brief           Writes a line to a socket without copying it.
+ * \details         The line and a network-standard terminating CRLF
+ * are written from their own buffers with `writev()`, so no memory
+ * is allocated and the line is not copied. The provided string should
+ * not normally end in any newline characters.
+ * \param socket File description of the socket
+ * \param buffer The buffer from which to write. It need not be
+ * NUL-terminated.
+ * \param len The number of characters to write from the buffer.
+ * `len + 2` characters will actually be written.
+ * \returns         The number of characters written, or -1 on encountering
+ * an error.
+ */
+
+ssize_t socket_writelinev(const int socket, const char * buffer,
+        const size_t len) {
+    struct iovec iov[2];
+    ssize_t num_written;
+
+    iov[0].iov_base = (char *) buffer;
+    iov[0].iov_len = len;
+    iov[1].iov_base = (char *) crlf;
+    iov[1].iov_len = 2;
+
+    if ( (num_written = socket_writev_all(socket, iov, 2)) == ERROR_RETURN ) {
+        record_error("error writing to socket");
+    }
+
+    return num_written;
+}
+
+
+/*!
+ * \brief           Waits for a socket to become writable.
+ * \param socket File description of the socket
+ * \returns         0 when the socket is writable, or -1 with `errno` set
+ * on encountering an error.
+ */
+
+static int wait_writable(const int socket) {
+    struct pollfd pfd;
+    int status;
+
+    pfd.fd = socket;
+    pfd.events = POLLOUT;
+
+    while ( (status = poll(&pfd, 1, -1)) == -1 && errno == EINTR ) {
+        continue;
     }
 
-    sprintf(eol_buf, "%s\r\n", buffer);
-    buf_ptr = eol_buf;
+    return status == -1 ? ERROR_RETURN : 0;
+}
+
 
-    /*  Write characters  */
+/*!
+ * \brief           Writes the whole of a set of buffers to a socket.
+ * \details         Calls `writev()` until every byte has been written,
+ * resuming after partial writes and retrying when interrupted by a
+ * signal. On a non-blocking socket, the function waits for the socket
+ * to become writable whenever `writev()` would block, so should not be
+ * called from the event-loop or worker pool servers, which write
+ * through their connections' output queues instead. Errors are recorded
+ * with socket_set_error(), for the calling thread, as well as with
+ * set_errno_errmsg().
+ * \param socket File description of the socket
+ * \param iov The buffers to write. The array is modified to record
+ * progress, so should be considered unusable after return.
+ * \param iovcnt The number of buffers in `iov`.
+ * \returns         The number of characters written, or -1 with `errno`
+ * set on encountering an error.
+ */
+
+ssize_t socket_writev_all(const int socket, struct iovec * iov, int iovcnt) {
+    ssize_t num_written, total_written = 0;
 
-    while ( num_left > 0 ) {
-        num_written = write(socket, buf_ptr, num_left);
+    while ( iovcnt > 0 ) {
+        num_written = writev(socket, iov, iovcnt > IOV_MAX ? IOV_MAX : iovcnt);
 
-        if ( num_written <= 0 ) {
+        if ( num_written == -1 ) {
             if ( errno == EINTR ) {
-                num_written = 0;
-            } else {
-                set_errno_errmsg("error writing to socket");
-                free(eol_buf);
-                return ERROR_RETURN;
+                continue;
+            } else if ( (errno == EAGAIN || errno == EWOULDBLOCK) &&
+                        wait_writable(socket) == 0 ) {
+                continue;
             }
+            record_error("error writing to socket");
+            return ERROR_RETURN;
         }
 
-        num_left -= num_written;
-        buf_ptr += num_written;
         total_written += num_written;
+
+        /*  Skip the buffers written in full, and advance
+            into any buffer which was partially written    */
+
+        while ( iovcnt > 0 && (size_t) num_written >= iov->iov_len ) {
+            num_written -= iov->iov_len;
+            ++iov;
+            --iovcnt;
+        }
+
+        if ( iovcnt > 0 ) {
+            iov->iov_base = (char *) iov->iov_base + num_written;
+            iov->iov_len -= num_written;
+        }
     }
 
-    free(eol_buf);
     return total_written;
 }
 
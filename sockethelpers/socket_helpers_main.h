@@ -12,7 +12,10 @@
 
 #include <inttypes.h>
 #include <sys/time.h>
+#include <time.h>
+#include <sys/uio.h>
 #include <unistd.h>
+#include "socket_helpers_reader.h"
 
 
 /*  Function prototypes  */
@@ -24,9 +27,16 @@ extern "C" {
 ssize_t socket_readline(const int l_socket, char * buffer,
         const size_t max_len);
 ssize_t socket_readline_timeout(const int l_socket, char * buffer,
-        const size_t max_len, struct timeval * time_out);
+        const size_t max_len, const struct timeval * time_out);
+ssize_t socket_readline_deadline(const int l_socket, char * buffer,
+        const size_t max_len, const struct timespec * deadline);
+ssize_t socket_readlines(const int l_socket, SocketLine * lines,
+        const size_t max_lines, const struct timespec * deadline);
 ssize_t socket_writeline(const int l_socket, const char * buffer,
         const size_t max_len);
+ssize_t socket_writelinev(const int l_socket, const char * buffer,
+        const size_t len);
+ssize_t socket_writev_all(const int l_socket, struct iovec * iov, int iovcnt);
 uint16_t port_from_string(const char * port_str);
 int conn_socket_from_string(const char * host, const char * port);
 void ignore_sigpipe(void);
@@ -0,0 +1,337 @@
+/*!
+ * \file            socket_helpers_message.c
+ * \brief           Implementation of length-prefixed message functions.
+ * \details         Each message is sent as a length prefix followed by
+ * the payload, so payloads may hold any bytes and are never scanned.
+ * Messages are read with `recv()` calls of exactly the size still
+ * needed, straight into the caller's buffer, so no bytes beyond the
+ * message are consumed; a varint prefix is peeked at first to find its
+ * length. Input which has already arrived is read without polling.
+ * Messages are written with a single gathered write of the prefix and
+ * payload. Message and line functions should not be
+ * mixed on the same socket, as the line functions read ahead.
+ * \author          Paul Griffiths
+ * \copyright       Copyright 2013 Paul Griffiths. Distributed under the terms
+ * of the GNU General Public License. <http://www.gnu.org/licenses/>
+ */
+
+
+#include <errno.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <paulgrif/chelpers.h>
+#include "socket_helpers_message.h"
+#include "socket_helpers_main.h"
+#include "socket_helpers_reader.h"
+
+
+/*!
+ * \brief           Encodes a message length prefix.
+ * \param header    Buffer of at least `SOCKET_MSG_MAX_HEADER` bytes to
+ * receive the prefix.
+ * \param len       The length of the message, which must not exceed
+ * `SOCKET_MSG_MAX_LEN`.
+ * \param format    `SOCKET_MSG_VARINT` or `SOCKET_MSG_FIXED32`.
+ * \returns         The length of the prefix.
+ */
+
+size_t socket_msg_header(unsigned char * header, const size_t len,
+                         const int format) {
+    size_t value = len;
+    size_t index = 0;
+
+    if ( format == SOCKET_MSG_FIXED32 ) {
+        header[0] = (unsigned char) ((value >> 24) & 0xFF);
+        header[1] = (unsigned char) ((value >> 16) & 0xFF);
+        header[2] = (unsigned char) ((value >> 8) & 0xFF);
+        header[3] = (unsigned char) (value & 0xFF);
+        return 4;
+    }
+
+    while ( value >= 0x80 ) {
+        header[index++] = (unsigned char) ((value & 0x7F) | 0x80);
+        value >>= 7;
+    }
+    header[index++] = (unsigned char) value;
+
+    return index;
+}
+
+
+/*!
+ * \brief           Makes a single `recv()` call, waiting only if need be.
+ * \details         With a deadline, input which has already arrived is
+ * read without waiting, and the socket is polled only if there is none.
+ * \param socket    File descriptor of the socket.
+ * \param buffer    The buffer into which to read.
+ * \param len       The size of the buffer.
+ * \param flags     Flags for `recv()`.
+ * \param deadline  The absolute deadline, from socket_deadline_after(),
+ * or NULL to wait indefinitely.
+ * \returns         The number of bytes read, 0 on end-of-file, or -1
+ * with `errno` set on encountering an error, including `ETIMEDOUT` if
+ * the deadline passed first.
+ */
+
+static ssize_t recv_until(const int socket, void * buffer, const size_t len,
+                          const int flags, const struct timespec * deadline) {
+    ssize_t num_read;
+    int status;
+
+    while ( 1 ) {
+        do {
+            num_read = recv(socket, buffer, len, deadline == NULL ?
+                            flags : flags | MSG_DONTWAIT);
+        } while ( num_read == -1 && errno == EINTR );
+
+        if ( num_read != -1 || deadline == NULL ||
+             (errno != EAGAIN && errno != EWOULDBLOCK) ) {
+            return num_read;
+        }
+
+        if ( (status = socket_wait_readable_until(socket, deadline)) < 1 ) {
+            if ( status == 0 ) {
+                errno = ETIMEDOUT;
+            }
+            return ERROR_RETURN;
+        }
+    }
+}
+
+
+/*!
+ * \brief           Receives an exact number of bytes from a socket.
+ * \details         Reads only the bytes asked for, so leaves any later
+ * input in the socket for the next call.
+ * \param socket    File descriptor of the socket.
+ * \param buffer    The buffer into which to read.
+ * \param len       The number of bytes to read.
+ * \param deadline  The absolute deadline, from socket_deadline_after(),
+ * or NULL to wait indefinitely.
+ * \returns         The number of bytes read, which is less than `len`
+ * only on end-of-file, or -1 with `errno` set on encountering an error,
+ * including `ETIMEDOUT` if the deadline passed first.
+ */
+
+ssize_t socket_recv_exact(const int socket, void * buffer, const size_t len,
+                          const struct timespec * deadline) {
+    size_t index = 0;
+    ssize_t num_read;
+
+    while ( index < len ) {
+        if ( (num_read = recv_until(socket, (char *) buffer + index,
+                                    len - index,
+                                    deadline == NULL ? MSG_WAITALL : 0,
+                                    deadline)) == -1 ) {
+            return ERROR_RETURN;
+        } else if ( num_read == 0 ) {
+            break;
+        }
+
+        index += (size_t) num_read;
+    }
+
+    return (ssize_t) index;
+}
+
+
+/*!
+ * \brief           Reads a message length prefix from a socket.
+ * \details         The payload is left unread, so may be read with
+ * socket_recv_exact() in whatever pieces suit the caller.
+ * \param socket    File descriptor of the socket.
+ * \param format    `SOCKET_MSG_VARINT` or `SOCKET_MSG_FIXED32`.
+ * \param len       Pointer to receive the length of the message.
+ * \param deadline  The absolute deadline, from socket_deadline_after(),
+ * or NULL to wait indefinitely.
+ * \returns         1 if a prefix was read, 0 on end-of-file before the
+ * prefix, or -1 with `errno` set on encountering an error, including
+ * `EPROTO` for a truncated or malformed prefix and `ETIMEDOUT` if the
+ * deadline passed first.
+ */
+
+int socket_readmsg_header(const int socket, const int format, size_t * len,
+                          const struct timespec * deadline) {
+    unsigned char header[SOCKET_MSG_MAX_HEADER];
+    size_t index = 0;
+    size_t value = 0;
+    size_t end;
+    ssize_t num_read;
+
+    if ( format == SOCKET_MSG_FIXED32 ) {
+        if ( (num_read = socket_recv_exact(socket, header, 4,
+                                           deadline)) == ERROR_RETURN ) {
+            return ERROR_RETURN;
+        } else if ( num_read == 0 ) {
+            return 0;
+        } else if ( num_read < 4 ) {
+            errno = EPROTO;
+            return ERROR_RETURN;
+        }
+
+        *len = ((size_t) header[0] << 24) | ((size_t) header[1] << 16) |
+               ((size_t) header[2] << 8) | (size_t) header[3];
+        return 1;
+    }
+
+    /*  A varint's length is not known until its last byte is seen,
+        so peek at as much of it as has arrived, and consume only
+        the bytes up to and including its last byte, to avoid
+        reading past it. Usually the whole prefix has arrived, and
+        one peek and one read suffice.                              */
+
+    do {
+        if ( index == SOCKET_MSG_MAX_HEADER ) {
+            errno = EPROTO;
+            return ERROR_RETURN;
+        }
+
+        if ( (num_read = recv_until(socket, header + index,
+                                    SOCKET_MSG_MAX_HEADER - index,
+                                    MSG_PEEK, deadline)) == ERROR_RETURN ) {
+            return ERROR_RETURN;
+        } else if ( num_read == 0 ) {
+            if ( index == 0 ) {
+                return 0;
+            }
+            errno = EPROTO;
+            return ERROR_RETURN;
+        }
+
+        end = index;
+        while ( end < index + (size_t) num_read - 1 &&
+                (header[end] & 0x80) ) {
+            ++end;
+        }
+
+        if ( (num_read = socket_recv_exact(socket, header + index,
+                                           end + 1 - index,
+                                           deadline)) == ERROR_RETURN ) {
+            return ERROR_RETURN;
+        } else if ( (size_t) num_read < end + 1 - index ) {
+            errno = EPROTO;
+            return ERROR_RETURN;
+        }
+
+        while ( index <= end ) {
+            value |= (size_t) (header[index] & 0x7F) << (7 * index);
+            ++index;
+        }
+    } while ( header[index - 1] & 0x80 );
+
+    if ( index == SOCKET_MSG_MAX_HEADER && header[index - 1] > 0x0F ) {
+
+        /*  Length too large for 32 bits  */
+
+        errno = EPROTO;
+        return ERROR_RETURN;
+    }
+
+    *len = value;
+    return 1;
+}
+
+
+/*!
+ * \brief           Reads a length-prefixed message from a socket.
+ * \param socket    File descriptor of the socket.
+ * \param buffer    The buffer into which to read the payload.
+ * \param max_len   The size of the buffer.
+ * \param len       Pointer to receive the length of the message.
+ * \param format    `SOCKET_MSG_VARINT` or `SOCKET_MSG_FIXED32`.
+ * \param deadline  The absolute deadline, from socket_deadline_after(),
+ * or NULL to wait indefinitely.
+ * \returns         1 if a message was read, 0 on end-of-file before the
+ * message, or -1 with `errno` set on encountering an error. If the
+ * message is longer than `max_len`, `errno` is `EMSGSIZE`, `len` holds
+ * its length, and its payload is left unread.
+ */
+
+int socket_readmsg(const int socket, void * buffer, const size_t max_len,
+                   size_t * len, const int format,
+                   const struct timespec * deadline) {
+    ssize_t num_read;
+    int status;
+
+    if ( (status = socket_readmsg_header(socket, format, len,
+                                         deadline)) < 1 ) {
+        return status;
+    } else if ( *len > max_len ) {
+        errno = EMSGSIZE;
+        return ERROR_RETURN;
+    }
+
+    if ( (num_read = socket_recv_exact(socket, buffer, *len,
+                                       deadline)) == ERROR_RETURN ) {
+        return ERROR_RETURN;
+    } else if ( (size_t) num_read < *len ) {
+        errno = EPROTO;
+        return ERROR_RETURN;
+    }
+
+    return 1;
+}
+
+
+/*!
+ * \brief           Writes a length-prefixed message to a socket.
+ * \param socket    File descriptor of the socket.
+ * \param data      The payload, which may hold any bytes.
+ * \param len       The length of the payload.
+ * \param format    `SOCKET_MSG_VARINT` or `SOCKET_MSG_FIXED32`.
+ * \returns         The number of bytes written, including the prefix,
+ * or -1 with `errno` set on encountering an error.
+ */
+
+ssize_t socket_writemsg(const int socket, const void * data,
+                        const size_t len, const int format) {
+    struct iovec iov;
+
+    iov.iov_base = (void *) data;
+    iov.iov_len = len;
+    return socket_writemsgv(socket, &iov, 1, format);
+}
+
+
+/*!
+ * \brief           Writes a length-prefixed message from several buffers.
+ * \details         The prefix and all the buffers are written with a
+ * single gathered write, and the buffers are not copied.
+ * \param socket    File descriptor of the socket.
+ * \param iov       The buffers making up the payload, which is not
+ * modified.
+ * \param iovcnt    The number of buffers, which must not exceed
+ * `SOCKET_MSG_MAX_IOV`.
+ * \param format    `SOCKET_MSG_VARINT` or `SOCKET_MSG_FIXED32`.
+ * \returns         The number of bytes written, including the prefix,
+ * or -1 with `errno` set on encountering an error.
+ */
+
+ssize_t socket_writemsgv(const int socket, const struct iovec * iov,
+                         const int iovcnt, const int format) {
+    unsigned char header[SOCKET_MSG_MAX_HEADER];
+    struct iovec msg_iov[SOCKET_MSG_MAX_IOV + 1];
+    size_t len = 0;
+    int index;
+
+    if ( iovcnt < 0 || iovcnt > SOCKET_MSG_MAX_IOV ) {
+        errno = EINVAL;
+        return ERROR_RETURN;
+    }
+
+    for ( index = 0; index < iovcnt; ++index ) {
+        msg_iov[index + 1] = iov[index];
+        len += iov[index].iov_len;
+    }
+
+    if ( len > SOCKET_MSG_MAX_LEN ) {
+        errno = EMSGSIZE;
+        return ERROR_RETURN;
+    }
+
+    msg_iov[0].iov_base = header;
+    msg_iov[0].iov_len = socket_msg_header(header, len, format);
+
+    return socket_writev_all(socket, msg_iov, iovcnt + 1);
+}
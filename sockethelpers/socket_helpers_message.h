@@ -0,0 +1,83 @@
+/*!
+ * \file            socket_helpers_message.h
+ * \brief           Interface to length-prefixed message functions.
+ * \details         Interface to length-prefixed message functions.
+ * \author          Paul Griffiths
+ * \copyright       Copyright 2013 Paul Griffiths. Distributed under the terms
+ * of the GNU General Public License. <http://www.gnu.org/licenses/>
+ */
+
+
+#ifndef PG_SOCKET_HELPERS_MESSAGE_H
+#define PG_SOCKET_HELPERS_MESSAGE_H
+
+#include <stddef.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+#include <time.h>
+
+
+/*!
+ * \brief           Message format with a varint length prefix.
+ * \details         The length is sent seven bits at a time, least
+ * significant first, with the top bit of each byte set if another
+ * byte follows, so lengths below 128 take a single byte.
+ */
+
+#define SOCKET_MSG_VARINT 0
+
+
+/*!
+ * \brief           Message format with a fixed 32-bit length prefix.
+ * \details         The length is sent as four bytes in network byte order.
+ */
+
+#define SOCKET_MSG_FIXED32 1
+
+
+/*!
+ * \brief           Maximum length of a message length prefix.
+ */
+
+#define SOCKET_MSG_MAX_HEADER 5
+
+
+/*!
+ * \brief           Maximum length of a message.
+ */
+
+#define SOCKET_MSG_MAX_LEN 0xFFFFFFFFUL
+
+
+/*!
+ * \brief           Maximum number of buffers for socket_writemsgv().
+ */
+
+#define SOCKET_MSG_MAX_IOV 64
+
+
+/*  Function prototypes  */
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+size_t socket_msg_header(unsigned char * header, const size_t len,
+                         const int format);
+ssize_t socket_recv_exact(const int socket, void * buffer, const size_t len,
+                          const struct timespec * deadline);
+int socket_readmsg_header(const int socket, const int format, size_t * len,
+                          const struct timespec * deadline);
+int socket_readmsg(const int socket, void * buffer, const size_t max_len,
+                   size_t * len, const int format,
+                   const struct timespec * deadline);
+ssize_t socket_writemsg(const int socket, const void * data,
+                        const size_t len, const int format);
+ssize_t socket_writemsgv(const int socket, const struct iovec * iov,
+                         const int iovcnt, const int format);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif          /*  PG_SOCKET_HELPERS_MESSAGE_H  */
@@ -0,0 +1,333 @@
+/*!
+ * \file            socket_helpers_metrics.c
+ * \brief           Implementation of server metrics functions.
+ * \details         Each thread counts into its own slot, which fills a
+ * whole number of cache lines, so counting takes no lock, no atomic
+ * read-modify-write, and never contends for a cache line with another
+ * thread. Latencies are recorded the same way, in a histogram per
+ * thread. The slots are summed when the metrics are read. A slot is
+ * never freed: when its thread exits it is kept, with its counts, for
+ * the next thread to start, so short-lived connection threads neither
+ * lose their counts nor leave a slot behind each.
+ * \author          Paul Griffiths
+ * \copyright       Copyright 2013 Paul Griffiths. Distributed under the terms
+ * of the GNU General Public License. <http://www.gnu.org/licenses/>
+ */
+
+
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include "socket_helpers_metrics.h"
+
+
+/*!
+ * \brief           Size of a cache line, to which slots are aligned.
+ */
+
+#define METRICS_CACHE_LINE 64
+
+
+/*!
+ * \brief           Struct for one thread's counters and histograms.
+ * \details         Written only by the thread which owns it, and read by
+ * any thread, with relaxed atomic loads and stores.
+ */
+
+typedef struct MetricsSlot {
+    unsigned long counts[SOCKET_METRICS];   /*!< The counters */
+    struct MetricsSlot * next;              /*!< Next of all slots */
+    struct MetricsSlot * next_free;         /*!< Next slot without a thread */
+    SocketHistogram latencies[SOCKET_LATENCIES];    /*!< The histograms */
+} MetricsSlot;
+
+
+/*!
+ * \brief           The slot of the calling thread, or NULL if it has
+ * none yet.
+ */
+
+static __thread MetricsSlot * thread_slot = NULL;
+
+
+/*!
+ * \brief           File scope variable for the list of all slots.
+ * \details         Slots are only ever pushed, so readers walk the list
+ * without a lock.
+ */
+
+static MetricsSlot * all_slots = NULL;
+
+
+/*!
+ * \brief           File scope variable for the list of slots without a
+ * thread.
+ */
+
+static MetricsSlot * free_slots = NULL;
+
+
+/*!
+ * \brief           File scope mutex guarding the list of free slots.
+ * \details         Taken only when a thread first counts, and when it
+ * exits.
+ */
+
+static pthread_mutex_t slots_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+
+/*!
+ * \brief           Slot shared, with atomic adds, by threads for which
+ * a slot could not be allocated.
+ */
+
+static MetricsSlot shared_slot;
+
+
+/*!
+ * \brief           Key whose destructor frees an exiting thread's slot.
+ */
+
+static pthread_key_t slot_key;
+
+
+/*!
+ * \brief           Once control for creating `slot_key`.
+ */
+
+static pthread_once_t slot_key_once = PTHREAD_ONCE_INIT;
+
+
+/*  Function prototypes  */
+
+static void make_slot_key(void);
+static MetricsSlot * acquire_slot(void);
+static void release_slot(void * arg);
+
+
+/*!
+ * \brief           Adds to a counter.
+ * \details         Counts into the calling thread's slot, which is taken
+ * on the thread's first call.
+ * \param metric    The counter, such as `SOCKET_METRIC_BYTES_IN`.
+ * \param count     The amount to add.
+ */
+
+void socket_metrics_add(const int metric, const unsigned long count) {
+    MetricsSlot * slot = thread_slot;
+    unsigned long * counter;
+
+    if ( slot == NULL && (slot = acquire_slot()) == NULL ) {
+        __atomic_add_fetch(&shared_slot.counts[metric], count,
+                           __ATOMIC_RELAXED);
+        return;
+    }
+
+    counter = &slot->counts[metric];
+    __atomic_store_n(counter, __atomic_load_n(counter, __ATOMIC_RELAXED) +
+                     count, __ATOMIC_RELAXED);
+}
+
+
+/*!
+ * \brief           Records a latency.
+ * \details         Records into the calling thread's histogram, as
+ * socket_metrics_add() counts.
+ * \param latency   The histogram, such as `SOCKET_LATENCY_SERVICE`.
+ * \param value     The latency, in nanoseconds.
+ * \param count     The number of times to record it, such as the number
+ * of lines answered by one write.
+ */
+
+void socket_metrics_record(const int latency, const uint64_t value,
+                           const unsigned long count) {
+    MetricsSlot * slot = thread_slot;
+    const int bucket = socket_histogram_bucket(value);
+    unsigned long * counter;
+
+    uint64_t * sum;
+
+    if ( slot == NULL && (slot = acquire_slot()) == NULL ) {
+        __atomic_add_fetch(&shared_slot.latencies[latency].counts[bucket],
+                           count, __ATOMIC_RELAXED);
+        __atomic_add_fetch(&shared_slot.latencies[latency].sum,
+                           value * count, __ATOMIC_RELAXED);
+        return;
+    }
+
+    counter = &slot->latencies[latency].counts[bucket];
+    __atomic_store_n(counter, __atomic_load_n(counter, __ATOMIC_RELAXED) +
+                     count, __ATOMIC_RELAXED);
+    sum = &slot->latencies[latency].sum;
+    __atomic_store_n(sum, __atomic_load_n(sum, __ATOMIC_RELAXED) +
+                     value * count, __ATOMIC_RELAXED);
+}
+
+
+/*!
+ * \brief           Reads the counters.
+ * \details         Sums the counters of every thread which has counted,
+ * including those which have exited, without taking a lock.
+ * \param counts    An array of `SOCKET_METRICS` elements to receive the
+ * counters, indexed by counter.
+ */
+
+void socket_metrics_read(unsigned long * counts) {
+    const MetricsSlot * slot;
+    int metric;
+
+    for ( metric = 0; metric < SOCKET_METRICS; ++metric ) {
+        counts[metric] = __atomic_load_n(&shared_slot.counts[metric],
+                                         __ATOMIC_RELAXED);
+    }
+
+    for ( slot = __atomic_load_n(&all_slots, __ATOMIC_ACQUIRE);
+          slot != NULL; slot = slot->next ) {
+        for ( metric = 0; metric < SOCKET_METRICS; ++metric ) {
+            counts[metric] += __atomic_load_n(&slot->counts[metric],
+                                              __ATOMIC_RELAXED);
+        }
+    }
+}
+
+
+/*!
+ * \brief           Gets a snapshot of the server metrics.
+ * \details         The gauges are the differences of counters which may
+ * be updated by different threads, so are read as zero should a close
+ * be seen before its open.
+ * \param metrics   Pointer to a struct to receive the metrics.
+ */
+
+void socket_metrics_get(SocketMetrics * metrics) {
+    unsigned long counts[SOCKET_METRICS];
+    int kind;
+
+    socket_metrics_read(counts);
+
+    metrics->active_conns = counts[SOCKET_METRIC_OPENED] >
+                            counts[SOCKET_METRIC_CLOSED] ?
+                            counts[SOCKET_METRIC_OPENED] -
+                            counts[SOCKET_METRIC_CLOSED] : 0;
+    metrics->accepts = counts[SOCKET_METRIC_ACCEPTS];
+    metrics->lines_in = counts[SOCKET_METRIC_LINES_IN];
+    metrics->lines_out = counts[SOCKET_METRIC_LINES_OUT];
+    metrics->bytes_in = counts[SOCKET_METRIC_BYTES_IN];
+    metrics->bytes_out = counts[SOCKET_METRIC_BYTES_OUT];
+    metrics->timeouts = counts[SOCKET_METRIC_ERRORS + SOCKET_ERROR_TIMEOUT];
+    metrics->errors = 0;
+    for ( kind = SOCKET_ERROR_NONE + 1; kind < SOCKET_ERROR_KINDS; ++kind ) {
+        if ( kind != SOCKET_ERROR_TIMEOUT ) {
+            metrics->errors += counts[SOCKET_METRIC_ERRORS + kind];
+        }
+    }
+    metrics->threads = counts[SOCKET_METRIC_THREADS_STARTED] >
+                       counts[SOCKET_METRIC_THREADS_EXITED] ?
+                       counts[SOCKET_METRIC_THREADS_STARTED] -
+                       counts[SOCKET_METRIC_THREADS_EXITED] : 0;
+}
+
+
+/*!
+ * \brief           Reads a latency histogram.
+ * \details         Merges the histograms of every thread which has
+ * recorded, as socket_metrics_read() sums the counters. The percentiles
+ * over an interval are those of the difference of the histograms read
+ * at its ends, from socket_histogram_latency().
+ * \param latency   The histogram, such as `SOCKET_LATENCY_SERVICE`.
+ * \param histogram Pointer to a histogram to receive the merged counts.
+ */
+
+void socket_metrics_read_latency(const int latency,
+                                 SocketHistogram * histogram) {
+    const MetricsSlot * slot;
+    int bucket;
+
+    for ( bucket = 0; bucket < SOCKET_HISTOGRAM_BUCKETS; ++bucket ) {
+        histogram->counts[bucket] = __atomic_load_n(
+                &shared_slot.latencies[latency].counts[bucket],
+                __ATOMIC_RELAXED);
+    }
+    histogram->sum = __atomic_load_n(&shared_slot.latencies[latency].sum,
+                                     __ATOMIC_RELAXED);
+
+    for ( slot = __atomic_load_n(&all_slots, __ATOMIC_ACQUIRE);
+          slot != NULL; slot = slot->next ) {
+        for ( bucket = 0; bucket < SOCKET_HISTOGRAM_BUCKETS; ++bucket ) {
+            histogram->counts[bucket] += __atomic_load_n(
+                    &slot->latencies[latency].counts[bucket],
+                    __ATOMIC_RELAXED);
+        }
+        histogram->sum += __atomic_load_n(&slot->latencies[latency].sum,
+                                          __ATOMIC_RELAXED);
+    }
+}
+
+
+/*!
+ * \brief           Creates the key whose destructor frees thread slots.
+ */
+
+static void make_slot_key(void) {
+    pthread_key_create(&slot_key, release_slot);
+}
+
+
+/*!
+ * \brief           Takes a slot for the calling thread.
+ * \details         Reuses the slot of an exited thread if there is one,
+ * and otherwise allocates one, aligned to a cache line and padded to a
+ * whole number of them.
+ * \returns         The slot, or NULL if one could not be allocated.
+ */
+
+static MetricsSlot * acquire_slot(void) {
+    MetricsSlot * slot;
+    void * memory;
+    const size_t size = (sizeof(*slot) + METRICS_CACHE_LINE - 1) &
+                        ~((size_t) METRICS_CACHE_LINE - 1);
+
+    pthread_once(&slot_key_once, make_slot_key);
+
+    pthread_mutex_lock(&slots_mutex);
+    if ( (slot = free_slots) != NULL ) {
+        free_slots = slot->next_free;
+    }
+    pthread_mutex_unlock(&slots_mutex);
+
+    if ( slot == NULL ) {
+        if ( posix_memalign(&memory, METRICS_CACHE_LINE, size) != 0 ) {
+            return NULL;
+        }
+        slot = memory;
+        memset(slot, 0, size);
+
+        slot->next = __atomic_load_n(&all_slots, __ATOMIC_RELAXED);
+        while ( !__atomic_compare_exchange_n(&all_slots, &slot->next, slot,
+                                             0, __ATOMIC_RELEASE,
+                                             __ATOMIC_RELAXED) ) {
+            ;
+        }
+    }
+
+    pthread_setspecific(slot_key, slot);
+    thread_slot = slot;
+    return slot;
+}
+
+
+/*!
+ * \brief           Frees an exiting thread's slot for another thread.
+ * \param arg       The thread's slot.
+ */
+
+static void release_slot(void * arg) {
+    MetricsSlot * slot = arg;
+
+    thread_slot = NULL;
+
+    pthread_mutex_lock(&slots_mutex);
+    slot->next_free = free_slots;
+    free_slots = slot;
+    pthread_mutex_unlock(&slots_mutex);
+}
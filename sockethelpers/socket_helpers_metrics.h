@@ -0,0 +1,159 @@
+/*!
+ * \file            socket_helpers_metrics.h
+ * \brief           Interface to server metrics functions.
+ * \details         Interface to server metrics functions.
+ * \author          Paul Griffiths
+ * \copyright       Copyright 2013 Paul Griffiths. Distributed under the terms
+ * of the GNU General Public License. <http://www.gnu.org/licenses/>
+ */
+
+
+#ifndef PG_SOCKET_HELPERS_METRICS_H
+#define PG_SOCKET_HELPERS_METRICS_H
+
+#include <inttypes.h>
+#include "socket_helpers_error.h"
+#include "socket_helpers_histogram.h"
+
+
+/*!
+ * \brief           Counter for connections accepted, including those
+ * rejected or closed at once.
+ */
+
+#define SOCKET_METRIC_ACCEPTS 0
+
+
+/*!
+ * \brief           Counter for connections a server began serving.
+ */
+
+#define SOCKET_METRIC_OPENED 1
+
+
+/*!
+ * \brief           Counter for connections a server finished serving.
+ */
+
+#define SOCKET_METRIC_CLOSED 2
+
+
+/*!
+ * \brief           Counter for complete lines, or messages, received.
+ */
+
+#define SOCKET_METRIC_LINES_IN 3
+
+
+/*!
+ * \brief           Counter for complete lines, or messages, written.
+ */
+
+#define SOCKET_METRIC_LINES_OUT 4
+
+
+/*!
+ * \brief           Counter for bytes received.
+ */
+
+#define SOCKET_METRIC_BYTES_IN 5
+
+
+/*!
+ * \brief           Counter for bytes written or queued for writing.
+ */
+
+#define SOCKET_METRIC_BYTES_OUT 6
+
+
+/*!
+ * \brief           Counter for server threads started.
+ */
+
+#define SOCKET_METRIC_THREADS_STARTED 7
+
+
+/*!
+ * \brief           Counter for server threads finished.
+ */
+
+#define SOCKET_METRIC_THREADS_EXITED 8
+
+
+/*!
+ * \brief           First of the counters for connections closed for
+ * errors, one for each error kind, indexed by adding the kind.
+ * \details         Updated by socket_count_error().
+ */
+
+#define SOCKET_METRIC_ERRORS 9
+
+
+/*!
+ * \brief           The number of counters.
+ */
+
+#define SOCKET_METRICS (SOCKET_METRIC_ERRORS + SOCKET_ERROR_KINDS)
+
+
+/*!
+ * \brief           Latency histogram for the time from a line, or
+ * message, being received to its reply being written, in nanoseconds.
+ */
+
+#define SOCKET_LATENCY_SERVICE 0
+
+
+/*!
+ * \brief           Latency histogram for the time from a connection
+ * being accepted to its first input arriving, in nanoseconds.
+ */
+
+#define SOCKET_LATENCY_FIRST_BYTE 1
+
+
+/*!
+ * \brief           The number of latency histograms.
+ */
+
+#define SOCKET_LATENCIES 2
+
+
+/*!
+ * \brief           Struct for a snapshot of the server metrics.
+ * \details         Summed from every thread's counters when read, so
+ * counters updated by different threads are not read at one instant.
+ */
+
+typedef struct SocketMetrics {
+    unsigned long active_conns;     /*!< Connections now being served */
+    unsigned long accepts;          /*!< Connections accepted */
+    unsigned long lines_in;         /*!< Lines, or messages, received */
+    unsigned long lines_out;        /*!< Lines, or messages, written */
+    unsigned long bytes_in;         /*!< Bytes received */
+    unsigned long bytes_out;        /*!< Bytes written or queued */
+    unsigned long timeouts;         /*!< Connections closed for timeouts */
+    unsigned long errors;           /*!< Connections closed for other errors */
+    unsigned long threads;          /*!< Server threads now running */
+} SocketMetrics;
+
+
+/*  Function prototypes  */
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+void socket_metrics_add(const int metric, const unsigned long count);
+void socket_metrics_read(unsigned long * counts);
+void socket_metrics_get(SocketMetrics * metrics);
+void socket_metrics_record(const int latency, const uint64_t value,
+                           const unsigned long count);
+void socket_metrics_read_latency(const int latency,
+                                 SocketHistogram * histogram);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif          /*  PG_SOCKET_HELPERS_METRICS_H  */
@@ -0,0 +1,890 @@
+/*!
+ * \file            socket_helpers_pool.c
+ * \brief           Implementation of worker pool server functions.
+ * \details         The calling thread accepts connections and waits for
+ * them to become readable with epoll. New and readable connections are
+ * queued as tasks on the deques of a fixed pool of worker threads, in
+ * turn. A worker takes tasks from the front of its own deque, and when
+ * that is empty steals from the back of the other workers' deques.
+ * Connections are registered with `EPOLLONESHOT`, so each connection is
+ * queued at most once until its task has run and re-armed it. A new
+ * connection is not registered until its first task has run, as even a
+ * disarmed registration reports errors and hang-ups, which would queue
+ * its task a second time.
+ *
+ * Tasks never wait for a peer to read. They write through their
+ * connection's SocketQueue, which sends what the socket will take and
+ * keeps the rest, and a connection with output queued is armed for
+ * writability instead of readability. Its task is not run again until
+ * the output has been sent, so a peer which stops reading holds no
+ * worker, and makes the server buffer no more than one turn's output.
+ *
+ * If an idle timeout is set with set_pool_idle_timeout(), each
+ * connection's timer is armed along with the connection, and cancelled
+ * when the accepting thread queues its task, so only connections waiting
+ * on their peer can expire. The accepting thread expires them, and
+ * closes them itself, as no worker holds them.
+ *
+ * When `accept()` fails for want of file descriptors or memory, the
+ * listening socket is removed from the epoll instance, and added again
+ * once a worker closes a connection, or after `SERVER_RETRY_MS`
+ * milliseconds.
+ * \author          Paul Griffiths
+ * \copyright       Copyright 2013 Paul Griffiths. Distributed under the terms
+ * of the GNU General Public License. <http://www.gnu.org/licenses/>
+ */
+
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/epoll.h>
+#include <paulgrif/chelpers.h>
+#include "socket_helpers_pool.h"
+#include "socket_helpers_error.h"
+#include "socket_helpers_metrics.h"
+#include "socket_helpers_epoll.h"
+#include "socket_helpers_reader.h"
+#include "socket_helpers_slab.h"
+#include "socket_helpers_timer.h"
+
+
+/*!
+ * \brief           Maximum number of events to handle per `epoll_wait()`.
+ */
+
+#define POOL_MAX_EVENTS 256
+
+
+/*!
+ * \brief           Initial capacity of each worker's deque.
+ */
+
+#define POOL_DEQUE_CAPACITY 64
+
+
+/*!
+ * \brief           Struct for a pooled connection.
+ * \details         The public tag comes first, so that the tag a task
+ * function is given may be converted back to its task.
+ */
+
+typedef struct PoolTask {
+    ServerTag tag;              /*!< Tag passed to the task function */
+    SocketQueue output;         /*!< Output waiting for the peer to read */
+    uint64_t deferred_us;       /*!< When the connection last used up its
+                                     turn, or 0 if it has not */
+    TimerEntry timer;           /*!< Idle timer, armed while the
+                                     connection waits on its peer */
+} PoolTask;
+
+
+/*!
+ * \brief           Struct for a worker's deque of tasks.
+ * \details         A ring buffer of `count` tasks starting at `head`,
+ * which grows when full.
+ */
+
+typedef struct TaskDeque {
+    pthread_mutex_t mutex;      /*!< Mutex for synchronized access */
+    PoolTask ** tasks;         /*!< Ring buffer of tasks */
+    size_t capacity;            /*!< Capacity of the ring buffer */
+    size_t head;                /*!< Index of the front task */
+    size_t count;               /*!< Number of tasks in the deque */
+} TaskDeque;
+
+
+struct WorkerPool;
+
+
+/*!
+ * \brief           Struct for a worker thread.
+ */
+
+typedef struct PoolWorker {
+    struct WorkerPool * pool;   /*!< The pool the worker belongs to */
+    TaskDeque deque;            /*!< The worker's own tasks */
+    size_t index;               /*!< Index of the worker in the pool */
+    pthread_t thread_id;        /*!< Thread running the worker */
+} PoolWorker;
+
+
+/*!
+ * \brief           Struct for a worker pool.
+ * \details         `pending` and `num_idle` are accessed atomically. A
+ * producer increments `pending` before checking `num_idle`, and an idle
+ * worker increments `num_idle` before checking `pending`, so a task is
+ * never left queued while every worker sleeps. `accept_paused` and
+ * `resume_ms` are also accessed atomically. `timers` is shared by the
+ * workers, which arm the idle timers, and the accepting thread, which
+ * cancels and expires them, and is guarded by `timer_mutex`.
+ */
+
+typedef struct WorkerPool {
+    int listening_socket;           /*!< Listening socket */
+    int epoll_fd;                   /*!< Readiness epoll instance */
+    int (*task_func)(ServerTag *);  /*!< Connection task function */
+    PoolWorker * workers;           /*!< The worker threads */
+    size_t num_workers;             /*!< Number of worker threads */
+    size_t next_worker;             /*!< Worker to receive the next task */
+    size_t pending;                 /*!< Number of queued tasks */
+    size_t num_idle;                /*!< Number of sleeping workers */
+    pthread_mutex_t idle_mutex;     /*!< Mutex for sleeping workers */
+    pthread_cond_t idle_cond;       /*!< Condition for sleeping workers */
+    int accept_paused;              /*!< True while not accepting */
+    uint64_t resume_ms;             /*!< When to accept again if paused */
+    long idle_timeout_ms;           /*!< Idle timeout, or 0 for none */
+    void (*on_timeout)(ServerTag *);    /*!< Idle timeout callback */
+    TimerWheel * timers;            /*!< Idle timers, or NULL if none */
+    pthread_mutex_t timer_mutex;    /*!< Mutex for the idle timers */
+} WorkerPool;
+
+
+/*!
+ * rief           File scope variable for the pool idle timeout.
+ */
+
+static long pool_idle_timeout_ms = 0;
+
+
+/*!
+ * rief           File scope variable for the pool idle timeout callback.
+ */
+
+static void (*pool_on_timeout)(ServerTag *) = NULL;
+
+
+/*!
+ * \brief           File scope variable for the task slab.
+ * \details         Created when the first task is allocated.
+ */
+
+static SocketSlab * task_slab = NULL;
+
+
+/*!
+ * \brief           Allocates a task for an accepted connection.
+ * \details         Tasks come from a slab rather than from `malloc()`,
+ * so accepting a connection takes no lock in the common case.
+ * \param c_socket  File descriptor for the connected socket.
+ * \returns         A pointer to the task, or NULL with `errno` set if
+ * memory could not be allocated.
+ */
+
+static PoolTask * create_task(const int c_socket) {
+    PoolTask * task;
+
+    if ( socket_slab_shared(&task_slab, "pool_task",
+                            sizeof(*task)) == NULL ||
+         (task = socket_slab_alloc(task_slab)) == NULL ) {
+        return NULL;
+    }
+
+    task->tag.c_socket = c_socket;
+    task->tag.accepted_ns = socket_clock_ns();
+    socket_queue_init(&task->output);
+    task->deferred_us = 0;
+    timer_entry_init(&task->timer, task);
+    return task;
+}
+
+
+/*!
+ * \brief           Initializes a deque.
+ * \param deque     The deque.
+ * \returns         0 on success, or -1 on encountering an error.
+ */
+
+static int deque_init(TaskDeque * deque) {
+    deque->capacity = POOL_DEQUE_CAPACITY;
+    deque->head = 0;
+    deque->count = 0;
+
+    if ( (deque->tasks = malloc(deque->capacity *
+                                sizeof(*deque->tasks))) == NULL ) {
+        return ERROR_RETURN;
+    }
+
+    if ( pthread_mutex_init(&deque->mutex, NULL) != 0 ) {
+        free(deque->tasks);
+        return ERROR_RETURN;
+    }
+
+    return 0;
+}
+
+
+/*!
+ * \brief           Adds a task to the back of a deque.
+ * \param deque     The deque.
+ * \param task      The task.
+ * \returns         0 on success, or -1 if memory could not be allocated.
+ */
+
+static int deque_push_back(TaskDeque * deque, PoolTask * task) {
+    PoolTask ** tasks;
+    size_t index;
+    int status = 0;
+
+    pthread_mutex_lock(&deque->mutex);
+
+    if ( deque->count == deque->capacity ) {
+
+        /*  Grow the ring buffer, unwrapping it as we go  */
+
+        if ( (tasks = malloc(2 * deque->capacity * sizeof(*tasks))) == NULL ) {
+            status = ERROR_RETURN;
+        } else {
+            for ( index = 0; index < deque->count; ++index ) {
+                tasks[index] = deque->tasks[(deque->head + index) %
+                                            deque->capacity];
+            }
+            free(deque->tasks);
+            deque->tasks = tasks;
+            deque->capacity *= 2;
+            deque->head = 0;
+        }
+    }
+
+    if ( status == 0 ) {
+        deque->tasks[(deque->head + deque->count) % deque->capacity] = task;
+        ++deque->count;
+    }
+
+    pthread_mutex_unlock(&deque->mutex);
+    return status;
+}
+
+
+/*!
+ * \brief           Takes a task from the front or back of a deque.
+ * \param deque     The deque.
+ * \param front     Non-zero to take the oldest task, as the owning worker
+ * does, or zero to take the newest, as a stealing worker does.
+ * \returns         The task, or NULL if the deque is empty.
+ */
+
+static PoolTask * deque_take(TaskDeque * deque, const int front) {
+    PoolTask * task = NULL;
+
+    pthread_mutex_lock(&deque->mutex);
+
+    if ( deque->count > 0 ) {
+        --deque->count;
+        if ( front ) {
+            task = deque->tasks[deque->head];
+            deque->head = (deque->head + 1) % deque->capacity;
+        } else {
+            task = deque->tasks[(deque->head + deque->count) %
+                                deque->capacity];
+        }
+    }
+
+    pthread_mutex_unlock(&deque->mutex);
+    return task;
+}
+
+
+/*!
+ * \brief           Queues a connection task on a worker's deque.
+ * \details         Wakes an idle worker, if there is one.
+ * \param worker    The worker.
+ * \param task      The task.
+ * \returns         0 on success, or -1 if memory could not be allocated.
+ */
+
+static int pool_queue(PoolWorker * worker, PoolTask * task) {
+    WorkerPool * pool = worker->pool;
+
+    if ( deque_push_back(&worker->deque, task) == -1 ) {
+        return ERROR_RETURN;
+    }
+
+    __atomic_add_fetch(&pool->pending, 1, __ATOMIC_SEQ_CST);
+    if ( __atomic_load_n(&pool->num_idle, __ATOMIC_SEQ_CST) > 0 ) {
+        pthread_mutex_lock(&pool->idle_mutex);
+        pthread_cond_signal(&pool->idle_cond);
+        pthread_mutex_unlock(&pool->idle_mutex);
+    }
+
+    return 0;
+}
+
+
+/*!
+ * \brief           Queues a connection task on the next worker's deque.
+ * \param pool      The pool.
+ * \param task      The task.
+ * \returns         0 on success, or -1 if memory could not be allocated.
+ */
+
+static int pool_submit(WorkerPool * pool, PoolTask * task) {
+    PoolWorker * worker = &pool->workers[pool->next_worker];
+
+    pool->next_worker = (pool->next_worker + 1) % pool->num_workers;
+    return pool_queue(worker, task);
+}
+
+
+/*!
+ * \brief           Gets a worker's next task.
+ * \details         Takes the oldest task from the worker's own deque,
+ * or steals the newest task from another worker's deque, sleeping
+ * until a task is queued if none is available.
+ * \param worker    The worker.
+ * \returns         The task.
+ */
+
+static PoolTask * worker_next_task(PoolWorker * worker) {
+    WorkerPool * pool = worker->pool;
+    PoolTask * task;
+    size_t index;
+
+    while ( 1 ) {
+        task = deque_take(&worker->deque, 1);
+
+        for ( index = 1; task == NULL && index < pool->num_workers; ++index ) {
+            task = deque_take(&pool->workers[(worker->index + index) %
+                                             pool->num_workers].deque, 0);
+        }
+
+        if ( task != NULL ) {
+            __atomic_sub_fetch(&pool->pending, 1, __ATOMIC_SEQ_CST);
+            return task;
+        }
+
+        pthread_mutex_lock(&pool->idle_mutex);
+        __atomic_add_fetch(&pool->num_idle, 1, __ATOMIC_SEQ_CST);
+        while ( __atomic_load_n(&pool->pending, __ATOMIC_SEQ_CST) == 0 ) {
+            pthread_cond_wait(&pool->idle_cond, &pool->idle_mutex);
+        }
+        __atomic_sub_fetch(&pool->num_idle, 1, __ATOMIC_SEQ_CST);
+        pthread_mutex_unlock(&pool->idle_mutex);
+    }
+}
+
+
+/*!
+ * \brief           Starts accepting again, if accepting was paused.
+ * \details         Called by the accepting thread once the pause is
+ * over, and by the workers when they close connections. Should the
+ * listening socket not be watched again, the pause is restarted.
+ * \param pool      The pool.
+ */
+
+static void resume_accepting(WorkerPool * pool) {
+    struct epoll_event event;
+
+    if ( !__atomic_exchange_n(&pool->accept_paused, FALSE,
+                              __ATOMIC_ACQ_REL) ) {
+        return;
+    }
+
+    event.events = EPOLLIN;
+    event.data.ptr = NULL;
+    if ( epoll_ctl(pool->epoll_fd, EPOLL_CTL_ADD,
+                   pool->listening_socket, &event) == -1 ) {
+        __atomic_store_n(&pool->resume_ms, timer_now_ms() + SERVER_RETRY_MS,
+                         __ATOMIC_RELAXED);
+        __atomic_store_n(&pool->accept_paused, TRUE, __ATOMIC_RELEASE);
+    }
+}
+
+
+/*!
+ * \brief           Stops accepting for a while.
+ * \details         Called when `accept()` fails for want of resources.
+ * The listening socket is removed from the epoll instance, as it would
+ * otherwise be reported readable on every pass.
+ * \param pool      The pool.
+ */
+
+static void pause_accepting(WorkerPool * pool) {
+    socket_count_error(SOCKET_ERROR_RESOURCE);
+    if ( epoll_ctl(pool->epoll_fd, EPOLL_CTL_DEL,
+                   pool->listening_socket, NULL) == -1 ) {
+        return;
+    }
+
+    __atomic_store_n(&pool->resume_ms, timer_now_ms() + SERVER_RETRY_MS,
+                     __ATOMIC_RELAXED);
+    __atomic_store_n(&pool->accept_paused, TRUE, __ATOMIC_RELEASE);
+}
+
+
+/*!
+ * \brief           Closes a pooled connection.
+ * \details         Starts accepting again if accepting was paused, as a
+ * file descriptor has been freed.
+ * \param pool      The pool.
+ * \param task      The connection's task.
+ */
+
+static void close_task(WorkerPool * pool, PoolTask * task) {
+    socket_reader_release(task->tag.c_socket);
+    close(task->tag.c_socket);
+    socket_queue_clear(&task->output);
+    socket_slab_free(task_slab, task);
+    socket_metrics_add(SOCKET_METRIC_CLOSED, 1);
+
+    if ( __atomic_load_n(&pool->accept_paused, __ATOMIC_ACQUIRE) ) {
+        resume_accepting(pool);
+    }
+}
+
+
+/*!
+ * \brief           Runs a connection's task.
+ * \details         Sends any output queued for the connection first, and
+ * runs the task function only once the output has all been sent.
+ * \param pool      The pool.
+ * \param task      The connection's task.
+ * \returns         The task function's return value, SERVER_TASK_CONTINUE
+ * if output is still queued, or SERVER_TASK_CLOSE if it could not be
+ * sent.
+ */
+
+static int run_task(WorkerPool * pool, PoolTask * task) {
+    if ( task->output.len > 0 ) {
+        if ( socket_queue_send(&task->output, task->tag.c_socket) == -1 ) {
+            socket_count_error(socket_error_kind(errno));
+            return SERVER_TASK_CLOSE;
+        } else if ( task->output.len > 0 ) {
+            return SERVER_TASK_CONTINUE;
+        }
+    }
+
+    return pool->task_func(&task->tag);
+}
+
+
+/*!
+ * \brief           Arms a connection to queue its task when next ready.
+ * \details         Waits for the connection to become readable, or
+ * writable if output is still queued, registering it if this was its
+ * first task. The idle timer is armed before the connection, so that it
+ * is never left armed for a task the accepting thread has already
+ * queued, and with the timer mutex held throughout, so that the
+ * accepting thread cannot expire the connection in between.
+ * \param pool      The pool.
+ * \param task      The connection's task.
+ * \returns         0 on success, or -1 on encountering an error.
+ */
+
+static int arm_task(WorkerPool * pool, PoolTask * task) {
+    struct epoll_event event;
+    int status = 0;
+
+    event.events = task->output.len > 0 ? EPOLLOUT | EPOLLONESHOT :
+                   EPOLLIN | EPOLLRDHUP | EPOLLONESHOT;
+    event.data.ptr = task;
+
+    if ( pool->timers != NULL ) {
+        pthread_mutex_lock(&pool->timer_mutex);
+        timer_wheel_arm(pool->timers, &task->timer,
+                        timer_now_ms() + pool->idle_timeout_ms);
+    }
+
+    if ( epoll_ctl(pool->epoll_fd, EPOLL_CTL_MOD,
+                   task->tag.c_socket, &event) == -1 &&
+         (errno != ENOENT ||
+          epoll_ctl(pool->epoll_fd, EPOLL_CTL_ADD,
+                    task->tag.c_socket, &event) == -1) ) {
+        status = ERROR_RETURN;
+    }
+
+    if ( pool->timers != NULL ) {
+        if ( status != 0 ) {
+            timer_wheel_cancel(pool->timers, &task->timer);
+        }
+        pthread_mutex_unlock(&pool->timer_mutex);
+    }
+
+    return status;
+}
+
+
+/*!
+ * \brief           Thread function for worker threads.
+ * \details         Runs tasks, arming each connection which is left open
+ * so that it is queued again when next readable, or when next writable
+ * if output is still queued, registering it if this was its first task,
+ * or queuing a yielding task with no output queued again straight away
+ * behind this worker's other tasks.
+ * \param arg       Pointer to the thread's PoolWorker struct.
+ * \returns         NULL
+ */
+
+static void * pool_worker_thread(void * arg) {
+    PoolWorker * worker = arg;
+    WorkerPool * pool = worker->pool;
+    PoolTask * task;
+    int status;
+
+    socket_metrics_add(SOCKET_METRIC_THREADS_STARTED, 1);
+
+    while ( 1 ) {
+        task = worker_next_task(worker);
+
+        if ( task->deferred_us != 0 ) {
+            server_round_resumed(task->deferred_us);
+            task->deferred_us = 0;
+        }
+
+        status = run_task(pool, task);
+        if ( status == SERVER_TASK_YIELD && task->output.len == 0 ) {
+            task->deferred_us = server_round_deferred();
+            if ( pool_queue(worker, task) == -1 ) {
+                server_round_resumed(task->deferred_us);
+                close_task(pool, task);
+            }
+            continue;
+        } else if ( status != SERVER_TASK_CONTINUE &&
+                    status != SERVER_TASK_YIELD ) {
+            close_task(pool, task);
+            continue;
+        }
+
+        /*  Wait for the peer to read any output still queued  */
+
+        if ( arm_task(pool, task) == -1 ) {
+            close_task(pool, task);
+        }
+    }
+
+    return NULL;
+}
+
+
+/*!
+ * \brief           Accepts all pending connections and queues them.
+ * \details         Each connection is queued straight away, and is
+ * registered for readiness by the worker which runs its first task.
+ * Pauses accepting if the process runs out of file descriptors or
+ * memory.
+ * \param pool      The pool.
+ * \returns         0 on success, or -1 on encountering an error.
+ */
+
+static int pool_accept(WorkerPool * pool) {
+    PoolTask * task;
+    int conn_socket;
+
+    while ( 1 ) {
+        conn_socket = accept(pool->listening_socket, NULL, NULL);
+        if ( conn_socket == -1 ) {
+            if ( errno == EAGAIN || errno == EWOULDBLOCK ) {
+                break;
+            } else if ( errno == EINTR || errno == ECONNABORTED ||
+                        errno == EPROTO ) {
+                continue;
+            } else if ( server_accept_exhausted(errno) ) {
+                pause_accepting(pool);
+                break;
+            }
+            set_errno_errmsg("Error accepting connection");
+            return ERROR_RETURN;
+        }
+
+        socket_metrics_add(SOCKET_METRIC_ACCEPTS, 1);
+        if ( set_socket_nonblocking(conn_socket) == -1 ||
+             (task = create_task(conn_socket)) == NULL ) {
+            socket_count_error(socket_error_kind(errno));
+            close(conn_socket);
+            continue;
+        }
+        socket_metrics_add(SOCKET_METRIC_OPENED, 1);
+
+        if ( pool_submit(pool, task) == -1 ) {
+            close_task(pool, task);
+        }
+    }
+
+    return 0;
+}
+
+
+/*!
+ * \brief           Closes a connection whose idle timer has expired.
+ * \details         Called by the accepting thread with the timer mutex
+ * held. The connection is armed, so no worker holds its task. Anything
+ * the `on_timeout` callback writes which the socket will not take at once
+ * is discarded.
+ * \param timer     The connection's timer.
+ * \param arg       The pool.
+ */
+
+static void expire_task(TimerEntry * timer, void * arg) {
+    WorkerPool * pool = arg;
+    PoolTask * task = timer->data;
+
+    socket_count_error(SOCKET_ERROR_TIMEOUT);
+    if ( pool->on_timeout != NULL ) {
+        pool->on_timeout(&task->tag);
+    }
+
+    close_task(pool, task);
+}
+
+
+/*!
+ * \brief           Updates the idle timers after waiting for events.
+ * \details         Cancels the timers of the connections about to be
+ * queued, and then expires the rest which are due.
+ * \param pool      The pool.
+ * \param events    The events returned by `epoll_wait()`.
+ * \param num_events The number of events.
+ */
+
+static void update_timers(WorkerPool * pool,
+                          const struct epoll_event * events,
+                          const int num_events) {
+    PoolTask * task;
+    int index;
+
+    pthread_mutex_lock(&pool->timer_mutex);
+
+    for ( index = 0; index < num_events; ++index ) {
+        if ( (task = events[index].data.ptr) != NULL ) {
+            timer_wheel_cancel(pool->timers, &task->timer);
+        }
+    }
+    timer_wheel_advance(pool->timers, timer_now_ms(), expire_task, pool);
+
+    pthread_mutex_unlock(&pool->timer_mutex);
+}
+
+
+/*!
+ * \brief           Gets how long the accepting thread may wait.
+ * \details         While accepting is paused, wakes to resume it in
+ * time, and while an idle timeout is set, wakes to expire the timers. A
+ * timer armed during the wait expires no sooner than the idle timeout
+ * from now, so the wait is never longer than that.
+ * \param pool      The pool.
+ * \returns         The timeout for `epoll_wait()`, in milliseconds, or
+ * -1 to wait indefinitely.
+ */
+
+static long pool_wait_timeout(WorkerPool * pool) {
+    long time_out = -1, next_ms;
+    uint64_t now_ms, resume_ms;
+
+    if ( __atomic_load_n(&pool->accept_paused, __ATOMIC_ACQUIRE) ) {
+        now_ms = timer_now_ms();
+        resume_ms = __atomic_load_n(&pool->resume_ms, __ATOMIC_RELAXED);
+        if ( resume_ms <= now_ms ) {
+            resume_accepting(pool);
+            time_out = 0;
+        } else {
+            time_out = (long) (resume_ms - now_ms);
+        }
+    }
+
+    if ( pool->timers != NULL ) {
+        pthread_mutex_lock(&pool->timer_mutex);
+        next_ms = timer_wheel_next_timeout(pool->timers, timer_now_ms());
+        pthread_mutex_unlock(&pool->timer_mutex);
+
+        if ( next_ms == -1 || next_ms > pool->idle_timeout_ms ) {
+            next_ms = pool->idle_timeout_ms;
+        }
+        if ( time_out == -1 || next_ms < time_out ) {
+            time_out = next_ms;
+        }
+    }
+
+    return time_out;
+}
+
+
+/*!
+ * \brief           Initializes a worker pool and starts its workers.
+ * \param pool      The pool.
+ * \returns         0 on success, or -1 on encountering an error.
+ */
+
+static int pool_init(WorkerPool * pool) {
+    struct epoll_event event;
+    size_t index;
+
+    if ( (pool->epoll_fd = epoll_create1(0)) == -1 ) {
+        set_errno_errmsg("Error creating epoll instance");
+        return ERROR_RETURN;
+    }
+
+    event.events = EPOLLIN;
+    event.data.ptr = NULL;
+    if ( epoll_ctl(pool->epoll_fd, EPOLL_CTL_ADD,
+                   pool->listening_socket, &event) == -1 ) {
+        set_errno_errmsg("Error adding listening socket to epoll");
+        return ERROR_RETURN;
+    }
+
+    if ( pthread_mutex_init(&pool->idle_mutex, NULL) != 0 ||
+         pthread_cond_init(&pool->idle_cond, NULL) != 0 ) {
+        set_errmsg("Error initializing worker pool");
+        return ERROR_RETURN;
+    }
+
+    if ( pool->idle_timeout_ms > 0 ) {
+        if ( pthread_mutex_init(&pool->timer_mutex, NULL) != 0 ) {
+            set_errmsg("Error initializing worker pool");
+            return ERROR_RETURN;
+        } else if ( (pool->timers =
+                         timer_wheel_create(timer_now_ms())) == NULL ) {
+            set_errno_errmsg("Error creating timer wheel");
+            return ERROR_RETURN;
+        }
+    }
+
+    if ( (pool->workers = malloc(pool->num_workers *
+                                 sizeof(*pool->workers))) == NULL ) {
+        set_errno_errmsg("Error allocating worker pool");
+        return ERROR_RETURN;
+    }
+
+    for ( index = 0; index < pool->num_workers; ++index ) {
+        pool->workers[index].pool = pool;
+        pool->workers[index].index = index;
+        if ( deque_init(&pool->workers[index].deque) == -1 ) {
+            set_errmsg("Error initializing worker deque");
+            return ERROR_RETURN;
+        }
+    }
+
+    for ( index = 0; index < pool->num_workers; ++index ) {
+        if ( pthread_create(&pool->workers[index].thread_id, NULL,
+                            pool_worker_thread,
+                            &pool->workers[index]) != 0 ) {
+            set_errmsg("Error creating thread");
+            return ERROR_RETURN;
+        }
+    }
+
+    return 0;
+}
+
+
+/*!
+ * \brief           Starts a worker pool server.
+ * \details         Connections are served by a fixed pool of worker
+ * threads. The task function is called with a connection's `ServerTag`
+ * when the connection is accepted, and again each time it becomes
+ * readable. The connected socket is non-blocking, and the task function
+ * should read what is available and return without waiting for more.
+ * Data left unread causes the task to be queued again straight away.
+ * The task function should write with socket_queue_writev() on the
+ * queue from server_task_output(), which never waits, and the task is not run
+ * again until the output has been sent. Output still queued when the
+ * connection is closed is discarded.
+ * Unlike start_threaded_tcp_server(), the pool owns the `ServerTag`,
+ * and closes the socket and frees the tag itself. Connections waiting on
+ * their peer longer than the idle timeout from set_pool_idle_timeout(),
+ * if any, are closed.
+ * \param listening_socket A file descriptor for a listening socket.
+ * \param num_workers The number of worker threads, or zero for one per
+ * online CPU.
+ * \param task_func A pointer to a task function, which should return
+ * `SERVER_TASK_CONTINUE` to keep the connection open,
+ * `SERVER_TASK_YIELD` to keep it open and run the task again after the
+ * other waiting tasks, or `SERVER_TASK_CLOSE` to close it.
+ * \returns         Returns non-zero on encountering an error. The
+ * server runs in an infinite loop, and this function will not return
+ * unless an error is encountered.
+ */
+
+int start_pooled_tcp_server(const int listening_socket, const int num_workers,
+                            int (*task_func)(ServerTag *)) {
+    struct epoll_event events[POOL_MAX_EVENTS];
+    WorkerPool * pool;
+    long num_cpus;
+    int num_events, index;
+
+    if ( set_socket_nonblocking(listening_socket) == -1 ) {
+        set_errno_errmsg("Error setting listening socket non-blocking");
+        return ERROR_RETURN;
+    }
+
+    if ( (pool = calloc(1, sizeof(*pool))) == NULL ) {
+        set_errno_errmsg("Error allocating worker pool");
+        return ERROR_RETURN;
+    }
+
+    pool->listening_socket = listening_socket;
+    pool->task_func = task_func;
+    pool->idle_timeout_ms = pool_idle_timeout_ms;
+    pool->on_timeout = pool_on_timeout;
+
+    if ( num_workers > 0 ) {
+        pool->num_workers = (size_t) num_workers;
+    } else {
+        num_cpus = sysconf(_SC_NPROCESSORS_ONLN);
+        pool->num_workers = num_cpus > 0 ? (size_t) num_cpus : 1;
+    }
+
+    if ( pool_init(pool) == -1 ) {
+        return ERROR_RETURN;
+    }
+
+    while ( 1 ) {
+        num_events = epoll_wait(pool->epoll_fd, events, POOL_MAX_EVENTS,
+                                (int) pool_wait_timeout(pool));
+        if ( num_events == -1 ) {
+            if ( errno == EINTR ) {
+                continue;
+            }
+            set_errno_errmsg("Error calling epoll_wait()");
+            return ERROR_RETURN;
+        }
+
+        if ( pool->timers != NULL ) {
+            update_timers(pool, events, num_events);
+        }
+
+        for ( index = 0; index < num_events; ++index ) {
+            if ( events[index].data.ptr == NULL ) {
+                if ( pool_accept(pool) == -1 ) {
+                    return ERROR_RETURN;
+                }
+            } else if ( pool_submit(pool, events[index].data.ptr) == -1 ) {
+                close_task(pool, events[index].data.ptr);
+            }
+        }
+    }
+}
+
+
+/*!
+ * \brief           Gets a pooled connection's output queue.
+ * \details         For use by task functions, which should write with
+ * socket_queue_writev() on the queue rather than to the socket.
+ * \param server_tag The tag passed to the task function.
+ * \returns         The connection's output queue.
+ */
+
+SocketQueue * server_task_output(ServerTag * server_tag) {
+    return &((PoolTask *) server_tag)->output;
+}
+
+
+/*!
+ * \brief           Sets the idle timeout for worker pool servers.
+ * \details         Applies to servers started afterwards with
+ * start_pooled_tcp_server(). A connection is closed once it has waited
+ * this long for its peer to send more input or to read its output.
+ * \param idle_timeout_ms The idle timeout in milliseconds, or 0 for none.
+ * \param on_timeout A function to call with a connection's `ServerTag`
+ * before it is closed for being idle, which may write to the queue from
+ * server_task_output(), but should not wait. May be NULL.
+ */
+
+void set_pool_idle_timeout(const long idle_timeout_ms,
+                           void (*on_timeout)(ServerTag *)) {
+    pool_idle_timeout_ms = idle_timeout_ms;
+    pool_on_timeout = on_timeout;
+}
@@ -0,0 +1,59 @@
+/*!
+ * \file            socket_helpers_pool.h
+ * \brief           Interface to worker pool server functions.
+ * \details         Interface to worker pool server functions.
+ * \author          Paul Griffiths
+ * \copyright       Copyright 2013 Paul Griffiths. Distributed under the terms
+ * of the GNU General Public License. <http://www.gnu.org/licenses/>
+ */
+
+
+#ifndef PG_SOCKET_HELPERS_POOL_H
+#define PG_SOCKET_HELPERS_POOL_H
+
+#include "socket_helpers_server.h"
+#include "socket_helpers_queue.h"
+
+
+/*!
+ * \brief           Task function return value to keep a connection open.
+ */
+
+#define SERVER_TASK_CONTINUE 0
+
+
+/*!
+ * \brief           Task function return value to close a connection.
+ */
+
+#define SERVER_TASK_CLOSE 1
+
+
+/*!
+ * \brief           Task function return value to keep a connection open
+ * and queue its task again behind the tasks already waiting.
+ * \details         For a task which has used up its turn with input left
+ * to handle, whether unread or already buffered, so that it runs again
+ * without waiting for the connection to become readable.
+ */
+
+#define SERVER_TASK_YIELD 2
+
+
+/*  Function prototypes  */
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+int start_pooled_tcp_server(const int listening_socket, const int num_workers,
+                            int (*task_func)(ServerTag *));
+SocketQueue * server_task_output(ServerTag * server_tag);
+void set_pool_idle_timeout(const long idle_timeout_ms,
+                           void (*on_timeout)(ServerTag *));
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif          /*  PG_SOCKET_HELPERS_POOL_H  */
@@ -0,0 +1,553 @@
+/*!
+ * \file            socket_helpers_queue.c
+ * \brief           Implementation of output queue functions.
+ * \details         A write to a connection is sent at once with a
+ * non-blocking `writev()` when nothing is already queued for it, and
+ * whatever the socket does not take is copied into the queue, to be
+ * sent by socket_queue_send() when the socket becomes writable. No write
+ * ever waits for a peer to read. Instead, the event loops apply the
+ * connection's SocketQueuePolicy: by default they stop reading from a
+ * connection whose queue passes its high watermark, so that a peer which
+ * does not read its replies can make the server buffer no more than
+ * about one read's worth of replies past the mark, and read from it
+ * again once the queue drains to its low watermark.
+ * \author          Paul Griffiths
+ * \copyright       Copyright 2013 Paul Griffiths. Distributed under the terms
+ * of the GNU General Public License. <http://www.gnu.org/licenses/>
+ */
+
+
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <errno.h>
+#include <unistd.h>
+#include <paulgrif/chelpers.h>
+#include "socket_helpers_queue.h"
+#include "socket_helpers_slab.h"
+
+
+/*!
+ * \brief           Number of bytes of output held by each chunk.
+ */
+
+#define QUEUE_CHUNK_DATA 16384
+
+
+/*!
+ * \brief           Maximum number of buffers to pass to one `writev()` call.
+ */
+
+#ifndef IOV_MAX
+# define IOV_MAX 1024
+#endif
+
+
+/*!
+ * \brief           Maximum number of chunks sent with one `writev()`.
+ */
+
+#define QUEUE_MAX_IOV 64
+
+
+/*!
+ * \brief           Enumeration of the states of a connection's output
+ * between messages.
+ */
+
+enum queue_message {
+    QUEUE_MESSAGE_COMPLETE,     /*!< The last write ended a message */
+    QUEUE_MESSAGE_KEPT,         /*!< A message was begun and kept */
+    QUEUE_MESSAGE_DROPPED       /*!< A message was begun and discarded */
+};
+
+
+/*!
+ * \brief           Struct for a chunk of queued output.
+ */
+
+struct SocketQueueChunk {
+    struct SocketQueueChunk * next;     /*!< Next chunk, or NULL */
+    size_t start;                       /*!< Offset of the first unsent byte */
+    size_t end;                         /*!< Offset past the last byte */
+    char data[QUEUE_CHUNK_DATA];        /*!< Queued output */
+};
+
+
+/*!
+ * \brief           File scope variable for the chunk slab.
+ */
+
+static SocketSlab * chunk_slab = NULL;
+
+
+/*!
+ * \brief           File scope variable for the queue counters.
+ * \details         Accessed atomically.
+ */
+
+static SocketQueueStats queue_stats;
+
+
+/*!
+ * \brief           True while this thread's writes end partway through
+ * a message.
+ */
+
+static __thread int write_partial = 0;
+
+
+/*  Function prototypes  */
+
+static ssize_t write_now(const int socket, const struct iovec * iov,
+                         const int iovcnt);
+static int append(SocketQueue * queue, const struct iovec * iov,
+                  const int iovcnt, size_t skip);
+static size_t high_watermark(const SocketQueuePolicy * policy);
+static size_t low_watermark(const SocketQueuePolicy * policy);
+
+
+/*!
+ * \brief           Initializes an empty output queue.
+ * \param queue     The queue.
+ */
+
+void socket_queue_init(SocketQueue * queue) {
+    queue->head = NULL;
+    queue->tail = NULL;
+    queue->len = 0;
+    queue->message = QUEUE_MESSAGE_COMPLETE;
+}
+
+
+/*!
+ * \brief           Discards the output in a queue.
+ * \details         The chunks are returned to their pool.
+ * \param queue     The queue, which is empty afterwards.
+ */
+
+void socket_queue_clear(SocketQueue * queue) {
+    struct SocketQueueChunk * chunk;
+
+    while ( (chunk = queue->head) != NULL ) {
+        queue->head = chunk->next;
+        socket_slab_free(chunk_slab, chunk);
+    }
+
+    socket_queue_count_sent(queue->len);
+    socket_queue_init(queue);
+}
+
+
+/*!
+ * \brief           Writes several buffers to a connection without waiting.
+ * \details         If the queue is empty, as much as the socket will take
+ * is written at once, and the rest is queued. Otherwise all of it is
+ * queued behind the output already there, subject to the overflow
+ * policy. The buffers are copied, so may be reused as soon as the
+ * function returns.
+ * \param queue     The connection's queue.
+ * \param socket    File descriptor of the socket, which must be
+ * non-blocking.
+ * \param iov       The buffers to write, which are not modified.
+ * \param iovcnt    The number of buffers in `iov`.
+ * \param policy    The connection's output limits.
+ * \returns         The number of bytes written, queued or discarded
+ * under `SOCKET_OVERFLOW_DROP`, or -1 with `errno` set on encountering
+ * an error, including `ENOBUFS` if the connection should be closed
+ * under `SOCKET_OVERFLOW_DISCONNECT`.
+ */
+
+ssize_t socket_queue_writev(SocketQueue * queue, const int socket,
+                            const struct iovec * iov, const int iovcnt,
+                            const SocketQueuePolicy * policy) {
+    size_t total = 0, written = 0;
+    ssize_t num_written;
+    int index;
+
+    for ( index = 0; index < iovcnt; ++index ) {
+        total += iov[index].iov_len;
+    }
+
+    if ( queue->len == 0 && queue->message != QUEUE_MESSAGE_DROPPED ) {
+        if ( (num_written = write_now(socket, iov, iovcnt)) == -1 ) {
+            return ERROR_RETURN;
+        }
+        written = (size_t) num_written;
+    }
+
+    switch ( socket_queue_admit(policy, &queue->message, queue->len,
+                                total - written) ) {
+        case SOCKET_OVERFLOW_DROP:
+            return (ssize_t) total;
+
+        case SOCKET_OVERFLOW_DISCONNECT:
+            errno = ENOBUFS;
+            return ERROR_RETURN;
+
+        default:
+            break;
+    }
+
+    if ( written < total && append(queue, iov, iovcnt, written) == -1 ) {
+        return ERROR_RETURN;
+    }
+
+    return (ssize_t) total;
+}
+
+
+/*!
+ * \brief           Sends queued output until the socket would block.
+ * \details         Sent chunks are returned to their pool.
+ * \param queue     The queue.
+ * \param socket    File descriptor of the socket, which must be
+ * non-blocking.
+ * \returns         The number of bytes sent, or -1 with `errno` set on
+ * encountering an error.
+ */
+
+ssize_t socket_queue_send(SocketQueue * queue, const int socket) {
+    struct iovec iov[QUEUE_MAX_IOV];
+    struct SocketQueueChunk * chunk;
+    ssize_t num_written, total_written = 0;
+    int iovcnt;
+
+    while ( queue->head != NULL ) {
+        iovcnt = 0;
+        for ( chunk = queue->head; chunk != NULL && iovcnt < QUEUE_MAX_IOV;
+              chunk = chunk->next ) {
+            iov[iovcnt].iov_base = chunk->data + chunk->start;
+            iov[iovcnt].iov_len = chunk->end - chunk->start;
+            ++iovcnt;
+        }
+
+        if ( (num_written = writev(socket, iov, iovcnt)) == -1 ) {
+            if ( errno == EINTR ) {
+                continue;
+            } else if ( errno == EAGAIN || errno == EWOULDBLOCK ) {
+                break;
+            }
+            return ERROR_RETURN;
+        }
+
+        total_written += num_written;
+        queue->len -= (size_t) num_written;
+        socket_queue_count_sent((size_t) num_written);
+
+        /*  Free the chunks sent in full, and advance
+            into any chunk which was partially sent    */
+
+        while ( (chunk = queue->head) != NULL &&
+                (size_t) num_written >= chunk->end - chunk->start ) {
+            num_written -= (ssize_t) (chunk->end - chunk->start);
+            queue->head = chunk->next;
+            socket_slab_free(chunk_slab, chunk);
+        }
+
+        if ( chunk != NULL && num_written > 0 ) {
+            chunk->start += (size_t) num_written;
+            break;
+        }
+    }
+
+    if ( queue->head == NULL ) {
+        queue->tail = NULL;
+    }
+
+    return total_written;
+}
+
+
+/*!
+ * \brief           Marks whether the calling thread's writes end partway
+ * through a message.
+ * \details         Under `SOCKET_OVERFLOW_DROP`, the event loops keep or
+ * discard a write made while this is in effect together with the writes
+ * which follow it, up to and including the first made while it is not,
+ * so the peer never receives part of a message. A writer which splits
+ * messages across writes should set it before each such write, and
+ * clear it afterwards.
+ * \param partial   True if the writes end partway through a message.
+ */
+
+void socket_queue_set_partial(const int partial) {
+    write_partial = partial;
+}
+
+
+/*!
+ * \brief           Applies an overflow policy to a write.
+ * \details         A write is refused only if output is already queued,
+ * so a write to a connection which is keeping up is never refused,
+ * however long, and a write is refused as a whole, so the peer never
+ * receives part of one. The rest of a message is refused or accepted
+ * as its start was.
+ * \param policy    The connection's output limits.
+ * \param message   Pointer to the connection's message state, which is
+ * updated. Zero for a new connection.
+ * \param queued    The number of bytes queued for the connection.
+ * \param len       The number of bytes to be queued, which is 0 if the
+ * write has been made in full.
+ * \returns         0 if the write should be queued, or
+ * `SOCKET_OVERFLOW_DROP` or `SOCKET_OVERFLOW_DISCONNECT` if it should be
+ * discarded, or the connection closed, in which case it is counted.
+ */
+
+int socket_queue_admit(const SocketQueuePolicy * policy, int * message,
+                       const size_t queued, const size_t len) {
+    int action = 0;
+
+    if ( *message == QUEUE_MESSAGE_DROPPED ) {
+        action = SOCKET_OVERFLOW_DROP;
+    } else if ( *message != QUEUE_MESSAGE_KEPT &&
+                policy->overflow != SOCKET_OVERFLOW_BLOCK && queued > 0 &&
+                queued + len > high_watermark(policy) ) {
+        action = policy->overflow;
+    }
+
+    if ( action == SOCKET_OVERFLOW_DISCONNECT ) {
+        __atomic_add_fetch(&queue_stats.disconnects, 1, __ATOMIC_RELAXED);
+        return action;
+    } else if ( action == SOCKET_OVERFLOW_DROP ) {
+        __atomic_add_fetch(&queue_stats.dropped_writes, 1, __ATOMIC_RELAXED);
+        __atomic_add_fetch(&queue_stats.dropped_bytes, len, __ATOMIC_RELAXED);
+        *message = write_partial ? QUEUE_MESSAGE_DROPPED :
+                                   QUEUE_MESSAGE_COMPLETE;
+    } else {
+        *message = write_partial ? QUEUE_MESSAGE_KEPT :
+                                   QUEUE_MESSAGE_COMPLETE;
+    }
+
+    return action;
+}
+
+
+/*!
+ * \brief           Decides whether to read from a connection.
+ * \details         Under `SOCKET_OVERFLOW_BLOCK`, a connection is blocked
+ * once its queued output passes the high watermark, and unblocked once
+ * it drains to the low watermark. Under the other policies, connections
+ * are never blocked.
+ * \param policy    The connection's output limits.
+ * \param blocked   Pointer to the connection's flag, which is true while
+ * the connection should not be read.
+ * \param queued    The number of bytes queued for the connection.
+ * \returns         True if the flag changed, false otherwise.
+ */
+
+int socket_queue_update_blocked(const SocketQueuePolicy * policy,
+                                int * blocked, const size_t queued) {
+    if ( !*blocked && policy->overflow == SOCKET_OVERFLOW_BLOCK &&
+         queued > high_watermark(policy) ) {
+        *blocked = TRUE;
+        __atomic_add_fetch(&queue_stats.blocked, 1, __ATOMIC_RELAXED);
+        __atomic_add_fetch(&queue_stats.blocks, 1, __ATOMIC_RELAXED);
+        return TRUE;
+    } else if ( *blocked && queued <= low_watermark(policy) ) {
+        *blocked = FALSE;
+        __atomic_sub_fetch(&queue_stats.blocked, 1, __ATOMIC_RELAXED);
+        return TRUE;
+    }
+
+    return FALSE;
+}
+
+
+/*!
+ * \brief           Counts output queued for a connection.
+ * \details         For event loops which keep their own output buffers.
+ * \param len       The number of bytes queued.
+ * \param depth     The number of bytes now queued for the connection.
+ */
+
+void socket_queue_count_queued(const size_t len, const size_t depth) {
+    unsigned long max_depth;
+
+    __atomic_add_fetch(&queue_stats.queued_bytes, len, __ATOMIC_RELAXED);
+
+    max_depth = __atomic_load_n(&queue_stats.max_depth, __ATOMIC_RELAXED);
+    while ( depth > max_depth &&
+            !__atomic_compare_exchange_n(&queue_stats.max_depth, &max_depth,
+                                         depth, TRUE, __ATOMIC_RELAXED,
+                                         __ATOMIC_RELAXED) ) {
+        continue;
+    }
+}
+
+
+/*!
+ * \brief           Counts queued output sent or discarded.
+ * \details         For event loops which keep their own output buffers.
+ * \param len       The number of bytes no longer queued.
+ */
+
+void socket_queue_count_sent(const size_t len) {
+    __atomic_sub_fetch(&queue_stats.queued_bytes, len, __ATOMIC_RELAXED);
+}
+
+
+/*!
+ * \brief           Gets the output queue counters.
+ * \details         The counters are read without locking, so may not
+ * be consistent with one another while connections are being served.
+ * \param stats     Pointer to a struct to receive the counters.
+ */
+
+void socket_queue_get_stats(SocketQueueStats * stats) {
+    stats->queued_bytes = __atomic_load_n(&queue_stats.queued_bytes,
+                                          __ATOMIC_RELAXED);
+    stats->max_depth = __atomic_load_n(&queue_stats.max_depth,
+                                       __ATOMIC_RELAXED);
+    stats->blocked = __atomic_load_n(&queue_stats.blocked, __ATOMIC_RELAXED);
+    stats->blocks = __atomic_load_n(&queue_stats.blocks, __ATOMIC_RELAXED);
+    stats->dropped_writes = __atomic_load_n(&queue_stats.dropped_writes,
+                                            __ATOMIC_RELAXED);
+    stats->dropped_bytes = __atomic_load_n(&queue_stats.dropped_bytes,
+                                           __ATOMIC_RELAXED);
+    stats->disconnects = __atomic_load_n(&queue_stats.disconnects,
+                                         __ATOMIC_RELAXED);
+}
+
+
+/*!
+ * \brief           Writes as much of several buffers as a socket will take.
+ * \param socket    File descriptor of the socket, which must be
+ * non-blocking.
+ * \param iov       The buffers to write, which are not modified.
+ * \param iovcnt    The number of buffers in `iov`.
+ * \returns         The number of bytes written, or -1 with `errno` set on
+ * encountering an error other than the socket being full.
+ */
+
+static ssize_t write_now(const int socket, const struct iovec * iov,
+                         const int iovcnt) {
+    struct iovec window[IOV_MAX];
+    ssize_t num_written, total_written = 0;
+    size_t offset = 0;
+    int first = 0, count;
+
+    while ( first < iovcnt ) {
+        count = iovcnt - first > IOV_MAX ? IOV_MAX : iovcnt - first;
+        memcpy(window, iov + first, count * sizeof(*iov));
+        window[0].iov_base = (char *) window[0].iov_base + offset;
+        window[0].iov_len -= offset;
+
+        if ( (num_written = writev(socket, window, count)) == -1 ) {
+            if ( errno == EINTR ) {
+                continue;
+            } else if ( errno == EAGAIN || errno == EWOULDBLOCK ) {
+                break;
+            }
+            return ERROR_RETURN;
+        }
+
+        total_written += num_written;
+
+        /*  Skip the buffers written in full, and note how far
+            into any buffer which was partially written we got  */
+
+        num_written += (ssize_t) offset;
+        while ( first < iovcnt &&
+                (size_t) num_written >= iov[first].iov_len ) {
+            num_written -= (ssize_t) iov[first].iov_len;
+            ++first;
+        }
+        offset = (size_t) num_written;
+    }
+
+    return total_written;
+}
+
+
+/*!
+ * \brief           Copies the unwritten part of several buffers to a queue.
+ * \param queue     The queue.
+ * \param iov       The buffers.
+ * \param iovcnt    The number of buffers in `iov`.
+ * \param skip      The number of bytes from the start of the buffers
+ * already written.
+ * \returns         0 on success, or -1 with `errno` set if memory could
+ * not be allocated, in which case some of the output may have been
+ * queued.
+ */
+
+static int append(SocketQueue * queue, const struct iovec * iov,
+                  const int iovcnt, size_t skip) {
+    struct SocketQueueChunk * chunk;
+    const char * data;
+    size_t len, space, queued = 0;
+    int index;
+
+    for ( index = 0; index < iovcnt; ++index ) {
+        if ( skip >= iov[index].iov_len ) {
+            skip -= iov[index].iov_len;
+            continue;
+        }
+
+        data = (const char *) iov[index].iov_base + skip;
+        len = iov[index].iov_len - skip;
+        skip = 0;
+
+        while ( len > 0 ) {
+            if ( (chunk = queue->tail) == NULL ||
+                 chunk->end == QUEUE_CHUNK_DATA ) {
+                if ( socket_slab_shared(&chunk_slab, "socket_queue",
+                                        sizeof(*chunk)) == NULL ||
+                     (chunk = socket_slab_alloc(chunk_slab)) == NULL ) {
+                    socket_queue_count_queued(queued, queue->len);
+                    return ERROR_RETURN;
+                }
+
+                chunk->next = NULL;
+                chunk->start = 0;
+                chunk->end = 0;
+                if ( queue->tail == NULL ) {
+                    queue->head = chunk;
+                } else {
+                    queue->tail->next = chunk;
+                }
+                queue->tail = chunk;
+            }
+
+            space = QUEUE_CHUNK_DATA - chunk->end;
+            if ( space > len ) {
+                space = len;
+            }
+
+            memcpy(chunk->data + chunk->end, data, space);
+            chunk->end += space;
+            data += space;
+            len -= space;
+            queue->len += space;
+            queued += space;
+        }
+    }
+
+    socket_queue_count_queued(queued, queue->len);
+    return 0;
+}
+
+
+/*!
+ * \brief           Returns a policy's high watermark.
+ * \param policy    The policy.
+ * \returns         The high watermark, in bytes.
+ */
+
+static size_t high_watermark(const SocketQueuePolicy * policy) {
+    return policy->high_watermark > 0 ? policy->high_watermark :
+                                        SOCKET_QUEUE_HIGH_WATERMARK;
+}
+
+
+/*!
+ * \brief           Returns a policy's low watermark.
+ * \param policy    The policy.
+ * \returns         The low watermark, in bytes.
+ */
+
+static size_t low_watermark(const SocketQueuePolicy * policy) {
+    return policy->low_watermark > 0 ? policy->low_watermark :
+                                       high_watermark(policy) / 2;
+}
@@ -0,0 +1,148 @@
+/*!
+ * \file            socket_helpers_queue.h
+ * \brief           Interface to output queue functions.
+ * \details         Interface to output queue functions.
+ * \author          Paul Griffiths
+ * \copyright       Copyright 2013 Paul Griffiths. Distributed under the terms
+ * of the GNU General Public License. <http://www.gnu.org/licenses/>
+ */
+
+
+#ifndef PG_SOCKET_HELPERS_QUEUE_H
+#define PG_SOCKET_HELPERS_QUEUE_H
+
+#include <stddef.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+
+
+/*!
+ * \brief           Overflow policy to stop reading from a connection
+ * until its queued output drains below the low watermark.
+ */
+
+#define SOCKET_OVERFLOW_BLOCK 0
+
+
+/*!
+ * \brief           Overflow policy to discard writes which would take
+ * queued output past the high watermark.
+ * \details         Writes are kept or discarded whole, and a write
+ * made while socket_queue_set_partial() is in effect is kept or
+ * discarded together with the writes which complete its message.
+ */
+
+#define SOCKET_OVERFLOW_DROP 1
+
+
+/*!
+ * \brief           Overflow policy to close a connection whose queued
+ * output would pass the high watermark.
+ */
+
+#define SOCKET_OVERFLOW_DISCONNECT 2
+
+
+/*!
+ * \brief           Default high watermark, in bytes.
+ */
+
+#define SOCKET_QUEUE_HIGH_WATERMARK (256UL * 1024)
+
+
+/*!
+ * \brief           Struct for a connection's output limits.
+ * \details         A zeroed struct gives the default watermarks and the
+ * `SOCKET_OVERFLOW_BLOCK` policy.
+ */
+
+typedef struct SocketQueuePolicy {
+    size_t high_watermark;      /*!< Queued bytes at which the overflow
+                                     policy applies, or 0 for the default */
+    size_t low_watermark;       /*!< Queued bytes at or below which a
+                                     blocked connection is read again, or
+                                     0 for half the high watermark */
+    int overflow;               /*!< `SOCKET_OVERFLOW_BLOCK`,
+                                     `SOCKET_OVERFLOW_DROP` or
+                                     `SOCKET_OVERFLOW_DISCONNECT` */
+} SocketQueuePolicy;
+
+
+/*!
+ * \brief           Struct for a queue of output waiting to be sent.
+ * \details         Queues are embedded in the event loops' connection
+ * structures. The output is copied into a list of pooled chunks, so
+ * queued data never moves once queued. The fields other than `len` are
+ * private to the queue functions.
+ */
+
+typedef struct SocketQueue {
+    struct SocketQueueChunk * head;     /*!< Chunk to send from */
+    struct SocketQueueChunk * tail;     /*!< Chunk to append to */
+    size_t len;                         /*!< Number of bytes queued */
+    int message;                        /*!< State of a partial message */
+} SocketQueue;
+
+
+/*!
+ * \brief           Struct for a connection's non-blocking output.
+ * \details         Passed by the event loops to their handlers'
+ * `on_open` callbacks. `writev` is called with `conn` and the buffers
+ * to write, and writes what the socket will take at once and queues the
+ * rest, subject to the handler's output limits, so never waits for the
+ * peer. It returns the number of bytes written, queued or discarded, or
+ * -1 with `errno` set, in which case the connection is closed once the
+ * callback returns. It may be called only from the connection's
+ * callbacks.
+ */
+
+typedef struct SocketOutput {
+    ssize_t (*writev)(void * conn, const struct iovec * iov,
+                      const int iovcnt);    /*!< Writes to the connection */
+    void * conn;                            /*!< The event loop's connection */
+} SocketOutput;
+
+
+/*!
+ * \brief           Struct for the output queue counters.
+ * \details         Covers the queues of all connections served by the
+ * event-loop servers.
+ */
+
+typedef struct SocketQueueStats {
+    unsigned long queued_bytes;     /*!< Bytes now queued */
+    unsigned long max_depth;        /*!< Most bytes queued for one connection */
+    unsigned long blocked;          /*!< Connections now not being read */
+    unsigned long blocks;           /*!< Times a connection was blocked */
+    unsigned long dropped_writes;   /*!< Writes discarded */
+    unsigned long dropped_bytes;    /*!< Bytes discarded */
+    unsigned long disconnects;      /*!< Connections closed for overflow */
+} SocketQueueStats;
+
+
+/*  Function prototypes  */
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+void socket_queue_init(SocketQueue * queue);
+void socket_queue_clear(SocketQueue * queue);
+ssize_t socket_queue_writev(SocketQueue * queue, const int socket,
+                            const struct iovec * iov, const int iovcnt,
+                            const SocketQueuePolicy * policy);
+ssize_t socket_queue_send(SocketQueue * queue, const int socket);
+void socket_queue_set_partial(const int partial);
+int socket_queue_admit(const SocketQueuePolicy * policy, int * message,
+                       const size_t queued, const size_t len);
+int socket_queue_update_blocked(const SocketQueuePolicy * policy,
+                                int * blocked, const size_t queued);
+void socket_queue_count_queued(const size_t len, const size_t depth);
+void socket_queue_count_sent(const size_t len);
+void socket_queue_get_stats(SocketQueueStats * stats);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif          /*  PG_SOCKET_HELPERS_QUEUE_H  */
@@ -0,0 +1,798 @@
+/*!
+ * \file            socket_helpers_reader.c
+ * \brief           Implementation of buffered socket reader functions.
+ * \details         Implementation of buffered socket reader functions.
+ * \author          Paul Griffiths
+ * \copyright       Copyright 2013 Paul Griffiths. Distributed under the terms
+ * of the GNU General Public License. <http://www.gnu.org/licenses/>
+ */
+
+
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <errno.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <time.h>
+#include <poll.h>
+#include <paulgrif/chelpers.h>
+#include "socket_helpers_reader.h"
+#include "socket_helpers_scan.h"
+#include "socket_helpers_slab.h"
+
+
+/*!
+ * \brief           Number of bits of a socket used to index a registry page.
+ */
+
+#define READER_PAGE_BITS 10
+
+
+/*!
+ * \brief           Number of reader slots in each registry page.
+ */
+
+#define READER_PAGE_SIZE (1 << READER_PAGE_BITS)
+
+
+/*!
+ * \brief           Number of pages in the reader registry.
+ * \details         The registry can hold readers for sockets with file
+ * descriptors up to `READER_NUM_PAGES * READER_PAGE_SIZE - 1`.
+ */
+
+#define READER_NUM_PAGES 1024
+
+
+/*!
+ * \brief           Buffered socket reader.
+ * \details         Unread bytes occupy `buffer[start]` up to, but not
+ * including, `buffer[end]`.
+ */
+
+struct SocketReader {
+    int socket;         /*!< File descriptor of the socket being read */
+    int eof;            /*!< Non-zero once the peer has closed the socket */
+    size_t start;       /*!< Index of the first unread byte */
+    size_t end;         /*!< Index one past the last unread byte */
+    size_t scanned;     /*!< Number of unread bytes known to hold no CRLF */
+    size_t max_line;    /*!< Longest line accepted, or 0 for no limit */
+    size_t line_len;    /*!< Length of the parts of a line returned */
+    dev_t dev;          /*!< Device of a registry reader's socket */
+    ino_t ino;          /*!< Inode of a registry reader's socket */
+    char buffer[SOCKET_READER_BUFFER_SIZE];     /*!< Receive buffer */
+};
+
+
+/*!
+ * \brief           File scope registry of readers, indexed by socket.
+ * \details         Pages are allocated on first use and are never freed,
+ * so a page pointer, once published, can be read without locking. The
+ * slots within a page belong to whichever thread owns the corresponding
+ * socket, and are accessed without locking.
+ */
+
+static SocketReader ** reader_pages[READER_NUM_PAGES];
+
+
+/*!
+ * \brief           Mutex protecting allocation of registry pages.
+ */
+
+static pthread_mutex_t reader_pages_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+
+/*!
+ * \brief           File scope variable for the reader slab.
+ * \details         Created when the first reader is created.
+ */
+
+static SocketSlab * reader_slab = NULL;
+
+
+/*!
+ * \brief           Creates a buffered reader for a socket.
+ * \param socket    File descriptor of the socket to read.
+ * \returns         A pointer to the new reader, or NULL if memory could
+ * not be allocated. The reader should be destroyed with
+ * socket_reader_destroy().
+ */
+
+SocketReader * socket_reader_create(const int socket) {
+    SocketReader * reader;
+
+    if ( socket_slab_shared(&reader_slab, "socket_reader",
+                            sizeof(*reader)) == NULL ||
+         (reader = socket_slab_alloc(reader_slab)) == NULL ) {
+        return NULL;
+    }
+
+    socket_reader_reset(reader, socket);
+    return reader;
+}
+
+
+/*!
+ * \brief           Destroys a buffered reader.
+ * \details         The socket itself is not closed.
+ * \param reader    The reader to destroy. May be NULL.
+ */
+
+void socket_reader_destroy(SocketReader * reader) {
+    if ( reader != NULL ) {
+        socket_slab_free(reader_slab, reader);
+    }
+}
+
+
+/*!
+ * \brief           Returns the memory held by a reader.
+ * \returns         The number of bytes allocated for each reader,
+ * including its receive buffer.
+ */
+
+size_t socket_reader_size(void) {
+    return sizeof(SocketReader);
+}
+
+
+/*!
+ * \brief           Gets the counters of the slab readers come from.
+ * \details         Readers in use are attached to a connection, and the
+ * rest are pooled for reuse.
+ * \param stats     Pointer to a struct to receive the counters, which
+ * are all zero if no reader has yet been created.
+ */
+
+void socket_reader_pool_stats(SocketSlabStats * stats) {
+    SocketSlab * slab = __atomic_load_n(&reader_slab, __ATOMIC_ACQUIRE);
+
+    if ( slab == NULL ) {
+        memset(stats, 0, sizeof(*stats));
+    } else {
+        socket_slab_get_stats(slab, stats);
+    }
+}
+
+
+/*!
+ * \brief           Discards any buffered data and rebinds a reader.
+ * \param reader    The reader to reset.
+ * \param socket    File descriptor of the socket the reader should now read.
+ */
+
+void socket_reader_reset(SocketReader * reader, const int socket) {
+    reader->socket = socket;
+    reader->eof = 0;
+    reader->start = 0;
+    reader->end = 0;
+    reader->scanned = 0;
+    reader->max_line = 0;
+    reader->line_len = 0;
+}
+
+
+/*!
+ * \brief           Returns the number of buffered, unread bytes.
+ * \param reader    The reader.
+ * \returns         The number of bytes available without reading the socket.
+ */
+
+size_t socket_reader_pending(const SocketReader * reader) {
+    return reader->end - reader->start;
+}
+
+
+/*!
+ * \brief           Checks whether the peer has closed the socket.
+ * \param reader    The reader.
+ * \returns         Non-zero if a `recv()` call on the socket has returned
+ * end-of-file. Buffered bytes may still be pending.
+ */
+
+int socket_reader_eof(const SocketReader * reader) {
+    return reader->eof;
+}
+
+
+/*!
+ * \brief           Sets the longest line a reader will return.
+ * \details         Lines longer than the reader's buffer are returned in
+ * parts, so the limit applies to the total length of the parts.
+ * \param reader    The reader.
+ * \param max_line  The longest line to accept, excluding the `\r\n`,
+ * or 0 for no limit, which is the default.
+ */
+
+void socket_reader_set_max_line(SocketReader * reader, const size_t max_line) {
+    reader->max_line = max_line;
+}
+
+
+/*!
+ * \brief           Sets a deadline a period from now.
+ * \param deadline  Pointer to a struct to receive the deadline, as an
+ * absolute `CLOCK_MONOTONIC` time, so that it is unaffected by changes
+ * to the system clock.
+ * \param period    The period from now.
+ * \returns         0 on success, or -1 with `errno` set on encountering
+ * an error.
+ */
+
+int socket_deadline_after(struct timespec * deadline,
+                          const struct timeval * period) {
+    if ( clock_gettime(CLOCK_MONOTONIC, deadline) == -1 ) {
+        return ERROR_RETURN;
+    }
+
+    deadline->tv_sec += period->tv_sec + period->tv_usec / 1000000;
+    deadline->tv_nsec += (period->tv_usec % 1000000) * 1000;
+    if ( deadline->tv_nsec >= 1000000000 ) {
+        deadline->tv_nsec -= 1000000000;
+        ++deadline->tv_sec;
+    }
+
+    return 0;
+}
+
+
+/*!
+ * \brief           Waits for a socket to become readable before a deadline.
+ * \details         Uses `poll()`, so works for any file descriptor
+ * number. The wait is rounded up to a whole millisecond, and repeated
+ * if `poll()` returns early, so never ends before the deadline.
+ * \param socket    File descriptor of the socket.
+ * \param deadline  The deadline, from socket_deadline_after(), or NULL
+ * to wait indefinitely.
+ * \returns         1 if the socket is readable, 0 if the deadline
+ * passed first, or -1 with `errno` set on encountering an error.
+ */
+
+int socket_wait_readable_until(const int socket,
+                               const struct timespec * deadline) {
+    struct pollfd pfd;
+    struct timespec now;
+    long remaining_ms;
+    int status;
+
+    pfd.fd = socket;
+    pfd.events = POLLIN;
+
+    while ( deadline == NULL ) {
+        if ( (status = poll(&pfd, 1, -1)) > 0 ) {
+            return 1;
+        } else if ( status == -1 && errno != EINTR ) {
+            return ERROR_RETURN;
+        }
+    }
+
+    while ( 1 ) {
+        if ( clock_gettime(CLOCK_MONOTONIC, &now) == -1 ) {
+            return ERROR_RETURN;
+        }
+
+        if ( now.tv_sec > deadline->tv_sec ||
+             (now.tv_sec == deadline->tv_sec &&
+              now.tv_nsec >= deadline->tv_nsec) ) {
+            return 0;
+        }
+
+        remaining_ms = (long) (deadline->tv_sec - now.tv_sec) * 1000 +
+                       (deadline->tv_nsec - now.tv_nsec + 999999) / 1000000;
+
+        status = poll(&pfd, 1, remaining_ms > INT_MAX ?
+                               INT_MAX : (int) remaining_ms);
+        if ( status > 0 ) {
+            return 1;
+        } else if ( status == -1 && errno != EINTR ) {
+            return ERROR_RETURN;
+        }
+    }
+}
+
+
+/*!
+ * \brief           Makes room at the end of a reader's buffer.
+ * \details         Moves any unread bytes to the front of the buffer if
+ * there is no free space after them.
+ * \param reader    The reader.
+ * \returns         0 on success, or -1 with `errno` set to `ENOBUFS` if
+ * the buffer is full of unread bytes.
+ */
+
+static int make_room(SocketReader * reader) {
+    if ( reader->start == reader->end ) {
+        reader->start = reader->end = 0;
+    } else if ( reader->end == sizeof(reader->buffer) ) {
+        if ( reader->start == 0 ) {
+            errno = ENOBUFS;
+            return ERROR_RETURN;
+        }
+
+        memmove(reader->buffer, reader->buffer + reader->start,
+                reader->end - reader->start);
+        reader->end -= reader->start;
+        reader->start = 0;
+    }
+
+    return 0;
+}
+
+
+/*!
+ * \brief           Receives into the free space in a reader's buffer.
+ * \param reader    The reader, with room made by make_room().
+ * \param flags     Flags for `recv()`.
+ * \returns         The number of bytes read, 0 on end-of-file, or -1
+ * with `errno` set on encountering an error.
+ */
+
+static ssize_t reader_recv(SocketReader * reader, const int flags) {
+    ssize_t num_read;
+
+    do {
+        num_read = recv(reader->socket, reader->buffer + reader->end,
+                sizeof(reader->buffer) - reader->end, flags);
+    } while ( num_read == -1 && errno == EINTR );
+
+    if ( num_read > 0 ) {
+        reader->end += (size_t) num_read;
+    } else if ( num_read == 0 ) {
+        reader->eof = 1;
+    }
+
+    return num_read;
+}
+
+
+/*!
+ * \brief           Reads as much data as is available into the buffer.
+ * \details         Makes a single `recv()` call for all the free space in
+ * the reader's buffer, moving any unread bytes to the front of the buffer
+ * first if necessary.
+ * \param reader    The reader.
+ * \param deadline  The time, from socket_deadline_after(), after which
+ * to stop waiting for input, or NULL to wait indefinitely.
+ * \returns         The number of bytes read, 0 on end-of-file or on
+ * timing out (the two may be distinguished with socket_reader_eof()),
+ * or -1 with `errno` set on encountering an error.
+ */
+
+ssize_t socket_reader_fill_until(SocketReader * reader,
+                                 const struct timespec * deadline) {
+    int status;
+
+    if ( make_room(reader) == -1 ) {
+        return ERROR_RETURN;
+    }
+
+    if ( deadline != NULL &&
+         (status = socket_wait_readable_until(reader->socket,
+                                              deadline)) < 1 ) {
+        return status;
+    }
+
+    return reader_recv(reader, 0);
+}
+
+
+/*!
+ * \brief           Reads whatever data has already arrived into the buffer.
+ * \details         As socket_reader_fill_until(), but never waits, even on
+ * a blocking socket.
+ * \param reader    The reader.
+ * \returns         The number of bytes read, 0 on end-of-file, or -1 with
+ * `errno` set on encountering an error, including `EAGAIN` or
+ * `EWOULDBLOCK` if no data has arrived.
+ */
+
+ssize_t socket_reader_fill_nowait(SocketReader * reader) {
+    if ( make_room(reader) == -1 ) {
+        return ERROR_RETURN;
+    }
+
+    return reader_recv(reader, MSG_DONTWAIT);
+}
+
+
+/*!
+ * \brief           Reads as much data as is available into the buffer.
+ * \details         Equivalent to socket_reader_fill_until() with a
+ * deadline `time_out` from now.
+ * \param reader    The reader.
+ * \param time_out  A pointer to a `timeval` struct containing the period
+ * to wait for input, or NULL to wait indefinitely.
+ * \returns         The number of bytes read, 0 on end-of-file or on
+ * timing out (the two may be distinguished with socket_reader_eof()),
+ * or -1 with `errno` set on encountering an error.
+ */
+
+ssize_t socket_reader_fill(SocketReader * reader,
+                           const struct timeval * time_out) {
+    struct timespec deadline;
+
+    if ( time_out == NULL ) {
+        return socket_reader_fill_until(reader, NULL);
+    } else if ( socket_deadline_after(&deadline, time_out) == -1 ) {
+        return ERROR_RETURN;
+    }
+
+    return socket_reader_fill_until(reader, &deadline);
+}
+
+
+/*!
+ * \brief           Finds the end of a `\r\n` terminated line.
+ * \param data      The data to search.
+ * \param len       The number of bytes of data to search.
+ * \param prev      The character immediately preceding `data`, or `\0`.
+ * \returns         The number of bytes up to and including the first
+ * `\n` which is preceded by `\r`, or zero if there is no such `\n`.
+ */
+
+static size_t find_line_end(const char * data, const size_t len,
+                            const char prev) {
+    const char * cr;
+
+    if ( len > 0 && prev == '\r' && data[0] == '\n' ) {
+        return 1;
+    }
+
+    if ( (cr = socket_find_crlf(data, len)) != NULL ) {
+        return (size_t) (cr - data) + 2;
+    }
+
+    return 0;
+}
+
+
+/*!
+ * \brief           Reads an `\r\n` terminated line through a reader.
+ * \details         Lines are returned from the reader's buffer, which is
+ * only refilled from the socket when it is empty. The function will not
+ * overwrite the buffer, so `max_len` should be the size of the whole
+ * buffer, and function will at most write `max_len - 1` characters plus
+ * the terminating `\0`. Any characters of a longer line remain buffered
+ * for the next call. Any terminating CR or LF characters will be stripped.
+ * \param reader    The reader.
+ * \param buffer    The buffer into which to read.
+ * \param max_len   The maximum number of characters to read, including
+ * the terminating `\0`.
+ * \param deadline  The time, from socket_deadline_after(), by which the
+ * whole line must have arrived, or NULL to wait indefinitely. The socket
+ * is only waited on when the reader's buffer is empty, so a line which
+ * is already buffered is returned even after the deadline.
+ * \returns         The number of characters read, including any line
+ * ending, or -1 with `errno` set on encountering an error. On timing out
+ * or end-of-file, any partial line read so far is returned.
+ */
+
+ssize_t socket_reader_readline_until(SocketReader * reader, char * buffer,
+        const size_t max_len, const struct timespec * deadline) {
+    size_t index = 0;
+    size_t avail, count;
+    ssize_t num_read;
+
+    while ( index < max_len - 1 ) {
+        if ( reader->start == reader->end ) {
+            num_read = socket_reader_fill_until(reader, deadline);
+            if ( num_read == -1 ) {
+                return ERROR_RETURN;
+            } else if ( num_read == 0 ) {
+
+                /*  End-of-file or timed out before end of line  */
+
+                break;
+            }
+        }
+
+        avail = reader->end - reader->start;
+        if ( avail > max_len - 1 - index ) {
+            avail = max_len - 1 - index;
+        }
+
+        count = find_line_end(reader->buffer + reader->start, avail,
+                              index > 0 ? buffer[index - 1] : '\0');
+
+        if ( count > 0 ) {
+
+            /*  End of line, so copy it and break  */
+
+            memcpy(buffer + index, reader->buffer + reader->start, count);
+            reader->start += count;
+            index += count;
+            break;
+        }
+
+        memcpy(buffer + index, reader->buffer + reader->start, avail);
+        reader->start += avail;
+        index += avail;
+    }
+
+    reader->scanned = 0;
+
+    buffer[index] = '\0';
+    trim_line_ending(buffer);
+    return (ssize_t) index;
+}
+
+
+/*!
+ * \brief           Reads an `\r\n` terminated line through a reader.
+ * \details         Equivalent to socket_reader_readline_until() with a
+ * deadline `time_out` from now, so `time_out` bounds the time taken to
+ * read the whole line, not each wait for input.
+ * \param reader    The reader.
+ * \param buffer    The buffer into which to read.
+ * \param max_len   The maximum number of characters to read, including
+ * the terminating `\0`.
+ * \param time_out  A pointer to a `timeval` struct containing the period
+ * within which the line must arrive, or NULL to wait indefinitely.
+ * \returns         The number of characters read, including any line
+ * ending, or -1 with `errno` set on encountering an error. On timing out
+ * or end-of-file, any partial line read so far is returned.
+ */
+
+ssize_t socket_reader_readline(SocketReader * reader, char * buffer,
+        const size_t max_len, const struct timeval * time_out) {
+    struct timespec deadline;
+
+    if ( time_out == NULL ) {
+        return socket_reader_readline_until(reader, buffer, max_len, NULL);
+    } else if ( socket_deadline_after(&deadline, time_out) == -1 ) {
+        return ERROR_RETURN;
+    }
+
+    return socket_reader_readline_until(reader, buffer, max_len, &deadline);
+}
+
+
+/*!
+ * \brief           Checks a line against a reader's line length limit.
+ * \details         Once a line has exceeded the limit, it always does,
+ * so the reader returns no more lines.
+ * \param reader    The reader.
+ * \param len       The length of the next part of the line.
+ * \returns         Non-zero, with `errno` set to `EMSGSIZE`, if the line
+ * exceeds the limit, or zero otherwise.
+ */
+
+static int line_too_long(SocketReader * reader, const size_t len) {
+    if ( reader->max_line > 0 &&
+         reader->line_len + len > reader->max_line ) {
+        reader->line_len = reader->max_line + 1;
+        errno = EMSGSIZE;
+        return TRUE;
+    }
+
+    return FALSE;
+}
+
+
+/*!
+ * \brief           Gets a complete line from a reader's buffer.
+ * \details         Never reads from the socket, so is suitable for use
+ * with non-blocking sockets: call socket_reader_fill() when this
+ * function returns zero. The line is not copied, and the pointer is
+ * valid only until the next call to any other reader function. A line
+ * which is longer than the whole buffer is returned in parts as it
+ * arrives, so that the reader can always make progress, and a final
+ * partial line is returned once end-of-file has been reached. Bytes
+ * already searched for a line ending are not searched again when more
+ * data arrives.
+ * \param reader    The reader.
+ * \param line      Pointer to a pointer to receive the start of the line.
+ * \param len       Pointer to receive the length of the line, which
+ * excludes the terminating `\r\n`.
+ * \returns         `SOCKET_READER_LINE` if a line, or the final part of
+ * a line, was returned, `SOCKET_READER_PARTIAL` if any other part of a
+ * line was returned, 0 if the buffer does not hold a complete line, or
+ * -1 with `errno` set to `EMSGSIZE` if the line is longer than the limit
+ * set with socket_reader_set_max_line().
+ */
+
+int socket_reader_getline(SocketReader * reader, const char ** line,
+                          size_t * len) {
+    const char * data = reader->buffer + reader->start;
+    const size_t avail = reader->end - reader->start;
+    const size_t from = reader->scanned > 0 ? reader->scanned - 1 : 0;
+    const char * cr;
+    size_t count;
+
+    if ( line_too_long(reader, 0) ) {
+        return ERROR_RETURN;
+    }
+
+    if ( (cr = socket_find_crlf(data + from, avail - from)) != NULL ) {
+        count = (size_t) (cr - data);
+        if ( line_too_long(reader, count) ) {
+            return ERROR_RETURN;
+        }
+
+        *line = data;
+        *len = count;
+        reader->start += count + 2;
+        reader->scanned = 0;
+        reader->line_len = 0;
+        return SOCKET_READER_LINE;
+    } else if ( reader->eof && avail > 0 ) {
+        if ( line_too_long(reader, avail) ) {
+            return ERROR_RETURN;
+        }
+
+        *line = data;
+        *len = avail;
+        reader->start = reader->end;
+        reader->scanned = 0;
+        reader->line_len = 0;
+        return SOCKET_READER_LINE;
+    } else if ( avail == sizeof(reader->buffer) ) {
+
+        /*  Return part of the line, holding back a final `\r` until
+            the next byte shows whether it begins the line ending.     */
+
+        count = data[avail - 1] == '\r' ? avail - 1 : avail;
+        if ( line_too_long(reader, count) ) {
+            return ERROR_RETURN;
+        }
+
+        *line = data;
+        *len = count;
+        reader->start += count;
+        reader->scanned = 0;
+        reader->line_len += count;
+        return SOCKET_READER_PARTIAL;
+    }
+
+    reader->scanned = avail;
+    return 0;
+}
+
+
+/*!
+ * \brief           Gets the complete lines from a reader's buffer.
+ * \details         Behaves the same as repeated calls to
+ * socket_reader_getline(), and the lines are valid only until the next
+ * call to any other reader function.
+ * \param reader    The reader.
+ * \param lines     Array to receive the lines, or parts of lines.
+ * \param max_lines The number of elements in `lines`.
+ * \returns         The number of lines returned, which is less than
+ * `max_lines` only if no more complete lines are buffered, or -1 with
+ * `errno` set to `EMSGSIZE` if the first line is longer than the limit
+ * set with socket_reader_set_max_line().
+ */
+
+ssize_t socket_reader_getlines(SocketReader * reader, SocketLine * lines,
+                               const size_t max_lines) {
+    size_t num_lines = 0;
+    int status = 0;
+
+    while ( num_lines < max_lines &&
+            (status = socket_reader_getline(reader, &lines[num_lines].data,
+                                            &lines[num_lines].len)) > 0 ) {
+        lines[num_lines++].complete = status == SOCKET_READER_LINE;
+    }
+
+    if ( status == ERROR_RETURN && num_lines == 0 ) {
+        return ERROR_RETURN;
+    }
+
+    return (ssize_t) num_lines;
+}
+
+
+/*!
+ * \brief           Gets the registry reader for a socket.
+ * \details         The reader is created on first use. Only the thread
+ * which owns the socket should call this function for that socket.
+ * The reader records the device and inode of its socket, and is reset
+ * if they no longer match, so a socket closed with plain `close()`
+ * leaves no buffered bytes for a later socket with the same descriptor.
+ * Closing with socket_close(), or releasing with socket_reader_release()
+ * before closing, also returns the reader's memory.
+ * \param socket    File descriptor of the socket.
+ * \returns         A pointer to the reader, or NULL with `errno` set on
+ * encountering an error.
+ */
+
+SocketReader * socket_reader_for_socket(const int socket) {
+    SocketReader ** page;
+    SocketReader ** slot;
+    size_t page_index;
+    struct stat info;
+
+    if ( socket < 0 || socket >= READER_NUM_PAGES * READER_PAGE_SIZE ) {
+        errno = EBADF;
+        return NULL;
+    }
+
+    page_index = (size_t) socket >> READER_PAGE_BITS;
+    page = __atomic_load_n(&reader_pages[page_index], __ATOMIC_ACQUIRE);
+
+    if ( page == NULL ) {
+        if ( pthread_mutex_lock(&reader_pages_mutex) != 0 ) {
+            return NULL;
+        }
+
+        if ( (page = reader_pages[page_index]) == NULL ) {
+            page = calloc(READER_PAGE_SIZE, sizeof(*page));
+            __atomic_store_n(&reader_pages[page_index], page,
+                             __ATOMIC_RELEASE);
+        }
+
+        pthread_mutex_unlock(&reader_pages_mutex);
+
+        if ( page == NULL ) {
+            errno = ENOMEM;
+            return NULL;
+        }
+    }
+
+    if ( fstat(socket, &info) == -1 ) {
+        return NULL;
+    }
+
+    slot = &page[socket & (READER_PAGE_SIZE - 1)];
+    if ( *slot == NULL ) {
+        if ( (*slot = socket_reader_create(socket)) == NULL ) {
+            errno = ENOMEM;
+            return NULL;
+        }
+    } else if ( (*slot)->dev == info.st_dev && (*slot)->ino == info.st_ino ) {
+        return *slot;
+    } else {
+        socket_reader_reset(*slot, socket);
+    }
+
+    (*slot)->dev = info.st_dev;
+    (*slot)->ino = info.st_ino;
+    return *slot;
+}
+
+
+/*!
+ * \brief           Destroys the registry reader for a socket, if any.
+ * \details         Any buffered, unread bytes are discarded.
+ * \param socket    File descriptor of the socket.
+ */
+
+void socket_reader_release(const int socket) {
+    SocketReader ** page;
+    SocketReader ** slot;
+
+    if ( socket < 0 || socket >= READER_NUM_PAGES * READER_PAGE_SIZE ) {
+        return;
+    }
+
+    page = __atomic_load_n(&reader_pages[socket >> READER_PAGE_BITS],
+                           __ATOMIC_ACQUIRE);
+    if ( page != NULL ) {
+        slot = &page[socket & (READER_PAGE_SIZE - 1)];
+        socket_reader_destroy(*slot);
+        *slot = NULL;
+    }
+}
+
+
+/*!
+ * \brief           Closes a socket and releases its registry reader.
+ * \param socket    File descriptor of the socket.
+ * \returns         0 on success, or -1 on encountering an error.
+ */
+
+int socket_close(const int socket) {
+    socket_reader_release(socket);
+
+    if ( close(socket) == -1 ) {
+        set_errno_errmsg("couldn't close socket");
+        return ERROR_RETURN;
+    }
+
+    return 0;
+}
@@ -0,0 +1,108 @@
+/*!
+ * \file            socket_helpers_reader.h
+ * \brief           Interface to buffered socket reader functions.
+ * \details         Interface to buffered socket reader functions.
+ * \author          Paul Griffiths
+ * \copyright       Copyright 2013 Paul Griffiths. Distributed under the terms
+ * of the GNU General Public License. <http://www.gnu.org/licenses/>
+ */
+
+
+#ifndef PG_SOCKET_HELPERS_READER_H
+#define PG_SOCKET_HELPERS_READER_H
+
+#include <sys/types.h>
+#include <sys/time.h>
+#include <time.h>
+#include "socket_helpers_slab.h"
+
+
+/*!
+ * \brief           Size of the receive buffer owned by each reader.
+ */
+
+#define SOCKET_READER_BUFFER_SIZE 16384
+
+
+/*!
+ * \brief           Opaque buffered socket reader type.
+ * \details         A reader owns a receive buffer for a single socket.
+ * Each call to `recv()` fills as much of the buffer as the kernel has
+ * available, and any bytes left over after a line has been returned are
+ * kept for the next call.
+ */
+
+typedef struct SocketReader SocketReader;
+
+
+/*!
+ * \brief           Struct for a line returned without copying.
+ * \details         Points into a reader's buffer, so is valid only until
+ * the next call to a function which reads into that buffer.
+ */
+
+typedef struct SocketLine {
+    const char * data;          /*!< Start of the line, not NUL-terminated */
+    size_t len;                 /*!< Length of the line, excluding `\r\n` */
+    int complete;               /*!< False if the line continues */
+} SocketLine;
+
+
+/*!
+ * \brief           Return value of socket_reader_getline() for a line.
+ * \details         Also returned for the final part of a line longer
+ * than the reader's buffer.
+ */
+
+#define SOCKET_READER_LINE 1
+
+
+/*!
+ * \brief           Return value of socket_reader_getline() for part of a line.
+ * \details         Returned for each part of a line longer than the
+ * reader's buffer, other than the final part.
+ */
+
+#define SOCKET_READER_PARTIAL 2
+
+
+/*  Function prototypes  */
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+SocketReader * socket_reader_create(const int socket);
+void socket_reader_destroy(SocketReader * reader);
+size_t socket_reader_size(void);
+void socket_reader_pool_stats(SocketSlabStats * stats);
+void socket_reader_reset(SocketReader * reader, const int socket);
+size_t socket_reader_pending(const SocketReader * reader);
+int socket_reader_eof(const SocketReader * reader);
+void socket_reader_set_max_line(SocketReader * reader, const size_t max_line);
+int socket_deadline_after(struct timespec * deadline,
+                          const struct timeval * period);
+int socket_wait_readable_until(const int socket,
+                               const struct timespec * deadline);
+ssize_t socket_reader_fill(SocketReader * reader,
+                           const struct timeval * time_out);
+ssize_t socket_reader_fill_until(SocketReader * reader,
+                                 const struct timespec * deadline);
+ssize_t socket_reader_fill_nowait(SocketReader * reader);
+ssize_t socket_reader_readline(SocketReader * reader, char * buffer,
+        const size_t max_len, const struct timeval * time_out);
+ssize_t socket_reader_readline_until(SocketReader * reader, char * buffer,
+        const size_t max_len, const struct timespec * deadline);
+int socket_reader_getline(SocketReader * reader, const char ** line,
+                          size_t * len);
+ssize_t socket_reader_getlines(SocketReader * reader, SocketLine * lines,
+                               const size_t max_lines);
+SocketReader * socket_reader_for_socket(const int socket);
+void socket_reader_release(const int socket);
+int socket_close(const int socket);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif          /*  PG_SOCKET_HELPERS_READER_H  */
@@ -0,0 +1,240 @@
+/*!
+ * \file            socket_helpers_scan.c
+ * \brief           Implementation of line terminator scanning functions.
+ * \details         The SSE2 and AVX2 scanners compare a block of the data
+ * offset by one byte against `\n`, and for blocks containing one, the
+ * block itself against `\r`, so each set bit in the combined mask marks
+ * the start of a `\r\n` pair.
+ * The best scanner for the running CPU is chosen on first use.
+ * \author          Paul Griffiths
+ * \copyright       Copyright 2013 Paul Griffiths. Distributed under the terms
+ * of the GNU General Public License. <http://www.gnu.org/licenses/>
+ */
+
+
+#include <string.h>
+#include "socket_helpers_scan.h"
+
+#ifdef SOCKET_HELPERS_X86_SIMD
+#include <immintrin.h>
+#endif
+
+
+/*!
+ * \brief           Type of a CRLF scanner function.
+ */
+
+typedef const char * (*CrlfScanner)(const char *, const size_t);
+
+
+/*!
+ * \brief           File scope variable holding the selected scanner.
+ * \details         Set on the first call to socket_find_crlf(). Every
+ * thread selects the same scanner, so a race to set it is harmless.
+ */
+
+static CrlfScanner crlf_scanner = NULL;
+
+
+/*!
+ * \brief           File scope variable holding the selected scanner's name.
+ */
+
+static const char * crlf_scanner_name = NULL;
+
+
+/*!
+ * \brief           Finds a `\r\n` pair without vector instructions.
+ * \details         Searches for each `\n` with `memchr()` and checks the
+ * preceding character.
+ * \param data      The data to search.
+ * \param len       The number of bytes of data to search.
+ * \returns         A pointer to the `\r` of the first `\r\n` pair lying
+ * wholly within the data, or NULL if there is no such pair.
+ */
+
+const char * socket_find_crlf_scalar(const char * data, const size_t len) {
+    const char * end = data + len;
+    const char * p = data + 1;
+    const char * lf;
+
+    if ( len < 2 ) {
+        return NULL;
+    }
+
+    while ( p < end && (lf = memchr(p, '\n', end - p)) != NULL ) {
+        if ( lf[-1] == '\r' ) {
+            return lf - 1;
+        }
+        p = lf + 1;
+    }
+
+    return NULL;
+}
+
+
+#ifdef SOCKET_HELPERS_X86_SIMD
+
+/*!
+ * \brief           Finds a `\r\n` pair 64 bytes at a time with SSE2.
+ * \details         The main loop looks only for `\n` characters, and the
+ * `\r` check is only made for a block which contains one.
+ * \param data      The data to search.
+ * \param len       The number of bytes of data to search.
+ * \returns         A pointer to the `\r` of the first `\r\n` pair lying
+ * wholly within the data, or NULL if there is no such pair.
+ */
+
+__attribute__((target("sse2")))
+const char * socket_find_crlf_sse2(const char * data, const size_t len) {
+    const __m128i cr = _mm_set1_epi8('\r');
+    const __m128i lf = _mm_set1_epi8('\n');
+    const __m128i * block;
+    __m128i lfs[4];
+    size_t index = 0;
+    int mask, part;
+
+    /*  Each block needs one byte beyond it for the offset loads  */
+
+    while ( index + 65 <= len ) {
+        block = (const __m128i *) (data + index + 1);
+        lfs[0] = _mm_cmpeq_epi8(_mm_loadu_si128(block), lf);
+        lfs[1] = _mm_cmpeq_epi8(_mm_loadu_si128(block + 1), lf);
+        lfs[2] = _mm_cmpeq_epi8(_mm_loadu_si128(block + 2), lf);
+        lfs[3] = _mm_cmpeq_epi8(_mm_loadu_si128(block + 3), lf);
+
+        if ( _mm_movemask_epi8(_mm_or_si128(_mm_or_si128(lfs[0], lfs[1]),
+                                            _mm_or_si128(lfs[2], lfs[3]))) ) {
+            for ( part = 0; part < 4; ++part ) {
+                mask = _mm_movemask_epi8(_mm_and_si128(lfs[part],
+                        _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *)
+                                (data + index + part * 16)), cr)));
+                if ( mask != 0 ) {
+                    return data + index + part * 16 +
+                           __builtin_ctz((unsigned int) mask);
+                }
+            }
+        }
+        index += 64;
+    }
+
+    while ( index + 17 <= len ) {
+        mask = _mm_movemask_epi8(_mm_and_si128(
+                _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *)
+                        (data + index)), cr),
+                _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *)
+                        (data + index + 1)), lf)));
+        if ( mask != 0 ) {
+            return data + index + __builtin_ctz((unsigned int) mask);
+        }
+        index += 16;
+    }
+
+    return socket_find_crlf_scalar(data + index, len - index);
+}
+
+
+/*!
+ * \brief           Finds a `\r\n` pair 64 bytes at a time with AVX2.
+ * \details         Must only be called on a CPU which supports AVX2.
+ * Works in the same way as socket_find_crlf_sse2().
+ * \param data      The data to search.
+ * \param len       The number of bytes of data to search.
+ * \returns         A pointer to the `\r` of the first `\r\n` pair lying
+ * wholly within the data, or NULL if there is no such pair.
+ */
+
+__attribute__((target("avx2")))
+const char * socket_find_crlf_avx2(const char * data, const size_t len) {
+    const __m256i cr = _mm256_set1_epi8('\r');
+    const __m256i lf = _mm256_set1_epi8('\n');
+    const __m256i * block;
+    __m256i lfs[2];
+    size_t index = 0;
+    unsigned int mask;
+    int part;
+
+    while ( index + 65 <= len ) {
+        block = (const __m256i *) (data + index + 1);
+        lfs[0] = _mm256_cmpeq_epi8(_mm256_loadu_si256(block), lf);
+        lfs[1] = _mm256_cmpeq_epi8(_mm256_loadu_si256(block + 1), lf);
+
+        if ( !_mm256_testz_si256(_mm256_or_si256(lfs[0], lfs[1]),
+                                 _mm256_or_si256(lfs[0], lfs[1])) ) {
+            for ( part = 0; part < 2; ++part ) {
+                mask = (unsigned int) _mm256_movemask_epi8(
+                        _mm256_and_si256(lfs[part],
+                            _mm256_cmpeq_epi8(_mm256_loadu_si256(
+                                (const __m256i *) (data + index + part * 32)),
+                                cr)));
+                if ( mask != 0 ) {
+                    return data + index + part * 32 + __builtin_ctz(mask);
+                }
+            }
+        }
+        index += 64;
+    }
+
+    return socket_find_crlf_sse2(data + index, len - index);
+}
+
+#endif          /*  SOCKET_HELPERS_X86_SIMD  */
+
+
+/*!
+ * \brief           Selects the best scanner for the running CPU.
+ */
+
+static void select_crlf_scanner(void) {
+    CrlfScanner scanner = socket_find_crlf_scalar;
+    const char * name = "scalar";
+
+#ifdef SOCKET_HELPERS_X86_SIMD
+    __builtin_cpu_init();
+    if ( __builtin_cpu_supports("avx2") ) {
+        scanner = socket_find_crlf_avx2;
+        name = "avx2";
+    } else if ( __builtin_cpu_supports("sse2") ) {
+        scanner = socket_find_crlf_sse2;
+        name = "sse2";
+    }
+#endif
+
+    __atomic_store_n(&crlf_scanner_name, name, __ATOMIC_RELAXED);
+    __atomic_store_n(&crlf_scanner, scanner, __ATOMIC_RELAXED);
+}
+
+
+/*!
+ * \brief           Finds the first `\r\n` pair in a block of data.
+ * \details         Uses the fastest scanner the running CPU supports.
+ * \param data      The data to search.
+ * \param len       The number of bytes of data to search.
+ * \returns         A pointer to the `\r` of the first `\r\n` pair lying
+ * wholly within the data, or NULL if there is no such pair.
+ */
+
+const char * socket_find_crlf(const char * data, const size_t len) {
+    CrlfScanner scanner = __atomic_load_n(&crlf_scanner, __ATOMIC_RELAXED);
+
+    if ( scanner == NULL ) {
+        select_crlf_scanner();
+        scanner = crlf_scanner;
+    }
+
+    return scanner(data, len);
+}
+
+
+/*!
+ * \brief           Gets the name of the scanner socket_find_crlf() uses.
+ * \returns         One of "avx2", "sse2" or "scalar".
+ */
+
+const char * socket_crlf_scanner_name(void) {
+    if ( __atomic_load_n(&crlf_scanner_name, __ATOMIC_RELAXED) == NULL ) {
+        select_crlf_scanner();
+    }
+
+    return crlf_scanner_name;
+}
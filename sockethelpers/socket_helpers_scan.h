@@ -0,0 +1,44 @@
+/*!
+ * \file            socket_helpers_scan.h
+ * \brief           Interface to line terminator scanning functions.
+ * \details         Interface to line terminator scanning functions.
+ * \author          Paul Griffiths
+ * \copyright       Copyright 2013 Paul Griffiths. Distributed under the terms
+ * of the GNU General Public License. <http://www.gnu.org/licenses/>
+ */
+
+
+#ifndef PG_SOCKET_HELPERS_SCAN_H
+#define PG_SOCKET_HELPERS_SCAN_H
+
+#include <stddef.h>
+
+
+/*!
+ * \brief           Defined if SSE2 and AVX2 scanners are available.
+ */
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+# define SOCKET_HELPERS_X86_SIMD
+#endif
+
+
+/*  Function prototypes  */
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+const char * socket_find_crlf(const char * data, const size_t len);
+const char * socket_find_crlf_scalar(const char * data, const size_t len);
+#ifdef SOCKET_HELPERS_X86_SIMD
+const char * socket_find_crlf_sse2(const char * data, const size_t len);
+const char * socket_find_crlf_avx2(const char * data, const size_t len);
+#endif
+const char * socket_crlf_scanner_name(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif          /*  PG_SOCKET_HELPERS_SCAN_H  */
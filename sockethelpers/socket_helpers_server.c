@@ -8,13 +8,24 @@
  */
 
 
+#define _GNU_SOURCE
+
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <errno.h>
+#include <unistd.h>
 #include <pthread.h>
+#include <sched.h>
+#include <time.h>
+#include <sys/socket.h>
 #include <netinet/in.h>
+#include <linux/filter.h>
 #include <paulgrif/chelpers.h>
 #include "socket_helpers_server.h"
+#include "socket_helpers_slab.h"
+#include "socket_helpers_error.h"
+#include "socket_helpers_metrics.h"
 
 
 /*!
@@ -33,16 +44,85 @@
 static const int backlog = 1024;
 
 
+/*!
+ * \brief           Struct for passing to shard acceptor threads.
+ */
+
+typedef struct ShardAcceptor {
+    TcpShard * shard;               /*!< The shard to accept on */
+    void * (*sfunc)(void *);        /*!< Server thread function */
+} ShardAcceptor;
+
+
+/*!
+ * \brief           File scope variable for the turn counters.
+ * \details         Updated with relaxed atomics by all server threads.
+ */
+
+static ServerRoundStats round_stats = {0, 0, 0, 0};
+
+
+/*!
+ * \brief           Struct for a connection accepted by a threaded server.
+ * \details         The public tag comes first, so that the pointer the
+ * server function is given, and may `free()`, is the one allocated.
+ */
+
+typedef struct ThreadTag {
+    ServerTag tag;                  /*!< Tag passed to the server function */
+    void * (*sfunc)(void *);        /*!< Server thread function to run */
+    struct ThreadTag * next;        /*!< Next connection waiting for a thread */
+} ThreadTag;
+
+
+/*!
+ * \brief           Struct for the threaded servers' admission state.
+ * \details         The counters are changed with the mutex held, but
+ * atomically, so they can be read without it.
+ */
+
+typedef struct ServerAdmission {
+    pthread_mutex_t mutex;          /*!< Guards the other fields */
+    pthread_cond_t cond;            /*!< Signalled when a connection closes */
+    ServerLimits limits;            /*!< The limits */
+    ThreadTag * head;               /*!< Connection waiting longest */
+    ThreadTag * tail;               /*!< Connection waiting least long */
+    ServerAdmissionStats stats;     /*!< The counters */
+} ServerAdmission;
+
+
+/*!
+ * \brief           File scope variable for the admission state.
+ */
+
+static ServerAdmission admission = {
+    PTHREAD_MUTEX_INITIALIZER,
+    PTHREAD_COND_INITIALIZER,
+    {0, 0, SERVER_LIMIT_WAIT, NULL},
+    NULL,
+    NULL,
+    {0, 0, 0, 0, 0, 0, 0}
+};
+
+
+/*  Function prototypes  */
+
+static int start_server_thread(ThreadTag * thread_tag);
+
+
 /*!
  * \brief           Creates a TCP listening socket.
  * \details         The function creates an IPv4 socket by default, but
  * creates an IPv6 socket if the IPV6 preprocessor macro is defined.
  * \param listening_port The port the socket should listen on
+ * \param reuse_port Non-zero to set `SO_REUSEPORT` before binding.
  * \returns         The file descriptor of the created listening socket
  * on success, or -1 on encountering an error.
  */
 
-int create_tcp_server_socket(const uint16_t listening_port) {
+static int create_server_socket(const uint16_t listening_port,
+                                const int reuse_port) {
+    const int on = 1;
 
 #ifdef IPV6
     struct sockaddr_in6 server_address;
@@ -57,6 +137,13 @@ int create_tcp_server_socket(const uint16_t listening_port) {
         return ERROR_RETURN;
     }
 
+    if ( reuse_port && setsockopt(listening_socket, SOL_SOCKET, SO_REUSEPORT,
+                                  &on, sizeof(on)) == -1 ) {
+        set_errno_errmsg("error setting SO_REUSEPORT");
+        close(listening_socket);
+        return ERROR_RETURN;
+    }
+
     memset(&server_address, 0, sizeof(server_address));
 
 #ifdef IPV6
@@ -84,9 +171,575 @@ int create_tcp_server_socket(const uint16_t listening_port) {
 }
 
 
+/*!
+ * \brief           Creates a TCP listening socket.
+ * \details         The function creates an IPv4 socket by default, but
+ * creates an IPv6 socket if the IPV6 preprocessor macro is defined.
+ * \param listening_port The port the socket should listen on
+ * \returns         The file descriptor of the created listening socket
+ * on success, or -1 on encountering an error.
+ */
+
+int create_tcp_server_socket(const uint16_t listening_port) {
+    return create_server_socket(listening_port, 0);
+}
+
+
+/*!
+ * \brief           Steers each connection to the shard for its CPU.
+ * \details         Sets `SO_INCOMING_CPU` on each listening socket, so
+ * that the kernel prefers the listener for the CPU which received the
+ * connection's packets, and attaches a classic BPF program to the
+ * reuseport group which selects shard `cpu % num_shards` directly. The
+ * listeners must have been created in shard order. Steering is an
+ * optimization only, so failures are ignored, and kernels without the
+ * BPF option fall back to `SO_INCOMING_CPU` alone.
+ * \param shards    The shards.
+ * \param num_shards The number of shards.
+ */
+
+static void steer_shards_by_cpu(TcpShard * shards, const int num_shards) {
+    struct sock_filter code[3];
+    struct sock_fprog prog;
+    int index;
+
+    for ( index = 0; index < num_shards; ++index ) {
+        setsockopt(shards[index].l_socket, SOL_SOCKET, SO_INCOMING_CPU,
+                   &shards[index].cpu, sizeof(shards[index].cpu));
+    }
+
+    /*  A = current CPU; A = A % num_shards; return A  */
+
+    code[0].code = BPF_LD | BPF_W | BPF_ABS;
+    code[0].jt = code[0].jf = 0;
+    code[0].k = (unsigned int) (SKF_AD_OFF + SKF_AD_CPU);
+    code[1].code = BPF_ALU | BPF_MOD | BPF_K;
+    code[1].jt = code[1].jf = 0;
+    code[1].k = (unsigned int) num_shards;
+    code[2].code = BPF_RET | BPF_A;
+    code[2].jt = code[2].jf = 0;
+    code[2].k = 0;
+
+    prog.len = sizeof(code) / sizeof(code[0]);
+    prog.filter = code;
+
+#ifdef SO_ATTACH_REUSEPORT_CBPF
+    setsockopt(shards[0].l_socket, SOL_SOCKET, SO_ATTACH_REUSEPORT_CBPF,
+               &prog, sizeof(prog));
+#endif
+}
+
+
+/*!
+ * \brief           Creates a set of `SO_REUSEPORT` listening sockets.
+ * \details         All the sockets listen on the same port, and the
+ * kernel spreads incoming connections across them, so each shard can
+ * have its own acceptor.
+ * \param listening_port The port the sockets should listen on
+ * \param shards    An array of `num_shards` shards to initialize.
+ * \param num_shards The number of shards.
+ * \param flags     `SHARD_STEER_CPU` to assign shard `i` to CPU
+ * `i % online CPUs`, pin the threads running it to that CPU, and steer
+ * connections to the shard for the CPU which received them, or zero.
+ * \returns         0 on success, or -1 on encountering an error.
+ */
+
+int create_tcp_server_shards(const uint16_t listening_port, TcpShard * shards,
+                             const int num_shards, const int flags) {
+    long num_cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    int index;
+
+    if ( num_cpus < 1 ) {
+        num_cpus = 1;
+    }
+
+    for ( index = 0; index < num_shards; ++index ) {
+        shards[index].cpu = (flags & SHARD_STEER_CPU) ?
+                            (int) (index % num_cpus) : -1;
+        shards[index].accepts = 0;
+        shards[index].l_socket = create_server_socket(listening_port, 1);
+        if ( shards[index].l_socket == -1 ) {
+            while ( index-- > 0 ) {
+                close(shards[index].l_socket);
+            }
+            return ERROR_RETURN;
+        }
+    }
+
+    if ( flags & SHARD_STEER_CPU ) {
+        steer_shards_by_cpu(shards, num_shards);
+    }
+
+    return 0;
+}
+
+
+/*!
+ * \brief           Gets the number of connections a shard has accepted.
+ * \param shard     The shard.
+ * \returns         The number of connections accepted.
+ */
+
+unsigned long get_shard_accept_count(const TcpShard * shard) {
+    return __atomic_load_n(&shard->accepts, __ATOMIC_RELAXED);
+}
+
+
+/*!
+ * \brief           Counts a connection whose turn ended with input left.
+ * \details         Called by the servers when a connection has used up
+ * its input budget and is requeued behind the other connections.
+ * \returns         The time the connection started waiting, to be passed
+ * to server_round_resumed(). Never 0.
+ */
+
+uint64_t server_round_deferred(void) {
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    __atomic_add_fetch(&round_stats.deferrals, 1, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&round_stats.waiting, 1, __ATOMIC_RELAXED);
+    return (uint64_t) now.tv_sec * 1000000 +
+           (uint64_t) now.tv_nsec / 1000 + 1;
+}
+
+
+/*!
+ * \brief           Counts the end of a requeued connection's wait.
+ * \details         Called when the connection's next turn starts, or
+ * when it is closed while waiting.
+ * \param deferred_us The value returned by server_round_deferred().
+ */
+
+void server_round_resumed(const uint64_t deferred_us) {
+    struct timespec now;
+    unsigned long wait_us, max_wait_us;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    wait_us = (unsigned long) ((uint64_t) now.tv_sec * 1000000 +
+                               (uint64_t) now.tv_nsec / 1000 + 1 -
+                               deferred_us);
+
+    __atomic_sub_fetch(&round_stats.waiting, 1, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&round_stats.total_wait_us, wait_us,
+                       __ATOMIC_RELAXED);
+
+    max_wait_us = __atomic_load_n(&round_stats.max_wait_us, __ATOMIC_RELAXED);
+    while ( wait_us > max_wait_us &&
+            !__atomic_compare_exchange_n(&round_stats.max_wait_us,
+                                         &max_wait_us, wait_us, 1,
+                                         __ATOMIC_RELAXED,
+                                         __ATOMIC_RELAXED) ) {
+        ;
+    }
+}
+
+
+/*!
+ * \brief           Gets the counters of connections which used up their
+ * turns.
+ * \param stats     Pointer to a struct to receive the counters.
+ */
+
+void get_server_round_stats(ServerRoundStats * stats) {
+    stats->deferrals = __atomic_load_n(&round_stats.deferrals,
+                                       __ATOMIC_RELAXED);
+    stats->waiting = __atomic_load_n(&round_stats.waiting, __ATOMIC_RELAXED);
+    stats->total_wait_us = __atomic_load_n(&round_stats.total_wait_us,
+                                           __ATOMIC_RELAXED);
+    stats->max_wait_us = __atomic_load_n(&round_stats.max_wait_us,
+                                         __ATOMIC_RELAXED);
+}
+
+
+/*!
+ * \brief           Checks whether an `accept()` failed for want of
+ * resources.
+ * \details         Such a failure is transient, so a server should stop
+ * accepting for up to `SERVER_RETRY_MS` milliseconds, or until it
+ * closes a connection, rather than stop.
+ * \param errnum    The `errno` value set by `accept()`.
+ * \returns         TRUE if the process or system ran out of file
+ * descriptors or memory, otherwise FALSE.
+ */
+
+int server_accept_exhausted(const int errnum) {
+    return errnum == EMFILE || errnum == ENFILE ||
+           errnum == ENOBUFS || errnum == ENOMEM;
+}
+
+
+/*!
+ * \brief           Pins the calling thread to a CPU.
+ * \param cpu       The CPU, or -1 to leave the thread unpinned.
+ * \returns         0 on success, or -1 on encountering an error.
+ */
+
+int pin_thread_to_cpu(const int cpu) {
+    cpu_set_t cpu_set;
+
+    if ( cpu < 0 ) {
+        return 0;
+    }
+
+    CPU_ZERO(&cpu_set);
+    CPU_SET(cpu, &cpu_set);
+
+    if ( pthread_setaffinity_np(pthread_self(), sizeof(cpu_set),
+                                &cpu_set) != 0 ) {
+        return ERROR_RETURN;
+    }
+
+    return 0;
+}
+
+
+/*!
+ * \brief           Counts a connection rejected by a threaded server.
+ * \details         Sends the limits' reject message without waiting, in
+ * case the peer is not reading, and closes the connection.
+ * \param conn_socket File descriptor for the connected socket.
+ */
+
+static void reject_conn(const int conn_socket) {
+    const char * msg = admission.limits.reject_msg;
+
+    if ( msg != NULL ) {
+        send(conn_socket, msg, strlen(msg), MSG_DONTWAIT | MSG_NOSIGNAL);
+    }
+    close(conn_socket);
+    __atomic_add_fetch(&admission.stats.rejected, 1, __ATOMIC_RELAXED);
+}
+
+
+/*!
+ * \brief           Adds a connection to the end of the waiting list.
+ * \details         Must be called with the admission mutex held.
+ * \param thread_tag The connection's tag.
+ */
+
+static void wait_for_thread(ThreadTag * thread_tag) {
+    unsigned long queued;
+
+    thread_tag->next = NULL;
+    if ( admission.tail != NULL ) {
+        admission.tail->next = thread_tag;
+    } else {
+        admission.head = thread_tag;
+    }
+    admission.tail = thread_tag;
+
+    queued = __atomic_add_fetch(&admission.stats.queued, 1, __ATOMIC_RELAXED);
+    if ( queued > admission.stats.max_queued ) {
+        __atomic_store_n(&admission.stats.max_queued, queued,
+                         __ATOMIC_RELAXED);
+    }
+}
+
+
+/*!
+ * \brief           Finishes a server thread.
+ * \details         Runs as the thread's cleanup handler, so also when
+ * the server function calls pthread_exit(). The thread's slot passes to
+ * the connection which has waited longest for a thread, if there is
+ * one, and a paused acceptor is woken for the connection closed.
+ * \param arg       Not used.
+ */
+
+static void end_server_thread(void * arg) {
+    ThreadTag * thread_tag;
+
+    (void) arg;
+
+    socket_metrics_add(SOCKET_METRIC_CLOSED, 1);
+
+    pthread_mutex_lock(&admission.mutex);
+    __atomic_sub_fetch(&admission.stats.conns, 1, __ATOMIC_RELAXED);
+    pthread_cond_broadcast(&admission.cond);
+
+    while ( (thread_tag = admission.head) != NULL ) {
+        if ( (admission.head = thread_tag->next) == NULL ) {
+            admission.tail = NULL;
+        }
+        __atomic_sub_fetch(&admission.stats.queued, 1, __ATOMIC_RELAXED);
+        pthread_mutex_unlock(&admission.mutex);
+
+        if ( start_server_thread(thread_tag) == 0 ) {
+            return;
+        }
+        reject_conn(thread_tag->tag.c_socket);
+        free(thread_tag);
+
+        pthread_mutex_lock(&admission.mutex);
+        __atomic_sub_fetch(&admission.stats.conns, 1, __ATOMIC_RELAXED);
+        pthread_cond_broadcast(&admission.cond);
+    }
+
+    __atomic_sub_fetch(&admission.stats.threads, 1, __ATOMIC_RELAXED);
+    pthread_mutex_unlock(&admission.mutex);
+}
+
+
+/*!
+ * \brief           Thread function for threaded server threads.
+ * \details         Runs the server function for the connection, and
+ * then lets the admission state know the thread has finished. The
+ * thread keeps no slab cache, as it spends most of its time blocked.
+ * \param arg       Pointer to the connection's ThreadTag struct, whose
+ * ServerTag is passed to the server function.
+ * \returns         The server function's return value.
+ */
+
+static void * server_thread(void * arg) {
+    ThreadTag * thread_tag = arg;
+    void * (*sfunc)(void *) = thread_tag->sfunc;
+    void * result;
+
+    socket_metrics_add(SOCKET_METRIC_OPENED, 1);
+    socket_slab_set_thread_cache(FALSE);
+
+    pthread_cleanup_push(end_server_thread, NULL);
+    result = sfunc(&thread_tag->tag);
+    pthread_cleanup_pop(1);
+
+    return result;
+}
+
+
+/*!
+ * \brief           Starts a server thread for a connection.
+ * \param thread_tag The connection's tag.
+ * \returns         0 on success, or -1 if the thread could not be created.
+ */
+
+static int start_server_thread(ThreadTag * thread_tag) {
+    pthread_t thread_id;
+
+    if ( pthread_create(&thread_id, NULL, server_thread, thread_tag) != 0 ) {
+        __atomic_add_fetch(&admission.stats.thread_failures, 1,
+                           __ATOMIC_RELAXED);
+        socket_count_error(SOCKET_ERROR_RESOURCE);
+        return ERROR_RETURN;
+    }
+
+    return 0;
+}
+
+
+/*!
+ * \brief           Gets the most connections to have open at once.
+ * \returns         The limit, or 0 for no limit.
+ */
+
+static size_t conn_limit(void) {
+    return admission.limits.max_conns > 0 ? admission.limits.max_conns :
+                                            admission.limits.max_threads;
+}
+
+
+/*!
+ * \brief           Waits until a connection may be accepted.
+ * \details         Returns at once unless the policy is
+ * `SERVER_LIMIT_WAIT` and the connection limit has been reached.
+ */
+
+static void wait_for_capacity(void) {
+    const size_t limit = conn_limit();
+
+    if ( limit == 0 || admission.limits.policy != SERVER_LIMIT_WAIT ) {
+        return;
+    }
+
+    pthread_mutex_lock(&admission.mutex);
+    if ( admission.stats.conns >= limit ) {
+        __atomic_add_fetch(&admission.stats.pauses, 1, __ATOMIC_RELAXED);
+        while ( admission.stats.conns >= limit ) {
+            pthread_cond_wait(&admission.cond, &admission.mutex);
+        }
+    }
+    pthread_mutex_unlock(&admission.mutex);
+}
+
+
+/*!
+ * \brief           Waits for file descriptors or memory to free up.
+ * \details         Called when `accept()` fails for want of resources,
+ * and waits until a connection is closed, or for at most
+ * `SERVER_RETRY_MS` milliseconds.
+ */
+
+static void pause_accepting(void) {
+    struct timespec until;
+
+    clock_gettime(CLOCK_REALTIME, &until);
+    until.tv_nsec += SERVER_RETRY_MS * 1000000L;
+    if ( until.tv_nsec >= 1000000000L ) {
+        until.tv_sec += 1;
+        until.tv_nsec -= 1000000000L;
+    }
+
+    pthread_mutex_lock(&admission.mutex);
+    __atomic_add_fetch(&admission.stats.pauses, 1, __ATOMIC_RELAXED);
+    pthread_cond_timedwait(&admission.cond, &admission.mutex, &until);
+    pthread_mutex_unlock(&admission.mutex);
+}
+
+
+/*!
+ * \brief           Serves or rejects an accepted connection.
+ * \details         A connection over the connection limit is rejected,
+ * or under `SERVER_LIMIT_WAIT` waits for a connection to close, as
+ * another shard's acceptor may have taken the last slot since
+ * wait_for_capacity() returned. One at the thread limit, or whose
+ * thread could not be created while other server threads are running,
+ * waits for a thread to finish.
+ * \param thread_tag The connection's tag.
+ */
+
+static void admit_conn(ThreadTag * thread_tag) {
+    const size_t limit = conn_limit();
+
+    pthread_mutex_lock(&admission.mutex);
+
+    if ( limit > 0 && admission.limits.policy == SERVER_LIMIT_WAIT ) {
+        while ( admission.stats.conns >= limit ) {
+            pthread_cond_wait(&admission.cond, &admission.mutex);
+        }
+    } else if ( limit > 0 && admission.stats.conns >= limit ) {
+        pthread_mutex_unlock(&admission.mutex);
+        reject_conn(thread_tag->tag.c_socket);
+        free(thread_tag);
+        return;
+    }
+
+    __atomic_add_fetch(&admission.stats.conns, 1, __ATOMIC_RELAXED);
+    if ( admission.limits.max_threads > 0 &&
+         admission.stats.threads >= admission.limits.max_threads ) {
+        wait_for_thread(thread_tag);
+        pthread_mutex_unlock(&admission.mutex);
+        return;
+    }
+
+    __atomic_add_fetch(&admission.stats.threads, 1, __ATOMIC_RELAXED);
+    pthread_mutex_unlock(&admission.mutex);
+
+    if ( start_server_thread(thread_tag) == 0 ) {
+        return;
+    }
+
+    pthread_mutex_lock(&admission.mutex);
+    if ( __atomic_sub_fetch(&admission.stats.threads, 1,
+                            __ATOMIC_RELAXED) > 0 ) {
+        wait_for_thread(thread_tag);
+        pthread_mutex_unlock(&admission.mutex);
+        return;
+    }
+    __atomic_sub_fetch(&admission.stats.conns, 1, __ATOMIC_RELAXED);
+    pthread_cond_broadcast(&admission.cond);
+    pthread_mutex_unlock(&admission.mutex);
+
+    reject_conn(thread_tag->tag.c_socket);
+    free(thread_tag);
+}
+
+
+/*!
+ * \brief           Accepts connections and passes them to server threads.
+ * \details         Running out of file descriptors, memory or threads
+ * rejects or delays connections, but does not stop the server.
+ * \param listening_socket A file descriptor for a listening socket.
+ * \param sfunc     A pointer to a server thread function.
+ * \param accepts   A pointer to a counter to increment atomically for each
+ * accepted connection, or NULL.
+ * \returns         Returns non-zero on encountering an error.
+ */
+
+static int run_threaded_acceptor(const int listening_socket,
+                                 void * (*sfunc)(void *),
+                                 unsigned long * accepts) {
+    ThreadTag * thread_tag;
+    int conn_socket;
+
+    while ( 1 ) {
+        wait_for_capacity();
+
+        if ( (conn_socket = accept(listening_socket, NULL, NULL)) == -1 ) {
+            if ( errno == EINTR || errno == ECONNABORTED ||
+                 errno == EPROTO ) {
+                continue;
+            } else if ( server_accept_exhausted(errno) ) {
+                socket_count_error(SOCKET_ERROR_RESOURCE);
+                pause_accepting();
+                continue;
+            }
+            set_errno_errmsg("Error accepting connection");
+            return ERROR_RETURN;
+        }
+
+        if ( accepts != NULL ) {
+            __atomic_add_fetch(accepts, 1, __ATOMIC_RELAXED);
+        }
+        socket_metrics_add(SOCKET_METRIC_ACCEPTS, 1);
+
+        if ( (thread_tag = malloc(sizeof(*thread_tag))) == NULL ) {
+            socket_count_error(SOCKET_ERROR_RESOURCE);
+            reject_conn(conn_socket);
+            continue;
+        }
+
+        thread_tag->tag.c_socket = conn_socket;
+        thread_tag->tag.accepted_ns = socket_clock_ns();
+        thread_tag->sfunc = sfunc;
+        thread_tag->next = NULL;
+        admit_conn(thread_tag);
+    }
+}
+
+
+/*!
+ * \brief           Sets the limits on threaded servers.
+ * \details         Applies to start_threaded_tcp_server() and
+ * start_sharded_tcp_server(), with the limits shared by all shards.
+ * Must be called before any connections are accepted.
+ * \param limits    The limits, which are copied. The reject message must
+ * remain valid while the server runs.
+ */
+
+void set_server_limits(const ServerLimits * limits) {
+    pthread_mutex_lock(&admission.mutex);
+    admission.limits = *limits;
+    pthread_mutex_unlock(&admission.mutex);
+}
+
+
+/*!
+ * \brief           Gets the threaded servers' admission counters.
+ * \details         Takes no locks, so the counters are each up to date,
+ * but not necessarily consistent with one another.
+ * \param stats     Pointer to a struct to receive the counters.
+ */
+
+void get_server_admission_stats(ServerAdmissionStats * stats) {
+    stats->conns = __atomic_load_n(&admission.stats.conns, __ATOMIC_RELAXED);
+    stats->threads = __atomic_load_n(&admission.stats.threads,
+                                     __ATOMIC_RELAXED);
+    stats->queued = __atomic_load_n(&admission.stats.queued,
+                                    __ATOMIC_RELAXED);
+    stats->max_queued = __atomic_load_n(&admission.stats.max_queued,
+                                        __ATOMIC_RELAXED);
+    stats->rejected = __atomic_load_n(&admission.stats.rejected,
+                                      __ATOMIC_RELAXED);
+    stats->pauses = __atomic_load_n(&admission.stats.pauses,
+                                    __ATOMIC_RELAXED);
+    stats->thread_failures = __atomic_load_n(&admission.stats.thread_failures,
+                                             __ATOMIC_RELAXED);
+}
+
+
 /*!
  * \brief           Starts an active server.
- * \details         Connections are passed to a new server thread.
+ * \details         Connections are passed to a new server thread,
+ * subject to the limits set by set_server_limits().
  * \param listening_socket A file descriptor for a listening socket.
  * \param sfunc     A pointer to a server thread function. The function
  * should return a pointer to void and accept a single pointer to void
@@ -100,32 +753,63 @@ int create_tcp_server_socket(const uint16_t listening_port) {
 
 int start_threaded_tcp_server(const int listening_socket,
                               void * (*sfunc)(void *)) {
-    ServerTag * server_tag;
-    pthread_t thread_id;
-    int failure_code = 0;
-    int conn_socket;
+    return run_threaded_acceptor(listening_socket, sfunc, NULL);
+}
 
-    while ( failure_code == 0 ) {
-        if ( (conn_socket = accept(listening_socket, NULL, NULL)) == -1 ) {
-            set_errno_errmsg("Error accepting connection");
-            failure_code = ERROR_RETURN;
-            break;
-        }
 
-        if ( (server_tag = malloc(sizeof(*server_tag))) == NULL ) {
-            set_errno_errmsg("Error allocating server tag");
-            failure_code = ERROR_RETURN;
-            break;
-        }
+/*!
+ * \brief           Thread function for additional shard acceptors.
+ * \param arg       Pointer to a ShardAcceptor struct.
+ * \returns         NULL
+ */
+
+static void * shard_acceptor_thread(void * arg) {
+    ShardAcceptor * acceptor = arg;
+
+    pin_thread_to_cpu(acceptor->shard->cpu);
+    run_threaded_acceptor(acceptor->shard->l_socket, acceptor->sfunc,
+                          &acceptor->shard->accepts);
+    return NULL;
+}
+
+
+/*!
+ * \brief           Starts an active server on a set of shards.
+ * \details         Each shard has its own acceptor thread, one of which
+ * is the calling thread, and connections are passed to a new server
+ * thread as by start_threaded_tcp_server(). When a shard is assigned
+ * to a CPU, its acceptor and server threads are pinned to that CPU.
+ * \param shards    The shards, created with create_tcp_server_shards().
+ * \param num_shards The number of shards.
+ * \param sfunc     A pointer to a server thread function, as for
+ * start_threaded_tcp_server().
+ * \returns         Returns non-zero on encountering an error. The
+ * server runs in an infinite loop, and this function will not return
+ * unless an error is encountered.
+ */
+
+int start_sharded_tcp_server(TcpShard * shards, const int num_shards,
+                             void * (*sfunc)(void *)) {
+    ShardAcceptor * acceptors;
+    pthread_t thread_id;
+    int index;
+
+    if ( (acceptors = malloc(num_shards * sizeof(*acceptors))) == NULL ) {
+        set_errno_errmsg("Error allocating shard acceptors");
+        return ERROR_RETURN;
+    }
 
-        server_tag->c_socket = conn_socket;
-        if ( pthread_create(&thread_id, NULL, sfunc, server_tag) != 0 ) {
+    for ( index = 1; index < num_shards; ++index ) {
+        acceptors[index].shard = &shards[index];
+        acceptors[index].sfunc = sfunc;
+        if ( pthread_create(&thread_id, NULL, shard_acceptor_thread,
+                            &acceptors[index]) != 0 ) {
             set_errmsg("Error creating thread");
-            free(server_tag);
-            failure_code = ERROR_RETURN;
-            break;
+            return ERROR_RETURN;
         }
     }
 
-    return failure_code;
+    pin_thread_to_cpu(shards[0].cpu);
+    return run_threaded_acceptor(shards[0].l_socket, sfunc,
+                                 &shards[0].accepts);
 }
@@ -18,14 +18,123 @@
 /*!
  * \brief           Struct for passing to server threads.
  * \details         Contains a file descriptor for the connected socket,
- * as the server obviously needs to know this.
+ * as the server obviously needs to know this, and when it was accepted.
  */
 
 typedef struct ServerTag {
     int c_socket;       /*!< File descriptor for the connected socket */
+    uint64_t accepted_ns;   /*!< When the connection was accepted, from
+                                 socket_clock_ns(), or 0 once the time
+                                 to its first input is recorded */
 } ServerTag;
 
 
+/*!
+ * \brief           Limit policy to stop accepting connections while at
+ * the connection limit, so that new connections wait in the listening
+ * socket's backlog.
+ */
+
+#define SERVER_LIMIT_WAIT 0
+
+
+/*!
+ * \brief           Limit policy to accept connections while at the
+ * connection limit, and close them straight away.
+ */
+
+#define SERVER_LIMIT_REJECT 1
+
+
+/*!
+ * \brief           Struct for the limits on a threaded server.
+ * \details         Connections accepted while at the thread limit, but
+ * under the connection limit, wait for a server thread to finish. A
+ * zeroed struct gives no limits.
+ */
+
+typedef struct ServerLimits {
+    size_t max_conns;           /*!< Most connections open at once, or 0
+                                     for `max_threads` */
+    size_t max_threads;         /*!< Most server threads at once, or 0 for
+                                     no limit */
+    int policy;                 /*!< `SERVER_LIMIT_WAIT` or
+                                     `SERVER_LIMIT_REJECT` */
+    const char * reject_msg;    /*!< Sent to a rejected connection before
+                                     it is closed, or NULL */
+} ServerLimits;
+
+
+/*!
+ * \brief           Struct for the threaded servers' admission counters.
+ */
+
+typedef struct ServerAdmissionStats {
+    unsigned long conns;        /*!< Connections now open */
+    unsigned long threads;      /*!< Server threads now running */
+    unsigned long queued;       /*!< Connections now waiting for a thread */
+    unsigned long max_queued;   /*!< Most connections waiting at once */
+    unsigned long rejected;     /*!< Connections rejected */
+    unsigned long pauses;       /*!< Times accepting stopped at a limit */
+    unsigned long thread_failures;  /*!< Server threads not created */
+} ServerAdmissionStats;
+
+
+/*!
+ * \brief           Milliseconds to wait before accepting again, after
+ * running out of file descriptors or memory.
+ */
+
+#define SERVER_RETRY_MS 100
+
+
+/*!
+ * \brief           Default input budget for one connection's turn, in
+ * bytes.
+ * \details         The event-loop and pooled servers move on to other
+ * connections once a connection has had this much input handled, and
+ * come back to it once the others have had their turn.
+ */
+
+#define SERVER_ROUND_BYTES (64UL * 1024)
+
+
+/*!
+ * \brief           Struct for the counters of connections which used
+ * up their turns.
+ * \details         Covers the epoll event-loop and pooled servers. The
+ * waits are measured from the end of a connection's turn to the start
+ * of its next, so they show how long other connections held it up.
+ */
+
+typedef struct ServerRoundStats {
+    unsigned long deferrals;        /*!< Turns ended with input left */
+    unsigned long waiting;          /*!< Connections now waiting a turn */
+    unsigned long total_wait_us;    /*!< Microseconds waited, in total */
+    unsigned long max_wait_us;      /*!< Longest wait, in microseconds */
+} ServerRoundStats;
+
+
+/*!
+ * \brief           Flag to steer connections to a shard per CPU.
+ */
+
+#define SHARD_STEER_CPU 1
+
+
+/*!
+ * \brief           Struct for a listening shard.
+ * \details         Each shard has its own `SO_REUSEPORT` listening
+ * socket and its own acceptor.
+ */
+
+typedef struct TcpShard {
+    int l_socket;               /*!< The shard's listening socket */
+    int cpu;                    /*!< CPU the shard is pinned to, or -1 */
+    unsigned long accepts;      /*!< Connections accepted, atomic */
+} TcpShard;
+
+
 /*  Function prototypes  */
 
 #ifdef __cplusplus
@@ -35,6 +144,18 @@ extern "C" {
 int create_tcp_server_socket(const uint16_t listening_port);
 int start_threaded_tcp_server(const int listening_socket,
                               void * (*sfunc)(void *));
+void set_server_limits(const ServerLimits * limits);
+void get_server_admission_stats(ServerAdmissionStats * stats);
+int create_tcp_server_shards(const uint16_t listening_port, TcpShard * shards,
+                             const int num_shards, const int flags);
+int start_sharded_tcp_server(TcpShard * shards, const int num_shards,
+                             void * (*sfunc)(void *));
+unsigned long get_shard_accept_count(const TcpShard * shard);
+uint64_t server_round_deferred(void);
+void server_round_resumed(const uint64_t deferred_us);
+void get_server_round_stats(ServerRoundStats * stats);
+int server_accept_exhausted(const int errnum);
+int pin_thread_to_cpu(const int cpu);
 
 #ifdef __cplusplus
 }
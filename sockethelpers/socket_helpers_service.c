@@ -0,0 +1,785 @@
+/*!
+ * \file            socket_helpers_service.c
+ * \brief           Implementation of line service functions.
+ * \details         A line service supplies only a handler, which maps each
+ * line to the slices of its reply. Framing, buffering, idle timeouts,
+ * batching of replies, and threading are the same for every service, so
+ * are handled here, on top of each of the servers: the replies to all
+ * the lines received by one read are written together with a single
+ * gathered write, and lines longer than the input buffer are passed to
+ * the handler in parts as they arrive, so need no extra memory.
+ * \author          Paul Griffiths
+ * \copyright       Copyright 2013 Paul Griffiths. Distributed under the terms
+ * of the GNU General Public License. <http://www.gnu.org/licenses/>
+ */
+
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/uio.h>
+#include <paulgrif/chelpers.h>
+#include "socket_helpers_service.h"
+#include "socket_helpers_main.h"
+#include "socket_helpers_reader.h"
+#include "socket_helpers_framer.h"
+#include "socket_helpers_epoll.h"
+#include "socket_helpers_pool.h"
+#include "socket_helpers_uring.h"
+#include "socket_helpers_conn.h"
+#include "socket_helpers_slab.h"
+#include "socket_helpers_error.h"
+#include "socket_helpers_metrics.h"
+
+
+/*!
+ * \brief           Maximum number of lines taken from a reader at once.
+ */
+
+#define SERVICE_MAX_LINES 256
+
+
+/*!
+ * \brief           Maximum number of slices in one gathered write.
+ */
+
+#define REPLY_MAX_SLICES 512
+
+
+/*!
+ * \brief           Size of a reply's buffer for copied slices.
+ */
+
+#define REPLY_SCRATCH_LEN 4096
+
+
+/*!
+ * \brief           Struct for the replies to a batch of lines.
+ * \details         Slices are gathered until the batch is flushed with a
+ * single `writev()`, so each added slice must remain valid until then.
+ * Copied slices are kept in the reply's own buffer.
+ */
+
+struct LineReply {
+    SocketConn * conn;              /*!< Connection context, or NULL */
+    SocketQueue * queue;            /*!< Pooled output queue, if no
+                                         context */
+    int c_socket;                   /*!< File descriptor for the socket */
+    int iovcnt;                     /*!< Number of slices in `iov` */
+    size_t lines;                   /*!< Lines ended in `iov` */
+    int added;                      /*!< Slices added for the current line */
+    int open;                       /*!< True if a line's reply is begun
+                                         and not yet ended */
+    int failed;                     /*!< `errno` from a failed write, or 0 */
+    uint64_t received_ns;           /*!< When the lines were received */
+    size_t scratch_len;             /*!< Bytes used in `scratch` */
+    struct iovec iov[REPLY_MAX_SLICES];     /*!< Slices of the replies */
+    char scratch[REPLY_SCRATCH_LEN];        /*!< Copied slices */
+};
+
+
+/*!
+ * \brief           Struct for an event-loop service connection.
+ */
+
+typedef struct ServiceConn {
+    SocketConn * conn;              /*!< Connection context */
+    LineFramer framer;              /*!< Framer for the connection's input */
+} ServiceConn;
+
+
+/*!
+ * \brief           File scope variable for the service being run.
+ * \details         Set before the server is started, and only read
+ * afterwards, as the servers pass no argument to their callbacks.
+ */
+
+static const LineService * line_service = NULL;
+
+
+/*!
+ * \brief           File scope variable for line ending.
+ */
+
+static const char crlf[] = "\r\n";
+
+
+/*!
+ * \brief           File scope variable for the event-loop connection slab.
+ */
+
+static SocketSlab * service_conn_slab = NULL;
+
+
+/*  Function prototypes  */
+
+static void reply_init(LineReply * reply, SocketConn * conn,
+                       SocketQueue * queue, const int c_socket);
+static int reply_flush(LineReply * reply);
+static int reply_append(LineReply * reply, const char * data,
+                        const size_t len);
+static int service_line(LineReply * reply, const char * line,
+                        const size_t len, const int complete);
+static void service_timeout(SocketConn * conn);
+static void * service_thread(void * arg);
+static int service_task(ServerTag * server_tag);
+static void service_task_timeout(ServerTag * server_tag);
+static int service_conn_open(const int c_socket, const SocketOutput * output,
+                             void ** conn_data);
+static int service_conn_data(const int c_socket, void * conn_data,
+                             const char * data, const size_t len);
+static void service_conn_close(const int c_socket, void * conn_data);
+static void service_conn_timeout(const int c_socket, void * conn_data);
+
+
+/*!
+ * \brief           File scope variable for the event-loop callbacks.
+ * \details         The idle timeout, output limits and round budget are
+ * filled in from the service when the server is started.
+ */
+
+static EpollHandler service_handler = {
+    service_conn_open,
+    service_conn_data,
+    service_conn_close,
+    service_conn_timeout,
+    0,
+    {0, 0, SOCKET_OVERFLOW_BLOCK},
+    0
+};
+
+
+/*!
+ * \brief           Adds a slice to the reply to a line.
+ * \details         The slice is not copied, so must remain valid until
+ * the replies are written, which is no later than the return of the
+ * read that delivered the line. Slices of the line itself, and of
+ * static or long-lived data, may always be added.
+ * \param reply     The reply.
+ * \param data      The slice, which need not be NUL-terminated.
+ * \param len       The length of the slice.
+ * \returns         0 on success, or -1 with `errno` set if the replies
+ * could not be written, in which case the handler should return
+ * non-zero.
+ */
+
+int line_reply_add(LineReply * reply, const char * data, const size_t len) {
+    if ( reply_append(reply, data, len) != 0 ) {
+        return ERROR_RETURN;
+    }
+
+    ++reply->added;
+    reply->open = TRUE;
+    return 0;
+}
+
+
+/*!
+ * \brief           Adds a copy of a slice to the reply to a line.
+ * \details         For slices which do not outlive the handler call,
+ * such as those built in a local buffer.
+ * \param reply     The reply.
+ * \param data      The slice, which need not be NUL-terminated.
+ * \param len       The length of the slice.
+ * \returns         0 on success, or -1 with `errno` set if the replies
+ * could not be written, in which case the handler should return
+ * non-zero.
+ */
+
+int line_reply_copy(LineReply * reply, const char * data, const size_t len) {
+    char * copy;
+
+    if ( len > REPLY_SCRATCH_LEN - reply->scratch_len &&
+         reply_flush(reply) != 0 ) {
+        return ERROR_RETURN;
+    }
+
+    if ( len > REPLY_SCRATCH_LEN ) {
+
+        /*  Too big to copy, so write it now, while it is valid  */
+
+        if ( line_reply_add(reply, data, len) != 0 ) {
+            return ERROR_RETURN;
+        }
+        return reply_flush(reply);
+    }
+
+    copy = reply->scratch + reply->scratch_len;
+    memcpy(copy, data, len);
+    reply->scratch_len += len;
+    return line_reply_add(reply, copy, len);
+}
+
+
+/*!
+ * \brief           Starts a line service.
+ * \details         Only one line service may be run by a process.
+ * \param listening_socket File descriptor of the listening socket.
+ * \param mode      `LINE_SERVICE_THREADED`, `LINE_SERVICE_EPOLL`,
+ * `LINE_SERVICE_URING`, or `LINE_SERVICE_POOL`.
+ * \param num_threads The number of event-loop or worker threads, which
+ * is ignored in threaded mode.
+ * \param service   The service, which must remain valid while the server
+ * runs.
+ * \returns         Only returns on encountering an error, returning -1
+ * with `errno` set.
+ */
+
+int start_line_service(const int listening_socket, const int mode,
+                       const int num_threads, const LineService * service) {
+    line_service = service;
+    service_handler.idle_timeout_ms = service->idle_timeout_ms;
+    service_handler.output = service->output;
+    service_handler.round_bytes = service->round_bytes;
+
+    switch ( mode ) {
+        case LINE_SERVICE_THREADED:
+            return start_threaded_tcp_server(listening_socket,
+                                             service_thread);
+
+        case LINE_SERVICE_EPOLL:
+            return start_epoll_tcp_server(listening_socket, num_threads,
+                                          &service_handler);
+
+        case LINE_SERVICE_URING:
+            return start_uring_tcp_server(listening_socket, num_threads,
+                                          &service_handler);
+
+        case LINE_SERVICE_POOL:
+            set_pool_idle_timeout(service->idle_timeout_ms,
+                                  service_task_timeout);
+            return start_pooled_tcp_server(listening_socket, num_threads,
+                                           service_task);
+
+        default:
+            break;
+    }
+
+    errno = EINVAL;
+    set_errno_errmsg("unknown line service mode");
+    return ERROR_RETURN;
+}
+
+
+/*!
+ * \brief           Starts a line service on a set of listening shards.
+ * \details         Only one line service may be run by a process.
+ * \param shards    The shards, from create_tcp_server_shards().
+ * \param num_shards The number of shards.
+ * \param mode      `LINE_SERVICE_THREADED` or `LINE_SERVICE_EPOLL`.
+ * \param service   The service, which must remain valid while the server
+ * runs.
+ * \returns         Only returns on encountering an error, returning -1
+ * with `errno` set.
+ */
+
+int start_sharded_line_service(TcpShard * shards, const int num_shards,
+                               const int mode, const LineService * service) {
+    line_service = service;
+    service_handler.idle_timeout_ms = service->idle_timeout_ms;
+    service_handler.output = service->output;
+    service_handler.round_bytes = service->round_bytes;
+
+    if ( mode == LINE_SERVICE_THREADED ) {
+        return start_sharded_tcp_server(shards, num_shards, service_thread);
+    } else if ( mode == LINE_SERVICE_EPOLL ) {
+        return start_sharded_epoll_tcp_server(shards, num_shards,
+                                              &service_handler);
+    }
+
+    errno = EINVAL;
+    set_errno_errmsg("line service mode cannot be sharded");
+    return ERROR_RETURN;
+}
+
+
+/*!
+ * \brief           Initializes the replies to a batch of lines.
+ * \param reply     The reply.
+ * \param conn      The connection context, through which the replies are
+ * written and counted, or NULL to write them to `queue`.
+ * \param queue     A pooled connection's output queue, if `conn` is NULL.
+ * \param c_socket  File descriptor for the connected socket.
+ */
+
+static void reply_init(LineReply * reply, SocketConn * conn,
+                       SocketQueue * queue, const int c_socket) {
+    reply->conn = conn;
+    reply->queue = queue;
+    reply->c_socket = c_socket;
+    reply->iovcnt = 0;
+    reply->lines = 0;
+    reply->added = 0;
+    reply->open = FALSE;
+    reply->failed = 0;
+    reply->received_ns = 0;
+    reply->scratch_len = 0;
+}
+
+
+/*!
+ * \brief           Writes the replies gathered so far with a single write.
+ * \details         A write which ends partway through the reply to a
+ * line is marked as such, so that in event-loop modes the rest of the
+ * reply is discarded with it under `SOCKET_OVERFLOW_DROP`. The time
+ * since the lines were received is recorded once for each line the
+ * write completes.
+ * \param reply     The reply, which is empty afterwards.
+ * \returns         0 on success, or -1 with `errno` set on encountering
+ * an error, or if an earlier write failed.
+ */
+
+static int reply_flush(LineReply * reply) {
+    const int iovcnt = reply->iovcnt;
+    const size_t lines = reply->lines;
+    ssize_t num_written;
+
+    if ( reply->failed ) {
+        errno = reply->failed;
+        return ERROR_RETURN;
+    } else if ( iovcnt == 0 ) {
+        return 0;
+    }
+
+    reply->iovcnt = 0;
+    reply->scratch_len = 0;
+    socket_queue_set_partial(reply->open);
+    if ( reply->conn != NULL ) {
+        num_written = socket_conn_writev(reply->conn, reply->iov, iovcnt,
+                                         lines);
+    } else if ( (num_written = socket_queue_writev(reply->queue,
+                                reply->c_socket, reply->iov, iovcnt,
+                                &line_service->output)) >= 0 ) {
+
+        /*  Connection contexts count their own output  */
+
+        socket_metrics_add(SOCKET_METRIC_BYTES_OUT,
+                           (unsigned long) num_written);
+        socket_metrics_add(SOCKET_METRIC_LINES_OUT, (unsigned long) lines);
+    }
+    socket_queue_set_partial(FALSE);
+
+    reply->lines = 0;
+    if ( num_written < 0 ) {
+        reply->failed = errno != 0 ? errno : EIO;
+        return ERROR_RETURN;
+    } else if ( lines > 0 ) {
+        socket_metrics_record(SOCKET_LATENCY_SERVICE,
+                              socket_clock_ns() - reply->received_ns,
+                              (unsigned long) lines);
+    }
+
+    return 0;
+}
+
+
+/*!
+ * \brief           Appends a slice to the replies.
+ * \details         Flushes the replies first if they are full, always
+ * leaving room for a line ending.
+ * \param reply     The reply.
+ * \param data      The slice.
+ * \param len       The length of the slice.
+ * \returns         0 on success, or -1 with `errno` set on encountering
+ * an error.
+ */
+
+static int reply_append(LineReply * reply, const char * data,
+                        const size_t len) {
+    if ( reply->iovcnt > REPLY_MAX_SLICES - 2 && reply_flush(reply) != 0 ) {
+        return ERROR_RETURN;
+    } else if ( reply->failed ) {
+        errno = reply->failed;
+        return ERROR_RETURN;
+    }
+
+    reply->iov[reply->iovcnt].iov_base = (char *) data;
+    reply->iov[reply->iovcnt++].iov_len = len;
+    return 0;
+}
+
+
+/*!
+ * \brief           Passes a line, or part of a line, to the handler.
+ * \details         Ends the reply to a complete line with a line ending,
+ * if the handler replied to it.
+ * \param reply     The reply.
+ * \param line      The line.
+ * \param len       The length of the line.
+ * \param complete  False for a part of a line other than its last.
+ * \returns         0 to continue, or non-zero to close the connection.
+ */
+
+static int service_line(LineReply * reply, const char * line,
+                        const size_t len, const int complete) {
+    reply->added = 0;
+
+    if ( line_service->on_line(line_service->arg, line, len,
+                               complete, reply) != 0 ) {
+        return 1;
+    } else if ( complete ) {
+        if ( reply->added > 0 ) {
+            ++reply->lines;
+            if ( reply_append(reply, crlf, 2) != 0 ) {
+                return 1;
+            }
+        }
+        reply->open = FALSE;
+    }
+
+    return reply->failed != 0;
+}
+
+
+/*!
+ * \brief           Sends the service's timeout message.
+ * \param conn      The connection context.
+ */
+
+static void service_timeout(SocketConn * conn) {
+    const char * msg = line_service->timeout_msg;
+
+    if ( msg != NULL && socket_conn_writeline(conn, msg, strlen(msg)) != -1 ) {
+        socket_conn_flush(conn);
+    }
+}
+
+
+/*!
+ * \brief           Thread function serving one connection.
+ * \details         Takes as many lines as are available from the
+ * connection, and writes the replies to them together. Each line must
+ * arrive in full within the idle timeout of the previous replies being
+ * written. Any error closes the connection, and only the connection.
+ * \param arg       Pointer to a ServerTag struct, which is freed.
+ * \returns         NULL
+ */
+
+static void * service_thread(void * arg) {
+    ServerTag * server_tag = arg;
+    const int c_socket = server_tag->c_socket;
+    const uint64_t accepted_ns = server_tag->accepted_ns;
+    SocketConn * conn;
+    SocketLine lines[SERVICE_MAX_LINES];
+    LineReply reply;
+    ssize_t num_lines, index;
+
+    free(server_tag);
+
+    /*  The server doesn't wait for the thread. Should detaching
+        fail, the thread still serves the connection.             */
+
+    pthread_detach(pthread_self());
+    socket_metrics_add(SOCKET_METRIC_THREADS_STARTED, 1);
+
+    if ( (conn = socket_conn_create(c_socket)) == NULL ) {
+        close(c_socket);
+        socket_metrics_add(SOCKET_METRIC_THREADS_EXITED, 1);
+        return NULL;
+    }
+
+    socket_conn_set_max_line(conn, line_service->max_line_len);
+    socket_conn_set_idle_timeout(conn, line_service->idle_timeout_ms);
+    socket_conn_set_accepted(conn, accepted_ns);
+    reply_init(&reply, conn, NULL, c_socket);
+
+    while ( (num_lines = socket_conn_readlines(conn, lines,
+                                               SERVICE_MAX_LINES)) > 0 ) {
+        reply.received_ns = socket_clock_ns();
+        for ( index = 0; index < num_lines; ++index ) {
+            if ( service_line(&reply, lines[index].data, lines[index].len,
+                              lines[index].complete) != 0 ) {
+                break;
+            }
+        }
+
+        if ( reply_flush(&reply) != 0 || index < num_lines ) {
+            break;
+        }
+    }
+
+    if ( num_lines == -1 ) {
+        socket_count_error(socket_error_kind(errno));
+        if ( errno == ETIMEDOUT ) {
+            service_timeout(conn);
+        }
+    } else if ( reply.failed ) {
+        socket_count_error(socket_error_kind(reply.failed));
+    }
+
+    socket_conn_close(conn);
+    socket_metrics_add(SOCKET_METRIC_THREADS_EXITED, 1);
+    return NULL;
+}
+
+
+/*!
+ * \brief           Worker pool task serving one connection.
+ * \details         Handles every line available on the non-blocking
+ * socket, and returns when no more input is available, or yields once
+ * the connection has had its round budget of input handled, or once
+ * its replies are queued because the peer is not reading them. Any partial
+ * line is kept in the socket's reader until the rest of it arrives,
+ * and otherwise the reader is released until more input arrives.
+ * \param server_tag Pointer to the connection's ServerTag struct, which
+ * is owned by the worker pool.
+ * \returns         SERVER_TASK_CONTINUE to keep the connection open,
+ * SERVER_TASK_YIELD to run the task again after the others waiting, or
+ * SERVER_TASK_CLOSE to close it.
+ */
+
+static int service_task(ServerTag * server_tag) {
+    SocketReader * reader;
+    SocketLine lines[SERVICE_MAX_LINES];
+    LineReply reply;
+    ssize_t num_lines, num_read, index;
+    size_t handled = 0;
+    unsigned long complete;
+    const size_t budget = line_service->round_bytes > 0 ?
+                          line_service->round_bytes : SERVER_ROUND_BYTES;
+
+    if ( (reader = socket_reader_for_socket(server_tag->c_socket)) == NULL ) {
+        return SERVER_TASK_CLOSE;
+    }
+
+    socket_reader_set_max_line(reader, line_service->max_line_len);
+    reply_init(&reply, NULL, server_task_output(server_tag),
+               server_tag->c_socket);
+
+    while ( 1 ) {
+        if ( (num_lines = socket_reader_getlines(reader, lines,
+                                                 SERVICE_MAX_LINES)) == -1 ) {
+            socket_count_error(socket_error_kind(errno));
+            return SERVER_TASK_CLOSE;
+        } else if ( num_lines > 0 ) {
+            reply.received_ns = socket_clock_ns();
+            complete = 0;
+            for ( index = 0; index < num_lines; ++index ) {
+                complete += lines[index].complete ? 1 : 0;
+                if ( service_line(&reply, lines[index].data,
+                                  lines[index].len,
+                                  lines[index].complete) != 0 ) {
+                    break;
+                }
+                handled += lines[index].len;
+            }
+            socket_metrics_add(SOCKET_METRIC_LINES_IN, complete);
+
+            if ( reply_flush(&reply) != 0 ) {
+                socket_count_error(socket_error_kind(errno));
+                return SERVER_TASK_CLOSE;
+            } else if ( index < num_lines ) {
+                return SERVER_TASK_CLOSE;
+            } else if ( server_task_output(server_tag)->len > 0 ) {
+
+                /*  Read no more until the peer reads its replies  */
+
+                return SERVER_TASK_CONTINUE;
+            } else if ( handled >= budget ) {
+                return SERVER_TASK_YIELD;
+            }
+            continue;
+        }
+
+        num_read = socket_reader_fill(reader, NULL);
+        if ( num_read > 0 ) {
+            socket_metrics_add(SOCKET_METRIC_BYTES_IN,
+                               (unsigned long) num_read);
+            if ( server_tag->accepted_ns != 0 ) {
+                socket_metrics_record(SOCKET_LATENCY_FIRST_BYTE,
+                        socket_clock_ns() - server_tag->accepted_ns, 1);
+                server_tag->accepted_ns = 0;
+            }
+        }
+
+        if ( num_read == -1 && (errno == EAGAIN || errno == EWOULDBLOCK) ) {
+
+            /*  Idle, so return the receive buffer to the pool
+                unless it holds a partial line.                  */
+
+            if ( socket_reader_pending(reader) == 0 ) {
+                socket_reader_release(server_tag->c_socket);
+            }
+            return SERVER_TASK_CONTINUE;
+        } else if ( num_read == -1 ) {
+            socket_count_error(socket_error_kind(errno));
+            return SERVER_TASK_CLOSE;
+        } else if ( num_read == 0 && socket_reader_pending(reader) == 0 ) {
+
+            /*  End-of-file  */
+
+            return SERVER_TASK_CLOSE;
+        }
+    }
+}
+
+
+/*!
+ * \brief           Worker pool callback for an idle connection.
+ * \details         Queues the service's timeout message, which is sent as
+ * far as the socket will take it, as the pool closes the connection
+ * afterwards.
+ * \param server_tag Pointer to the connection's ServerTag struct.
+ */
+
+static void service_task_timeout(ServerTag * server_tag) {
+    const char * msg = line_service->timeout_msg;
+    struct iovec iov[2];
+    ssize_t num_written;
+
+    if ( msg == NULL ) {
+        return;
+    }
+
+    iov[0].iov_base = (char *) msg;
+    iov[0].iov_len = strlen(msg);
+    iov[1].iov_base = (char *) crlf;
+    iov[1].iov_len = 2;
+    if ( (num_written = socket_queue_writev(server_task_output(server_tag),
+                                            server_tag->c_socket, iov, 2,
+                                            &line_service->output)) >= 0 ) {
+        socket_metrics_add(SOCKET_METRIC_BYTES_OUT,
+                           (unsigned long) num_written);
+        socket_metrics_add(SOCKET_METRIC_LINES_OUT, 1);
+    }
+}
+
+
+/*!
+ * \brief           Opens an event-loop service connection.
+ * \details         Creates the connection's context, which the event
+ * loop's input never passes through, so holds no receive buffer, and
+ * whose output goes through the event loop, and initializes its
+ * streaming line framer, which holds no buffer either.
+ * \param c_socket  File descriptor for the connected socket.
+ * \param output    The connection's output.
+ * \param conn_data Pointer to a pointer to receive the connection data.
+ * \returns         0 on success, or -1 if memory could not be allocated.
+ */
+
+static int service_conn_open(const int c_socket, const SocketOutput * output,
+                             void ** conn_data) {
+    ServiceConn * conn;
+    const size_t max_len = line_service->max_line_len;
+
+    if ( socket_slab_shared(&service_conn_slab, "service_conn",
+                            sizeof(*conn)) == NULL ||
+         (conn = socket_slab_alloc(service_conn_slab)) == NULL ) {
+        return ERROR_RETURN;
+    } else if ( (conn->conn = socket_conn_create(c_socket)) == NULL ) {
+        socket_slab_free(service_conn_slab, conn);
+        return ERROR_RETURN;
+    }
+
+    /*  The event loops open connections as they accept them  */
+
+    socket_conn_set_accepted(conn->conn, socket_clock_ns());
+    socket_conn_set_output(conn->conn, output);
+
+    line_framer_init_stream(&conn->framer,
+                            max_len > 0 ? max_len : (size_t) -1);
+    *conn_data = conn;
+    return 0;
+}
+
+
+/*!
+ * \brief           Handles the lines in a chunk of input.
+ * \details         Lines are passed to the handler straight from the
+ * chunk, and the replies written together with a single write. A line
+ * which continues beyond the chunk is passed as far as it goes, and the
+ * rest of it as it arrives. A line longer than the maximum line length
+ * closes the connection. An empty chunk marks end-of-file, at which a
+ * final line without a `\r\n` is handled as a complete line, as the
+ * threaded and pooled servers handle it.
+ * \param c_socket  File descriptor for the connected socket.
+ * \param conn_data Pointer to the connection's ServiceConn struct.
+ * \param data      The chunk of input.
+ * \param len       The length of the chunk.
+ * \returns         0 to keep the connection open, or non-zero to close it.
+ */
+
+static int service_conn_data(const int c_socket, void * conn_data,
+                             const char * data, const size_t len) {
+    ServiceConn * conn = conn_data;
+    LineReply reply;
+    size_t offset = 0, consumed, line_len, num_lines = 0;
+    const char * line;
+    int status;
+
+    reply_init(&reply, conn->conn, NULL, c_socket);
+    reply.received_ns = socket_clock_ns();
+    socket_conn_add_input(conn->conn, len, 0);
+
+    if ( len == 0 ) {
+        if ( (status = line_framer_finish(&conn->framer, &line,
+                                          &line_len)) == -1 ) {
+            socket_count_error(socket_error_kind(errno));
+            return ERROR_RETURN;
+        } else if ( status == LINE_FRAMER_NONE ) {
+            return 0;
+        }
+
+        socket_conn_add_input(conn->conn, 0, 1);
+        service_line(&reply, line, line_len, TRUE);
+        return reply_flush(&reply);
+    }
+
+    while ( offset < len ) {
+        status = line_framer_next(&conn->framer, data + offset, len - offset,
+                                  &consumed, &line, &line_len);
+        offset += consumed;
+
+        if ( status == LINE_FRAMER_LINE ) {
+            ++num_lines;
+        }
+
+        if ( status == -1 ) {
+            socket_count_error(socket_error_kind(errno));
+            return ERROR_RETURN;
+        } else if ( status != LINE_FRAMER_NONE &&
+                    service_line(&reply, line, line_len,
+                                 status == LINE_FRAMER_LINE) != 0 ) {
+            reply_flush(&reply);
+            return ERROR_RETURN;
+        }
+    }
+
+    socket_conn_add_input(conn->conn, 0, num_lines);
+    return reply_flush(&reply);
+}
+
+
+/*!
+ * \brief           Closes an event-loop service connection.
+ * \param c_socket  File descriptor for the connected socket.
+ * \param conn_data Pointer to the connection's ServiceConn struct.
+ */
+
+static void service_conn_close(const int c_socket, void * conn_data) {
+    ServiceConn * conn = conn_data;
+
+    (void) c_socket;
+
+    line_framer_free(&conn->framer);
+    socket_conn_destroy(conn->conn);
+    socket_slab_free(service_conn_slab, conn);
+}
+
+
+/*!
+ * \brief           Event-loop callback for an idle connection.
+ * \details         The event loop closes the connection afterwards.
+ * \param c_socket  File descriptor for the connected socket.
+ * \param conn_data Pointer to the connection's ServiceConn struct.
+ */
+
+static void service_conn_timeout(const int c_socket, void * conn_data) {
+    ServiceConn * conn = conn_data;
+
+    (void) c_socket;
+
+    service_timeout(conn->conn);
+}
@@ -0,0 +1,108 @@
+/*!
+ * \file            socket_helpers_service.h
+ * \brief           Interface to line service functions.
+ * \details         Interface to line service functions.
+ * \author          Paul Griffiths
+ * \copyright       Copyright 2013 Paul Griffiths. Distributed under the terms
+ * of the GNU General Public License. <http://www.gnu.org/licenses/>
+ */
+
+
+#ifndef PG_SOCKET_HELPERS_SERVICE_H
+#define PG_SOCKET_HELPERS_SERVICE_H
+
+#include <stddef.h>
+#include "socket_helpers_server.h"
+#include "socket_helpers_queue.h"
+
+
+/*!
+ * \brief           Line service mode with one thread per connection.
+ */
+
+#define LINE_SERVICE_THREADED 0
+
+
+/*!
+ * \brief           Line service mode with epoll event-loop threads.
+ */
+
+#define LINE_SERVICE_EPOLL 1
+
+
+/*!
+ * \brief           Line service mode with io_uring event-loop threads.
+ */
+
+#define LINE_SERVICE_URING 2
+
+
+/*!
+ * \brief           Line service mode with a fixed pool of worker threads.
+ */
+
+#define LINE_SERVICE_POOL 3
+
+
+/*!
+ * \brief           Opaque type for the reply to a line.
+ * \details         Collects the slices of a reply, which are written
+ * together with the replies to the other lines received by the same
+ * read.
+ */
+
+typedef struct LineReply LineReply;
+
+
+/*!
+ * \brief           Line handler callback type.
+ * \details         Called with each line received, excluding its line
+ * ending. A line longer than the receive buffer is passed in parts as
+ * it arrives, with `complete` false for all but the final part. The
+ * line is valid only until the handler returns. If the handler adds any
+ * slices to the reply for a line, or for the final part of a line, the
+ * reply is ended with `\r\n`. Should return zero to continue, or non-zero
+ * to close the connection once the replies so far have been written.
+ */
+
+typedef int (*LineHandler)(void * arg, const char * line, const size_t len,
+                           const int complete, LineReply * reply);
+
+
+/*!
+ * \brief           Struct describing a line service.
+ */
+
+typedef struct LineService {
+    LineHandler on_line;        /*!< Called with each line */
+    void * arg;                 /*!< Passed to `on_line` */
+    const char * timeout_msg;   /*!< Line sent on idle timeout, or NULL */
+    long idle_timeout_ms;       /*!< Idle timeout, or 0 for none */
+    size_t max_line_len;        /*!< Longest line, or 0 for no limit */
+    SocketQueuePolicy output;   /*!< Limits on each connection's queued
+                                     output, in epoll, uring and pool
+                                     modes */
+    size_t round_bytes;         /*!< Input handled for a connection per
+                                     turn, in epoll and pool modes, or 0
+                                     for `SERVER_ROUND_BYTES` */
+} LineService;
+
+
+/*  Function prototypes  */
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+int line_reply_add(LineReply * reply, const char * data, const size_t len);
+int line_reply_copy(LineReply * reply, const char * data, const size_t len);
+int start_line_service(const int listening_socket, const int mode,
+                       const int num_threads, const LineService * service);
+int start_sharded_line_service(TcpShard * shards, const int num_shards,
+                               const int mode, const LineService * service);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif          /*  PG_SOCKET_HELPERS_SERVICE_H  */
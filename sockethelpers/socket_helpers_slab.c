@@ -0,0 +1,628 @@
+/*!
+ * \file            socket_helpers_slab.c
+ * \brief           Implementation of slab allocator functions.
+ * \details         Objects are carved from chunks of `SLAB_CHUNK_SIZE`
+ * bytes, the size of a huge page, so a slab backed by huge pages needs
+ * a single TLB entry for every object in a chunk. Each thread caches
+ * freed objects for reuse, and hands them back to the slab in batches
+ * when its cache grows long, and all at once when it exits, so objects
+ * freed by short-lived connection threads are not lost. Threads which
+ * each serve one connection, and spend most of their time blocked,
+ * keep no cache at all, as objects cached by a blocked thread are
+ * unavailable to every other thread for as long as it waits.
+ * \author          Paul Griffiths
+ * \copyright       Copyright 2013 Paul Griffiths. Distributed under the terms
+ * of the GNU General Public License. <http://www.gnu.org/licenses/>
+ */
+
+
+#define _GNU_SOURCE
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <stdint.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <paulgrif/chelpers.h>
+#include "socket_helpers_slab.h"
+
+
+/*!
+ * \brief           Size of each chunk, which is the huge page size.
+ */
+
+#define SLAB_CHUNK_SIZE (2UL * 1024 * 1024)
+
+
+/*!
+ * \brief           Number of objects moved between a thread and a slab.
+ */
+
+#define SLAB_BATCH 32
+
+
+/*!
+ * \brief           Maximum bytes of objects moved between a thread and a
+ * slab.
+ * \details         Large objects are moved in smaller batches, so that a
+ * thread serving one connection does not hold free buffers for dozens.
+ */
+
+#define SLAB_BATCH_BYTES (64UL * 1024)
+
+
+/*!
+ * \brief           Alignment of objects of at least a cache line.
+ * \details         So that objects used by different threads never
+ * share a cache line.
+ */
+
+#define SLAB_CACHE_LINE 64
+
+
+/*!
+ * \brief           Alignment of smaller objects.
+ */
+
+#define SLAB_MIN_ALIGN 16
+
+
+/*!
+ * \brief           Struct for a free object.
+ */
+
+typedef struct SlabObject {
+    struct SlabObject * next;       /*!< Next free object */
+} SlabObject;
+
+
+/*!
+ * \brief           Struct for a slab.
+ */
+
+struct SocketSlab {
+    const char * name;              /*!< Name, for reporting */
+    size_t object_size;             /*!< Rounded size of each object */
+    size_t batch;                   /*!< Objects moved at a time */
+    int flags;                      /*!< Flags from socket_slab_create() */
+    int index;                      /*!< Index in `slabs` */
+    pthread_mutex_t mutex;          /*!< Guards the fields below */
+    SlabObject * free_list;         /*!< Objects freed back to the slab */
+    char * carve;                   /*!< Next uncarved object, or NULL */
+    size_t carve_left;              /*!< Objects left to carve */
+    unsigned long chunks;           /*!< Chunks mapped, stored atomically */
+    unsigned long huge_chunks;      /*!< Chunks mapped with MAP_HUGETLB,
+                                         stored atomically */
+    unsigned long objects;          /*!< Objects carved, stored atomically */
+    unsigned long in_use;           /*!< Objects allocated, atomic */
+};
+
+
+/*!
+ * \brief           Struct for a thread's cache of free objects.
+ */
+
+typedef struct SlabCache {
+    SlabObject * head;              /*!< First free object */
+    size_t count;                   /*!< Number of free objects */
+} SlabCache;
+
+
+/*!
+ * \brief           File scope variable for the slabs.
+ * \details         Slabs are never destroyed, so a thread's cache for
+ * a slab may be found by the slab's index.
+ */
+
+static SocketSlab slabs[SOCKET_SLAB_MAX];
+
+
+/*!
+ * \brief           File scope variable for the number of slabs, atomic.
+ */
+
+static int num_slabs = 0;
+
+
+/*!
+ * \brief           File scope mutex guarding the creation of slabs.
+ */
+
+static pthread_mutex_t slabs_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+
+/*!
+ * \brief           File scope mutex guarding the creation of shared slabs.
+ */
+
+static pthread_mutex_t shared_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+
+/*!
+ * \brief           File scope variable for the flags of library slabs.
+ */
+
+static int default_flags = 0;
+
+
+/*!
+ * \brief           Thread local caches of free objects, one per slab.
+ */
+
+static __thread SlabCache slab_caches[SOCKET_SLAB_MAX];
+
+
+/*!
+ * \brief           Thread local flag set while the thread keeps no cache.
+ */
+
+static __thread int cache_disabled = FALSE;
+
+
+/*!
+ * \brief           Thread local flag set once the cache is registered.
+ */
+
+static __thread int cache_registered = FALSE;
+
+
+/*!
+ * \brief           Key whose destructor empties an exiting thread's caches.
+ */
+
+static pthread_key_t cache_key;
+
+
+/*!
+ * \brief           Once control for creating `cache_key`.
+ */
+
+static pthread_once_t cache_key_once = PTHREAD_ONCE_INIT;
+
+
+/*  Function prototypes  */
+
+static void make_cache_key(void);
+static void register_caches(void);
+static void release_caches(void * arg);
+static int map_chunk(SocketSlab * slab);
+static void refill_cache(SocketSlab * slab, SlabCache * cache);
+static void drain_cache(SocketSlab * slab, SlabCache * cache,
+                        const size_t count);
+
+
+/*!
+ * \brief           Creates a slab.
+ * \param name      A name for the slab, for reporting, which must remain
+ * valid for the life of the process.
+ * \param object_size The size of each object, which must not exceed the
+ * huge page size.
+ * \param flags     0 or `SOCKET_SLAB_HUGE`.
+ * \returns         A pointer to the slab, or NULL with `errno` set on
+ * encountering an error, including `ENOSPC` if `SOCKET_SLAB_MAX` slabs
+ * already exist.
+ */
+
+SocketSlab * socket_slab_create(const char * name, const size_t object_size,
+                                const int flags) {
+    SocketSlab * slab;
+    size_t size = object_size;
+    int index;
+
+    if ( size == 0 || size > SLAB_CHUNK_SIZE ) {
+        errno = EINVAL;
+        return NULL;
+    }
+
+    if ( size < sizeof(SlabObject) ) {
+        size = sizeof(SlabObject);
+    }
+    if ( size >= SLAB_CACHE_LINE ) {
+        size = (size + SLAB_CACHE_LINE - 1) & ~((size_t) SLAB_CACHE_LINE - 1);
+    } else {
+        size = (size + SLAB_MIN_ALIGN - 1) & ~((size_t) SLAB_MIN_ALIGN - 1);
+    }
+
+    if ( pthread_mutex_lock(&slabs_mutex) != 0 ) {
+        return NULL;
+    }
+
+    if ( (index = num_slabs) == SOCKET_SLAB_MAX ) {
+        pthread_mutex_unlock(&slabs_mutex);
+        errno = ENOSPC;
+        return NULL;
+    }
+
+    slab = &slabs[index];
+    slab->name = name;
+    slab->object_size = size;
+    slab->batch = SLAB_BATCH_BYTES / size;
+    if ( slab->batch > SLAB_BATCH ) {
+        slab->batch = SLAB_BATCH;
+    } else if ( slab->batch == 0 ) {
+        slab->batch = 1;
+    }
+    slab->flags = flags;
+    slab->index = index;
+    slab->free_list = NULL;
+    slab->carve = NULL;
+    slab->carve_left = 0;
+    slab->chunks = 0;
+    slab->huge_chunks = 0;
+    slab->objects = 0;
+    slab->in_use = 0;
+
+    if ( pthread_mutex_init(&slab->mutex, NULL) != 0 ) {
+        pthread_mutex_unlock(&slabs_mutex);
+        return NULL;
+    }
+
+    __atomic_store_n(&num_slabs, index + 1, __ATOMIC_RELEASE);
+    pthread_mutex_unlock(&slabs_mutex);
+    return slab;
+}
+
+
+/*!
+ * \brief           Returns a shared slab, creating it on first use.
+ * \details         For slabs which, like the library's own, are created
+ * when first needed by whichever thread needs one first. The slab is
+ * created with the flags set by socket_slab_set_default_flags().
+ * \param slab      Pointer to the variable holding the slab, which is
+ * NULL until the slab is created.
+ * \param name      A name for the slab, as for socket_slab_create().
+ * \param object_size The size of each object.
+ * \returns         A pointer to the slab, or NULL with `errno` set on
+ * encountering an error.
+ */
+
+SocketSlab * socket_slab_shared(SocketSlab ** slab, const char * name,
+                                const size_t object_size) {
+    SocketSlab * shared = __atomic_load_n(slab, __ATOMIC_ACQUIRE);
+
+    if ( shared != NULL ) {
+        return shared;
+    }
+
+    if ( pthread_mutex_lock(&shared_mutex) != 0 ) {
+        return NULL;
+    }
+
+    if ( (shared = *slab) == NULL &&
+         (shared = socket_slab_create(name, object_size,
+                                      default_flags)) != NULL ) {
+        __atomic_store_n(slab, shared, __ATOMIC_RELEASE);
+    }
+
+    pthread_mutex_unlock(&shared_mutex);
+    return shared;
+}
+
+
+/*!
+ * \brief           Allocates an object from a slab.
+ * \param slab      The slab.
+ * \returns         A pointer to the uninitialized object, or NULL with
+ * `errno` set if memory could not be mapped.
+ */
+
+void * socket_slab_alloc(SocketSlab * slab) {
+    SlabCache * cache = &slab_caches[slab->index];
+    SlabObject * object;
+
+    if ( cache->head == NULL ) {
+        refill_cache(slab, cache);
+        if ( cache->head == NULL ) {
+            errno = ENOMEM;
+            return NULL;
+        }
+    }
+
+    object = cache->head;
+    cache->head = object->next;
+    --cache->count;
+
+    __atomic_add_fetch(&slab->in_use, 1, __ATOMIC_RELAXED);
+    return object;
+}
+
+
+/*!
+ * \brief           Frees an object to a slab.
+ * \details         The object may be freed by a different thread from
+ * the one which allocated it.
+ * \param slab      The slab from which the object was allocated.
+ * \param object    The object. May be NULL.
+ */
+
+void socket_slab_free(SocketSlab * slab, void * object) {
+    SlabCache * cache = &slab_caches[slab->index];
+    SlabObject * free_object = object;
+
+    if ( object == NULL ) {
+        return;
+    }
+
+    register_caches();
+    free_object->next = cache->head;
+    cache->head = free_object;
+    ++cache->count;
+
+    __atomic_sub_fetch(&slab->in_use, 1, __ATOMIC_RELAXED);
+
+    if ( cache_disabled ) {
+        drain_cache(slab, cache, cache->count);
+    } else if ( cache->count > slab->batch * 2 ) {
+        drain_cache(slab, cache, slab->batch);
+    }
+}
+
+
+/*!
+ * \brief           Gets a slab's counters.
+ * \details         Reads the counters without taking the slab's mutex,
+ * so never holds up a thread refilling or draining its cache. The
+ * counters are read one at a time, so may be from slightly different
+ * moments, but `in_use` is never reported above `objects`.
+ * \param slab      The slab.
+ * \param stats     Pointer to a struct to receive the counters.
+ */
+
+void socket_slab_get_stats(const SocketSlab * slab, SocketSlabStats * stats) {
+    stats->object_size = slab->object_size;
+    stats->chunks = __atomic_load_n(&slab->chunks, __ATOMIC_RELAXED);
+    stats->huge_chunks = __atomic_load_n(&slab->huge_chunks,
+                                         __ATOMIC_RELAXED);
+    stats->in_use = __atomic_load_n(&slab->in_use, __ATOMIC_RELAXED);
+    stats->objects = __atomic_load_n(&slab->objects, __ATOMIC_RELAXED);
+    if ( stats->in_use > stats->objects ) {
+        stats->in_use = stats->objects;
+    }
+}
+
+
+/*!
+ * \brief           Returns a slab's name.
+ * \param slab      The slab.
+ * \returns         The name given to socket_slab_create().
+ */
+
+const char * socket_slab_name(const SocketSlab * slab) {
+    return slab->name;
+}
+
+
+/*!
+ * \brief           Returns the number of slabs created.
+ * \returns         The number of slabs, which may be passed to
+ * socket_slab_get() to list them.
+ */
+
+int socket_slab_count(void) {
+    return __atomic_load_n(&num_slabs, __ATOMIC_ACQUIRE);
+}
+
+
+/*!
+ * \brief           Returns a slab by index.
+ * \param index     The index, less than socket_slab_count().
+ * \returns         A pointer to the slab, or NULL if `index` is out of
+ * range.
+ */
+
+SocketSlab * socket_slab_get(const int index) {
+    if ( index < 0 || index >= socket_slab_count() ) {
+        return NULL;
+    }
+    return &slabs[index];
+}
+
+
+/*!
+ * \brief           Sets whether the calling thread caches free objects.
+ * \details         Should be turned off by a thread which serves a single
+ * connection, and blocks waiting for it. Such a thread allocates one
+ * object at a time from the slabs' shared lists, and frees objects
+ * straight back to them. Turning the cache off returns any objects
+ * the thread has cached.
+ * \param enabled   FALSE to stop caching, or TRUE to cache again.
+ */
+
+void socket_slab_set_thread_cache(const int enabled) {
+    cache_disabled = !enabled;
+    if ( cache_disabled ) {
+        release_caches(slab_caches);
+    }
+}
+
+
+/*!
+ * \brief           Sets the flags for the library's own slabs.
+ * \details         The library creates its slabs, for connection
+ * contexts, readers and server tags, when first needed, so this must
+ * be called before any server is started.
+ * \param flags     0 or `SOCKET_SLAB_HUGE`.
+ */
+
+void socket_slab_set_default_flags(const int flags) {
+    default_flags = flags;
+}
+
+
+/*!
+ * \brief           Returns the flags for the library's own slabs.
+ * \returns         The flags set by socket_slab_set_default_flags().
+ */
+
+int socket_slab_default_flags(void) {
+    return default_flags;
+}
+
+
+/*!
+ * \brief           Creates the key whose destructor empties thread caches.
+ */
+
+static void make_cache_key(void) {
+    pthread_key_create(&cache_key, release_caches);
+}
+
+
+/*!
+ * \brief           Arranges for the calling thread's caches to be emptied
+ * when it exits.
+ */
+
+static void register_caches(void) {
+    if ( !cache_registered ) {
+        pthread_once(&cache_key_once, make_cache_key);
+        pthread_setspecific(cache_key, slab_caches);
+        cache_registered = TRUE;
+    }
+}
+
+
+/*!
+ * \brief           Returns an exiting thread's free objects to the slabs.
+ * \param arg       The thread's caches.
+ */
+
+static void release_caches(void * arg) {
+    SlabCache * caches = arg;
+    int index;
+
+    for ( index = 0; index < socket_slab_count(); ++index ) {
+        if ( caches[index].count > 0 ) {
+            drain_cache(&slabs[index], &caches[index], caches[index].count);
+        }
+    }
+}
+
+
+/*!
+ * \brief           Maps a new chunk for a slab to carve.
+ * \details         Called with the slab's mutex held.
+ * \param slab      The slab.
+ * \returns         0 on success, or -1 if memory could not be mapped.
+ */
+
+static int map_chunk(SocketSlab * slab) {
+    const int prot = PROT_READ | PROT_WRITE;
+    const int map_flags = MAP_PRIVATE | MAP_ANONYMOUS;
+    char * chunk = MAP_FAILED;
+    uintptr_t aligned;
+
+    if ( slab->flags & SOCKET_SLAB_HUGE ) {
+        chunk = mmap(NULL, SLAB_CHUNK_SIZE, prot, map_flags | MAP_HUGETLB,
+                     -1, 0);
+        if ( chunk != MAP_FAILED ) {
+            __atomic_store_n(&slab->huge_chunks, slab->huge_chunks + 1,
+                             __ATOMIC_RELAXED);
+        } else {
+
+            /*  No huge pages reserved, so map twice the size, trim it
+                to a huge page boundary, and ask for transparent huge
+                pages instead.                                          */
+
+            chunk = mmap(NULL, SLAB_CHUNK_SIZE * 2, prot, map_flags, -1, 0);
+            if ( chunk != MAP_FAILED ) {
+                aligned = ((uintptr_t) chunk + SLAB_CHUNK_SIZE - 1) &
+                          ~((uintptr_t) SLAB_CHUNK_SIZE - 1);
+                if ( aligned > (uintptr_t) chunk ) {
+                    munmap(chunk, aligned - (uintptr_t) chunk);
+                }
+                munmap((char *) aligned + SLAB_CHUNK_SIZE,
+                       (uintptr_t) chunk + SLAB_CHUNK_SIZE - aligned);
+                chunk = (char *) aligned;
+#ifdef MADV_HUGEPAGE
+                madvise(chunk, SLAB_CHUNK_SIZE, MADV_HUGEPAGE);
+#endif
+            }
+        }
+    } else {
+        chunk = mmap(NULL, SLAB_CHUNK_SIZE, prot, map_flags, -1, 0);
+    }
+
+    if ( chunk == MAP_FAILED ) {
+        return ERROR_RETURN;
+    }
+
+    __atomic_store_n(&slab->chunks, slab->chunks + 1, __ATOMIC_RELAXED);
+    slab->carve = chunk;
+    slab->carve_left = SLAB_CHUNK_SIZE / slab->object_size;
+    return 0;
+}
+
+
+/*!
+ * \brief           Moves a batch of free objects from a slab to a cache.
+ * \details         Takes objects freed back to the slab first, and
+ * carves new ones only if there are none. A thread which keeps no cache
+ * takes a single object.
+ * \param slab      The slab.
+ * \param cache     The calling thread's cache for the slab, which is
+ * empty. It is left empty if memory could not be mapped.
+ */
+
+static void refill_cache(SocketSlab * slab, SlabCache * cache) {
+    const size_t batch = cache_disabled ? 1 : slab->batch;
+    SlabObject * object;
+
+    register_caches();
+
+    if ( pthread_mutex_lock(&slab->mutex) != 0 ) {
+        return;
+    }
+
+    while ( cache->count < batch ) {
+        if ( slab->free_list != NULL ) {
+            object = slab->free_list;
+            slab->free_list = object->next;
+        } else if ( slab->carve_left > 0 || map_chunk(slab) == 0 ) {
+            object = (SlabObject *) slab->carve;
+            slab->carve += slab->object_size;
+            --slab->carve_left;
+            __atomic_store_n(&slab->objects, slab->objects + 1,
+                             __ATOMIC_RELAXED);
+        } else {
+            break;
+        }
+
+        object->next = cache->head;
+        cache->head = object;
+        ++cache->count;
+    }
+
+    pthread_mutex_unlock(&slab->mutex);
+}
+
+
+/*!
+ * \brief           Moves free objects from a cache back to a slab.
+ * \param slab      The slab.
+ * \param cache     The calling thread's cache for the slab.
+ * \param count     The number of objects to move, which must not exceed
+ * the number in the cache.
+ */
+
+static void drain_cache(SocketSlab * slab, SlabCache * cache,
+                        const size_t count) {
+    SlabObject * first = cache->head;
+    SlabObject * last = first;
+    size_t index;
+
+    for ( index = 1; index < count; ++index ) {
+        last = last->next;
+    }
+
+    cache->head = last->next;
+    cache->count -= count;
+
+    if ( pthread_mutex_lock(&slab->mutex) != 0 ) {
+        return;
+    }
+    last->next = slab->free_list;
+    slab->free_list = first;
+    pthread_mutex_unlock(&slab->mutex);
+}
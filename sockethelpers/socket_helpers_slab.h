@@ -0,0 +1,86 @@
+/*!
+ * \file            socket_helpers_slab.h
+ * \brief           Interface to slab allocator functions.
+ * \details         Interface to slab allocator functions.
+ * \author          Paul Griffiths
+ * \copyright       Copyright 2013 Paul Griffiths. Distributed under the terms
+ * of the GNU General Public License. <http://www.gnu.org/licenses/>
+ */
+
+
+#ifndef PG_SOCKET_HELPERS_SLAB_H
+#define PG_SOCKET_HELPERS_SLAB_H
+
+#include <stddef.h>
+
+
+/*!
+ * \brief           Slab flag to back the slab with huge pages.
+ * \details         Chunks are mapped with `MAP_HUGETLB` where huge pages
+ * have been reserved, and otherwise aligned to the huge page size and
+ * marked for transparent huge pages.
+ */
+
+#define SOCKET_SLAB_HUGE 1
+
+
+/*!
+ * \brief           Maximum number of slabs in a process.
+ */
+
+#define SOCKET_SLAB_MAX 16
+
+
+/*!
+ * \brief           Opaque slab type.
+ * \details         A slab hands out fixed-size objects carved from large
+ * chunks of memory. Each thread keeps its own list of free objects, so
+ * allocating and freeing take no lock except when a thread's list runs
+ * empty or grows long, when objects are moved to or from the slab's
+ * shared list in batches. A thread which turns its cache off with
+ * socket_slab_set_thread_cache() uses the shared list directly. Chunks are never returned to the system, so
+ * a slab's memory stays at its high-water mark, and slabs last for the
+ * life of the process.
+ */
+
+typedef struct SocketSlab SocketSlab;
+
+
+/*!
+ * \brief           Struct for a slab's counters.
+ */
+
+typedef struct SocketSlabStats {
+    size_t object_size;         /*!< Size of each object, once rounded up */
+    unsigned long chunks;       /*!< Chunks mapped */
+    unsigned long huge_chunks;  /*!< Chunks mapped with `MAP_HUGETLB` */
+    unsigned long objects;      /*!< Objects carved from the chunks */
+    unsigned long in_use;       /*!< Objects allocated and not yet freed */
+} SocketSlabStats;
+
+
+/*  Function prototypes  */
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+SocketSlab * socket_slab_create(const char * name, const size_t object_size,
+                                const int flags);
+SocketSlab * socket_slab_shared(SocketSlab ** slab, const char * name,
+                                const size_t object_size);
+void * socket_slab_alloc(SocketSlab * slab);
+void socket_slab_free(SocketSlab * slab, void * object);
+void socket_slab_get_stats(const SocketSlab * slab, SocketSlabStats * stats);
+const char * socket_slab_name(const SocketSlab * slab);
+int socket_slab_count(void);
+SocketSlab * socket_slab_get(const int index);
+void socket_slab_set_thread_cache(const int enabled);
+void socket_slab_set_default_flags(const int flags);
+int socket_slab_default_flags(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif          /*  PG_SOCKET_HELPERS_SLAB_H  */
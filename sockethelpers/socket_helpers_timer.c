@@ -0,0 +1,450 @@
+/*!
+ * \file            socket_helpers_timer.c
+ * \brief           Implementation of timer wheel functions.
+ * \details         The wheel has four levels of 64 slots. Level 0 holds
+ * timers due within 64 ticks, one slot per tick, and each higher level
+ * covers 64 times the span of the level below. As time passes, the
+ * timers in each higher-level slot are moved down a level when that
+ * slot's span begins, so arming, re-arming and cancelling a timer are
+ * all constant time. A bitmap of occupied slots per level lets the
+ * wheel skip runs of empty slots when advancing, and find the next
+ * tick with work to do for the event loop's wait timeout.
+ * \author          Paul Griffiths
+ * \copyright       Copyright 2013 Paul Griffiths. Distributed under the terms
+ * of the GNU General Public License. <http://www.gnu.org/licenses/>
+ */
+
+
+#include <stdlib.h>
+#include <limits.h>
+#include <time.h>
+#include <paulgrif/chelpers.h>
+#include "socket_helpers_timer.h"
+
+
+/*!
+ * \brief           Number of levels in the wheel.
+ */
+
+#define TIMER_LEVELS 4
+
+
+/*!
+ * \brief           Number of bits of a tick used to index a level.
+ */
+
+#define TIMER_BITS 6
+
+
+/*!
+ * \brief           Number of slots in each level.
+ */
+
+#define TIMER_SLOTS (1 << TIMER_BITS)
+
+
+/*!
+ * \brief           Mask for a slot index.
+ */
+
+#define TIMER_MASK (TIMER_SLOTS - 1)
+
+
+/*!
+ * \brief           Latest a timer can be placed ahead of the wheel.
+ * \details         Timers due later are placed at the limit, and placed
+ * again from there.
+ */
+
+#define TIMER_MAX_DELTA (((uint64_t) 1 << (TIMER_BITS * TIMER_LEVELS)) - 1)
+
+
+/*!
+ * \brief           Index of the list of timers being expired.
+ * \details         Timers due at a tick are moved to this list before
+ * any callback is made, so a timer re-armed by a callback for exactly
+ * one rotation later is not expired again at the same tick.
+ */
+
+#define TIMER_EXPIRING (TIMER_LEVELS * TIMER_SLOTS)
+
+
+/*!
+ * \brief           Timer wheel structure.
+ */
+
+struct TimerWheel {
+    uint64_t now;                   /*!< Next tick to process */
+    size_t count;                   /*!< Number of timers armed */
+    uint64_t occupied[TIMER_LEVELS];    /*!< Bitmaps of occupied slots */
+
+    /*!  Circular list heads, one per slot, and the expiring list  */
+
+    TimerEntry slots[TIMER_EXPIRING + 1];
+};
+
+
+/*!
+ * \brief           Returns the current monotonic time in milliseconds.
+ * \returns         The time.
+ */
+
+uint64_t timer_now_ms(void) {
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t) now.tv_sec * 1000 + (uint64_t) now.tv_nsec / 1000000;
+}
+
+
+/*!
+ * \brief           Creates a timer wheel.
+ * \param now_ms    The current time, from timer_now_ms().
+ * \returns         A pointer to the new wheel, or NULL on failure.
+ */
+
+TimerWheel * timer_wheel_create(const uint64_t now_ms) {
+    TimerWheel * wheel;
+    size_t index;
+
+    if ( (wheel = malloc(sizeof(*wheel))) == NULL ) {
+        return NULL;
+    }
+
+    wheel->now = now_ms;
+    wheel->count = 0;
+
+    for ( index = 0; index < TIMER_LEVELS; ++index ) {
+        wheel->occupied[index] = 0;
+    }
+
+    for ( index = 0; index <= TIMER_EXPIRING; ++index ) {
+        wheel->slots[index].next = &wheel->slots[index];
+        wheel->slots[index].prev = &wheel->slots[index];
+    }
+
+    return wheel;
+}
+
+
+/*!
+ * \brief           Destroys a timer wheel.
+ * \details         Any timers still armed are abandoned, not called.
+ * \param wheel     The wheel.
+ */
+
+void timer_wheel_destroy(TimerWheel * wheel) {
+    free(wheel);
+}
+
+
+/*!
+ * \brief           Initializes a timer as disarmed.
+ * \param timer     The timer.
+ * \param data      The caller's data for the timer.
+ */
+
+void timer_entry_init(TimerEntry * timer, void * data) {
+    timer->next = timer->prev = NULL;
+    timer->expires = 0;
+    timer->slot = 0;
+    timer->data = data;
+}
+
+
+/*!
+ * \brief           Checks whether a timer is armed.
+ * \param timer     The timer.
+ * \returns         Non-zero if the timer is armed, zero otherwise.
+ */
+
+int timer_entry_armed(const TimerEntry * timer) {
+    return timer->next != NULL;
+}
+
+
+/*!
+ * \brief           Adds a timer to the end of a slot's list.
+ * \param wheel     The wheel.
+ * \param timer     The timer, which must not be in any slot.
+ * \param slot      The index of the slot.
+ */
+
+static void link_timer(TimerWheel * wheel, TimerEntry * timer,
+                       const unsigned slot) {
+    TimerEntry * head = &wheel->slots[slot];
+
+    timer->slot = slot;
+    timer->next = head;
+    timer->prev = head->prev;
+    head->prev->next = timer;
+    head->prev = timer;
+}
+
+
+/*!
+ * \brief           Places a timer in the slot for its expiry time.
+ * \param wheel     The wheel.
+ * \param timer     The timer, which must not be in any slot.
+ */
+
+static void place_timer(TimerWheel * wheel, TimerEntry * timer) {
+    uint64_t expires = timer->expires < wheel->now ?
+                       wheel->now : timer->expires;
+    unsigned level = 0;
+    unsigned index;
+
+    if ( expires - wheel->now > TIMER_MAX_DELTA ) {
+        expires = wheel->now + TIMER_MAX_DELTA;
+    }
+
+    while ( level < TIMER_LEVELS - 1 && expires - wheel->now >=
+                (uint64_t) 1 << (TIMER_BITS * (level + 1)) ) {
+        ++level;
+    }
+
+    index = (unsigned) ((expires >> (TIMER_BITS * level)) & TIMER_MASK);
+    wheel->occupied[level] |= (uint64_t) 1 << index;
+    link_timer(wheel, timer, level * TIMER_SLOTS + index);
+}
+
+
+/*!
+ * \brief           Removes a timer from its slot.
+ * \param wheel     The wheel.
+ * \param timer     The timer, which must be in a slot.
+ */
+
+static void unlink_timer(TimerWheel * wheel, TimerEntry * timer) {
+    TimerEntry * head = &wheel->slots[timer->slot];
+
+    timer->prev->next = timer->next;
+    timer->next->prev = timer->prev;
+    timer->next = timer->prev = NULL;
+
+    if ( head->next == head && timer->slot != TIMER_EXPIRING ) {
+        wheel->occupied[timer->slot / TIMER_SLOTS] &=
+            ~((uint64_t) 1 << (timer->slot & TIMER_MASK));
+    }
+}
+
+
+/*!
+ * \brief           Arms a timer, or re-arms it if already armed.
+ * \param wheel     The wheel.
+ * \param timer     The timer.
+ * \param expires_ms The time at which the timer should expire. A time
+ * already passed expires on the next tick the wheel advances through.
+ */
+
+void timer_wheel_arm(TimerWheel * wheel, TimerEntry * timer,
+                     const uint64_t expires_ms) {
+    if ( timer_entry_armed(timer) ) {
+        unlink_timer(wheel, timer);
+    } else {
+        ++wheel->count;
+    }
+
+    timer->expires = expires_ms;
+    place_timer(wheel, timer);
+}
+
+
+/*!
+ * \brief           Cancels a timer, if it is armed.
+ * \param wheel     The wheel.
+ * \param timer     The timer.
+ */
+
+void timer_wheel_cancel(TimerWheel * wheel, TimerEntry * timer) {
+    if ( timer_entry_armed(timer) ) {
+        unlink_timer(wheel, timer);
+        --wheel->count;
+    }
+}
+
+
+/*!
+ * \brief           Returns the number of timers armed.
+ * \param wheel     The wheel.
+ * \returns         The number of timers armed.
+ */
+
+size_t timer_wheel_count(const TimerWheel * wheel) {
+    return wheel->count;
+}
+
+
+/*!
+ * \brief           Moves the timers in a higher-level slot down.
+ * \param wheel     The wheel.
+ * \param level     The level of the slot.
+ * \param index     The index of the slot within its level.
+ */
+
+static void cascade_slot(TimerWheel * wheel, const unsigned level,
+                         const unsigned index) {
+    TimerEntry * head = &wheel->slots[level * TIMER_SLOTS + index];
+    TimerEntry * timer;
+
+    while ( head->next != head ) {
+        timer = head->next;
+        unlink_timer(wheel, timer);
+        place_timer(wheel, timer);
+    }
+}
+
+
+/*!
+ * \brief           Moves down the timers whose span begins at a tick.
+ * \param wheel     The wheel, whose `now` must be the tick.
+ */
+
+static void cascade(TimerWheel * wheel) {
+    const uint64_t tick = wheel->now;
+    unsigned level = 1;
+
+    while ( level < TIMER_LEVELS &&
+            (tick & (((uint64_t) 1 << (TIMER_BITS * level)) - 1)) == 0 ) {
+        ++level;
+    }
+
+    /*  Cascade from the highest level, so timers moved down from it
+        into the lower levels' current slots are moved on in turn.    */
+
+    while ( --level > 0 ) {
+        cascade_slot(wheel, level,
+                     (unsigned) ((tick >> (TIMER_BITS * level)) & TIMER_MASK));
+    }
+}
+
+
+/*!
+ * \brief           Gets the time until the wheel next has work to do.
+ * \details         Suitable for use as an event loop's wait timeout. The
+ * wait may end at a tick where timers are only moved between levels,
+ * rather than expired, after which the timeout should be recalculated.
+ * \param wheel     The wheel.
+ * \param now_ms    The current time, from timer_now_ms().
+ * \returns         The number of milliseconds until the wheel should
+ * next be advanced, 0 if it should be advanced now, or -1 if no timers
+ * are armed.
+ */
+
+long timer_wheel_next_timeout(const TimerWheel * wheel,
+                              const uint64_t now_ms) {
+    const uint64_t tick = wheel->now;
+    uint64_t next = (uint64_t) -1, candidate, bits, span;
+    unsigned level, index, first, shift;
+
+    if ( wheel->count == 0 ) {
+        return -1;
+    }
+
+    for ( level = 0; level < TIMER_LEVELS; ++level ) {
+        if ( wheel->occupied[level] == 0 ) {
+            continue;
+        }
+
+        shift = TIMER_BITS * level;
+        span = (uint64_t) 1 << shift;
+        index = (unsigned) ((tick >> shift) & TIMER_MASK);
+
+        /*  A higher-level slot which has been reached has already been
+            cascaded, unless the wheel is exactly at its start.        */
+
+        first = (level == 0 || (tick & (span - 1)) == 0) ? index : index + 1;
+        bits = first < TIMER_SLOTS ? wheel->occupied[level] >> first : 0;
+
+        if ( bits != 0 ) {
+            candidate = ((tick >> shift) - index + first +
+                         (unsigned) __builtin_ctzll(bits)) << shift;
+        } else {
+
+            /*  Only slots for the next rotation are occupied, so the
+                next work is when this level wraps round.              */
+
+            candidate = (((tick >> shift) | TIMER_MASK) + 1) << shift;
+        }
+
+        if ( candidate < next ) {
+            next = candidate;
+        }
+    }
+
+    if ( next <= now_ms ) {
+        return 0;
+    }
+
+    return next - now_ms > LONG_MAX ? LONG_MAX : (long) (next - now_ms);
+}
+
+
+/*!
+ * \brief           Expires all timers due at or before a time.
+ * \param wheel     The wheel.
+ * \param now_ms    The current time, from timer_now_ms().
+ * \param expire    Function to call with each expired timer.
+ * \param arg       Argument to pass to `expire`.
+ * \returns         The number of timers expired.
+ */
+
+size_t timer_wheel_advance(TimerWheel * wheel, const uint64_t now_ms,
+                           TimerCallback expire, void * arg) {
+    size_t num_expired = 0;
+    TimerEntry * head;
+    TimerEntry * timer;
+    uint64_t pending, next;
+    unsigned index;
+
+    while ( wheel->now <= now_ms ) {
+        if ( wheel->count == 0 ) {
+            wheel->now = now_ms + 1;
+            break;
+        }
+
+        index = (unsigned) (wheel->now & TIMER_MASK);
+        if ( index == 0 ) {
+            cascade(wheel);
+        }
+
+        /*  Skip straight to the next occupied level 0 slot, or to the
+            next cascade if there is none, but not past `now_ms`, so
+            timers armed later are never placed behind the wheel.      */
+
+        pending = wheel->occupied[0] >> index;
+        if ( pending == 0 ) {
+            next = (wheel->now | TIMER_MASK) + 1;
+            wheel->now = next > now_ms + 1 ? now_ms + 1 : next;
+            continue;
+        } else if ( (pending & 1) == 0 ) {
+            next = wheel->now + (unsigned) __builtin_ctzll(pending);
+            wheel->now = next > now_ms + 1 ? now_ms + 1 : next;
+            continue;
+        }
+
+        /*  Step past the tick, and move its timers to the expiring
+            list, before making any callbacks, so that timers re-armed
+            by the callbacks land in later slots or rotations.          */
+
+        head = &wheel->slots[index];
+        ++wheel->now;
+
+        while ( head->next != head ) {
+            timer = head->next;
+            unlink_timer(wheel, timer);
+            link_timer(wheel, timer, TIMER_EXPIRING);
+        }
+
+        head = &wheel->slots[TIMER_EXPIRING];
+        while ( head->next != head ) {
+            timer = head->next;
+            unlink_timer(wheel, timer);
+            --wheel->count;
+            ++num_expired;
+            expire(timer, arg);
+        }
+    }
+
+    return num_expired;
+}
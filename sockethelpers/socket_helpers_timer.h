@@ -0,0 +1,76 @@
+/*!
+ * \file            socket_helpers_timer.h
+ * \brief           Interface to timer wheel functions.
+ * \details         Interface to timer wheel functions.
+ * \author          Paul Griffiths
+ * \copyright       Copyright 2013 Paul Griffiths. Distributed under the terms
+ * of the GNU General Public License. <http://www.gnu.org/licenses/>
+ */
+
+
+#ifndef PG_SOCKET_HELPERS_TIMER_H
+#define PG_SOCKET_HELPERS_TIMER_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+
+/*!
+ * \brief           Struct for a timer.
+ * \details         Timers are embedded in the caller's own structures,
+ * so arming and cancelling them never allocates. The fields other than
+ * `data` are private to the wheel.
+ */
+
+typedef struct TimerEntry {
+    struct TimerEntry * next;   /*!< Next timer in the slot */
+    struct TimerEntry * prev;   /*!< Previous timer in the slot */
+    uint64_t expires;           /*!< Expiry time in milliseconds */
+    unsigned slot;              /*!< Index of the slot holding the timer */
+    void * data;                /*!< Caller's data */
+} TimerEntry;
+
+
+/*!
+ * \brief           Opaque timer wheel type.
+ * \details         A hierarchical timer wheel with a one millisecond
+ * tick. A wheel is not thread-safe, and is meant to be owned by a single
+ * event-loop thread.
+ */
+
+typedef struct TimerWheel TimerWheel;
+
+
+/*!
+ * \brief           Timer expiry callback type.
+ * \details         The timer is disarmed before the callback is made, so
+ * the callback may re-arm it, or free the structure containing it.
+ */
+
+typedef void (*TimerCallback)(TimerEntry * timer, void * arg);
+
+
+/*  Function prototypes  */
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+uint64_t timer_now_ms(void);
+TimerWheel * timer_wheel_create(const uint64_t now_ms);
+void timer_wheel_destroy(TimerWheel * wheel);
+void timer_entry_init(TimerEntry * timer, void * data);
+int timer_entry_armed(const TimerEntry * timer);
+void timer_wheel_arm(TimerWheel * wheel, TimerEntry * timer,
+                     const uint64_t expires_ms);
+void timer_wheel_cancel(TimerWheel * wheel, TimerEntry * timer);
+size_t timer_wheel_count(const TimerWheel * wheel);
+long timer_wheel_next_timeout(const TimerWheel * wheel, const uint64_t now_ms);
+size_t timer_wheel_advance(TimerWheel * wheel, const uint64_t now_ms,
+                           TimerCallback expire, void * arg);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif          /*  PG_SOCKET_HELPERS_TIMER_H  */
@@ -0,0 +1,1466 @@
+/*!
+ * \file            socket_helpers_uring.c
+ * \brief           Implementation of io_uring event-loop server functions.
+ * \details         Each event-loop thread has its own io_uring instance,
+ * driven through the raw system calls. The thread keeps one multishot
+ * accept armed on the shared listening socket, and one multishot
+ * receive armed on each of its connections, which picks buffers from
+ * a ring of provided buffers. Output written to a connection during a
+ * handler callback, through the SocketOutput it is given when the
+ * connection is opened, is queued, and sent after the callback returns as
+ * a chain of linked sends, so a single `io_uring_enter()` both submits
+ * the sends for every connection served in a pass and waits for the
+ * next batch of completions. Idle timeouts are kept in a timer wheel
+ * per thread, which bounds that wait.
+ *
+ * Queued output is bounded by the handler's output limits. While a
+ * connection's output is over its high watermark, its receive is
+ * cancelled, and it is re-armed once the output drains to the low
+ * watermark. Should a cancellation find the submission queue full, the
+ * connection waits on a list to be cancelled on the next pass.
+ *
+ * When an accept fails for want of file descriptors or memory, the
+ * accept is re-armed after `SERVER_RETRY_MS` milliseconds, or once a
+ * connection is closed, rather than at once, which would fail again
+ * straight away while any connection waits in the backlog.
+ *
+ * Where the kernel or the system headers lack the features needed,
+ * start_uring_tcp_server() falls back to start_epoll_tcp_server().
+ * \author          Paul Griffiths
+ * \copyright       Copyright 2013 Paul Griffiths. Distributed under the terms
+ * of the GNU General Public License. <http://www.gnu.org/licenses/>
+ */
+
+
+#define _GNU_SOURCE
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <sys/mman.h>
+#include <linux/io_uring.h>
+#include <paulgrif/chelpers.h>
+#include "socket_helpers_uring.h"
+#include "socket_helpers_epoll.h"
+#include "socket_helpers_timer.h"
+#include "socket_helpers_queue.h"
+#include "socket_helpers_error.h"
+#include "socket_helpers_metrics.h"
+
+
+/*  The engine needs multishot receive and provided buffer rings, which
+    arrived in the same kernel release, so headers which define one
+    define the other.                                                   */
+
+#if defined(IORING_RECV_MULTISHOT) && defined(__NR_io_uring_setup)
+#define URING_SUPPORTED
+#endif
+
+
+#ifdef URING_SUPPORTED
+
+/*!
+ * \brief           Number of submission queue entries per ring.
+ */
+
+#define URING_ENTRIES 1024
+
+
+/*!
+ * \brief           Number of provided receive buffers per ring.
+ * \details         Must be a power of two.
+ */
+
+#define URING_BUF_COUNT 256
+
+
+/*!
+ * \brief           Size of each provided receive buffer.
+ */
+
+#define URING_BUF_SIZE 16384
+
+
+/*!
+ * \brief           Buffer group ID of the provided receive buffers.
+ */
+
+#define URING_BUF_GROUP 0
+
+
+/*!
+ * \brief           Maximum number of bytes per send submission.
+ */
+
+#define URING_SEND_CHUNK 65536
+
+
+/*!
+ * \brief           Maximum number of sends in one linked chain.
+ * \details         Any further output is sent once the chain completes.
+ */
+
+#define URING_MAX_LINKED 16
+
+
+/*!
+ * \brief           Enumeration of submission types.
+ * \details         The type is stored in the low bits of each
+ * submission's user data, and the connection pointer in the rest.
+ */
+
+enum uring_tag {
+    URING_TAG_ACCEPT,           /*!< Multishot accept */
+    URING_TAG_RECV,             /*!< Multishot receive */
+    URING_TAG_SEND,             /*!< Send */
+    URING_TAG_CANCEL            /*!< Cancellation, result ignored */
+};
+
+
+/*!
+ * \brief           Mask for the submission type in user data.
+ */
+
+#define URING_TAG_MASK 3
+
+
+/*!
+ * \brief           Struct for an io_uring instance.
+ */
+
+typedef struct UringRing {
+    int fd;                         /*!< File descriptor of the instance */
+    unsigned * sq_head;             /*!< Submission queue head */
+    unsigned * sq_tail;             /*!< Submission queue tail */
+    unsigned sq_mask;               /*!< Submission queue index mask */
+    unsigned sq_entries;            /*!< Submission queue size */
+    unsigned sqe_tail;              /*!< Tail including unpublished entries */
+    struct io_uring_sqe * sqes;     /*!< Submission queue entries */
+    unsigned * cq_head;             /*!< Completion queue head */
+    unsigned * cq_tail;             /*!< Completion queue tail */
+    unsigned cq_mask;               /*!< Completion queue index mask */
+    struct io_uring_cqe * cqes;     /*!< Completion queue entries */
+    void * sq_ptr;                  /*!< Submission queue ring mapping */
+    size_t sq_size;                 /*!< Size of submission ring mapping */
+    void * cq_ptr;                  /*!< Completion queue ring mapping */
+    size_t cq_size;                 /*!< Size of completion ring mapping */
+    size_t sqes_size;               /*!< Size of entries mapping */
+} UringRing;
+
+
+/*!
+ * \brief           Struct for a connection output buffer.
+ */
+
+typedef struct UringOutput {
+    char * data;                /*!< Buffered output */
+    size_t len;                 /*!< Number of bytes buffered */
+    size_t capacity;            /*!< Size of the allocation */
+} UringOutput;
+
+
+/*!
+ * \brief           Struct for an io_uring connection.
+ * \details         Output is double-buffered. `out[flight]` is being
+ * sent, and must not move while sends are outstanding, and the other
+ * buffer collects output written in the meantime.
+ */
+
+typedef struct UringConn {
+    int socket;                 /*!< File descriptor for the connection */
+    void * conn_data;           /*!< Handler data for the connection */
+    int recv_armed;             /*!< True while the receive is armed */
+    int closing;                /*!< True once the connection is closing */
+    int send_failed;            /*!< True if a send has failed */
+    int blocked;                /*!< True while not read, for output
+                                     to drain */
+    int message;                /*!< State of a partial message */
+    SocketOutput sink;          /*!< Queues output, for the handler */
+    const SocketQueuePolicy * policy;   /*!< The handler's output limits */
+    int cancel_pending;         /*!< True while on the cancel list */
+    struct UringConn * cancel_next;     /*!< Next on the cancel list */
+    unsigned sends_pending;     /*!< Number of sends outstanding */
+    size_t flight_sent;         /*!< Bytes of `out[flight]` sent */
+    int flight;                 /*!< Index of the buffer being sent */
+    UringOutput out[2];         /*!< Output buffers */
+    TimerEntry timer;           /*!< Idle timer */
+} UringConn;
+
+
+/*!
+ * \brief           Struct for starting event-loop threads together.
+ * \details         Threads wait for `state` to be set, so that they can
+ * be told to exit if the server fails to start.
+ */
+
+typedef struct UringStart {
+    pthread_mutex_t mutex;      /*!< Mutex guarding `state` */
+    pthread_cond_t cond;        /*!< Condition signalled on a change */
+    int state;                  /*!< 0 to wait, 1 to run, -1 to exit */
+} UringStart;
+
+
+/*!
+ * \brief           Struct for an io_uring event-loop thread.
+ */
+
+typedef struct UringLoop {
+    UringRing ring;                     /*!< This thread's io_uring */
+    int listening_socket;               /*!< Shared listening socket */
+    const EpollHandler * handler;       /*!< Connection callbacks */
+    struct io_uring_buf_ring * bufs;    /*!< Provided buffer ring */
+    char * buf_data;                    /*!< Provided buffer memory */
+    unsigned short buf_tail;            /*!< Provided buffer ring tail */
+    TimerWheel * timers;                /*!< Idle timers */
+    uint64_t now_ms;                    /*!< Time of the last wakeup */
+    UringConn * cancels;                /*!< Connections to cancel */
+    TimerEntry accept_timer;            /*!< Timer to re-arm the accept */
+    int accept_paused;                  /*!< True while the accept is not
+                                             armed */
+    UringStart * start;                 /*!< Start signal for the thread */
+    pthread_t thread_id;                /*!< Thread running the loop */
+} UringLoop;
+
+
+/*!
+ * \brief           Cached result of uring_available(): 0 if unknown.
+ */
+
+static int uring_probed = 0;
+
+
+/*!
+ * \brief           Wrapper for the `io_uring_setup()` system call.
+ */
+
+static int sys_uring_setup(unsigned entries, struct io_uring_params * p) {
+    return (int) syscall(__NR_io_uring_setup, entries, p);
+}
+
+
+/*!
+ * \brief           Wrapper for the `io_uring_enter()` system call.
+ * \details         A non-negative `time_out_ms` bounds any wait for
+ * completions, after which the call fails with `ETIME`.
+ */
+
+static int sys_uring_enter(int fd, unsigned to_submit, unsigned min_complete,
+                           unsigned flags, const long time_out_ms) {
+    struct io_uring_getevents_arg arg;
+    struct __kernel_timespec ts;
+
+    if ( time_out_ms < 0 || min_complete == 0 ) {
+        return (int) syscall(__NR_io_uring_enter, fd, to_submit,
+                             min_complete, flags, NULL, 0);
+    }
+
+    ts.tv_sec = time_out_ms / 1000;
+    ts.tv_nsec = (time_out_ms % 1000) * 1000000;
+    memset(&arg, 0, sizeof(arg));
+    arg.ts = (uint64_t) (uintptr_t) &ts;
+
+    return (int) syscall(__NR_io_uring_enter, fd, to_submit, min_complete,
+                         flags | IORING_ENTER_EXT_ARG, &arg, sizeof(arg));
+}
+
+
+/*!
+ * \brief           Wrapper for the `io_uring_register()` system call.
+ */
+
+static int sys_uring_register(int fd, unsigned opcode, void * arg,
+                              unsigned nr_args) {
+    return (int) syscall(__NR_io_uring_register, fd, opcode, arg, nr_args);
+}
+
+
+/*!
+ * \brief           Unmaps and closes an io_uring instance.
+ * \param ring      The ring.
+ */
+
+static void ring_free(UringRing * ring) {
+    if ( ring->sqes != NULL ) {
+        munmap(ring->sqes, ring->sqes_size);
+    }
+    if ( ring->cq_ptr != NULL && ring->cq_ptr != ring->sq_ptr ) {
+        munmap(ring->cq_ptr, ring->cq_size);
+    }
+    if ( ring->sq_ptr != NULL ) {
+        munmap(ring->sq_ptr, ring->sq_size);
+    }
+    close(ring->fd);
+}
+
+
+/*!
+ * \brief           Creates and maps an io_uring instance.
+ * \param ring      The ring to initialize.
+ * \param entries   The number of submission queue entries.
+ * \returns         0 on success, or -1 with `errno` set on encountering
+ * an error.
+ */
+
+static int ring_init(UringRing * ring, const unsigned entries) {
+    struct io_uring_params params;
+    unsigned * sq_array;
+    char * sq_ptr, * cq_ptr;
+    unsigned index;
+
+    memset(ring, 0, sizeof(*ring));
+    memset(&params, 0, sizeof(params));
+
+    /*  Cooperative task running avoids interrupting the thread to run
+        completion work, since it enters the kernel regularly anyway.  */
+
+    params.flags = IORING_SETUP_COOP_TASKRUN;
+    if ( (ring->fd = sys_uring_setup(entries, &params)) == -1 ) {
+        memset(&params, 0, sizeof(params));
+        if ( (ring->fd = sys_uring_setup(entries, &params)) == -1 ) {
+            return ERROR_RETURN;
+        }
+    }
+
+    ring->sq_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    ring->cq_size = params.cq_off.cqes +
+                    params.cq_entries * sizeof(struct io_uring_cqe);
+    if ( params.features & IORING_FEAT_SINGLE_MMAP ) {
+        if ( ring->cq_size > ring->sq_size ) {
+            ring->sq_size = ring->cq_size;
+        }
+        ring->cq_size = ring->sq_size;
+    }
+
+    ring->sq_ptr = mmap(NULL, ring->sq_size, PROT_READ | PROT_WRITE,
+                        MAP_SHARED | MAP_POPULATE, ring->fd,
+                        IORING_OFF_SQ_RING);
+    if ( ring->sq_ptr == MAP_FAILED ) {
+        ring->sq_ptr = NULL;
+        ring_free(ring);
+        return ERROR_RETURN;
+    }
+
+    if ( params.features & IORING_FEAT_SINGLE_MMAP ) {
+        ring->cq_ptr = ring->sq_ptr;
+    } else {
+        ring->cq_ptr = mmap(NULL, ring->cq_size, PROT_READ | PROT_WRITE,
+                            MAP_SHARED | MAP_POPULATE, ring->fd,
+                            IORING_OFF_CQ_RING);
+        if ( ring->cq_ptr == MAP_FAILED ) {
+            ring->cq_ptr = NULL;
+            ring_free(ring);
+            return ERROR_RETURN;
+        }
+    }
+
+    ring->sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+    ring->sqes = mmap(NULL, ring->sqes_size, PROT_READ | PROT_WRITE,
+                      MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQES);
+    if ( ring->sqes == MAP_FAILED ) {
+        ring->sqes = NULL;
+        ring_free(ring);
+        return ERROR_RETURN;
+    }
+
+    sq_ptr = ring->sq_ptr;
+    cq_ptr = ring->cq_ptr;
+
+    ring->sq_head = (unsigned *) (sq_ptr + params.sq_off.head);
+    ring->sq_tail = (unsigned *) (sq_ptr + params.sq_off.tail);
+    ring->sq_mask = *(unsigned *) (sq_ptr + params.sq_off.ring_mask);
+    ring->sq_entries = params.sq_entries;
+    ring->sqe_tail = *ring->sq_tail;
+    ring->cq_head = (unsigned *) (cq_ptr + params.cq_off.head);
+    ring->cq_tail = (unsigned *) (cq_ptr + params.cq_off.tail);
+    ring->cq_mask = *(unsigned *) (cq_ptr + params.cq_off.ring_mask);
+    ring->cqes = (struct io_uring_cqe *) (cq_ptr + params.cq_off.cqes);
+
+    /*  Submission queue entries are always used in ring order, so the
+        indirection array is set up once as the identity.              */
+
+    sq_array = (unsigned *) (sq_ptr + params.sq_off.array);
+    for ( index = 0; index < params.sq_entries; ++index ) {
+        sq_array[index] = index;
+    }
+
+    return 0;
+}
+
+
+/*!
+ * \brief           Submits queued entries and optionally waits.
+ * \param ring      The ring.
+ * \param wait_nr   The number of completions to wait for.
+ * \param time_out_ms The longest time to wait, or -1 to wait
+ * indefinitely.
+ * \returns         0 on success or on timing out, or -1 with `errno`
+ * set on encountering an error.
+ */
+
+static int ring_submit(UringRing * ring, const unsigned wait_nr,
+                       const long time_out_ms) {
+    unsigned to_submit;
+
+    __atomic_store_n(ring->sq_tail, ring->sqe_tail, __ATOMIC_RELEASE);
+    to_submit = ring->sqe_tail - __atomic_load_n(ring->sq_head,
+                                                 __ATOMIC_ACQUIRE);
+
+    if ( to_submit == 0 && wait_nr == 0 ) {
+        return 0;
+    }
+
+    while ( sys_uring_enter(ring->fd, to_submit, wait_nr,
+                            wait_nr > 0 ? IORING_ENTER_GETEVENTS : 0,
+                            time_out_ms) == -1 ) {
+
+        /*  EBUSY and EAGAIN mean the completion queue needs draining
+            before the kernel will accept more submissions.            */
+
+        if ( errno == EBUSY || errno == EAGAIN || errno == ETIME ) {
+            break;
+        } else if ( errno != EINTR ) {
+            return ERROR_RETURN;
+        }
+    }
+
+    return 0;
+}
+
+
+/*!
+ * \brief           Makes room for a number of submission entries.
+ * \details         Submits what is already queued if the submission
+ * queue does not have `count` free entries, so that a linked chain is
+ * never split across two submissions.
+ * \param ring      The ring.
+ * \param count     The number of entries needed.
+ * \returns         0 on success, or -1 with `errno` set on encountering
+ * an error.
+ */
+
+static int ring_reserve(UringRing * ring, const unsigned count) {
+    unsigned head = __atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE);
+
+    if ( ring->sq_entries - (ring->sqe_tail - head) >= count ) {
+        return 0;
+    }
+
+    if ( ring_submit(ring, 0, -1) == -1 ) {
+        return ERROR_RETURN;
+    }
+
+    head = __atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE);
+    if ( ring->sq_entries - (ring->sqe_tail - head) < count ) {
+        errno = EBUSY;
+        return ERROR_RETURN;
+    }
+
+    return 0;
+}
+
+
+/*!
+ * \brief           Gets the next submission entry, cleared.
+ * \details         ring_reserve() must have been called first.
+ * \param ring      The ring.
+ * \param user_data The user data for the entry.
+ * \returns         The entry.
+ */
+
+static struct io_uring_sqe * ring_next(UringRing * ring,
+                                       const uint64_t user_data) {
+    struct io_uring_sqe * sqe = &ring->sqes[ring->sqe_tail & ring->sq_mask];
+
+    ++ring->sqe_tail;
+    memset(sqe, 0, sizeof(*sqe));
+    sqe->user_data = user_data;
+    return sqe;
+}
+
+
+/*!
+ * \brief           Makes submission user data for a connection.
+ */
+
+static uint64_t conn_user_data(UringConn * conn, const enum uring_tag tag) {
+    return (uint64_t) (uintptr_t) conn | (uint64_t) tag;
+}
+
+
+/*!
+ * \brief           Returns a provided buffer to the buffer ring.
+ * \param loop      The event loop.
+ * \param bid       The ID of the buffer.
+ */
+
+static void recycle_buffer(UringLoop * loop, const unsigned short bid) {
+    struct io_uring_buf * buf;
+
+    buf = &loop->bufs->bufs[loop->buf_tail & (URING_BUF_COUNT - 1)];
+    buf->addr = (uint64_t) (uintptr_t) (loop->buf_data +
+                                        (size_t) bid * URING_BUF_SIZE);
+    buf->len = URING_BUF_SIZE;
+    buf->bid = bid;
+
+    ++loop->buf_tail;
+    __atomic_store_n(&loop->bufs->tail, loop->buf_tail, __ATOMIC_RELEASE);
+}
+
+
+/*!
+ * \brief           Registers a ring of provided receive buffers.
+ * \param loop      The event loop.
+ * \returns         0 on success, or -1 with `errno` set on encountering
+ * an error.
+ */
+
+static int init_buffers(UringLoop * loop) {
+    struct io_uring_buf_reg reg;
+    size_t ring_size = URING_BUF_COUNT * sizeof(struct io_uring_buf);
+    unsigned short bid;
+
+    loop->bufs = mmap(NULL, ring_size, PROT_READ | PROT_WRITE,
+                      MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if ( loop->bufs == MAP_FAILED ) {
+        return ERROR_RETURN;
+    }
+
+    if ( (loop->buf_data = malloc((size_t) URING_BUF_COUNT *
+                                  URING_BUF_SIZE)) == NULL ) {
+        munmap(loop->bufs, ring_size);
+        return ERROR_RETURN;
+    }
+
+    memset(&reg, 0, sizeof(reg));
+    reg.ring_addr = (uint64_t) (uintptr_t) loop->bufs;
+    reg.ring_entries = URING_BUF_COUNT;
+    reg.bgid = URING_BUF_GROUP;
+
+    if ( sys_uring_register(loop->ring.fd, IORING_REGISTER_PBUF_RING,
+                            &reg, 1) == -1 ) {
+        free(loop->buf_data);
+        munmap(loop->bufs, ring_size);
+        return ERROR_RETURN;
+    }
+
+    loop->buf_tail = 0;
+    for ( bid = 0; bid < URING_BUF_COUNT; ++bid ) {
+        recycle_buffer(loop, bid);
+    }
+
+    return 0;
+}
+
+
+/*!
+ * \brief           Arms a multishot accept on the listening socket.
+ * \param loop      The event loop.
+ * \returns         0 on success, or -1 with `errno` set on encountering
+ * an error.
+ */
+
+static int arm_accept(UringLoop * loop) {
+    struct io_uring_sqe * sqe;
+
+    if ( ring_reserve(&loop->ring, 1) == -1 ) {
+        return ERROR_RETURN;
+    }
+
+    sqe = ring_next(&loop->ring, conn_user_data(NULL, URING_TAG_ACCEPT));
+    sqe->opcode = IORING_OP_ACCEPT;
+    sqe->fd = loop->listening_socket;
+    sqe->ioprio = IORING_ACCEPT_MULTISHOT;
+    sqe->accept_flags = SOCK_CLOEXEC;
+    return 0;
+}
+
+
+/*!
+ * \brief           Arms a multishot receive on a connection.
+ * \param loop      The event loop.
+ * \param conn      The connection.
+ * \returns         0 on success, or -1 with `errno` set on encountering
+ * an error.
+ */
+
+static int arm_recv(UringLoop * loop, UringConn * conn) {
+    struct io_uring_sqe * sqe;
+
+    if ( ring_reserve(&loop->ring, 1) == -1 ) {
+        return ERROR_RETURN;
+    }
+
+    sqe = ring_next(&loop->ring, conn_user_data(conn, URING_TAG_RECV));
+    sqe->opcode = IORING_OP_RECV;
+    sqe->fd = conn->socket;
+    sqe->ioprio = IORING_RECV_MULTISHOT;
+    sqe->flags = IOSQE_BUFFER_SELECT;
+    sqe->buf_group = URING_BUF_GROUP;
+    conn->recv_armed = TRUE;
+    return 0;
+}
+
+
+/*!
+ * \brief           Cancels a connection's receive.
+ * \details         If the submission queue has no room, the connection
+ * is put on the loop's cancel list, and cancelled by submit_cancels()
+ * on the next pass.
+ * \param loop      The event loop.
+ * \param conn      The connection, whose receive is armed.
+ */
+
+static void cancel_recv(UringLoop * loop, UringConn * conn) {
+    struct io_uring_sqe * sqe;
+
+    if ( conn->cancel_pending ) {
+        return;
+    }
+
+    if ( ring_reserve(&loop->ring, 1) == -1 ) {
+        conn->cancel_pending = TRUE;
+        conn->cancel_next = loop->cancels;
+        loop->cancels = conn;
+        return;
+    }
+
+    sqe = ring_next(&loop->ring, conn_user_data(NULL, URING_TAG_CANCEL));
+    sqe->opcode = IORING_OP_ASYNC_CANCEL;
+    sqe->addr = conn_user_data(conn, URING_TAG_RECV);
+}
+
+
+/*!
+ * \brief           Starts closing a connection.
+ * \details         Cancels the connection's receive. The connection is
+ * closed and freed by release_conn() once its outstanding submissions
+ * have completed and its output has been sent.
+ * \param loop      The event loop.
+ * \param conn      The connection.
+ */
+
+static void close_conn(UringLoop * loop, UringConn * conn) {
+    if ( conn->closing ) {
+        return;
+    }
+    conn->closing = TRUE;
+    timer_wheel_cancel(loop->timers, &conn->timer);
+
+    if ( conn->recv_armed ) {
+        cancel_recv(loop, conn);
+    }
+}
+
+
+/*!
+ * \brief           Returns the number of bytes of output not yet sent.
+ * \param conn      The connection.
+ * \returns         The number of bytes queued.
+ */
+
+static size_t queued_output(const UringConn * conn) {
+    return conn->out[conn->flight].len - conn->flight_sent +
+           conn->out[conn->flight ^ 1].len;
+}
+
+
+/*!
+ * \brief           Blocks or unblocks a connection for its queued output.
+ * \details         A connection is blocked by cancelling its receive,
+ * and unblocked by re-arming it.
+ * \param loop      The event loop.
+ * \param conn      The connection.
+ */
+
+static void update_flow(UringLoop * loop, UringConn * conn) {
+    if ( conn->closing ||
+         !socket_queue_update_blocked(&loop->handler->output,
+                                      &conn->blocked, queued_output(conn)) ) {
+        return;
+    }
+
+    if ( conn->blocked ) {
+        if ( conn->recv_armed ) {
+            cancel_recv(loop, conn);
+        }
+    } else if ( !conn->recv_armed && arm_recv(loop, conn) == -1 ) {
+        close_conn(loop, conn);
+    }
+}
+
+
+/*!
+ * \brief           Submits a linked chain of sends for a connection.
+ * \details         Sends `out[flight]` from `flight_sent` onwards. The
+ * sends use `MSG_WAITALL`, so a short send fails the chain, and the
+ * cancelled remainder is resubmitted when the chain completes.
+ * \param loop      The event loop.
+ * \param conn      The connection.
+ */
+
+static void submit_sends(UringLoop * loop, UringConn * conn) {
+    UringOutput * out = &conn->out[conn->flight];
+    struct io_uring_sqe * sqe;
+    size_t offset = conn->flight_sent;
+    size_t chunk;
+    unsigned num_sends = 0;
+
+    while ( offset < out->len && num_sends < URING_MAX_LINKED ) {
+        offset += (out->len - offset) > URING_SEND_CHUNK ?
+                  URING_SEND_CHUNK : out->len - offset;
+        ++num_sends;
+    }
+
+    if ( ring_reserve(&loop->ring, num_sends) == -1 ) {
+        socket_count_error(SOCKET_ERROR_RESOURCE);
+        conn->send_failed = TRUE;
+        close_conn(loop, conn);
+        return;
+    }
+
+    offset = conn->flight_sent;
+    while ( num_sends > 0 ) {
+        chunk = (out->len - offset) > URING_SEND_CHUNK ?
+                URING_SEND_CHUNK : out->len - offset;
+
+        sqe = ring_next(&loop->ring, conn_user_data(conn, URING_TAG_SEND));
+        sqe->opcode = IORING_OP_SEND;
+        sqe->fd = conn->socket;
+        sqe->addr = (uint64_t) (uintptr_t) (out->data + offset);
+        sqe->len = (unsigned) chunk;
+        sqe->msg_flags = MSG_WAITALL | MSG_NOSIGNAL;
+        if ( --num_sends > 0 ) {
+            sqe->flags = IOSQE_IO_LINK;
+        }
+
+        ++conn->sends_pending;
+        offset += chunk;
+    }
+}
+
+
+/*!
+ * \brief           Sends any output queued on a connection.
+ * \details         Does nothing while sends are outstanding. Otherwise,
+ * resumes the buffer being sent if it was not sent in full, or swaps
+ * in the buffer of output queued since.
+ * \param loop      The event loop.
+ * \param conn      The connection.
+ */
+
+static void flush_conn(UringLoop * loop, UringConn * conn) {
+    if ( conn->sends_pending > 0 || conn->send_failed ) {
+        return;
+    }
+
+    if ( conn->flight_sent >= conn->out[conn->flight].len ) {
+        conn->out[conn->flight].len = 0;
+        conn->flight_sent = 0;
+        conn->flight ^= 1;
+    }
+
+    if ( conn->flight_sent < conn->out[conn->flight].len ) {
+        submit_sends(loop, conn);
+    }
+}
+
+
+/*!
+ * \brief           Stops accepting for a while.
+ * \details         Called when an accept fails for want of resources,
+ * or cannot be re-armed. The accept is re-armed from the loop's accept
+ * timer, or when a connection is released.
+ * \param loop      The event loop.
+ */
+
+static void pause_accepting(UringLoop * loop) {
+    loop->accept_paused = TRUE;
+    timer_wheel_arm(loop->timers, &loop->accept_timer,
+                    loop->now_ms + SERVER_RETRY_MS);
+}
+
+
+/*!
+ * \brief           Re-arms the accept after a pause.
+ * \details         Should the accept not be re-armed, the pause is
+ * restarted.
+ * \param loop      The event loop.
+ */
+
+static void resume_accepting(UringLoop * loop) {
+    timer_wheel_cancel(loop->timers, &loop->accept_timer);
+    loop->accept_paused = FALSE;
+    if ( arm_accept(loop) == -1 ) {
+        pause_accepting(loop);
+    }
+}
+
+
+/*!
+ * \brief           Closes and frees a connection if it is finished with.
+ * \details         Re-arms the accept if it was paused for want of file
+ * descriptors, as one has been freed.
+ * \param loop      The event loop.
+ * \param conn      The connection.
+ */
+
+static void release_conn(UringLoop * loop, UringConn * conn) {
+    if ( !conn->closing || conn->recv_armed || conn->sends_pending > 0 ||
+         conn->cancel_pending ) {
+        return;
+    }
+
+    socket_queue_count_sent(queued_output(conn));
+    socket_queue_update_blocked(&loop->handler->output, &conn->blocked, 0);
+
+    if ( loop->handler->on_close != NULL ) {
+        loop->handler->on_close(conn->socket, conn->conn_data);
+    }
+
+    close(conn->socket);
+    free(conn->out[0].data);
+    free(conn->out[1].data);
+    free(conn);
+    socket_metrics_add(SOCKET_METRIC_CLOSED, 1);
+
+    if ( loop->accept_paused ) {
+        resume_accepting(loop);
+    }
+}
+
+
+/*!
+ * \brief           Submits the cancellations which found the submission
+ * queue full.
+ * \details         A connection no longer needing its receive cancelled,
+ * because it has ended or been unblocked, is just taken off the list.
+ * \param loop      The event loop.
+ */
+
+static void submit_cancels(UringLoop * loop) {
+    UringConn * conn = loop->cancels;
+    UringConn * next;
+
+    loop->cancels = NULL;
+    while ( conn != NULL ) {
+        next = conn->cancel_next;
+        conn->cancel_pending = FALSE;
+        if ( conn->recv_armed && (conn->closing || conn->blocked) ) {
+            cancel_recv(loop, conn);
+        }
+        release_conn(loop, conn);
+        conn = next;
+    }
+}
+
+
+/*!
+ * \brief           Queues output on an io_uring connection.
+ * \details         The connection's SocketOutput function. The output is
+ * sent once the handler callback returns, and the buffers are copied,
+ * so may be reused as soon as the function returns. Output beyond the handler's output limits is
+ * discarded, or fails the connection, according to its policy.
+ * \param arg       The connection.
+ * \param iov       The buffers to write.
+ * \param iovcnt    The number of buffers in `iov`.
+ * \returns         The number of characters queued, or -1 with `errno` set on encountering an
+ * error, including `ENOBUFS` if the connection's output limit was
+ * exceeded. The connection is closed after the callback returns if the
+ * function fails.
+ */
+
+static ssize_t queue_output(void * arg, const struct iovec * iov,
+                            const int iovcnt) {
+    UringConn * conn = arg;
+    UringOutput * out;
+    size_t total = 0, capacity;
+    char * data;
+    int index;
+
+    if ( conn->send_failed ) {
+        errno = EPIPE;
+        return ERROR_RETURN;
+    }
+
+    for ( index = 0; index < iovcnt; ++index ) {
+        total += iov[index].iov_len;
+    }
+
+    switch ( socket_queue_admit(conn->policy,
+                                &conn->message, queued_output(conn),
+                                total) ) {
+        case SOCKET_OVERFLOW_DROP:
+            return (ssize_t) total;
+
+        case SOCKET_OVERFLOW_DISCONNECT:
+            socket_count_error(SOCKET_ERROR_OVERFLOW);
+            conn->send_failed = TRUE;
+            errno = ENOBUFS;
+            return ERROR_RETURN;
+
+        default:
+            break;
+    }
+
+    out = &conn->out[conn->flight ^ 1];
+    if ( out->len + total > out->capacity ) {
+        capacity = out->capacity > 0 ? out->capacity : URING_BUF_SIZE;
+        while ( capacity < out->len + total ) {
+            capacity *= 2;
+        }
+        if ( (data = realloc(out->data, capacity)) == NULL ) {
+            socket_count_error(SOCKET_ERROR_RESOURCE);
+            conn->send_failed = TRUE;
+            return ERROR_RETURN;
+        }
+        out->data = data;
+        out->capacity = capacity;
+    }
+
+    for ( index = 0; index < iovcnt; ++index ) {
+        memcpy(out->data + out->len, iov[index].iov_base, iov[index].iov_len);
+        out->len += iov[index].iov_len;
+    }
+
+    socket_queue_count_queued(total, queued_output(conn));
+    return (ssize_t) total;
+}
+
+
+/*!
+ * \brief           Handles an accept completion.
+ * \details         A multishot accept ends on an error. One which failed
+ * for want of resources is counted, and re-armed after a pause.
+ * \param loop      The event loop.
+ * \param res       The completion result.
+ * \param flags     The completion flags.
+ * \returns         0 on success, or -1 on encountering an error.
+ */
+
+static int handle_accept(UringLoop * loop, const int res,
+                         const unsigned flags) {
+    UringConn * conn;
+
+    if ( res >= 0 ) {
+        socket_metrics_add(SOCKET_METRIC_ACCEPTS, 1);
+        if ( (conn = calloc(1, sizeof(*conn))) == NULL ) {
+            socket_count_error(SOCKET_ERROR_RESOURCE);
+            close(res);
+        } else {
+            conn->socket = res;
+            timer_entry_init(&conn->timer, conn);
+            conn->sink.writev = queue_output;
+            conn->sink.conn = conn;
+            conn->policy = &loop->handler->output;
+            if ( loop->handler->on_open != NULL &&
+                 loop->handler->on_open(res, &conn->sink,
+                                        &conn->conn_data) != 0 ) {
+                close(res);
+                free(conn);
+            } else {
+                socket_metrics_add(SOCKET_METRIC_OPENED, 1);
+                if ( arm_recv(loop, conn) == -1 ) {
+                    conn->closing = TRUE;
+                    release_conn(loop, conn);
+                } else if ( loop->handler->idle_timeout_ms > 0 ) {
+                    timer_wheel_arm(loop->timers, &conn->timer,
+                            loop->now_ms + loop->handler->idle_timeout_ms);
+                }
+            }
+        }
+    } else if ( res == -EINVAL || res == -EBADF || res == -ENOTSOCK ) {
+        errno = -res;
+        set_errno_errmsg("Error accepting connection");
+        return ERROR_RETURN;
+    } else if ( server_accept_exhausted(-res) ) {
+        socket_count_error(SOCKET_ERROR_RESOURCE);
+        if ( !(flags & IORING_CQE_F_MORE) ) {
+            pause_accepting(loop);
+        }
+        return 0;
+    }
+
+    if ( !(flags & IORING_CQE_F_MORE) && arm_accept(loop) == -1 ) {
+        pause_accepting(loop);
+    }
+
+    return 0;
+}
+
+
+/*!
+ * \brief           Handles a receive completion.
+ * \details         Passes the data to the handler, recycles the buffer,
+ * and sends whatever the handler wrote.
+ * \param loop      The event loop.
+ * \param conn      The connection.
+ * \param res       The completion result.
+ * \param flags     The completion flags.
+ */
+
+static void handle_recv(UringLoop * loop, UringConn * conn, const int res,
+                        const unsigned flags) {
+    unsigned short bid;
+
+    if ( res > 0 && (flags & IORING_CQE_F_BUFFER) ) {
+        bid = (unsigned short) (flags >> IORING_CQE_BUFFER_SHIFT);
+
+        if ( !conn->closing ) {
+            if ( loop->handler->on_data(conn->socket, conn->conn_data,
+                        loop->buf_data + (size_t) bid * URING_BUF_SIZE,
+                        (size_t) res) != 0 || conn->send_failed ) {
+                close_conn(loop, conn);
+            } else if ( loop->handler->idle_timeout_ms > 0 ) {
+                timer_wheel_arm(loop->timers, &conn->timer,
+                        loop->now_ms + loop->handler->idle_timeout_ms);
+            }
+        }
+
+        recycle_buffer(loop, bid);
+        flush_conn(loop, conn);
+        update_flow(loop, conn);
+    }
+
+    if ( !(flags & IORING_CQE_F_MORE) ) {
+        conn->recv_armed = FALSE;
+
+        /*  The receive also stops when the buffer ring runs dry, in
+            which case it is re-armed, buffers having been recycled,
+            and when it is cancelled to block the connection, in which
+            case it is re-armed once the connection is unblocked.      */
+
+        if ( res < 0 && res != -ENOBUFS && res != -ECANCELED ) {
+            socket_count_error(socket_error_kind(-res));
+        } else if ( res == 0 && !conn->closing ) {
+            loop->handler->on_data(conn->socket, conn->conn_data,
+                                   loop->buf_data, 0);
+            flush_conn(loop, conn);
+        }
+
+        if ( conn->closing ||
+             (res <= 0 && res != -ENOBUFS && res != -ECANCELED) ) {
+            close_conn(loop, conn);
+        } else if ( !conn->blocked && arm_recv(loop, conn) == -1 ) {
+            close_conn(loop, conn);
+        }
+    }
+
+    release_conn(loop, conn);
+}
+
+
+/*!
+ * \brief           Handles a send completion.
+ * \param loop      The event loop.
+ * \param conn      The connection.
+ * \param res       The completion result.
+ */
+
+static void handle_send(UringLoop * loop, UringConn * conn, const int res) {
+    --conn->sends_pending;
+
+    if ( res > 0 ) {
+        conn->flight_sent += (size_t) res;
+        socket_queue_count_sent((size_t) res);
+        if ( !conn->closing && loop->handler->idle_timeout_ms > 0 ) {
+            timer_wheel_arm(loop->timers, &conn->timer,
+                    loop->now_ms + loop->handler->idle_timeout_ms);
+        }
+    } else if ( res != -ECANCELED ) {
+        socket_count_error(socket_error_kind(-res));
+        conn->send_failed = TRUE;
+        close_conn(loop, conn);
+    }
+
+    flush_conn(loop, conn);
+    update_flow(loop, conn);
+    release_conn(loop, conn);
+}
+
+
+/*!
+ * \brief           Closes a connection whose idle timer has expired.
+ * \details         Anything the handler's `on_timeout` callback writes
+ * is sent before the connection is closed. The loop's accept timer
+ * re-arms the accept instead.
+ * \param timer     The connection's timer, or the loop's accept timer.
+ * \param arg       The event loop.
+ */
+
+static void expire_conn(TimerEntry * timer, void * arg) {
+    UringLoop * loop = arg;
+    UringConn * conn = timer->data;
+
+    if ( timer == &loop->accept_timer ) {
+        resume_accepting(loop);
+        return;
+    }
+
+    socket_count_error(SOCKET_ERROR_TIMEOUT);
+    if ( loop->handler->on_timeout != NULL ) {
+        loop->handler->on_timeout(conn->socket, conn->conn_data);
+        flush_conn(loop, conn);
+    }
+
+    close_conn(loop, conn);
+}
+
+
+/*!
+ * \brief           Runs an event loop.
+ * \param loop      The event loop.
+ * \returns         Returns -1 on encountering an error. The loop runs
+ * indefinitely, and this function will not return unless an error is
+ * encountered.
+ */
+
+static int run_uring_loop(UringLoop * loop) {
+    struct io_uring_cqe * cqe;
+    unsigned head, tail;
+    uint64_t user_data;
+    unsigned flags;
+    int res;
+
+    if ( arm_accept(loop) == -1 ) {
+        set_errno_errmsg("Error arming accept");
+        return ERROR_RETURN;
+    }
+    socket_metrics_add(SOCKET_METRIC_THREADS_STARTED, 1);
+
+    while ( 1 ) {
+        if ( loop->cancels != NULL ) {
+            submit_cancels(loop);
+        }
+
+        if ( ring_submit(&loop->ring, 1, timer_wheel_next_timeout(
+                        loop->timers, loop->now_ms)) == -1 ) {
+            set_errno_errmsg("Error calling io_uring_enter()");
+            break;
+        }
+        loop->now_ms = timer_now_ms();
+
+        head = *loop->ring.cq_head;
+        tail = __atomic_load_n(loop->ring.cq_tail, __ATOMIC_ACQUIRE);
+
+        while ( head != tail ) {
+            cqe = &loop->ring.cqes[head & loop->ring.cq_mask];
+            user_data = cqe->user_data;
+            res = cqe->res;
+            flags = cqe->flags;
+            ++head;
+
+            /*  Release each entry before handling it, since handling
+                can submit, and submitting can post completions.      */
+
+            __atomic_store_n(loop->ring.cq_head, head, __ATOMIC_RELEASE);
+
+            switch ( user_data & URING_TAG_MASK ) {
+                case URING_TAG_ACCEPT:
+                    if ( handle_accept(loop, res, flags) == -1 ) {
+                        socket_metrics_add(SOCKET_METRIC_THREADS_EXITED, 1);
+                        return ERROR_RETURN;
+                    }
+                    break;
+
+                case URING_TAG_RECV:
+                    handle_recv(loop, (UringConn *) (uintptr_t)
+                                (user_data & ~(uint64_t) URING_TAG_MASK),
+                                res, flags);
+                    break;
+
+                case URING_TAG_SEND:
+                    handle_send(loop, (UringConn *) (uintptr_t)
+                                (user_data & ~(uint64_t) URING_TAG_MASK),
+                                res);
+                    break;
+
+                default:
+                    break;
+            }
+        }
+
+        timer_wheel_advance(loop->timers, loop->now_ms, expire_conn, loop);
+    }
+
+    socket_metrics_add(SOCKET_METRIC_THREADS_EXITED, 1);
+    return ERROR_RETURN;
+}
+
+
+/*!
+ * \brief           Thread function for additional event-loop threads.
+ * \details         Waits until every thread has been started, and exits
+ * without running the loop if the server failed to start.
+ * \param arg       Pointer to the thread's UringLoop struct.
+ * \returns         NULL
+ */
+
+static void * uring_loop_thread(void * arg) {
+    UringLoop * loop = arg;
+    int state;
+
+    pthread_mutex_lock(&loop->start->mutex);
+    while ( (state = loop->start->state) == 0 ) {
+        pthread_cond_wait(&loop->start->cond, &loop->start->mutex);
+    }
+    pthread_mutex_unlock(&loop->start->mutex);
+
+    if ( state > 0 ) {
+        run_uring_loop(loop);
+    }
+    return NULL;
+}
+
+
+/*!
+ * \brief           Tells the waiting event-loop threads to run or exit.
+ * \param start     The start signal.
+ * \param state     1 to run, or -1 to exit.
+ */
+
+static void signal_start(UringStart * start, const int state) {
+    pthread_mutex_lock(&start->mutex);
+    start->state = state;
+    pthread_cond_broadcast(&start->cond);
+    pthread_mutex_unlock(&start->mutex);
+}
+
+
+/*!
+ * \brief           Initializes an event loop.
+ * \param loop      The event loop to initialize.
+ * \param listening_socket A file descriptor for a listening socket.
+ * \param handler   The connection callbacks.
+ * \returns         0 on success, or -1 on encountering an error.
+ */
+
+static int init_uring_loop(UringLoop * loop, const int listening_socket,
+                           const EpollHandler * handler) {
+    loop->listening_socket = listening_socket;
+    loop->handler = handler;
+    loop->now_ms = timer_now_ms();
+    loop->cancels = NULL;
+    timer_entry_init(&loop->accept_timer, NULL);
+    loop->accept_paused = FALSE;
+
+    if ( (loop->timers = timer_wheel_create(loop->now_ms)) == NULL ) {
+        set_errno_errmsg("Error creating timer wheel");
+        return ERROR_RETURN;
+    }
+
+    if ( ring_init(&loop->ring, URING_ENTRIES) == -1 ) {
+        set_errno_errmsg("Error creating io_uring instance");
+        timer_wheel_destroy(loop->timers);
+        return ERROR_RETURN;
+    }
+
+    if ( init_buffers(loop) == -1 ) {
+        set_errno_errmsg("Error registering receive buffers");
+        ring_free(&loop->ring);
+        timer_wheel_destroy(loop->timers);
+        return ERROR_RETURN;
+    }
+
+    return 0;
+}
+
+
+/*!
+ * \brief           Frees an event loop which has not run.
+ * \param loop      The event loop.
+ */
+
+static void destroy_uring_loop(UringLoop * loop) {
+    ring_free(&loop->ring);
+    munmap(loop->bufs, URING_BUF_COUNT * sizeof(struct io_uring_buf));
+    free(loop->buf_data);
+    timer_wheel_destroy(loop->timers);
+}
+
+
+/*!
+ * \brief           Checks whether the io_uring server can run.
+ * \details         Probes, once per process, that io_uring instances
+ * can be created, which is not the case under some security policies,
+ * and that the kernel supports the operations the server needs. The
+ * zero-copy send operation is checked for as a marker of a kernel
+ * recent enough for multishot receive.
+ * \returns         TRUE if the io_uring server can run, FALSE otherwise.
+ */
+
+int uring_available(void) {
+    struct io_uring_probe * probe;
+    struct io_uring_buf_reg reg;
+    size_t probe_size;
+    UringRing ring;
+    void * bufs;
+    int probed, available = FALSE;
+
+    if ( (probed = __atomic_load_n(&uring_probed, __ATOMIC_RELAXED)) != 0 ) {
+        return probed > 0;
+    }
+
+    if ( ring_init(&ring, 8) == -1 ) {
+        __atomic_store_n(&uring_probed, -1, __ATOMIC_RELAXED);
+        return FALSE;
+    }
+
+    probe_size = sizeof(*probe) + 256 * sizeof(struct io_uring_probe_op);
+    if ( (probe = calloc(1, probe_size)) != NULL &&
+         sys_uring_register(ring.fd, IORING_REGISTER_PROBE,
+                            probe, 256) == 0 &&
+         probe->last_op >= IORING_OP_SEND_ZC ) {
+        available =
+            (probe->ops[IORING_OP_ACCEPT].flags & IO_URING_OP_SUPPORTED) &&
+            (probe->ops[IORING_OP_RECV].flags & IO_URING_OP_SUPPORTED) &&
+            (probe->ops[IORING_OP_SEND].flags & IO_URING_OP_SUPPORTED) &&
+            (probe->ops[IORING_OP_SEND_ZC].flags & IO_URING_OP_SUPPORTED);
+    }
+    free(probe);
+
+    /*  Provided buffer rings are a registration rather than an
+        operation, so are checked for by registering one.       */
+
+    if ( available ) {
+        bufs = mmap(NULL, (size_t) getpagesize(), PROT_READ | PROT_WRITE,
+                    MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if ( bufs == MAP_FAILED ) {
+            available = FALSE;
+        } else {
+            memset(&reg, 0, sizeof(reg));
+            reg.ring_addr = (uint64_t) (uintptr_t) bufs;
+            reg.ring_entries = 1;
+            reg.bgid = URING_BUF_GROUP;
+            available = sys_uring_register(ring.fd, IORING_REGISTER_PBUF_RING,
+                                           &reg, 1) == 0;
+            munmap(bufs, (size_t) getpagesize());
+        }
+    }
+
+    ring_free(&ring);
+    __atomic_store_n(&uring_probed, available ? 1 : -1, __ATOMIC_RELAXED);
+    return available;
+}
+
+
+/*!
+ * \brief           Starts an io_uring event-loop server.
+ * \details         Connections are served by `num_threads` event-loop
+ * threads, one of which is the calling thread, and readable data is
+ * passed to the handler's `on_data` callback, as for
+ * start_epoll_tcp_server(). The data passed is valid only until the
+ * callback returns. If io_uring is not available, the function runs
+ * start_epoll_tcp_server() instead. Every loop is set up before any
+ * thread runs, and if the server fails to start, any threads started
+ * are stopped and every loop freed before the function returns.
+ * \param listening_socket A file descriptor for a listening socket.
+ * \param num_threads The number of event-loop threads to run.
+ * \param handler   The connection callbacks.
+ * \returns         Returns non-zero on encountering an error. The
+ * server runs in an infinite loop, and this function will not return
+ * unless an error is encountered.
+ */
+
+int start_uring_tcp_server(const int listening_socket, const int num_threads,
+                           const EpollHandler * handler) {
+    UringStart * start;
+    UringLoop * loops;
+    int index, num_started;
+
+    if ( num_threads < 1 ) {
+        set_errmsg("Invalid number of event-loop threads");
+        return ERROR_RETURN;
+    }
+
+    if ( !uring_available() ) {
+        return start_epoll_tcp_server(listening_socket, num_threads, handler);
+    }
+
+    if ( (loops = malloc(num_threads * sizeof(*loops))) == NULL ||
+         (start = malloc(sizeof(*start))) == NULL ) {
+        set_errno_errmsg("Error allocating event loops");
+        free(loops);
+        return ERROR_RETURN;
+    }
+
+    if ( pthread_mutex_init(&start->mutex, NULL) != 0 ||
+         pthread_cond_init(&start->cond, NULL) != 0 ) {
+        set_errmsg("Error initializing event loops");
+        free(start);
+        free(loops);
+        return ERROR_RETURN;
+    }
+    start->state = 0;
+
+    for ( index = 0; index < num_threads; ++index ) {
+        if ( init_uring_loop(&loops[index], listening_socket,
+                             handler) == -1 ) {
+            break;
+        }
+        loops[index].start = start;
+    }
+
+    num_started = 1;
+    if ( index == num_threads ) {
+        while ( num_started < num_threads &&
+                pthread_create(&loops[num_started].thread_id, NULL,
+                        uring_loop_thread, &loops[num_started]) == 0 ) {
+            ++num_started;
+        }
+        if ( num_started < num_threads ) {
+            set_errmsg("Error creating thread");
+        }
+    }
+
+    if ( num_started < num_threads ) {
+
+        /*  Stop the threads started, and free every loop set up  */
+
+        signal_start(start, -1);
+        while ( --num_started > 0 ) {
+            pthread_join(loops[num_started].thread_id, NULL);
+        }
+        while ( --index >= 0 ) {
+            destroy_uring_loop(&loops[index]);
+        }
+        pthread_cond_destroy(&start->cond);
+        pthread_mutex_destroy(&start->mutex);
+        free(start);
+        free(loops);
+        return ERROR_RETURN;
+    }
+
+    signal_start(start, 1);
+    return run_uring_loop(&loops[0]);
+}
+
+#else           /*  URING_SUPPORTED  */
+
+/*!
+ * \brief           Checks whether the io_uring server can run.
+ * \returns         FALSE, as the library was built without io_uring.
+ */
+
+int uring_available(void) {
+    return FALSE;
+}
+
+
+/*!
+ * \brief           Starts an event-loop server.
+ * \details         Runs start_epoll_tcp_server(), as the library was
+ * built without io_uring.
+ */
+
+int start_uring_tcp_server(const int listening_socket, const int num_threads,
+                           const EpollHandler * handler) {
+    return start_epoll_tcp_server(listening_socket, num_threads, handler);
+}
+
+#endif          /*  URING_SUPPORTED  */
@@ -0,0 +1,33 @@
+/*!
+ * \file            socket_helpers_uring.h
+ * \brief           Interface to io_uring event-loop server functions.
+ * \details         Interface to io_uring event-loop server functions.
+ * \author          Paul Griffiths
+ * \copyright       Copyright 2013 Paul Griffiths. Distributed under the terms
+ * of the GNU General Public License. <http://www.gnu.org/licenses/>
+ */
+
+
+#ifndef PG_SOCKET_HELPERS_URING_H
+#define PG_SOCKET_HELPERS_URING_H
+
+#include <sys/types.h>
+#include <sys/uio.h>
+#include "socket_helpers_epoll.h"
+
+
+/*  Function prototypes  */
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+int uring_available(void);
+int start_uring_tcp_server(const int listening_socket, const int num_threads,
+                           const EpollHandler * handler);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif          /*  PG_SOCKET_HELPERS_URING_H  */
@@ -0,0 +1,331 @@
+/*!
+ * \file            test_framer.c
+ * \brief           Unit tests for the incremental line framer.
+ * \details         Each input is framed whole, split at every point, and
+ * fed in chunks of every size, by both a buffering and a streaming
+ * framer, and must give the same lines each time. The lines are
+ * recorded in a transcript, with `|` after each complete line, `!` for
+ * each line rejected as too long, and `$` after a final line returned
+ * at end-of-file.
+ * \author          Paul Griffiths
+ * \copyright       Copyright 2013 Paul Griffiths. Distributed under the terms
+ * of the GNU General Public License. <http://www.gnu.org/licenses/>
+ */
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include "socket_helpers_framer.h"
+#include "test_framer.h"
+#include "test_logging.h"
+
+
+/*!
+ * \brief           Longest line accepted by the framers under test.
+ */
+
+#define TEST_FRAMER_MAX_LEN 8
+
+
+/*!
+ * \brief           Size of a transcript buffer.
+ */
+
+#define TEST_FRAMER_BUFFER_SIZE 256
+
+
+/*!
+ * \brief           Struct for a transcript of framed lines.
+ */
+
+typedef struct FramerLog {
+    char text[TEST_FRAMER_BUFFER_SIZE];     /*!< The transcript */
+    size_t len;                             /*!< Length of the transcript */
+    char line[TEST_FRAMER_BUFFER_SIZE];     /*!< Pieces of the current line */
+    size_t line_len;                        /*!< Length of `line` */
+    int failed;                             /*!< True on an unexpected
+                                                 result */
+} FramerLog;
+
+
+/*!
+ * \brief           Appends bytes to a buffer, if they fit.
+ * \param buffer    The buffer, of `TEST_FRAMER_BUFFER_SIZE` bytes.
+ * \param len       Pointer to the length of the buffer's contents.
+ * \param data      The bytes to append.
+ * \param data_len  The number of bytes to append.
+ * \param failed    Pointer to a flag to set if the bytes do not fit.
+ */
+
+static void append(char * buffer, size_t * len, const char * data,
+                   const size_t data_len, int * failed) {
+    if ( *len + data_len >= TEST_FRAMER_BUFFER_SIZE ) {
+        *failed = 1;
+        return;
+    }
+
+    memcpy(buffer + *len, data, data_len);
+    *len += data_len;
+    buffer[*len] = 0;
+}
+
+
+/*!
+ * \brief           Records the result of a framer call.
+ * \param log       The transcript.
+ * \param status    The framer's return value.
+ * \param line      The line or piece returned.
+ * \param line_len  The length of the line or piece.
+ * \param end       The character to record after a complete line.
+ */
+
+static void log_result(FramerLog * log, const int status, const char * line,
+                       const size_t line_len, const char end) {
+    if ( status == LINE_FRAMER_PARTIAL || status == LINE_FRAMER_LINE ) {
+        append(log->line, &log->line_len, line, line_len, &log->failed);
+    }
+
+    if ( status == LINE_FRAMER_LINE ) {
+        append(log->text, &log->len, log->line, log->line_len, &log->failed);
+        append(log->text, &log->len, &end, 1, &log->failed);
+        log->line_len = 0;
+    } else if ( status == -1 ) {
+        if ( errno != EMSGSIZE ) {
+            log->failed = 1;
+        }
+        append(log->text, &log->len, "!", 1, &log->failed);
+        log->line_len = 0;
+    }
+}
+
+
+/*!
+ * \brief           Frames a chunk, recording its lines.
+ * \param framer    The framer.
+ * \param log       The transcript.
+ * \param data      The chunk.
+ * \param len       The length of the chunk.
+ */
+
+static void frame_chunk(LineFramer * framer, FramerLog * log,
+                        const char * data, const size_t len) {
+    size_t offset = 0, consumed, line_len;
+    const char * line;
+    int status;
+
+    while ( offset < len ) {
+        status = line_framer_next(framer, data + offset, len - offset,
+                                  &consumed, &line, &line_len);
+        if ( consumed == 0 && status != LINE_FRAMER_PARTIAL ) {
+            log->failed = 1;
+            return;
+        }
+        offset += consumed;
+        log_result(log, status, line, line_len, '|');
+
+        /*  A streaming framer never keeps a copy of the line  */
+
+        if ( framer->streaming && line_framer_pending(framer) != 0 ) {
+            log->failed = 1;
+        }
+    }
+}
+
+
+/*!
+ * \brief           Frames an input in chunks, recording its lines.
+ * \param log       The transcript.
+ * \param streaming True to use a streaming framer.
+ * \param input     The input.
+ * \param first     The length of the first chunk.
+ * \param chunk     The length of each later chunk.
+ */
+
+static void frame_input(FramerLog * log, const int streaming,
+                        const char * input, const size_t first,
+                        const size_t chunk) {
+    const size_t len = strlen(input);
+    LineFramer framer;
+    size_t offset, count;
+    const char * line = NULL;
+    size_t line_len = 0;
+    int status;
+    char * copy;
+
+    log->len = 0;
+    log->text[0] = 0;
+    log->line_len = 0;
+    log->failed = 0;
+
+    if ( streaming ) {
+        line_framer_init_stream(&framer, TEST_FRAMER_MAX_LEN);
+    } else {
+        line_framer_init(&framer, TEST_FRAMER_MAX_LEN);
+    }
+
+    for ( offset = 0; offset < len; offset += count ) {
+        count = offset == 0 ? first : chunk;
+        if ( count > len - offset ) {
+            count = len - offset;
+        }
+
+        /*  Copy each chunk, so a line kept between chunks which still
+            pointed into an earlier one would be caught.               */
+
+        if ( (copy = malloc(count)) == NULL ) {
+            perror("test_framer: couldn't allocate memory");
+            exit(EXIT_FAILURE);
+        }
+        memcpy(copy, input + offset, count);
+        frame_chunk(&framer, log, copy, count);
+        memset(copy, '#', count);
+        free(copy);
+    }
+
+    status = line_framer_finish(&framer, &line, &line_len);
+    log_result(log, status, line, line_len, '$');
+    line_framer_free(&framer);
+}
+
+
+void test_framer(void) {
+    test_framer_input("", "");
+    test_framer_input("abc\r\ndef\r\n", "abc|def|");
+    test_framer_input("\r\n\r\n", "||");
+    test_framer_input("a\rb\r\n", "a\rb|");
+    test_framer_input("a\r\r\n", "a\r|");
+    test_framer_input("a\n\r\n", "a\n|");
+    test_framer_input("\r\r\r\n\n", "\r\r|\n$");
+    test_framer_input("12345678\r\n", "12345678|");
+    test_framer_input("1234567\r\r\n", "1234567\r|");
+    test_framer_input("123456789\r\nok\r\n", "!ok|");
+    test_framer_input("12345678\r\r\nok\r\n", "!ok|");
+    test_framer_input("1234567890123456789\r\nok\r\n", "!ok|");
+    test_framer_input("123456789\r\r\nok\r\n", "!ok|");
+    test_framer_input("123456789\r\n\r\n", "!|");
+    test_framer_input("123456789012", "!");
+    test_framer_input("tail", "tail$");
+    test_framer_input("tail\r", "tail\r$");
+    test_framer_input("one\r\ntwo", "one|two$");
+    test_framer_input("12345678", "12345678$");
+    test_framer_input("1234567\r", "1234567\r$");
+    test_framer_input("12345678\r", "!");
+
+    test_framer_stream();
+    test_framer_feed_stop();
+}
+
+
+int test_framer_input(const char * input, const char * expected) {
+    const size_t len = strlen(input);
+    FramerLog log;
+    size_t split;
+    int streaming, test_result = 1;
+
+    for ( streaming = 0; streaming < 2; ++streaming ) {
+        for ( split = 1; split <= len; ++split ) {
+
+            /*  Split once at each point, and in chunks of each size  */
+
+            frame_input(&log, streaming, input, split, len);
+            if ( log.failed || strcmp(log.text, expected) != 0 ) {
+                test_result = 0;
+                break;
+            }
+
+            frame_input(&log, streaming, input, split, split);
+            if ( log.failed || strcmp(log.text, expected) != 0 ) {
+                test_result = 0;
+                break;
+            }
+        }
+
+        if ( len == 0 ) {
+            frame_input(&log, streaming, input, 1, 1);
+            test_result = test_result && !log.failed &&
+                          strcmp(log.text, expected) == 0;
+        }
+
+        if ( !test_result ) {
+            break;
+        }
+    }
+
+    tests_log_test(test_result, "test_framer_input: %s framer split at "
+                   "%lu gave [%s], expected [%s]",
+                   streaming ? "streaming" : "buffering",
+                   (unsigned long) split, log.text, expected);
+    return test_result;
+}
+
+
+int test_framer_stream(void) {
+    static const char first[] = "abc";
+    static const char second[] = "de\r";
+    static const char third[] = "\n";
+    LineFramer framer;
+    const char * line;
+    size_t consumed, line_len;
+    int test_result;
+
+    line_framer_init_stream(&framer, TEST_FRAMER_MAX_LEN);
+
+    /*  Pieces point into the chunk, and a trailing `\r` is held back
+        until the next chunk shows whether it ends the line.          */
+
+    test_result = line_framer_next(&framer, first, 3, &consumed,
+                                   &line, &line_len) == LINE_FRAMER_PARTIAL &&
+                  consumed == 3 && line == first && line_len == 3;
+
+    test_result = test_result &&
+                  line_framer_next(&framer, second, 3, &consumed,
+                                   &line, &line_len) == LINE_FRAMER_PARTIAL &&
+                  consumed == 3 && line == second && line_len == 2;
+
+    test_result = test_result &&
+                  line_framer_next(&framer, third, 1, &consumed,
+                                   &line, &line_len) == LINE_FRAMER_LINE &&
+                  consumed == 1 && line_len == 0 &&
+                  line_framer_pending(&framer) == 0;
+
+    tests_log_test(test_result, "test_framer_stream");
+    line_framer_free(&framer);
+    return test_result;
+}
+
+
+/*!
+ * \brief           Line callback which stops after the first line.
+ * \param arg       Pointer to a count of lines.
+ * \param line      The line.
+ * \param len       The length of the line.
+ * \param complete  True for a complete line.
+ * \returns         Non-zero to stop framing.
+ */
+
+static int stop_after_line(void * arg, const char * line, const size_t len,
+                           const int complete) {
+    (void) line;
+    (void) len;
+    (void) complete;
+
+    return ++*(int *) arg > 0;
+}
+
+
+int test_framer_feed_stop(void) {
+    static const char input[] = "ab\r\ncd\r\nef\r\n";
+    LineFramer framer;
+    int lines = 0, test_result;
+
+    line_framer_init(&framer, TEST_FRAMER_MAX_LEN);
+    test_result = line_framer_feed(&framer, input, sizeof(input) - 1,
+                                   stop_after_line, &lines) == 4 &&
+                  lines == 1;
+
+    tests_log_test(test_result, "test_framer_feed_stop");
+    line_framer_free(&framer);
+    return test_result;
+}
@@ -0,0 +1,19 @@
+/*!
+ * \file            test_framer.h
+ * \brief           Interface to line framer unit tests.
+ * \details         Interface to line framer unit tests.
+ * \author          Paul Griffiths
+ * \copyright       Copyright 2013 Paul Griffiths. Distributed under the terms
+ * of the GNU General Public License. <http://www.gnu.org/licenses/>
+ */
+
+
+#ifndef PG_SOCKET_HELPERS_TEST_FRAMER_H
+#define PG_SOCKET_HELPERS_TEST_FRAMER_H
+
+void test_framer(void);
+int test_framer_input(const char * input, const char * expected);
+int test_framer_stream(void);
+int test_framer_feed_stop(void);
+
+#endif          /*  PG_SOCKET_HELPERS_TEST_FRAMER_H  */
@@ -0,0 +1,55 @@
+/*!
+ * \file            test_logging.c
+ * \brief           Implementation of unit test logging functions.
+ * \details         Counts the tests run, and reports each failure to
+ * `stderr` as it happens.
+ * \author          Paul Griffiths
+ * \copyright       Copyright 2013 Paul Griffiths. Distributed under the terms
+ * of the GNU General Public License. <http://www.gnu.org/licenses/>
+ */
+
+
+#include <stdio.h>
+#include <stdarg.h>
+#include "test_logging.h"
+
+
+static int test_successes = 0;
+static int test_failures = 0;
+static int total_tests = 0;
+static int show_failures = 1;
+
+
+void tests_log_test(const int success, const char * fmt, ...) {
+    va_list ap;
+
+    ++total_tests;
+    if ( success ) {
+        ++test_successes;
+    } else {
+        ++test_failures;
+    }
+
+    if ( show_failures && !success ) {
+        fprintf(stderr, "Failure (%d): ", total_tests);
+        va_start(ap, fmt);
+        vfprintf(stderr, fmt, ap);
+        va_end(ap);
+        fprintf(stderr, "\n");
+    }
+}
+
+
+int tests_get_total_tests(void) {
+    return total_tests;
+}
+
+
+int tests_get_successes(void) {
+    return test_successes;
+}
+
+
+int tests_get_failures(void) {
+    return test_failures;
+}
@@ -0,0 +1,19 @@
+/*!
+ * \file            test_logging.h
+ * \brief           Interface to unit test logging functions.
+ * \details         Interface to unit test logging functions.
+ * \author          Paul Griffiths
+ * \copyright       Copyright 2013 Paul Griffiths. Distributed under the terms
+ * of the GNU General Public License. <http://www.gnu.org/licenses/>
+ */
+
+
+#ifndef PG_SOCKET_HELPERS_TEST_LOGGING_H
+#define PG_SOCKET_HELPERS_TEST_LOGGING_H
+
+void tests_log_test(const int success, const char * fmt, ...);
+int tests_get_total_tests(void);
+int tests_get_successes(void);
+int tests_get_failures(void);
+
+#endif          /*  PG_SOCKET_HELPERS_TEST_LOGGING_H  */
@@ -0,0 +1,27 @@
+/*!
+ * \file            test_main.c
+ * \brief           Main function for the sockethelpers unit tests.
+ * \author          Paul Griffiths
+ * \copyright       Copyright 2013 Paul Griffiths. Distributed under the terms
+ * of the GNU General Public License. <http://www.gnu.org/licenses/>
+ */
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include "test_logging.h"
+#include "test_timer.h"
+#include "test_framer.h"
+#include "test_message.h"
+
+
+int main(void) {
+    test_timer();
+    test_framer();
+    test_message();
+
+    printf("%d successes and %d failures from %d tests.\n",
+           tests_get_successes(), tests_get_failures(),
+           tests_get_total_tests());
+    return tests_get_failures() == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,327 @@
+/*!
+ * \file            test_message.c
+ * \brief           Unit tests for the length-prefixed message functions.
+ * \details         Each test writes raw bytes to one end of a socket
+ * pair and reads them from the other, so malformed and truncated
+ * prefixes can be sent, and checks that the reads consume no more than
+ * they should by reading a marker byte afterwards.
+ * \author          Paul Griffiths
+ * \copyright       Copyright 2013 Paul Griffiths. Distributed under the terms
+ * of the GNU General Public License. <http://www.gnu.org/licenses/>
+ */
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/time.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include "socket_helpers_message.h"
+#include "socket_helpers_reader.h"
+#include "test_message.h"
+#include "test_logging.h"
+
+
+/*!
+ * \brief           Byte written after the bytes under test.
+ */
+
+#define TEST_MSG_MARKER 0x5A
+
+
+/*!
+ * \brief           Struct for bytes to write after a delay.
+ */
+
+typedef struct DelayedWrite {
+    int socket;                 /*!< Socket to write to */
+    const unsigned char * data; /*!< Bytes to write */
+    size_t len;                 /*!< Number of bytes to write */
+} DelayedWrite;
+
+
+/*!
+ * \brief           Creates a connected pair of stream sockets.
+ * \param sockets   Array to receive the writing and reading ends.
+ */
+
+static void make_pair(int * sockets) {
+    if ( socketpair(AF_UNIX, SOCK_STREAM, 0, sockets) == -1 ) {
+        perror("test_message: couldn't create socket pair");
+        exit(EXIT_FAILURE);
+    }
+}
+
+
+/*!
+ * \brief           Writes bytes to a socket, and optionally closes it.
+ * \param socket    The socket.
+ * \param data      The bytes to write.
+ * \param len       The number of bytes to write.
+ * \param marker    True to write the marker byte afterwards.
+ * \param eof       True to shut the socket down for writing afterwards.
+ */
+
+static void put_bytes(const int socket, const void * data, const size_t len,
+                      const int marker, const int eof) {
+    const unsigned char byte = TEST_MSG_MARKER;
+
+    if ( (len > 0 && write(socket, data, len) != (ssize_t) len) ||
+         (marker && write(socket, &byte, 1) != 1) ) {
+        perror("test_message: couldn't write to socket pair");
+        exit(EXIT_FAILURE);
+    }
+
+    if ( eof ) {
+        shutdown(socket, SHUT_WR);
+    }
+}
+
+
+/*!
+ * \brief           Checks that the next byte on a socket is the marker.
+ * \param socket    The socket.
+ * \returns         Non-zero if it is, zero otherwise.
+ */
+
+static int marker_next(const int socket) {
+    unsigned char byte = 0;
+
+    return recv(socket, &byte, 1, MSG_DONTWAIT) == 1 &&
+           byte == TEST_MSG_MARKER;
+}
+
+
+/*!
+ * \brief           Thread function writing bytes after a delay.
+ * \param arg       Pointer to a DelayedWrite struct.
+ * \returns         NULL
+ */
+
+static void * delayed_write(void * arg) {
+    DelayedWrite * delayed = arg;
+    struct timespec delay;
+
+    delay.tv_sec = 0;
+    delay.tv_nsec = 20000000L;
+    nanosleep(&delay, NULL);
+    put_bytes(delayed->socket, delayed->data, delayed->len, 1, 0);
+    return NULL;
+}
+
+
+void test_message(void) {
+    static const unsigned char six_bytes[] = {
+        0x80, 0x80, 0x80, 0x80, 0x80, 0x01
+    };
+    static const unsigned char too_large[] = {
+        0xFF, 0xFF, 0xFF, 0xFF, 0x10
+    };
+    static const unsigned char largest[] = {
+        0xFF, 0xFF, 0xFF, 0xFF, 0x0F
+    };
+    static const unsigned char unterminated[] = { 0x80, 0x80 };
+    static const unsigned char short_fixed[] = { 0x00, 0x00 };
+    static const unsigned char short_payload[] = { 0x0A, 'a', 'b', 'c' };
+
+    test_message_header(0, SOCKET_MSG_VARINT, 1);
+    test_message_header(1, SOCKET_MSG_VARINT, 1);
+    test_message_header(127, SOCKET_MSG_VARINT, 1);
+    test_message_header(128, SOCKET_MSG_VARINT, 2);
+    test_message_header(16383, SOCKET_MSG_VARINT, 2);
+    test_message_header(16384, SOCKET_MSG_VARINT, 3);
+    test_message_header(2097151, SOCKET_MSG_VARINT, 3);
+    test_message_header(2097152, SOCKET_MSG_VARINT, 4);
+    test_message_header(268435455, SOCKET_MSG_VARINT, 4);
+    test_message_header(268435456, SOCKET_MSG_VARINT, 5);
+    test_message_header(SOCKET_MSG_MAX_LEN, SOCKET_MSG_VARINT, 5);
+    test_message_header(0, SOCKET_MSG_FIXED32, 4);
+    test_message_header(300, SOCKET_MSG_FIXED32, 4);
+    test_message_header(SOCKET_MSG_MAX_LEN, SOCKET_MSG_FIXED32, 4);
+
+    test_message_bad_header(six_bytes, sizeof(six_bytes),
+                            SOCKET_MSG_VARINT, 0, -1, EPROTO);
+    test_message_bad_header(too_large, sizeof(too_large),
+                            SOCKET_MSG_VARINT, 0, -1, EPROTO);
+    test_message_bad_header(largest, sizeof(largest),
+                            SOCKET_MSG_VARINT, 1, 1, 0);
+    test_message_bad_header(unterminated, sizeof(unterminated),
+                            SOCKET_MSG_VARINT, 1, -1, EPROTO);
+    test_message_bad_header(short_fixed, sizeof(short_fixed),
+                            SOCKET_MSG_FIXED32, 1, -1, EPROTO);
+    test_message_bad_header(NULL, 0, SOCKET_MSG_VARINT, 1, 0, 0);
+    test_message_bad_header(NULL, 0, SOCKET_MSG_FIXED32, 1, 0, 0);
+    test_message_bad_header(unterminated, sizeof(unterminated),
+                            SOCKET_MSG_VARINT, 0, -1, ETIMEDOUT);
+
+    test_message_truncated(short_payload, sizeof(short_payload));
+    test_message_split_header();
+    test_message_too_long(SOCKET_MSG_VARINT);
+    test_message_too_long(SOCKET_MSG_FIXED32);
+}
+
+
+int test_message_header(const size_t len, const int format,
+                        const size_t header_len) {
+    unsigned char header[SOCKET_MSG_MAX_HEADER];
+    size_t encoded_len, decoded = 0;
+    int sockets[2];
+    int test_result;
+
+    make_pair(sockets);
+
+    /*  The prefix is read without consuming the byte after it  */
+
+    encoded_len = socket_msg_header(header, len, format);
+    put_bytes(sockets[0], header, encoded_len, 1, 0);
+    test_result = encoded_len == header_len &&
+                  socket_readmsg_header(sockets[1], format, &decoded,
+                                        NULL) == 1 &&
+                  decoded == len && marker_next(sockets[1]);
+
+    tests_log_test(test_result, "test_message_header: %s length %lu "
+                   "decoded as %lu from %lu bytes",
+                   format == SOCKET_MSG_VARINT ? "varint" : "fixed32",
+                   (unsigned long) len, (unsigned long) decoded,
+                   (unsigned long) encoded_len);
+
+    close(sockets[0]);
+    close(sockets[1]);
+    return test_result;
+}
+
+
+int test_message_bad_header(const unsigned char * data, const size_t len,
+                            const int format, const int eof,
+                            const int expected, const int expected_errno) {
+    struct timespec deadline;
+    struct timeval period;
+    size_t decoded = 0;
+    int sockets[2];
+    int status, test_result;
+
+    make_pair(sockets);
+    put_bytes(sockets[0], data, len, 0, eof);
+
+    period.tv_sec = 0;
+    period.tv_usec = 50000;
+    socket_deadline_after(&deadline, &period);
+
+    errno = 0;
+    status = socket_readmsg_header(sockets[1], format, &decoded, &deadline);
+    test_result = status == expected &&
+                  (expected != -1 || errno == expected_errno) &&
+                  (expected != 1 || decoded == SOCKET_MSG_MAX_LEN);
+
+    tests_log_test(test_result, "test_message_bad_header: %lu bytes, "
+                   "returned %d with errno %d, expected %d with errno %d",
+                   (unsigned long) len, status, errno, expected,
+                   expected_errno);
+
+    close(sockets[0]);
+    close(sockets[1]);
+    return test_result;
+}
+
+
+int test_message_truncated(const unsigned char * data, const size_t len) {
+    char buffer[16];
+    size_t msg_len = 0;
+    int sockets[2];
+    int test_result;
+
+    make_pair(sockets);
+    put_bytes(sockets[0], data, len, 0, 1);
+
+    errno = 0;
+    test_result = socket_readmsg(sockets[1], buffer, sizeof(buffer),
+                                 &msg_len, SOCKET_MSG_VARINT, NULL) == -1 &&
+                  errno == EPROTO;
+
+    tests_log_test(test_result, "test_message_truncated");
+
+    close(sockets[0]);
+    close(sockets[1]);
+    return test_result;
+}
+
+
+int test_message_split_header(void) {
+    static const unsigned char first[] = { 0xAC };
+    static const unsigned char rest[] = { 0x02 };
+    DelayedWrite delayed;
+    pthread_t thread;
+    size_t decoded = 0;
+    int sockets[2];
+    int test_result;
+
+    make_pair(sockets);
+    put_bytes(sockets[0], first, sizeof(first), 0, 0);
+
+    /*  The rest of the prefix arrives while the reader waits  */
+
+    delayed.socket = sockets[0];
+    delayed.data = rest;
+    delayed.len = sizeof(rest);
+    if ( pthread_create(&thread, NULL, delayed_write, &delayed) != 0 ) {
+        perror("test_message: couldn't create thread");
+        exit(EXIT_FAILURE);
+    }
+
+    test_result = socket_readmsg_header(sockets[1], SOCKET_MSG_VARINT,
+                                        &decoded, NULL) == 1 &&
+                  decoded == 300;
+    pthread_join(thread, NULL);
+    test_result = test_result && marker_next(sockets[1]);
+
+    tests_log_test(test_result, "test_message_split_header: decoded %lu",
+                   (unsigned long) decoded);
+
+    close(sockets[0]);
+    close(sockets[1]);
+    return test_result;
+}
+
+
+int test_message_too_long(const int format) {
+    static const char payload[] = "0123456789";
+    static const char next[] = "ok";
+    char buffer[sizeof(payload)];
+    size_t msg_len = 0;
+    int sockets[2];
+    int test_result;
+
+    make_pair(sockets);
+    if ( socket_writemsg(sockets[0], payload, 10, format) == -1 ||
+         socket_writemsg(sockets[0], next, 2, format) == -1 ) {
+        perror("test_message: couldn't write to socket pair");
+        exit(EXIT_FAILURE);
+    }
+
+    /*  A message too long for the buffer leaves its payload unread,
+        so the caller may read it in pieces or skip it.              */
+
+    errno = 0;
+    test_result = socket_readmsg(sockets[1], buffer, 4, &msg_len,
+                                 format, NULL) == -1 &&
+                  errno == EMSGSIZE && msg_len == 10 &&
+                  socket_recv_exact(sockets[1], buffer, 10, NULL) == 10 &&
+                  memcmp(buffer, payload, 10) == 0;
+
+    test_result = test_result &&
+                  socket_readmsg(sockets[1], buffer, 4, &msg_len,
+                                 format, NULL) == 1 &&
+                  msg_len == 2 && memcmp(buffer, next, 2) == 0;
+
+    tests_log_test(test_result, "test_message_too_long: %s",
+                   format == SOCKET_MSG_VARINT ? "varint" : "fixed32");
+
+    close(sockets[0]);
+    close(sockets[1]);
+    return test_result;
+}
@@ -0,0 +1,26 @@
+/*!
+ * \file            test_message.h
+ * \brief           Interface to length-prefixed message unit tests.
+ * \details         Interface to length-prefixed message unit tests.
+ * \author          Paul Griffiths
+ * \copyright       Copyright 2013 Paul Griffiths. Distributed under the terms
+ * of the GNU General Public License. <http://www.gnu.org/licenses/>
+ */
+
+
+#ifndef PG_SOCKET_HELPERS_TEST_MESSAGE_H
+#define PG_SOCKET_HELPERS_TEST_MESSAGE_H
+
+#include <stddef.h>
+
+void test_message(void);
+int test_message_header(const size_t len, const int format,
+                        const size_t header_len);
+int test_message_bad_header(const unsigned char * data, const size_t len,
+                            const int format, const int eof,
+                            const int expected, const int expected_errno);
+int test_message_truncated(const unsigned char * data, const size_t len);
+int test_message_split_header(void);
+int test_message_too_long(const int format);
+
+#endif          /*  PG_SOCKET_HELPERS_TEST_MESSAGE_H  */
@@ -0,0 +1,309 @@
+/*!
+ * \file            test_timer.c
+ * \brief           Unit tests for the timer wheel.
+ * \details         Drives wheels with made-up times, so the tests do not
+ * depend on the clock. Expiry is checked around the boundaries where
+ * timers are cascaded between levels, from both aligned and unaligned
+ * starting times.
+ * \author          Paul Griffiths
+ * \copyright       Copyright 2013 Paul Griffiths. Distributed under the terms
+ * of the GNU General Public License. <http://www.gnu.org/licenses/>
+ */
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include "socket_helpers_timer.h"
+#include "test_timer.h"
+#include "test_logging.h"
+
+
+/*!
+ * \brief           Latest a timer can be placed ahead of the wheel.
+ * \details         Matches the wheel's four levels of 64 slots.
+ */
+
+#define TEST_TIMER_MAX_DELTA (((uint64_t) 1 << 24) - 1)
+
+
+/*!
+ * \brief           Struct recording the timers expired by a wheel.
+ */
+
+typedef struct TimerLog {
+    TimerWheel * wheel;         /*!< The wheel */
+    uint64_t now_ms;            /*!< Time passed to the current advance */
+    uint64_t expired_ms;        /*!< Time of the advance which last
+                                     expired a timer */
+    size_t count;               /*!< Number of timers expired */
+    TimerEntry * last;          /*!< Timer last expired */
+    uint64_t rearm_ms;          /*!< Period to re-arm timers for, or 0 */
+    size_t rearms;              /*!< Number of times left to re-arm */
+} TimerLog;
+
+
+/*!
+ * \brief           Starting times for each test.
+ */
+
+static const uint64_t start_times[] = {
+    0, 1, 63, 4095, 1000003, ((uint64_t) 1 << 24) - 1
+};
+
+
+/*!
+ * \brief           Delays either side of the cascade boundaries.
+ */
+
+static const uint64_t deltas[] = {
+    0, 1, 2, 63, 64, 65, 127, 128, 4095, 4096, 4097,
+    262143, 262144, 262145, 1000000, TEST_TIMER_MAX_DELTA
+};
+
+
+/*!
+ * \brief           Creates a wheel and its log.
+ * \param log       The log.
+ * \param start_ms  The wheel's starting time.
+ */
+
+static void log_init(TimerLog * log, const uint64_t start_ms) {
+    if ( (log->wheel = timer_wheel_create(start_ms)) == NULL ) {
+        perror("test_timer: couldn't allocate memory");
+        exit(EXIT_FAILURE);
+    }
+
+    log->now_ms = start_ms;
+    log->expired_ms = 0;
+    log->count = 0;
+    log->last = NULL;
+    log->rearm_ms = 0;
+    log->rearms = 0;
+}
+
+
+/*!
+ * \brief           Timer callback recording an expiry.
+ * \param timer     The timer.
+ * \param arg       The log.
+ */
+
+static void log_expiry(TimerEntry * timer, void * arg) {
+    TimerLog * log = arg;
+
+    ++log->count;
+    log->expired_ms = log->now_ms;
+    log->last = timer;
+
+    if ( log->rearm_ms > 0 && log->rearms > 0 ) {
+        --log->rearms;
+        timer_wheel_arm(log->wheel, timer, log->now_ms + log->rearm_ms);
+    }
+}
+
+
+/*!
+ * \brief           Advances a logged wheel.
+ * \param log       The log.
+ * \param now_ms    The time to advance to.
+ * \returns         The number of timers expired.
+ */
+
+static size_t log_advance(TimerLog * log, const uint64_t now_ms) {
+    log->now_ms = now_ms;
+    return timer_wheel_advance(log->wheel, now_ms, log_expiry, log);
+}
+
+
+void test_timer(void) {
+    const size_t num_starts = sizeof(start_times) / sizeof(start_times[0]);
+    const size_t num_deltas = sizeof(deltas) / sizeof(deltas[0]);
+    size_t start, delta;
+
+    for ( start = 0; start < num_starts; ++start ) {
+        for ( delta = 0; delta < num_deltas; ++delta ) {
+            test_timer_expiry(start_times[start], deltas[delta], 1);
+            test_timer_expiry(start_times[start], deltas[delta], 7);
+            test_timer_expiry(start_times[start], deltas[delta], 1000);
+            test_timer_expiry(start_times[start], deltas[delta],
+                              deltas[delta] + 1);
+            test_timer_cancel(start_times[start], deltas[delta]);
+            test_timer_next_timeout(start_times[start], deltas[delta]);
+        }
+
+        test_timer_rearm(start_times[start], 1);
+        test_timer_rearm(start_times[start], 64);
+        test_timer_rearm(start_times[start], 4096);
+
+        test_timer_clamp(start_times[start], TEST_TIMER_MAX_DELTA + 1);
+        test_timer_clamp(start_times[start], 3 * TEST_TIMER_MAX_DELTA);
+    }
+}
+
+
+int test_timer_expiry(const uint64_t start_ms, const uint64_t delta_ms,
+                      const uint64_t step_ms) {
+    const uint64_t expires = start_ms + delta_ms;
+    TimerLog log;
+    TimerEntry timer;
+    uint64_t now;
+    int test_result;
+
+    log_init(&log, start_ms);
+    timer_entry_init(&timer, NULL);
+    timer_wheel_arm(log.wheel, &timer, expires);
+
+    /*  Expect the first advance to reach the expiry time to expire it  */
+
+    for ( now = start_ms; log.count == 0 && now < expires + step_ms;
+          now += step_ms ) {
+        log_advance(&log, now);
+    }
+
+    test_result = log.count == 1 && log.expired_ms >= expires &&
+                  log.expired_ms < expires + step_ms &&
+                  !timer_entry_armed(&timer) &&
+                  timer_wheel_count(log.wheel) == 0;
+
+    tests_log_test(test_result, "test_timer_expiry: start %lu, delta %lu, "
+                   "step %lu, expired %lu times at %lu",
+                   (unsigned long) start_ms, (unsigned long) delta_ms,
+                   (unsigned long) step_ms, (unsigned long) log.count,
+                   (unsigned long) log.expired_ms);
+
+    timer_wheel_destroy(log.wheel);
+    return test_result;
+}
+
+
+int test_timer_cancel(const uint64_t start_ms, const uint64_t delta_ms) {
+    TimerLog log;
+    TimerEntry cancelled, kept;
+    int test_result;
+
+    log_init(&log, start_ms);
+    timer_entry_init(&cancelled, NULL);
+    timer_entry_init(&kept, NULL);
+    timer_wheel_arm(log.wheel, &cancelled, start_ms + delta_ms);
+    timer_wheel_arm(log.wheel, &kept, start_ms + delta_ms);
+    timer_wheel_cancel(log.wheel, &cancelled);
+
+    /*  Cancelling a disarmed timer does nothing  */
+
+    timer_wheel_cancel(log.wheel, &cancelled);
+
+    test_result = timer_wheel_count(log.wheel) == 1 &&
+                  !timer_entry_armed(&cancelled) &&
+                  timer_entry_armed(&kept);
+
+    log_advance(&log, start_ms + delta_ms);
+    test_result = test_result && log.count == 1 && log.last == &kept &&
+                  timer_wheel_count(log.wheel) == 0;
+
+    tests_log_test(test_result, "test_timer_cancel: start %lu, delta %lu",
+                   (unsigned long) start_ms, (unsigned long) delta_ms);
+
+    timer_wheel_destroy(log.wheel);
+    return test_result;
+}
+
+
+int test_timer_rearm(const uint64_t start_ms, const uint64_t period_ms) {
+    TimerLog log;
+    TimerEntry timer;
+    int test_result;
+
+    log_init(&log, start_ms);
+    log.rearm_ms = period_ms;
+    log.rearms = 2;
+    timer_entry_init(&timer, NULL);
+    timer_wheel_arm(log.wheel, &timer, start_ms + period_ms);
+
+    /*  A timer re-armed by its callback is not expired again until
+        its new time, even a whole rotation of a level later.        */
+
+    test_result = log_advance(&log, start_ms + period_ms) == 1 &&
+                  timer_entry_armed(&timer) &&
+                  log_advance(&log, start_ms + 2 * period_ms - 1) == 0 &&
+                  log_advance(&log, start_ms + 2 * period_ms) == 1 &&
+                  log_advance(&log, start_ms + 3 * period_ms) == 1 &&
+                  !timer_entry_armed(&timer) &&
+                  timer_wheel_count(log.wheel) == 0;
+
+    tests_log_test(test_result, "test_timer_rearm: start %lu, period %lu",
+                   (unsigned long) start_ms, (unsigned long) period_ms);
+
+    timer_wheel_destroy(log.wheel);
+    return test_result;
+}
+
+
+int test_timer_clamp(const uint64_t start_ms, const uint64_t delta_ms) {
+    const uint64_t expires = start_ms + delta_ms;
+    const uint64_t step = TEST_TIMER_MAX_DELTA / 3;
+    TimerLog log;
+    TimerEntry timer;
+    uint64_t now;
+    int test_result = 1;
+
+    log_init(&log, start_ms);
+    timer_entry_init(&timer, NULL);
+    timer_wheel_arm(log.wheel, &timer, expires);
+
+    /*  A timer beyond the wheel's reach is placed at the limit, and
+        must be placed again from there rather than expired early.   */
+
+    for ( now = start_ms; now < expires; now += step ) {
+        if ( log_advance(&log, now) != 0 ) {
+            test_result = 0;
+        }
+    }
+
+    test_result = test_result && log_advance(&log, expires - 1) == 0 &&
+                  log_advance(&log, expires) == 1 &&
+                  timer_wheel_count(log.wheel) == 0;
+
+    tests_log_test(test_result, "test_timer_clamp: start %lu, delta %lu",
+                   (unsigned long) start_ms, (unsigned long) delta_ms);
+
+    timer_wheel_destroy(log.wheel);
+    return test_result;
+}
+
+
+int test_timer_next_timeout(const uint64_t start_ms, const uint64_t delta_ms) {
+    const uint64_t expires = start_ms + delta_ms;
+    TimerLog log;
+    TimerEntry timer;
+    uint64_t now = start_ms;
+    long time_out;
+    int passes = 0, test_result;
+
+    log_init(&log, start_ms);
+    timer_entry_init(&timer, NULL);
+    test_result = timer_wheel_next_timeout(log.wheel, now) == -1;
+    timer_wheel_arm(log.wheel, &timer, expires);
+
+    /*  Sleeping for each timeout in turn, as an event loop does, must
+        wake exactly when the timer is due, in a few passes per level. */
+
+    while ( test_result && log.count == 0 && passes++ < 64 ) {
+        if ( (time_out = timer_wheel_next_timeout(log.wheel, now)) < 0 ) {
+            test_result = 0;
+        } else {
+            now += (uint64_t) time_out;
+            log_advance(&log, now);
+        }
+    }
+
+    test_result = test_result && log.count == 1 && log.expired_ms == expires &&
+                  timer_wheel_next_timeout(log.wheel, now) == -1;
+
+    tests_log_test(test_result, "test_timer_next_timeout: start %lu, "
+                   "delta %lu, expired %lu times at %lu",
+                   (unsigned long) start_ms, (unsigned long) delta_ms,
+                   (unsigned long) log.count, (unsigned long) log.expired_ms);
+
+    timer_wheel_destroy(log.wheel);
+    return test_result;
+}
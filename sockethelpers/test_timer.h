@@ -0,0 +1,24 @@
+/*!
+ * \file            test_timer.h
+ * \brief           Interface to timer wheel unit tests.
+ * \details         Interface to timer wheel unit tests.
+ * \author          Paul Griffiths
+ * \copyright       Copyright 2013 Paul Griffiths. Distributed under the terms
+ * of the GNU General Public License. <http://www.gnu.org/licenses/>
+ */
+
+
+#ifndef PG_SOCKET_HELPERS_TEST_TIMER_H
+#define PG_SOCKET_HELPERS_TEST_TIMER_H
+
+#include <stdint.h>
+
+void test_timer(void);
+int test_timer_expiry(const uint64_t start_ms, const uint64_t delta_ms,
+                      const uint64_t step_ms);
+int test_timer_cancel(const uint64_t start_ms, const uint64_t delta_ms);
+int test_timer_rearm(const uint64_t start_ms, const uint64_t period_ms);
+int test_timer_clamp(const uint64_t start_ms, const uint64_t delta_ms);
+int test_timer_next_timeout(const uint64_t start_ms, const uint64_t delta_ms);
+
+#endif          /*  PG_SOCKET_HELPERS_TEST_TIMER_H  */